@@ -0,0 +1,27 @@
+// bench_arrays.js
+// ---------------
+
+(this.load || require)((this.load ? 'bench' : '.') + '/tools/harness.js');
+
+
+benchmark('array-push', function() {
+  var a = [];
+  for (var i = 0; i < 200; i++) a.push(i);
+  return a.length;
+});
+
+var filled = [];
+for (var i = 0; i < 200; i++) filled.push(i);
+
+benchmark('array-index', function() {
+  var sum = 0;
+  for (var i = 0; i < filled.length; i++) sum += filled[i];
+  return sum;
+});
+
+benchmark('array-sort', function() {
+  var a = [];
+  for (var i = 0; i < 100; i++) a.push((i * 7919) % 101);
+  a.sort(function(x, y) { return x - y; });
+  return a[0];
+});
@@ -0,0 +1,27 @@
+// bench_calls.js
+// --------------
+
+(this.load || require)((this.load ? 'bench' : '.') + '/tools/harness.js');
+
+
+function add(a, b) { return a + b; }
+
+var counter = {
+  n: 0,
+  inc: function(by) { this.n += by; return this.n; }
+};
+
+benchmark('call-function', function() {
+  var x = 0;
+  for (var i = 0; i < 100; i++) x = add(x, i);
+  return x;
+});
+
+benchmark('call-method', function() {
+  for (var i = 0; i < 100; i++) counter.inc(1);
+});
+
+benchmark('call-recursive', function() {
+  var fib = function(n) { return n < 2 ? n : fib(n - 1) + fib(n - 2); };
+  return fib(12);
+});
@@ -0,0 +1,23 @@
+// bench_closures.js
+// -----------------
+
+(this.load || require)((this.load ? 'bench' : '.') + '/tools/harness.js');
+
+
+function makeAdder(n) {
+  return function(x) { return x + n; };
+}
+
+benchmark('closure-create', function() {
+  var f;
+  for (var i = 0; i < 100; i++) f = makeAdder(i);
+  return f;
+});
+
+var add5 = makeAdder(5);
+
+benchmark('closure-call', function() {
+  var x = 0;
+  for (var i = 0; i < 100; i++) x = add5(x);
+  return x;
+});
@@ -0,0 +1,23 @@
+// bench_forin.js
+// --------------
+
+(this.load || require)((this.load ? 'bench' : '.') + '/tools/harness.js');
+
+
+var record = {id: 1, name: 'n', email: 'e', age: 3, city: 'c', zip: 'z'};
+
+benchmark('for-in', function() {
+  var n = 0;
+  for (var i = 0; i < 20; i++)
+    for (var key in record) n++;
+  return n;
+});
+
+var list = [1, 2, 3, 4, 5, 6, 7, 8, 9, 10];
+
+benchmark('for-in-array', function() {
+  var n = 0;
+  for (var i = 0; i < 10; i++)
+    for (var key in list) n += list[key];
+  return n;
+});
@@ -0,0 +1,24 @@
+// bench_gc.js
+// -----------
+
+(this.load || require)((this.load ? 'bench' : '.') + '/tools/harness.js');
+
+
+benchmark('alloc-objects', function() {
+  var last;
+  for (var i = 0; i < 200; i++) last = {i: i, next: last && last.i};
+  return last;
+});
+
+benchmark('alloc-arrays', function() {
+  var keep = [];
+  for (var i = 0; i < 50; i++) keep.push([i, i + 1, i + 2]);
+  return keep.length;
+});
+
+var retained = [];
+
+benchmark('alloc-retained', function() {
+  for (var i = 0; i < 50; i++) retained.push({i: i});
+  if (retained.length > 5000) retained = [];
+});
@@ -0,0 +1,29 @@
+// bench_properties.js
+// -------------------
+
+(this.load || require)((this.load ? 'bench' : '.') + '/tools/harness.js');
+
+
+var point = {x: 1, y: 2, z: 3};
+
+benchmark('property-get', function() {
+  var sum = 0;
+  for (var i = 0; i < 100; i++) sum += point.x + point.y + point.z;
+  return sum;
+});
+
+benchmark('property-set', function() {
+  for (var i = 0; i < 100; i++) {
+    point.x = i;
+    point.y = i + 1;
+  }
+});
+
+function Shape(w, h) { this.w = w; this.h = h; }
+Shape.prototype.kind = 'shape';
+
+benchmark('property-proto-get', function() {
+  var s = new Shape(1, 2), n = 0;
+  for (var i = 0; i < 100; i++) if (s.kind === 'shape') n++;
+  return n;
+});
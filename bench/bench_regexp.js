@@ -0,0 +1,19 @@
+// bench_regexp.js
+// ---------------
+
+(this.load || require)((this.load ? 'bench' : '.') + '/tools/harness.js');
+
+
+var line = '2013-04-01 12:00:01 GET /index.html 200 1043';
+
+benchmark('regexp-test', function() {
+  var n = 0;
+  for (var i = 0; i < 20; i++) if (/GET \/\S+ 200/.test(line)) n++;
+  return n;
+});
+
+benchmark('regexp-replace', function() {
+  var s;
+  for (var i = 0; i < 20; i++) s = line.replace(/\d/g, '#');
+  return s;
+});
@@ -0,0 +1,26 @@
+// bench_strings.js
+// ----------------
+
+(this.load || require)((this.load ? 'bench' : '.') + '/tools/harness.js');
+
+
+benchmark('string-concat', function() {
+  var s = '';
+  for (var i = 0; i < 200; i++) s += 'ab';
+  return s.length;
+});
+
+benchmark('string-concat-read', function() {
+  var s = '';
+  for (var i = 0; i < 50; i++) s = s + i + ',';
+  return s.charAt(10);
+});
+
+benchmark('string-methods', function() {
+  var s = 'The quick brown fox jumps over the lazy dog', n = 0;
+  for (var i = 0; i < 20; i++) {
+    n += s.indexOf('lazy') + s.toUpperCase().length;
+    n += s.split(' ').length + s.slice(4, 9).length;
+  }
+  return n;
+});
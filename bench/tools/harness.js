@@ -0,0 +1,54 @@
+// harness.js
+// ----------
+// Times benchmarks the same way in every implementation, and prints the
+// samples for bin/bench to read.
+//
+// Each benchmark is first run until it has taken SAMPLE_MS, to find how many
+// calls make up a sample. Then WARMUP samples are thrown away, and SAMPLES
+// samples are printed, in microseconds per call:
+//
+//   bench:<name>:<sample>,<sample>,...
+
+(function() {
+
+  var root = this.GLOBAL || this;
+
+  if (typeof console !== 'object') {
+    root.console = { log: function(s) { print(s); } };
+  }
+
+  // Everything the benchmark needs is kept within it, as some of the
+  // implementations resolve free names from their callers.
+  root.benchmark = function(name, fn) {
+    var SAMPLE_MS = 50, WARMUP = 2, SAMPLES = 10;
+
+    var now = function() { return new Date().getTime(); };
+
+    // Time `calls` calls of fn, in microseconds per call.
+    var sample = function(calls) {
+      var start = now();
+      for (var i = 0; i < calls; i++) fn();
+      return (now() - start) * 1000 / calls;
+    };
+
+    try {
+      var calls = 1, start = now();
+      while (now() - start < SAMPLE_MS) {
+        fn();
+        calls++;
+      }
+
+      var i, samples = [];
+      for (i = 0; i < WARMUP; i++) sample(calls);
+      for (i = 0; i < SAMPLES; i++) {
+        var time = sample(calls);
+        samples.push(time);
+      }
+      console.log('bench:' + name + ':' + samples.join(','));
+    }
+    catch (e) {
+      console.log('bench-error:' + name + ':' + e.message);
+    }
+  };
+
+})();
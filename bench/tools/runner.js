@@ -0,0 +1,146 @@
+// runner.js
+// =========
+// Runs the benchmarks on flathead and other implementations, and reports the
+// median and 95th percentile of each as JSON. With a baseline from an earlier
+// run, benchmarks that got slower by more than the threshold fail the run.
+
+var path  = require('path'),
+    fs    = require('fs'),
+    exec  = require('child_process').execSync;
+
+
+// Options
+// -------
+
+var usage = [
+  'Usage: bench [options] [bench.js ...]',
+  '',
+  '  -d, --dir <path>         the benchmark directory (default bench)',
+  '  -x, --exec <path>        executable to run the benchmarks with',
+  '  -a, --args-tpl <string>  template for arguments to pass to exec',
+  '  -b, --baseline <file>    compare with the results saved in file',
+  '  -s, --save <file>        save the results to file',
+  '  -t, --threshold <ratio>  slowdown that counts as a regression (0.1)',
+  ''
+].join('\n');
+
+var parseArgs = function(argv) {
+  var options = {
+    dir: 'bench', exec: null, argsTpl: '[bench]', baseline: null, save: null,
+    threshold: 0.1, files: []
+  };
+  var names = {
+    '-d': 'dir', '--dir': 'dir',
+    '-x': 'exec', '--exec': 'exec',
+    '-a': 'argsTpl', '--args-tpl': 'argsTpl',
+    '-b': 'baseline', '--baseline': 'baseline',
+    '-s': 'save', '--save': 'save',
+    '-t': 'threshold', '--threshold': 'threshold'
+  };
+  for (var i = 0; i < argv.length; i++) {
+    if (names[argv[i]] && i + 1 < argv.length)
+      options[names[argv[i]]] = argv[++i];
+    else if (argv[i][0] === '-') {
+      console.error(usage);
+      process.exit(argv[i] === '-h' || argv[i] === '--help' ? 0 : 1);
+    }
+    else
+      options.files.push(argv[i]);
+  }
+  options.threshold = Number(options.threshold);
+  if (!options.exec) {
+    console.error(usage);
+    process.exit(1);
+  }
+  return options;
+};
+
+
+// Statistics
+// ----------
+
+// The value below which `p` of the sorted samples fall.
+var percentile = function(sorted, p) {
+  var i = Math.min(sorted.length - 1, Math.ceil(p * sorted.length) - 1);
+  return sorted[Math.max(i, 0)];
+};
+
+var summarize = function(samples) {
+  var sorted = samples.slice().sort(function(a, b) { return a - b; });
+  var round = function(x) { return Math.round(x * 1000) / 1000; };
+  return {
+    median: round(percentile(sorted, 0.5)),
+    p95: round(percentile(sorted, 0.95)),
+    samples: sorted.length
+  };
+};
+
+
+// Running
+// -------
+
+// Run one benchmark file, and add what it reports to `results`.
+var runFile = function(options, file, results, errors) {
+  var args = options.argsTpl.replace('[bench]', file);
+  var output;
+  try {
+    output = exec([options.exec, args].join(' '), {encoding: 'utf8', stdio: 'pipe'});
+  }
+  catch (e) {
+    errors[path.basename(file)] = (e.stderr || e.message).trim();
+    return;
+  }
+  output.split('\n').forEach(function(line) {
+    var m = /^bench(-error)?:([^:]+):(.*)$/.exec(line.trim());
+    if (!m) return;
+    if (m[1])
+      errors[m[2]] = m[3];
+    else
+      results[m[2]] = summarize(m[3].split(',').map(Number));
+  });
+};
+
+// Compare with a baseline, adding the ratio of the medians to each result.
+// Returns the names of the benchmarks that regressed.
+var compare = function(results, baseline, threshold) {
+  var regressed = [];
+  Object.keys(results).forEach(function(name) {
+    var base = baseline.results && baseline.results[name];
+    if (!base || !base.median) return;
+    var ratio = results[name].median / base.median;
+    results[name].baseline = base.median;
+    results[name].ratio = Math.round(ratio * 1000) / 1000;
+    if (ratio > 1 + threshold) regressed.push(name);
+  });
+  return regressed;
+};
+
+exports.run = function() {
+  var options = parseArgs(process.argv.slice(2));
+  var files = options.files;
+  if (!files.length) {
+    files = fs.readdirSync(options.dir).filter(function(f) {
+      return /^bench_.*\.js$/.test(f);
+    }).sort().map(function(f) {
+      return path.join(options.dir, f);
+    });
+  }
+
+  var results = {}, errors = {};
+  files.forEach(function(file) { runFile(options, file, results, errors); });
+
+  var report = {exec: options.exec, unit: 'us', results: results};
+  if (Object.keys(errors).length) report.errors = errors;
+
+  var regressed = [];
+  if (options.baseline) {
+    var baseline = JSON.parse(fs.readFileSync(options.baseline, 'utf8'));
+    regressed = compare(results, baseline, options.threshold);
+    report.regressed = regressed;
+  }
+
+  var json = JSON.stringify(report, null, 2);
+  console.log(json);
+  if (options.save) fs.writeFileSync(options.save, json + '\n');
+  if (regressed.length) process.exit(1);
+};
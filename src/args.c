@@ -1,5 +1,5 @@
 /*
- * args.c -- singly linked list used internally to represent arguments 
+ * args.c -- counted vectors used internally to represent arguments
  *
  * Copyright (c) 2013 Nick Reynolds
  *  
@@ -16,58 +16,96 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <string.h>
+
 #include "args.h"
 #include "flathead.h"
 
+/* Returns a heap-allocated, empty list. */
 js_args *
 args_new()
 {
   js_args *args = malloc(sizeof(js_args));
-  args->arg = NULL;
-  args->next = NULL;
+  args_init(args);
+  return args;
+}
+
+void
+args_init(js_args *args)
+{
+  args->argv = args->inline_argv;
+  args->argc = 0;
+  args->cap = ARGS_INLINE;
+}
+
+/* Borrow `argc` values at `argv`, which must outlive the view. */
+void
+args_view(js_args *args, js_val **argv, unsigned argc)
+{
+  args->argv = argv;
+  args->argc = argc;
+  args->cap = 0;
+}
+
+/* Borrow the arguments of `src` from index `from` on. */
+void
+args_slice(js_args *args, js_args *src, unsigned from)
+{
+  unsigned argc = args_len(src);
+  if (from > argc) from = argc;
+  args_view(args, src ? src->argv + from : NULL, argc - from);
+}
+
+/* Returns a heap-allocated copy that owns its values, for lists that are
+ * kept beyond the call (e.g. bound arguments). */
+js_args *
+args_copy(js_args *src)
+{
+  js_args *args = args_new();
+  unsigned i, argc = args_len(src);
+  for (i = 0; i < argc; i++)
+    args_append(args, src->argv[i]);
   return args;
 }
 
+/* Free a vector that outgrew the inline buffer. */
+void
+args_release(js_args *args)
+{
+  if (args->cap > ARGS_INLINE)
+    free(args->argv);
+  args_init(args);
+}
+
 void
 args_append(js_args *args, js_val *val)
 {
-  if (args->arg == NULL) 
-    args->arg = val;
-  else {
-    while (args->next != NULL) args = args->next;
-    args->next = args_new();
-    args->next->arg = val;
+  // Although arrays can be up to 2^32 - 1 in length, we limit
+  // the number of arguments to UINT_MAX.
+  if (args->argc >= UINT_MAX)
+    fh_throw(NULL, fh_new_error(E_RANGE, "too many arguments"));
+
+  if (args->argc == args->cap) {
+    unsigned cap = args->cap ? args->cap * 2 : ARGS_INLINE;
+    js_val **argv = malloc(cap * sizeof(js_val *));
+    memcpy(argv, args->argv, args->argc * sizeof(js_val *));
+    if (args->cap > ARGS_INLINE) free(args->argv);
+    args->argv = argv;
+    args->cap = cap;
   }
+  args->argv[args->argc++] = val;
 }
 
 js_val *
 args_get(js_args *args, int n)
 {
-  int i;
-  for (i = 0; i <= n; i++) {
-    if (i == n) 
-      return args->arg ? args->arg : JSUNDEF();
-    if (args->next == NULL) 
-      break;
-    args = args->next;
-  }
-  return JSUNDEF();
+  if (args == NULL || n < 0 || (unsigned)n >= args->argc)
+    return JSUNDEF();
+  return args->argv[n];
 }
 
 unsigned int
 args_len(js_args *args)
 {
-  if (args == NULL) return 0;
-
-  // Although arrays can be up to 2^32 - 1 in length, we limit
-  // the number of arguments to 2^16 - 1 (UINT_MAX).
-  unsigned long i = 0;
-  while (i < UINT_MAX) {
-    if (args->arg) i++;
-    if (args->next == NULL) break;
-    args = args->next;
-  }
-  if (i >= UINT_MAX)
-    fh_throw(NULL, fh_new_error(E_RANGE, "too many arguments"));
-  return i;
+  return args == NULL ? 0 : args->argc;
 }
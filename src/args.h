@@ -1,5 +1,5 @@
 /*
- * args.h -- singly linked list used internally to represent arguments 
+ * args.h -- counted vectors used internally to represent arguments
  *
  * Copyright (c) 2013 Nick Reynolds
  *  
@@ -19,14 +19,29 @@
 #ifndef ARGS_H
 #define ARGS_H
 
+#include <stdbool.h>
+
+#define ARGS_INLINE 6
+
 struct js_val;
 
+/* Arguments are passed as a counted vector, `argv[0..argc)`. Lists built with
+ * args_init keep up to ARGS_INLINE values in the struct itself, so a call
+ * site can hold them on the C stack without allocating. A view (args_view,
+ * args_slice) borrows the vector of another list or of the VM stack. */
 typedef struct js_args {
-  struct js_val *arg;
-  struct js_args *next;
+  struct js_val **argv;
+  unsigned argc;
+  unsigned cap;               // 0 for views
+  struct js_val *inline_argv[ARGS_INLINE];
 } js_args;
 
 js_args * args_new();
+void args_init(js_args *);
+void args_view(js_args *, struct js_val **, unsigned);
+void args_slice(js_args *, js_args *, unsigned);
+js_args * args_copy(js_args *);
+void args_release(js_args *);
 void args_append(js_args *, struct js_val *);
 struct js_val * args_get(js_args *, int);
 unsigned args_len(js_args *);
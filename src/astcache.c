@@ -0,0 +1,389 @@
+/*
+ * astcache.c -- On-disk cache of parsed scripts
+ *
+ * Copyright (c) 2012-2013 Nick Reynolds
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* An entry holds the AST of one script, so a script that hasn't changed since
+ * it last ran isn't lexed and parsed again. Entries live in the --parse-cache
+ * directory, named after a hash of the script's absolute path, and are laid
+ * out as
+ *
+ *   header | path | nodes | strings
+ *
+ * The header records the script's size, modification time and a hash of its
+ * contents, and whether its function bodies were left to be parsed lazily;
+ * an entry is only used if all four still match. Nodes refer
+ * to each other and to the NUL-terminated strings by index, so an entry is
+ * mapped in and copied out without fixing up pointers; only the strings are
+ * interned. Entries are written to a temporary file and renamed into place,
+ * so concurrent runs never read a partial one.
+ *
+ * Bump AST_CACHE_VERSION when ast_node or the node and operator enums
+ * change. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "astcache.h"
+#include "flathead.h"
+#include "atom.h"
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t node_size;         // sizeof(ast_cache_node), as a layout check
+  uint32_t path_len;          // including the NUL
+  uint64_t size;
+  int64_t mtime;
+  uint64_t hash;
+  uint32_t num_nodes;
+  uint32_t strings_len;
+  uint32_t lazy;              // function bodies left unparsed (1) or not (0)
+} ast_cache_header;
+
+typedef struct {
+  uint32_t e1, e2, e3;        // index of the node + 1, or 0 for none
+  uint32_t sval;              // offset of the string + 1, or 0 for none
+  double val;
+  int32_t type;
+  int32_t sub_type;
+  int32_t op;
+  int32_t line;
+  int32_t column;
+} ast_cache_node;
+
+static const char ast_cache_magic[4] = {'F', 'H', 'A', 'C'};
+
+/* FNV-1a, of a script's contents and of entry paths. */
+uint64_t
+fh_ast_cache_hash(const char *s, size_t len)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  size_t i;
+  for (i = 0; i < len; i++) {
+    hash ^= (unsigned char)s[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+/* Write the absolute form of `path` to `abs` and the name of its entry to
+ * `entry`. Returns false if either doesn't fit. */
+static bool
+entry_names(char *path, char *abs, char *entry, size_t size)
+{
+  int n;
+  if (path[0] == '/')
+    n = snprintf(abs, size, "%s", path);
+  else {
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof(cwd))) return false;
+    n = snprintf(abs, size, "%s/%s", cwd, path);
+  }
+  if (n < 0 || (size_t)n >= size) return false;
+
+  n = snprintf(entry, size, "%s/%016llx.ast", fh->opt_parse_cache,
+      (unsigned long long)fh_ast_cache_hash(abs, strlen(abs)));
+  return n >= 0 && (size_t)n < size;
+}
+
+
+// ----------------------------------------------------------------------------
+// Loading
+// ----------------------------------------------------------------------------
+
+/* Copy the nodes out of a mapped entry, with their strings interned. Returns
+ * NULL if the nodes don't hold together, as in a damaged entry. Children are
+ * numbered after their parents, so finishing the nodes from the last one
+ * sees each node's children done. */
+static ast_node *
+read_nodes(ast_cache_header *header, ast_cache_node *recs, char *strings)
+{
+  uint32_t i, n = header->num_nodes, len = header->strings_len;
+  if (n == 0 || len == 0 || strings[len - 1] != '\0') return NULL;
+
+  for (i = 0; i < n; i++) {
+    ast_cache_node *rec = &recs[i];
+    if (rec->e1 > n || rec->e2 > n || rec->e3 > n || rec->sval > len ||
+        (rec->e1 && rec->e1 <= i + 1) || (rec->e2 && rec->e2 <= i + 1) ||
+        (rec->e3 && rec->e3 <= i + 1) ||
+        rec->type < 0 || rec->type > NODE_WHILE ||
+        rec->sub_type < 0 || rec->sub_type > NODE_WHILE ||
+        rec->op < 0 || rec->op > OP_BIT_NOT)
+      return NULL;
+  }
+
+  ast_node *nodes = calloc(n, sizeof(ast_node));
+  for (i = 0; i < n; i++) {
+    ast_cache_node *rec = &recs[i];
+    ast_node *node = &nodes[i];
+    node->e1 = rec->e1 ? &nodes[rec->e1 - 1] : NULL;
+    node->e2 = rec->e2 ? &nodes[rec->e2 - 1] : NULL;
+    node->e3 = rec->e3 ? &nodes[rec->e3 - 1] : NULL;
+    char *sval = rec->sval ? strings + rec->sval - 1 : NULL;
+    if (sval && rec->type == NODE_LAZY_BODY) {
+      // The source of a skipped body isn't a name; keep it out of the atoms.
+      size_t sval_len = strlen(sval) + 1;
+      node->sval = memcpy(malloc(sval_len), sval, sval_len);
+    }
+    else node->sval = sval ? fh_intern(sval) : NULL;
+    node->val = rec->val;
+    node->type = rec->type;
+    node->sub_type = rec->sub_type;
+    node->op = rec->op;
+    node->line = rec->line;
+    node->column = rec->column;
+  }
+  for (i = n; i > 0; i--)
+    node_finish(&nodes[i - 1]);
+  return nodes;
+}
+
+/* Returns the cached AST of the script at `path`, whose contents are `len`
+ * bytes with `hash`, parsed lazily or not as `lazy` says, or NULL if there's
+ * no entry for it that's still current. */
+ast_node *
+fh_ast_cache_load(char *path, size_t len, uint64_t hash, bool lazy)
+{
+  char abs[4096], entry[4096];
+  struct stat script, st;
+  if (!entry_names(path, abs, entry, sizeof(abs))) return NULL;
+  if (stat(path, &script) == -1) return NULL;
+
+  int fd = open(entry, O_RDONLY);
+  if (fd == -1) return NULL;
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(ast_cache_header)) {
+    close(fd);
+    return NULL;
+  }
+
+  size_t size = st.st_size;
+  char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return NULL;
+
+  ast_node *root = NULL;
+  ast_cache_header *header = (ast_cache_header *)map;
+  size_t nodes_at = sizeof(ast_cache_header) + header->path_len;
+  nodes_at += (sizeof(double) - nodes_at % sizeof(double)) % sizeof(double);
+  size_t strings_at = nodes_at +
+    (size_t)header->num_nodes * sizeof(ast_cache_node);
+
+  if (memcmp(header->magic, ast_cache_magic, 4) == 0 &&
+      header->version == AST_CACHE_VERSION &&
+      header->node_size == sizeof(ast_cache_node) &&
+      header->size == (uint64_t)len &&
+      header->size == (uint64_t)script.st_size &&
+      header->mtime == (int64_t)script.st_mtime &&
+      strings_at + header->strings_len == size &&
+      header->path_len == strlen(abs) + 1 &&
+      memcmp(map + sizeof(ast_cache_header), abs, header->path_len) == 0 &&
+      header->hash == hash &&
+      header->lazy == (uint32_t)lazy) {
+    root = read_nodes(header, (ast_cache_node *)(map + nodes_at),
+        map + strings_at);
+  }
+
+  munmap(map, size);
+  return root;
+}
+
+
+// ----------------------------------------------------------------------------
+// Storing
+// ----------------------------------------------------------------------------
+
+/* Indexes of nodes and strings by address, open-addressed since uthash tables
+ * here are keyed by atoms. */
+typedef struct {
+  void *key;
+  uint32_t index;
+} ref_entry;
+
+typedef struct {
+  ref_entry *entries;
+  size_t cap;
+  size_t len;
+} ref_map;
+
+static ref_entry *
+ref_slot(ref_map *map, void *key)
+{
+  size_t i = ((uintptr_t)key >> 3) * 2654435761u & (map->cap - 1);
+  while (map->entries[i].key && map->entries[i].key != key)
+    i = (i + 1) & (map->cap - 1);
+  return &map->entries[i];
+}
+
+/* Returns the index of `key`, adding it as `next` if it's new. */
+static uint32_t
+ref_index(ref_map *map, void *key, uint32_t next, bool *added)
+{
+  if ((map->len + 1) * 2 > map->cap) {
+    ref_map grown = {calloc(map->cap * 2, sizeof(ref_entry)), map->cap * 2, 0};
+    size_t i;
+    for (i = 0; i < map->cap; i++)
+      if (map->entries[i].key)
+        *ref_slot(&grown, map->entries[i].key) = map->entries[i];
+    grown.len = map->len;
+    free(map->entries);
+    *map = grown;
+  }
+
+  ref_entry *slot = ref_slot(map, key);
+  *added = !slot->key;
+  if (*added) {
+    slot->key = key;
+    slot->index = next;
+    map->len++;
+  }
+  return slot->index;
+}
+
+typedef struct {
+  ref_map node_refs;
+  ref_map string_refs;
+  ast_node **nodes;
+  uint32_t num_nodes;
+  uint32_t nodes_cap;
+  char *strings;
+  uint32_t strings_len;
+  uint32_t strings_cap;
+} ast_writer;
+
+static uint32_t
+node_ref(ast_writer *w, ast_node *node)
+{
+  bool added;
+  if (!node) return 0;
+  uint32_t index = ref_index(&w->node_refs, node, w->num_nodes, &added);
+  if (added) {
+    if (w->num_nodes == w->nodes_cap) {
+      w->nodes_cap *= 2;
+      w->nodes = realloc(w->nodes, w->nodes_cap * sizeof(ast_node *));
+    }
+    w->nodes[w->num_nodes++] = node;
+  }
+  return index + 1;
+}
+
+static uint32_t
+string_ref(ast_writer *w, char *str)
+{
+  bool added;
+  if (!str) return 0;
+  uint32_t offset = ref_index(&w->string_refs, str, w->strings_len, &added);
+  if (added) {
+    uint32_t len = strlen(str) + 1;
+    while (w->strings_len + len > w->strings_cap) {
+      w->strings_cap *= 2;
+      w->strings = realloc(w->strings, w->strings_cap);
+    }
+    memcpy(w->strings + w->strings_len, str, len);
+    w->strings_len += len;
+  }
+  return offset + 1;
+}
+
+/* Store the AST of the script at `path`, whose contents are `len` bytes with
+ * `hash`, and which was parsed lazily or not. Failing to store it only means it will be parsed again next time. */
+void
+fh_ast_cache_store(char *path, size_t len, uint64_t hash, bool lazy,
+    ast_node *root)
+{
+  char abs[4096], entry[4096], tmp[4096 + 32];
+  struct stat script;
+  if (!root || !entry_names(path, abs, entry, sizeof(abs))) return;
+  if (stat(path, &script) == -1) return;
+
+  ast_writer w = {
+    {calloc(256, sizeof(ref_entry)), 256, 0},
+    {calloc(256, sizeof(ref_entry)), 256, 0},
+    malloc(128 * sizeof(ast_node *)), 0, 128,
+    malloc(1024), 0, 1024
+  };
+
+  // Number the nodes breadth first, so deep lists don't recurse.
+  node_ref(&w, root);
+  ast_cache_node *recs = NULL;
+  uint32_t i, recs_cap = 0;
+  for (i = 0; i < w.num_nodes; i++) {
+    ast_node *node = w.nodes[i];
+    ast_cache_node rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.e1 = node_ref(&w, node->e1);
+    rec.e2 = node_ref(&w, node->e2);
+    rec.e3 = node_ref(&w, node->e3);
+    rec.sval = string_ref(&w, node->sval);
+    rec.val = node->val;
+    rec.type = node->type;
+    rec.sub_type = node->sub_type;
+    rec.op = node->op;
+    rec.line = node->line;
+    rec.column = node->column;
+
+    if (i == recs_cap) {
+      recs_cap = recs_cap ? recs_cap * 2 : 128;
+      recs = realloc(recs, recs_cap * sizeof(ast_cache_node));
+    }
+    recs[i] = rec;
+  }
+
+  // The string table is never empty, so its last byte can be checked.
+  if (w.strings_len == 0) string_ref(&w, "");
+
+  ast_cache_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, ast_cache_magic, 4);
+  header.version = AST_CACHE_VERSION;
+  header.node_size = sizeof(ast_cache_node);
+  header.path_len = strlen(abs) + 1;
+  header.size = len;
+  header.mtime = script.st_mtime;
+  header.hash = hash;
+  header.num_nodes = w.num_nodes;
+  header.strings_len = w.strings_len;
+  header.lazy = lazy;
+
+  size_t at = sizeof(header) + header.path_len;
+  size_t pad = (sizeof(double) - at % sizeof(double)) % sizeof(double);
+  static const char zeros[sizeof(double)];
+
+  mkdir(fh->opt_parse_cache, 0777);
+  snprintf(tmp, sizeof(tmp), "%s.%ld", entry, (long)getpid());
+  FILE *file = fopen(tmp, "wb");
+  if (file) {
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+      fwrite(abs, header.path_len, 1, file) == 1 &&
+      fwrite(zeros, 1, pad, file) == pad &&
+      fwrite(recs, sizeof(ast_cache_node), w.num_nodes, file) == w.num_nodes &&
+      fwrite(w.strings, 1, w.strings_len, file) == w.strings_len;
+    if (fclose(file) != 0) ok = false;
+    if (!ok || rename(tmp, entry) == -1) remove(tmp);
+  }
+
+  free(recs);
+  free(w.node_refs.entries);
+  free(w.string_refs.entries);
+  free(w.nodes);
+  free(w.strings);
+}
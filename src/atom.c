@@ -0,0 +1,162 @@
+/*
+ * atom.c -- Interned property names
+ *
+ * Copyright (c) 2012-2013 Nick Reynolds
+ *  
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *  
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "atom.h"
+
+#define ATOM_CHUNK_SIZE  65536
+#define ATOM_ALIGN       sizeof(fh_atom_header)
+
+/* Atoms are packed into chunks that are never freed. Chunks double in size,
+ * so there are only ever a few of them to check in `fh_is_atom`. */
+typedef struct atom_chunk {
+  struct atom_chunk *next;
+  char *free;
+  char *end;
+  char data[];
+} atom_chunk;
+
+static atom_chunk *chunks = NULL;
+static char **table = NULL;       // open addressing, by hash
+static unsigned long table_cap = 0;
+static unsigned long table_count = 0;
+
+static unsigned
+atom_hash(char *str, unsigned len)
+{
+  // FNV-1a
+  unsigned hash = 2166136261u, i;
+  for (i = 0; i < len; i++) {
+    hash ^= (unsigned char)str[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static char *
+atom_alloc(char *str, unsigned len, unsigned hash)
+{
+  size_t size = sizeof(fh_atom_header) + len + 1;
+  size = (size + ATOM_ALIGN - 1) / ATOM_ALIGN * ATOM_ALIGN;
+
+  if (!chunks || chunks->free + size > chunks->end) {
+    size_t cap = chunks ? (size_t)(chunks->end - chunks->data) * 2 : ATOM_CHUNK_SIZE;
+    if (cap < size) cap = size;
+    atom_chunk *chunk = malloc(sizeof(atom_chunk) + cap);
+    chunk->free = chunk->data;
+    chunk->end = chunk->data + cap;
+    chunk->next = chunks;
+    chunks = chunk;
+  }
+
+  fh_atom_header *header = (fh_atom_header *)chunks->free;
+  chunks->free += size;
+  header->hash = hash;
+  header->len = len;
+
+  char *atom = (char *)(header + 1);
+  memcpy(atom, str, len);
+  atom[len] = '\0';
+  return atom;
+}
+
+static void
+table_grow()
+{
+  unsigned long i, j, cap = table_cap ? table_cap * 2 : 1024;
+  char **grown = calloc(cap, sizeof(char *));
+
+  for (i = 0; i < table_cap; i++) {
+    if (!table[i]) continue;
+    for (j = ATOM_HASH(table[i]) & (cap - 1); grown[j]; j = (j + 1) & (cap - 1));
+    grown[j] = table[i];
+  }
+
+  free(table);
+  table = grown;
+  table_cap = cap;
+}
+
+/* Find the slot of the atom equal to `str`, or the empty slot it goes in. */
+static char **
+table_find(char *str, unsigned len, unsigned hash)
+{
+  unsigned long i = hash & (table_cap - 1);
+  char *atom;
+  for (; (atom = table[i]); i = (i + 1) & (table_cap - 1)) {
+    if (ATOM_HASH(atom) == hash && ATOM_HEADER(atom)->len == len &&
+        memcmp(atom, str, len) == 0)
+      break;
+  }
+  return &table[i];
+}
+
+/* Is the pointer the start of an atom? Where it points can only rule it out:
+ * an aligned pointer into an atom's characters looks like one too, so a
+ * candidate must be the very pointer its hash's probe sequence holds. */
+bool
+fh_is_atom(char *str)
+{
+  atom_chunk *chunk;
+  uintptr_t p = (uintptr_t)str;
+  for (chunk = chunks; chunk; chunk = chunk->next) {
+    uintptr_t start = (uintptr_t)chunk->data, end = (uintptr_t)chunk->free;
+    if (p <= start || p >= end) continue;
+    if ((p - start) % ATOM_ALIGN != 0) return false;
+
+    fh_atom_header *header = ATOM_HEADER(str);
+    if (header->len >= end - p) return false;
+
+    unsigned long i = header->hash & (table_cap - 1);
+    for (; table[i]; i = (i + 1) & (table_cap - 1))
+      if (table[i] == str) return true;
+    return false;
+  }
+  return false;
+}
+
+/* Return the atom for the string, interning it if it's new. */
+char *
+fh_intern(char *str)
+{
+  if (fh_is_atom(str)) return str;
+
+  if (table_count * 2 >= table_cap) table_grow();
+
+  unsigned len = strlen(str), hash = atom_hash(str, len);
+  char **slot = table_find(str, len, hash);
+  if (!*slot) {
+    *slot = atom_alloc(str, len, hash);
+    table_count++;
+  }
+  return *slot;
+}
+
+/* Return the atom for the string, or NULL if it was never interned. */
+char *
+fh_atom_lookup(char *str)
+{
+  if (fh_is_atom(str)) return str;
+  if (!table) return NULL;
+
+  unsigned len = strlen(str);
+  return *table_find(str, len, atom_hash(str, len));
+}
@@ -0,0 +1,39 @@
+/*
+ * atom.h -- Interned property names
+ *
+ * Copyright (c) 2012-2013 Nick Reynolds
+ *  
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *  
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef ATOM_H
+#define ATOM_H
+
+#include <stdbool.h>
+
+/* Atoms are interned, immutable C strings. Each is stored after a header
+ * holding its hash and length, so equal names share one pointer and never
+ * need to be rehashed. */
+typedef struct {
+  unsigned hash;
+  unsigned len;
+} fh_atom_header;
+
+#define ATOM_HEADER(a)  ((fh_atom_header *)(a) - 1)
+#define ATOM_HASH(a)    (ATOM_HEADER(a)->hash)
+
+char * fh_intern(char *);
+char * fh_atom_lookup(char *);
+bool fh_is_atom(char *);
+
+#endif
@@ -16,10 +16,13 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <ctype.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "flathead.h"
 #include "cli.h"
+#include "output.h"
 
 
 void
@@ -32,7 +35,103 @@ fh_print_help()
          "  -h, --help          print this help text\n"
          "  -i, --interactive   force REPL\n"
          "  -n, --nodes         print the AST\n"
-         "  -t, --tokens        print tokens\n");
+         "  -t, --tokens        print tokens\n"
+         "  -e, --engine=NAME   evaluate with the 'ast' walker (default) or the 'vm'\n"
+         "  --initial-heap=SIZE grow the heap to SIZE before collecting garbage\n"
+         "  --max-heap=SIZE     never grow the heap past SIZE\n"
+         "  --heap-grow=RATIO   grow the heap when more than RATIO of it survives\n"
+         "                      a collection (default 0.5)\n"
+         "  --gc-pause=MS       aim for incremental GC steps of at most MS\n"
+         "                      milliseconds (default 5, 0 for no limit)\n"
+         "  --heap-profile=FILE write live values by type and class, and allocations\n"
+         "                      by source position, to FILE as JSON after each\n"
+         "                      collection and at exit\n"
+         "  --gc-stats[=FILE]   write each collection's pauses, marked and swept\n"
+         "                      values and heap sizes to FILE (default stderr)\n"
+         "                      as JSON lines, then their totals at exit\n"
+         "  --gc-compact        move values out of sparse arenas once the heap\n"
+         "                      is fragmented, and free them\n"
+         "  --startup-time      report the time taken to bootstrap the runtime\n"
+         "                      and run the script on stderr\n"
+         "  --parse-cache=DIR   keep the parsed scripts and loaded files in DIR,\n"
+         "                      and skip parsing them again while unchanged\n"
+         "  --isolates          run each script given in a fresh interpreter of its\n"
+         "                      own, one after another in this process\n"
+         "  --eager-parse       parse function bodies up front rather than on the\n"
+         "                      first call\n"
+         "  --each-line         run the script, then call its onLine(line, number)\n"
+         "                      for each line of stdin, printing what it returns\n"
+         "  --prof[=FILE]       sample the JS stack and write the counts of each\n"
+         "                      stack to FILE (default flathead.folded) at exit,\n"
+         "                      in the folded format of flamegraph tools\n"
+         "  --prof-rate=HZ      take HZ samples per second of CPU time with --prof\n"
+         "                      (default 1000)\n"
+         "  --hotspots[=N]      print the N (default 20) source locations run most\n"
+         "                      often and the functions that took longest, at exit\n"
+         "                      (in a build made with `make hotspots=on`)\n"
+         "  --jit=TIER          compile hot numeric loops to machine code with the\n"
+         "                      'baseline' JIT (default on x86-64), or 'off'\n"
+         "  --jit-log           report the loops compiled, and why others weren't\n"
+         "                      or had to go back to the interpreter, on stderr\n"
+         "  --max-steps=N       terminate the script after N loop iterations and\n"
+         "                      function calls\n"
+         "  --timeout=MS        terminate the script after MS milliseconds\n"
+         "  --heap-quota=SIZE   terminate the script when its heap is full at SIZE\n"
+         "  --server=SOCKET     load the scripts given, then run each script sent\n"
+         "                      by `flat-client SOCKET script.js` in a fork\n"
+         "\n"
+         "SIZE is in bytes, with an optional k, m or g suffix. The FH_INITIAL_HEAP,\n"
+         "FH_MAX_HEAP, FH_HEAP_GROW, FH_GC_PAUSE, FH_HEAP_PROFILE, FH_GC_STATS and\n"
+         "FH_PARSE_CACHE environment variables set the defaults. Running out of a\n"
+         "--max-heap throws a RangeError; a script terminated by a quota can't catch\n"
+         "it, and the process exits with status 3.\n");
+}
+
+/* Parse a size such as "4096", "64k", "512m" or "2g" into bytes. */
+bool
+fh_parse_size(const char *str, size_t *bytes)
+{
+  char *end;
+  double size = strtod(str, &end);
+  if (end == str || size < 0) return false;
+
+  int shift = 0;
+  switch (tolower(*end)) {
+    case 'g': shift = 30; break;
+    case 'm': shift = 20; break;
+    case 'k': shift = 10; break;
+    case '\0': break;
+    default: return false;
+  }
+  if (shift) end++;
+  if (*end != '\0') return false;
+
+  *bytes = size * (1UL << shift);
+  return true;
+}
+
+/* Parse a heap growth ratio, which must be in (0, 1]. */
+bool
+fh_parse_ratio(const char *str, double *ratio)
+{
+  char *end;
+  double val = strtod(str, &end);
+  if (end == str || *end != '\0' || val <= 0 || val > 1) return false;
+
+  *ratio = val;
+  return true;
+}
+
+/* Parse a non-negative duration in milliseconds. */
+bool
+fh_parse_ms(const char *str, double *ms)
+{
+  char *end;
+  double val = strtod(str, &end);
+  if (end == str || *end != '\0' || val < 0) return false;
+
+  *ms = val;
+  return true;
 }
 
 void
@@ -56,14 +155,17 @@ fh_print_version()
 void
 cfprintf(FILE *stream, const char *color, const char *tpl, ...)
 {
-  bool use_colors = fh->opt_interactive || isatty(fileno(stdin));
+  bool use_colors = fh_use_colors();
+  fh_buf buf = {NULL, 0, 0};
 
-  if (use_colors) fputs(color, stream);
+  if (use_colors) fh_buf_append(&buf, color, strlen(color));
 
   va_list ap;
   va_start(ap, tpl);
-  vfprintf(stream, tpl, ap);
+  fh_buf_vprintf(&buf, tpl, ap);
   va_end(ap);
 
-  if (use_colors) fputs(ANSI_RESET, stream);
+  if (use_colors) fh_buf_append(&buf, ANSI_RESET, strlen(ANSI_RESET));
+  fh_write(stream, buf.data, buf.len);
+  free(buf.data);
 }
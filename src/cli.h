@@ -32,5 +32,8 @@ void fh_print_help(void);
 void fh_print_startup(void);
 void fh_print_version(void);
 void cfprintf(FILE *, const char *, const char *, ...);
+bool fh_parse_size(const char *, size_t *);
+bool fh_parse_ratio(const char *, double *);
+bool fh_parse_ms(const char *, double *);
 
 #endif
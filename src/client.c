@@ -0,0 +1,108 @@
+/*
+ * client.c -- Runs a script on a flat --server
+ *
+ * Copyright (c) 2012-2013 Nick Reynolds
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* `flat-client SOCKET script.js` has the server listening on SOCKET run the
+ * script, in this directory and with this process's stdin, stdout and
+ * stderr, and exits with the script's status. It's built on its own, without
+ * the runtime or its libraries, to start as fast as it can. */
+
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "server.h"
+
+int
+main(int argc, char **argv)
+{
+  char buf[SERVER_MAX_REQUEST];
+  char control[CMSG_SPACE(SERVER_NUM_FDS * sizeof(int))];
+  struct sockaddr_un addr;
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  struct iovec iov;
+  int32_t status;
+  int fd, i;
+
+  if (argc != 3) {
+    fprintf(stderr, "Usage: flat-client SOCKET script.js\n");
+    return 1;
+  }
+  if (strlen(argv[1]) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "flat-client: the socket path is too long\n");
+    return 1;
+  }
+
+  // The request: the working directory, then the script.
+  if (!getcwd(buf, sizeof(buf))) {
+    perror("flat-client: getcwd");
+    return 1;
+  }
+  size_t dir_len = strlen(buf) + 1, path_len = strlen(argv[2]) + 1;
+  if (dir_len + path_len > sizeof(buf)) {
+    fprintf(stderr, "flat-client: the script's path is too long\n");
+    return 1;
+  }
+  memcpy(buf + dir_len, argv[2], path_len);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, argv[1]);
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+      connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    fprintf(stderr, "flat-client: can't connect to %s: %s\n", argv[1],
+        strerror(errno));
+    return 1;
+  }
+
+  // With stdin, stdout and stderr.
+  iov.iov_base = buf;
+  iov.iov_len = dir_len + path_len;
+  memset(&msg, 0, sizeof(msg));
+  memset(control, 0, sizeof(control));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(SERVER_NUM_FDS * sizeof(int));
+  for (i = 0; i < SERVER_NUM_FDS; i++)
+    ((int *)CMSG_DATA(cmsg))[i] = i;
+  if (sendmsg(fd, &msg, 0) < 0) {
+    perror("flat-client: sendmsg");
+    return 1;
+  }
+
+  ssize_t n;
+  while ((n = recv(fd, &status, sizeof(status), MSG_WAITALL)) < 0 &&
+      errno == EINTR);
+  if (n != sizeof(status)) {
+    fprintf(stderr, "flat-client: no reply from the server\n");
+    return 1;
+  }
+  return status;
+}
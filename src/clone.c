@@ -0,0 +1,191 @@
+/*
+ * clone.c -- Copies of plain data between heaps
+ *
+ * Copyright (c) 2012-2013 Nick Reynolds
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* A value is written out as bytes that can be read back into any isolate,
+ * in this process or another one from the same build: a structured clone.
+ * Only plain data goes, so undefined, null, booleans, numbers, strings,
+ * arrays and plain objects (their own enumerable properties); anything else
+ * is a TypeError. The bytes are a tag, then for
+ *
+ *   numbers    the double, as it is in memory
+ *   strings    the length (a size_t), then the bytes
+ *   arrays     the length, then each element (holes read back as undefined)
+ *   objects    the number of properties, then each name (as a string's
+ *              length and bytes) followed by the value
+ */
+
+#include <string.h>
+
+#include "clone.h"
+#include "props.h"
+
+enum {
+  CLONE_UNDEF = 'u',
+  CLONE_NULL = 'n',
+  CLONE_TRUE = 't',
+  CLONE_FALSE = 'f',
+  CLONE_NUM = 'd',
+  CLONE_STR = 's',
+  CLONE_ARR = 'a',
+  CLONE_OBJ = 'o'
+};
+
+static void
+put_tag(fh_strbuf *buf, char tag)
+{
+  fh_strbuf_append(buf, &tag, 1);
+}
+
+static void
+put_size(fh_strbuf *buf, size_t n)
+{
+  fh_strbuf_append(buf, (char *)&n, sizeof(n));
+}
+
+static void
+put_bytes(fh_strbuf *buf, const char *str, size_t len)
+{
+  put_size(buf, len);
+  fh_strbuf_append(buf, str, len);
+}
+
+static void
+clone_write(fh_strbuf *buf, js_val *val, int depth, eval_state *state)
+{
+  js_prop *prop;
+  unsigned long i;
+  size_t n;
+
+  if (depth > CLONE_MAX_DEPTH)
+    fh_throw(state, fh_new_error(E_RANGE, "value is nested too deeply to clone"));
+
+  switch (val->type) {
+    case T_UNDEF:   put_tag(buf, CLONE_UNDEF); return;
+    case T_NULL:    put_tag(buf, CLONE_NULL); return;
+    case T_BOOLEAN: put_tag(buf, val->boolean.val ? CLONE_TRUE : CLONE_FALSE); return;
+    case T_NUMBER:
+      put_tag(buf, CLONE_NUM);
+      fh_strbuf_append(buf, (char *)&val->number.val, sizeof(double));
+      return;
+    case T_STRING:
+      fh_str_flatten(val);
+      put_tag(buf, CLONE_STR);
+      put_bytes(buf, val->string.ptr, val->string.length);
+      return;
+    default:
+      break;
+  }
+
+  if (IS_ARR(val)) {
+    put_tag(buf, CLONE_ARR);
+    put_size(buf, val->object.length);
+    for (i = 0; i < val->object.length; i++)
+      clone_write(buf, fh_get_index(val, i), depth + 1, state);
+    return;
+  }
+  if (!IS_OBJ(val) || !STREQ(val->object.class, "Object"))
+    fh_throw(state, fh_new_error(E_TYPE, "%s can't be cloned",
+          IS_OBJ(val) ? val->object.class : fh_typeof(val)));
+
+  n = 0;
+  OBJ_ITER(val, prop) {
+    if (prop->enumerable) n++;
+  }
+  put_tag(buf, CLONE_OBJ);
+  put_size(buf, n);
+  {
+    OBJ_ITER(val, prop) {
+      if (!prop->enumerable) continue;
+      put_bytes(buf, prop->name, strlen(prop->name));
+      clone_write(buf, prop->ptr ? prop->ptr : JSUNDEF(), depth + 1, state);
+    }
+  }
+}
+
+/* Append a clone of `val` to `buf`. */
+void
+fh_clone_write(fh_strbuf *buf, js_val *val, eval_state *state)
+{
+  clone_write(buf, val, 0, state);
+}
+
+static bool
+get_size(const char **p, const char *end, size_t *n)
+{
+  if ((size_t)(end - *p) < sizeof(size_t)) return false;
+  memcpy(n, *p, sizeof(size_t));
+  *p += sizeof(size_t);
+  return true;
+}
+
+/* Read back a value written by fh_clone_write at `*p`, into the current
+ * isolate, and advance `*p` past it. Returns NULL if the bytes up to `end`
+ * aren't a whole clone. */
+js_val *
+fh_clone_read(const char **p, const char *end)
+{
+  js_val *val, *item;
+  size_t n, i, len;
+  double d;
+
+  if (*p >= end) return NULL;
+  switch (*(*p)++) {
+    case CLONE_UNDEF: return JSUNDEF();
+    case CLONE_NULL:  return JSNULL();
+    case CLONE_TRUE:  return JSBOOL(1);
+    case CLONE_FALSE: return JSBOOL(0);
+    case CLONE_NUM:
+      if ((size_t)(end - *p) < sizeof(double)) return NULL;
+      memcpy(&d, *p, sizeof(double));
+      *p += sizeof(double);
+      return JSNUM(d);
+    case CLONE_STR:
+      if (!get_size(p, end, &len) || (size_t)(end - *p) < len) return NULL;
+      val = JSSTRN(*p, len);
+      *p += len;
+      return val;
+    case CLONE_ARR:
+      if (!get_size(p, end, &n)) return NULL;
+      val = JSARR();
+      for (i = 0; i < n; i++) {
+        if (!(item = fh_clone_read(p, end))) return NULL;
+        fh_set_elem(val, i, item);
+      }
+      fh_set_len(val, n);
+      return val;
+    case CLONE_OBJ:
+      if (!get_size(p, end, &n)) return NULL;
+      val = JSOBJ();
+      for (i = 0; i < n; i++) {
+        if (!get_size(p, end, &len) || (size_t)(end - *p) < len) return NULL;
+        char *name = malloc(len + 1);
+        memcpy(name, *p, len);
+        name[len] = '\0';
+        *p += len;
+        if (!(item = fh_clone_read(p, end))) {
+          free(name);
+          return NULL;
+        }
+        fh_set(val, name, item);
+        free(name);
+      }
+      return val;
+    default:
+      return NULL;
+  }
+}
@@ -0,0 +1,30 @@
+/*
+ * clone.h -- Copies of plain data between heaps
+ *
+ * Copyright (c) 2012-2013 Nick Reynolds
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CLONE_H
+#define CLONE_H
+
+#include "flathead.h"
+#include "str.h"
+
+#define CLONE_MAX_DEPTH 512     // nesting of arrays and objects (and cycles)
+
+void fh_clone_write(fh_strbuf *, js_val *, eval_state *);
+js_val * fh_clone_read(const char **, const char *);
+
+#endif
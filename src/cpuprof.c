@@ -0,0 +1,252 @@
+/*
+ * cpuprof.c -- Sampling CPU profiler, writing folded stacks
+ *
+ * Copyright (c) 2012-2013 Nick Reynolds
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* With --prof, a timer signal (SIGPROF, on CPU time) samples the JS stack,
+ * which is the chain of call states from `fh->callstack`. The handler only
+ * copies pointers into a buffer set aside at the start: the names of frames
+ * are AST strings or literals, and script names are atoms, all of which live
+ * as long as the process. When the buffer is half full the handler raises
+ * `fh_prof_pending`, and the next PROF_SAFE_POINT folds the samples into a
+ * count per distinct stack, with the signal blocked.
+ *
+ * A throw pops call states one at a time before its longjmp, and popped
+ * states go back to a pool rather than being freed, so a sample taken in the
+ * middle of one still walks a chain of valid states.
+ *
+ * The profile is written at exit in the folded format of flamegraph.pl and
+ * similar tools: one line per stack, its frames from the outermost (the
+ * script) in, separated by semicolons, then the number of samples. */
+
+// SA_RESTART and setitimer are X/Open extensions.
+#define _XOPEN_SOURCE_EXTENDED 1
+
+#include <errno.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "cpuprof.h"
+#include "nodes.h"
+#include "str.h"
+
+#define PROF_SAMPLES 256        // samples buffered between folds
+#define PROF_MAX_DEPTH 64       // frames kept per sample, innermost first
+
+typedef struct {
+  const char *name;             // caller_info
+  const char *script;
+  int line;                     // where the function is defined (0 if native)
+} prof_frame;
+
+typedef struct {
+  const char *root;             // the script of the outermost state
+  int depth;
+  bool truncated;
+  prof_frame frames[PROF_MAX_DEPTH];
+} prof_sample;
+
+typedef struct prof_stack {
+  char *folded;                 // an atom
+  unsigned long count;
+  UT_hash_handle hh;
+} prof_stack;
+
+volatile sig_atomic_t fh_prof_pending = 0;
+
+static struct {
+  bool running;
+  const char *path;
+  prof_sample *samples;
+  volatile sig_atomic_t count;
+  unsigned long dropped;        // samples lost while the buffer was full
+  prof_stack *stacks;
+  struct sigaction prev_action;
+} prof;
+
+static void
+prof_signal(int sig)
+{
+  int saved_errno = errno;
+  fh_state *state = fh;
+
+  if (prof.count >= PROF_SAMPLES || !state) {
+    if (state) prof.dropped++;
+    errno = saved_errno;
+    return;
+  }
+
+  prof_sample *sample = &prof.samples[prof.count];
+  eval_state *frame;
+
+  sample->root = state->script_name;
+  sample->depth = 0;
+  sample->truncated = false;
+  for (frame = state->callstack; frame; frame = frame->parent) {
+    sample->root = frame->script_name;
+    if (!frame->caller_info) continue;      // a try or throw, not a call
+    if (sample->depth == PROF_MAX_DEPTH) {
+      sample->truncated = true;
+      continue;
+    }
+    prof_frame *f = &sample->frames[sample->depth++];
+    f->name = frame->caller_info;
+    f->script = frame->script_name;
+    f->line = frame->callee ? frame->callee->line : 0;
+  }
+
+  if (++prof.count >= PROF_SAMPLES / 2)
+    fh_prof_pending = 1;
+  errno = saved_errno;
+}
+
+/* Append a frame's name, with semicolons (the frame separator) replaced. */
+static void
+append_frame(fh_strbuf *sb, const char *str)
+{
+  char buf[256];
+  size_t len = strlen(str), i;
+  if (len >= sizeof(buf)) len = sizeof(buf) - 1;
+  for (i = 0; i < len; i++)
+    buf[i] = str[i] == ';' ? ':' : str[i];
+  fh_strbuf_append(sb, buf, len);
+}
+
+static void
+fold_sample(prof_sample *sample)
+{
+  fh_strbuf sb;
+  prof_stack *stack;
+  char pos[32];
+  int i;
+
+  fh_strbuf_init(&sb);
+  append_frame(&sb, sample->root ? sample->root : "(unknown)");
+  if (sample->truncated)
+    fh_strbuf_append(&sb, ";...", 4);
+
+  for (i = sample->depth - 1; i >= 0; i--) {
+    prof_frame *f = &sample->frames[i];
+    fh_strbuf_append(&sb, ";", 1);
+    append_frame(&sb, f->name);
+    if (f->line) {
+      fh_strbuf_append(&sb, " (", 2);
+      append_frame(&sb, f->script ? f->script : "(unknown)");
+      snprintf(pos, sizeof(pos), ":%d)", f->line);
+      fh_strbuf_append(&sb, pos, strlen(pos));
+    }
+  }
+
+  char *folded = fh_intern(sb.buf);
+  free(sb.buf);
+
+  HASH_FIND(hh, prof.stacks, &folded, sizeof(char *), stack);
+  if (!stack) {
+    stack = calloc(1, sizeof(prof_stack));
+    stack->folded = folded;
+    HASH_ADD(hh, prof.stacks, folded, sizeof(char *), stack);
+  }
+  stack->count++;
+}
+
+/* Fold the buffered samples into the counts per stack. */
+void
+fh_prof_fold()
+{
+  sigset_t block, prev;
+  int i;
+
+  sigemptyset(&block);
+  sigaddset(&block, SIGPROF);
+  sigprocmask(SIG_BLOCK, &block, &prev);
+
+  for (i = 0; i < prof.count; i++)
+    fold_sample(&prof.samples[i]);
+  prof.count = 0;
+  fh_prof_pending = 0;
+
+  sigprocmask(SIG_SETMASK, &prev, NULL);
+}
+
+/* Start sampling `hz` times a second of CPU time. The profile is written to
+ * `path` at exit. */
+bool
+fh_prof_start(const char *path, int hz)
+{
+  struct sigaction action;
+  struct itimerval timer;
+  long usec = 1000000 / (hz > 0 ? hz : PROF_DEFAULT_RATE);
+
+  if (prof.running) return true;
+  prof.path = path ? path : PROF_DEFAULT_FILE;
+  prof.samples = malloc(PROF_SAMPLES * sizeof(prof_sample));
+
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = prof_signal;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGPROF, &action, &prof.prev_action) != 0) {
+    free(prof.samples);
+    return false;
+  }
+
+  timer.it_interval.tv_sec = usec / 1000000;
+  timer.it_interval.tv_usec = usec % 1000000;
+  timer.it_value = timer.it_interval;
+  if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+    sigaction(SIGPROF, &prof.prev_action, NULL);
+    free(prof.samples);
+    return false;
+  }
+
+  prof.running = true;
+  atexit(fh_prof_stop);
+  return true;
+}
+
+/* Stop sampling and write the profile. */
+void
+fh_prof_stop()
+{
+  struct itimerval timer;
+  prof_stack *stack, *tmp;
+
+  if (!prof.running) return;
+
+  memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_PROF, &timer, NULL);
+  sigaction(SIGPROF, &prof.prev_action, NULL);
+  prof.running = false;
+  fh_prof_fold();
+
+  FILE *out = fopen(prof.path, "w");
+  if (!out)
+    fprintf(stderr, "Error: can't write the CPU profile to %s\n", prof.path);
+
+  HASH_ITER(hh, prof.stacks, stack, tmp) {
+    if (out) fprintf(out, "%s %lu\n", stack->folded, stack->count);
+    HASH_DEL(prof.stacks, stack);
+    free(stack);
+  }
+
+  if (out) {
+    fclose(out);
+    if (prof.dropped)
+      fprintf(stderr, "CPU profile: %lu samples dropped\n", prof.dropped);
+  }
+  free(prof.samples);
+  prof.samples = NULL;
+}
@@ -0,0 +1,40 @@
+/*
+ * cpuprof.h -- Sampling CPU profiler, writing folded stacks
+ *
+ * Copyright (c) 2012-2013 Nick Reynolds
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CPUPROF_H
+#define CPUPROF_H
+
+#include <signal.h>
+
+#include "flathead.h"
+
+#define PROF_DEFAULT_FILE "flathead.folded"
+#define PROF_DEFAULT_RATE 1000      // samples per second of CPU time
+
+// Set by the timer signal when samples are waiting to be folded.
+extern volatile sig_atomic_t fh_prof_pending;
+
+// Call where it's safe to allocate. Folding is rare, so this costs a load.
+#define PROF_SAFE_POINT() \
+  do { if (fh_prof_pending) fh_prof_fold(); } while (0)
+
+bool fh_prof_start(const char *, int);
+void fh_prof_fold(void);
+void fh_prof_stop(void);
+
+#endif
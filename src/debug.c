@@ -17,18 +17,26 @@
  */
 
 #include <math.h>
+#include <string.h>
 
 #include "debug.h"
 #include "props.h"
 #include "cli.h"
+#include "output.h"
 
 
 // ----------------------------------------------------------------------------
 // Value Debugging
 // ----------------------------------------------------------------------------
 
+/* Values are formatted into one buffer, and written with a single call. */
+
+static fh_buf out;
+
+static void debug_val(fh_buf *, js_val *, int);
+
 static void
-debug_obj(FILE *stream, js_val *obj, int indent, bool force_enum)
+debug_obj(fh_buf *buf, js_val *obj, int indent, bool force_enum)
 {
   js_prop *x;
   bool first = true;
@@ -36,142 +44,154 @@ debug_obj(FILE *stream, js_val *obj, int indent, bool force_enum)
   OBJ_ITER(obj, x) {
     if (!x->enumerable && !force_enum) continue;
     if (first) {
-      if (indent) fprintf(stream, "%*s", indent, " ");
-      fprintf(stream, "{");
+      if (indent) fh_buf_printf(buf, "%*s", indent, " ");
+      fh_buf_append(buf, "{", 1);
       first = false;
     }
     else {
-      fprintf(stream, ",\n");
-      fprintf(stream, "%*s", indent + 1, " ");
+      fh_buf_append(buf, ",\n", 2);
+      fh_buf_printf(buf, "%*s", indent + 1, " ");
     }
-    fprintf(stream, " %s: ", x->name);
+    fh_buf_printf(buf, " %s: ", x->name);
     if (x->circular)
-      cfprintf(stream, ANSI_BLUE, "[Circular]");
+      fh_buf_cprintf(buf, ANSI_BLUE, "[Circular]");
     else
-      fh_debug(stream, x->ptr, indent + 3, false);
+      debug_val(buf, x->ptr, indent + 3);
   };
 
-  fprintf(stream, first ? "{}" : " }");
+  if (first) fh_buf_append(buf, "{}", 2);
+  else fh_buf_append(buf, " }", 2);
 }
 
 static void
-debug_arr(FILE *stream, js_val *arr, int indent)
+debug_arr(fh_buf *buf, js_val *arr, int indent)
 {
   if (arr->object.length == 0) {
-    fprintf(stream, "[]");
+    fh_buf_append(buf, "[]", 2);
     return;
   }
-  fprintf(stream, "[ ");
+  fh_buf_append(buf, "[ ", 2);
 
   bool first = true;
-  js_prop *prop;
+  js_val *val;
   unsigned long i;
 
   for (i = 0; i < arr->object.length; i++) {
-    prop = fh_get_prop(arr, JSNUMKEY(i)->string.ptr);
+    val = fh_get_elem(arr, i);
 
     if (!first) 
-      fprintf(stream, ", ");
+      fh_buf_append(buf, ", ", 2);
     else
       first = false;
 
-    if (!prop) continue;
+    if (!val) continue;
 
-    if (prop->circular)
-      cfprintf(stream, ANSI_BLUE, "[Circular]");
+    if (val == arr)
+      fh_buf_cprintf(buf, ANSI_BLUE, "[Circular]");
     else
-      fh_debug(stream, prop->ptr, 0, false);
+      debug_val(buf, val, 0);
   }
 
-  fprintf(stream, " ]");
+  fh_buf_append(buf, " ]", 2);
 }
 
 static void
-debug_num(FILE *stream, js_val *num)
+debug_num(fh_buf *buf, js_val *num)
 {
   if (num->number.is_nan)
-    cfprintf(stream, ANSI_ORANGE, "NaN");
+    fh_buf_cprintf(buf, ANSI_ORANGE, "NaN");
   else if (num->number.is_inf) 
-    cfprintf(stream, ANSI_ORANGE, "%sInfinity", num->number.is_neg ? "-" : "");
+    fh_buf_cprintf(buf, ANSI_ORANGE, "%sInfinity", num->number.is_neg ? "-" : "");
   else {
     char *fmt = "%f";
     if (fmod(num->number.val, 1) == 0) 
       fmt = "%.0f";
     if (fabs(num->number.val) > 1e21)
       fmt = "%g";
-    cfprintf(stream, ANSI_ORANGE, fmt, num->number.val);
+    fh_buf_cprintf(buf, ANSI_ORANGE, fmt, num->number.val);
   }
 }
 
-void
-fh_debug(FILE *stream, js_val *val, int indent, bool newline)
+static void
+debug_val(fh_buf *buf, js_val *val, int indent)
 {
   switch (val->type) {
     case T_BOOLEAN:
-      fprintf(stream, "%s", !val->boolean.val ? "false" : "true");
+      if (val->boolean.val) fh_buf_append(buf, "true", 4);
+      else fh_buf_append(buf, "false", 5);
       break;
     case T_NUMBER:
-      debug_num(stream, val);
+      debug_num(buf, val);
       break;
     case T_STRING:
+      fh_str_flatten(val);
       if (fh->opt_interactive)
-        cfprintf(stream, ANSI_YELLOW, "'%s'", val->string.ptr);
+        fh_buf_cprintf(buf, ANSI_YELLOW, "'%s'", val->string.ptr);
       else
-        fprintf(stream, "%s", val->string.ptr);
+        fh_buf_append(buf, val->string.ptr, strlen(val->string.ptr));
       break;
     case T_NULL:
-      cfprintf(stream, ANSI_GRAY, "null");
+      fh_buf_cprintf(buf, ANSI_GRAY, "null");
       break;
     case T_UNDEF:
-      cfprintf(stream, ANSI_GRAY, "undefined");
+      fh_buf_cprintf(buf, ANSI_GRAY, "undefined");
       break;
     case T_OBJECT:
       if (IS_ARR(val))
-        debug_arr(stream, val, indent);
+        debug_arr(buf, val, indent);
       else if (IS_FUNC(val))
-        cfprintf(stream, ANSI_BLUE, "[Function]");
+        fh_buf_cprintf(buf, ANSI_BLUE, "[Function]");
       else if (IS_DATE(val))
-        fprintf(stream, "[Date %ld]", (long)val->object.primitive->number.val);
+        fh_buf_printf(buf, "[Date %ld]", (long)val->object.primitive->number.val);
       else
-        debug_obj(stream, val, indent, false);
+        debug_obj(buf, val, indent, false);
       break;
   }
-  if (newline) fprintf(stream, "\n");
+}
+
+void
+fh_debug(FILE *stream, js_val *val, int indent, bool newline)
+{
+  out.len = 0;
+  debug_val(&out, val, indent);
+  if (newline) fh_buf_append(&out, "\n", 1);
+  fh_write(stream, out.data, out.len);
 }
 
 // Debug an object with extra verbosity, displaying non-enumerable properties.
 void
 fh_debug_verbose(FILE *stream, js_val *val, int indent)
 {
+  out.len = 0;
   switch (val->type) {
     case T_BOOLEAN:
-      fprintf(stream, "Boolean: (%s)", !val->boolean.val ? "false" : "true");
+      fh_buf_printf(&out, "Boolean: (%s)", !val->boolean.val ? "false" : "true");
       break;
     case T_NUMBER:
-      debug_num(stream, val);
+      debug_num(&out, val);
       break;
     case T_STRING:
-      cfprintf(stream, ANSI_YELLOW, "String: '%s'", val->string.ptr);
+      fh_buf_cprintf(&out, ANSI_YELLOW, "String: '%s'", fh_str_flatten(val)->string.ptr);
       break;
     case T_NULL:
-      cfprintf(stream, ANSI_GRAY, "null");
+      fh_buf_cprintf(&out, ANSI_GRAY, "null");
       break;
     case T_UNDEF:
-      cfprintf(stream, ANSI_GRAY, "undefined");
+      fh_buf_cprintf(&out, ANSI_GRAY, "undefined");
       break;
     case T_OBJECT:
       if (IS_ARR(val))
-        fprintf(stream, "Array: ");
+        fh_buf_append(&out, "Array: ", 7);
       else if (IS_FUNC(val))
-        cfprintf(stream, ANSI_BLUE, "Function: ");
+        fh_buf_cprintf(&out, ANSI_BLUE, "Function: ");
       else
-        fprintf(stream, "Object: ");
+        fh_buf_append(&out, "Object: ", 8);
       break;
   }
 
   if (IS_OBJ(val))
-    debug_obj(stream, val, indent, true);
+    debug_obj(&out, val, indent, true);
 
-  fprintf(stream, "\n");
+  fh_buf_append(&out, "\n", 1);
+  fh_write(stream, out.data, out.len);
 }
-
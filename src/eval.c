@@ -24,6 +24,11 @@
 #include "nodes.h"
 #include "str.h"
 #include "gc.h"
+#include "vm.h"
+#include "heapprof.h"
+#include "hotspots.h"
+#include "jit.h"
+#include "quota.h"
 
 
 // ----------------------------------------------------------------------------
@@ -34,8 +39,8 @@ static js_val *
 eval_each(js_val *ctx, ast_node *node)
 {
   js_val *result = JSUNDEF();
-  node_rewind(node);
-  while (!node->visited) result = fh_eval(ctx, node_pop(node));
+  int i;
+  for (i = 0; i < node->num_items; i++) result = fh_eval(ctx, node->items[i]);
   return result;
 }
 
@@ -77,27 +82,39 @@ member_child(js_val *ctx, ast_node *member)
     str_from_node(ctx, member->e1);
 }
 
+/* Look up the member `member` of the already evaluated `parent`. */
 static js_val *
-member_exp(js_val *ctx, ast_node *member)
+member_get(js_val *ctx, ast_node *member, js_val *parent)
 {
-  js_val *parent = member_parent(ctx, member);
-  js_val *child_name = member_child(ctx, member);
+  js_val *key = NULL, *val;
+  unsigned long i;
+
+  // Index dense arrays by number, without building a string key.
+  if (member->val && parent->dense) {
+    key = fh_eval(ctx, member->e1);
+    if (fh_num_index(key, &i) && (val = fh_get_elem(parent, i)))
+      return val;
+  }
+
+  js_val *child_name = key ? TO_STR(key) : member_child(ctx, member);
 
   // Handle array-like string character access.
   if (IS_STR(parent) && member->e1->type == NODE_NUM) {
     int i = member->e1->val, len = parent->string.length;
-    if (i < len && i >= 0) {
-      char *str = malloc(sizeof(char) + 1);
-      str[1] = '\0';
-      sprintf(str, "%c", parent->string.ptr[i]);
-      return JSSTR(str);
-    }
+    if (i < len && i >= 0)
+      return JSSTRN(fh_str_flatten(parent)->string.ptr + i, 1);
     return JSUNDEF();
   }
 
   return fh_get_proto(parent, child_name->string.ptr);
 }
 
+static js_val *
+member_exp(js_val *ctx, ast_node *member)
+{
+  return member_get(ctx, member, member_parent(ctx, member));
+}
+
 static js_val *
 ident(js_val *ctx, ast_node *id)
 {
@@ -137,8 +154,9 @@ add_op(js_val *a, js_val *b)
   a = fh_to_primitive(a, T_NUMBER);
   b = fh_to_primitive(b, T_NUMBER);
 
+  // Strings stay ropes here; TO_STR would flatten them.
   if (IS_STR(a) || IS_STR(b))
-    return JSSTR(fh_str_concat(TO_STR(a)->string.ptr, TO_STR(b)->string.ptr));
+    return fh_concat(IS_STR(a) ? a : TO_STR(a), IS_STR(b) ? b : TO_STR(b));
 
   if (!IS_NUM(a) || !IS_NUM(b))
     return add_op(TO_NUM(a), TO_NUM(b));
@@ -230,8 +248,10 @@ eq_op(js_val *a, js_val *b, bool strict)
       if (a->number.val == b->number.val) return JSBOOL(1);
       return JSBOOL(0);
     }
-    if (IS_STR(a))
-      return JSBOOL(STREQ(a->string.ptr, b->string.ptr));
+    if (IS_STR(a)) {
+      if (a->string.length != b->string.length) return JSBOOL(0);
+      return JSBOOL(STREQ(TO_STR(a)->string.ptr, TO_STR(b)->string.ptr));
+    }
     if (IS_BOOL(a))
       return JSBOOL(a->boolean.val == b->boolean.val);
     // Functions & Objects (must be same ref)
@@ -287,7 +307,7 @@ abstr_rel_comp(js_val *a, js_val *b, bool left_first)
   }
 
   if (IS_STR(a) && IS_STR(b)) {
-    return JSBOOL(strcmp(a->string.ptr, b->string.ptr) < 0);
+    return JSBOOL(strcmp(TO_STR(a)->string.ptr, TO_STR(b)->string.ptr) < 0);
   }
 
   a = TO_NUM(a), b = TO_NUM(b);
@@ -330,7 +350,7 @@ and_exp(js_val *ctx, ast_node *a, ast_node *b)
 {
   // && operator returns the first false value, or the second true value. 
   js_val *aval = fh_eval(ctx, a);
-  if (TO_BOOL(aval)->boolean.val) return fh_eval(ctx, b);
+  if (fh_truthy(aval)) return fh_eval(ctx, b);
   return aval;
 }
 
@@ -339,7 +359,7 @@ or_exp(js_val *ctx, ast_node *a, ast_node *b)
 {
   // || returns the first true value, or the second false value.
   js_val *aval = fh_eval(ctx, a);
-  if (TO_BOOL(aval)->boolean.val) return aval;
+  if (fh_truthy(aval)) return aval;
   return fh_eval(ctx, b);
 }
 
@@ -357,6 +377,10 @@ delete_op(js_val *ctx, ast_node *node)
     name = str_from_node(ctx, node->e1);
   }
 
+  unsigned long i;
+  if (env->dense && fh_is_index(name->string.ptr, &i))
+    return JSBOOL(fh_del_elem(env, i));
+
   js_prop *prop = fh_get_prop(env, name->string.ptr);
   if (!prop->configurable)
     return JSBOOL(0);
@@ -369,62 +393,89 @@ delete_op(js_val *ctx, ast_node *node)
 // ----------------------------------------------------------------------------
 
 static void 
-assign(js_val *obj, char *name, js_val *val, char *op)
+assign(js_val *obj, char *name, js_val *val, enum ast_op op)
 {
-  if (STREQ(op, "=")) { 
+  if (op == OP_ASGN) { 
     fh_set_rec(obj, name, val);
     return;
   }
 
-  // Handle other assignment operators
-  js_val *cur = fh_get_rec(obj, name);
-  if (STREQ(op, "+=")) fh_set_rec(obj, name, add_op(cur, val));
-  if (STREQ(op, "-=")) fh_set_rec(obj, name, sub_op(cur, val));
-  if (STREQ(op, "*=")) fh_set_rec(obj, name, mul_op(cur, val));
-  if (STREQ(op, "/=")) fh_set_rec(obj, name, div_op(cur, val));
+  // Compound assignment operators store the binary operator to apply.
+  fh_set_rec(obj, name, fh_bin_op(op, fh_get_rec(obj, name), val));
+}
+
+void
+fh_assign_member(js_val *obj, char *key, js_val *val, enum ast_op op)
+{
+  unsigned long i;
+  if (obj->dense && fh_is_index(key, &i)) {
+    fh_assign_elem(obj, i, val, op);
+    return;
+  }
+
+  // Set the array length.
+  if (IS_ARR(obj)) {
+    char *err;
+    unsigned long idx = strtod(key, &err);
+    if (*err == 0 && idx >= obj->object.length)
+        fh_set_len(obj, idx + 1);
+  }
+
+  if (IS_OBJ(obj))
+    assign(obj, key, val, op);
+}
+
+/* Assign to an element of a dense array. */
+void
+fh_assign_elem(js_val *obj, unsigned long i, js_val *val, enum ast_op op)
+{
+  if (op != OP_ASGN)
+    val = fh_bin_op(op, fh_get_index(obj, i), val);
+
+  fh_set_elem(obj, i, val);
+  if (i >= obj->object.length && !obj->typed)
+    fh_set_len(obj, i + 1);
 }
 
 static js_val *
 assign_exp(js_val *ctx, ast_node *node)
 {
+  // The comma operator is also represented as an assignment node.
+  if (node->op == OP_NONE) {
+    fh_eval(ctx, node->e1);
+    return fh_eval(ctx, node->e2);
+  }
+
   js_val *val = fh_eval(ctx, node->e2);
   char *key = node->e1->sval;
 
   if (node->e1->type == NODE_MEMBER) {
-    js_val *old_ctx = ctx; 
-    ctx = member_parent(old_ctx, node->e1);
-    key = member_child(old_ctx, node->e1)->string.ptr;
-
-    // Set the array length.
-    if (IS_ARR(ctx)) {
-      char *err;
-      unsigned long val = strtod(key, &err);
-      if (*err == 0 && val >= ctx->object.length)
-          fh_set_len(ctx, val + 1);
+    js_val *obj = member_parent(ctx, node->e1);
+    if (node->e1->val && obj->dense) {
+      js_val *k = fh_eval(ctx, node->e1->e1);
+      unsigned long i;
+      if (fh_num_index(k, &i)) {
+        fh_assign_elem(obj, i, val, node->op);
+        return val;
+      }
+      key = TO_STR(k)->string.ptr;
     }
+    else
+      key = member_child(ctx, node->e1)->string.ptr;
+    fh_assign_member(obj, key, val, node->op);
+    return val;
   }
 
   if (IS_OBJ(ctx))
-    assign(ctx, key, val, node->sval);
+    assign(ctx, key, val, node->op);
   return val;
 }
 
 static js_val *
-var_dec(js_val *ctx, ast_node *node, bool ignore_rval)
+var_dec(js_val *ctx, ast_node *node)
 {
-  // If node->val is set, the variable declaration has already been hoisted and
-  // should not be touched.
-  if (!node->val) {
-    if (node->e2 == NULL || ignore_rval)
-      fh_set_prop(ctx, node->e1->sval, JSUNDEF(), P_WRITE | P_ENUM);
-    else
-      fh_set_prop(ctx, node->e1->sval, fh_eval(ctx, node->e2), P_WRITE | P_ENUM);
-  }
-  // If it has already been hoisted, we may still need to do the assignment.
-  else if (node->e2) {
-    node->sval = "=";
-    assign_exp(ctx, node);
-  }
+  // The variable has been hoisted, so only the assignment is left.
+  if (node->e2) assign_exp(ctx, node);
   return JSUNDEF();
 }
 
@@ -437,8 +488,12 @@ static js_val *
 return_stmt(js_val *ctx, ast_node *node)
 {
   js_val *result = node->e1 ? fh_eval(ctx, node->e1) : JSUNDEF();
-  if (IS_FUNC(result))
+  if (IS_FUNC(result)) {
+    GC_BARRIER(result, ctx);
     result->object.scope = ctx;
+  }
+  // The signal rides on the value, so shared cells need a copy of their own.
+  result = fh_unshare(result);
   result->signal = S_BREAK;
   return result;
 }
@@ -446,7 +501,7 @@ return_stmt(js_val *ctx, ast_node *node)
 static js_val *
 break_stmt()
 {
-  js_val *signal = JSNULL();
+  js_val *signal = fh_new_val(T_NULL);
   signal->signal = S_BREAK;
   return signal;
 }
@@ -454,56 +509,214 @@ break_stmt()
 static js_val *
 if_stmt(js_val *ctx, ast_node *node)
 {
-  if (TO_BOOL(fh_eval(ctx, node->e1))->boolean.val)
+  if (fh_eval_cond(ctx, node->e1))
     return fh_eval(ctx, node->e2);
   else if (node->e3 != NULL)
     return fh_eval(ctx, node->e3);
   return JSUNDEF();
 }
 
-static js_val *
-switch_stmt(js_val *ctx, ast_node *node)
+/* The clause at a position of a switch, counting in source order: the case
+ * clauses before the default, the default, and the case clauses after. */
+static ast_node *
+switch_clause(ast_node *caseblock, int i)
 {
-  js_val *val, *result, *test = fh_eval(ctx, node->e1);
+  int num_a = caseblock->e1 ? caseblock->e1->num_items : 0;
+  if (i < num_a) return caseblock->e1->items[i];
+  i -= num_a;
+  if (caseblock->e2) {
+    if (i == 0) return caseblock->e2;
+    i--;
+  }
+  return caseblock->e3->items[i];
+}
 
-  ast_node *current,
-           *caseblock = node->e2,
-           *clauses_a = caseblock->e1, 
-           *defaultclause = caseblock->e2, 
-           *clauses_b = caseblock->e3;
+static int
+switch_clauses(ast_node *caseblock)
+{
+  return (caseblock->e1 ? caseblock->e1->num_items : 0) +
+    (caseblock->e2 ? 1 : 0) +
+    (caseblock->e3 ? caseblock->e3->num_items : 0);
+}
 
-  bool matched = false;
+/* Whether a switch is dispatched through a table: it has enough cases, and
+ * each is labeled with a number or string literal. */
+bool
+fh_switch_table(ast_node *node)
+{
+  ast_node *caseblock = node->e2;
+  int i, n = switch_clauses(caseblock), cases = 0;
+
+  for (i = 0; i < n; i++) {
+    ast_node *clause = switch_clause(caseblock, i);
+    if (clause == caseblock->e2) continue;
+    if (clause->e1->type != NODE_NUM && clause->e1->type != NODE_STR)
+      return false;
+    cases++;
+  }
+  return cases >= SWITCH_TABLE_MIN;
+}
 
-  // Check case clauses before and after the default case
-  ast_node *clauses, *clauses_lst[] = {clauses_a, clauses_b};
-  int i;
-  for (i = 0; i < 2; i++) {
-    clauses = clauses_lst[i];
-    if (clauses) {
-      while (!clauses->visited) {
-        current = node_pop(clauses);
-        val = fh_eval(ctx, current->e1);
-        // Cases fall-through to the next when breaks are omitted.
-        if (matched || eq_op(test, val, true)->boolean.val) {
-          matched = true;
-          if (!current->e2) continue;
-          result = fh_eval(ctx, current->e2);
-          if (result->signal == S_BREAK) {
-            result->signal = S_NONE;
-            return result;
-          }
-        }
+static int
+switch_num_cmp(const void *a, const void *b)
+{
+  const fh_switch_num *x = a, *y = b;
+  if (x->num != y->num) return x->num < y->num ? -1 : 1;
+  return x->clause - y->clause;
+}
+
+/* Build the table of a switch, mapping each label to the first clause with
+ * it. NaN labels never match, and -0 is +0 under strict equality. Numbers
+ * are kept sorted, and integers close enough together also get a direct
+ * index; strings are hashed by atom. */
+static fh_switch_cases *
+switch_cases(ast_node *node)
+{
+  ast_node *caseblock = node->e2;
+  int i, j, n = switch_clauses(caseblock);
+  fh_switch_cases *table = calloc(1, sizeof(fh_switch_cases));
+  fh_switch_str *entry, *found;
+  bool ints = true;
+
+  table->linear = !fh_switch_table(node);
+  if (table->linear) return table;
+
+  table->nums = malloc(n * sizeof(fh_switch_num));
+  table->str_entries = calloc(n, sizeof(fh_switch_str));
+  table->fallback = n;
+  for (i = 0; i < n; i++) {
+    ast_node *clause = switch_clause(caseblock, i), *label = clause->e1;
+
+    if (clause == caseblock->e2)
+      table->fallback = i;
+    else if (label->type == NODE_NUM && !isnan(label->val)) {
+      fh_switch_num *num = &table->nums[table->num_nums++];
+      num->num = label->val == 0 ? 0 : label->val;
+      num->clause = i;
+      if (num->num != floor(num->num) || fabs(num->num) > SWITCH_MAX_INT)
+        ints = false;
+    }
+    else if (label->type == NODE_STR) {
+      entry = &table->str_entries[i];
+      entry->atom = fh_intern(label->sval);
+      entry->clause = i;
+      HASH_FIND(hh, table->strs, &entry->atom, sizeof(char *), found);
+      if (!found) HASH_ADD(hh, table->strs, atom, sizeof(char *), entry);
+    }
+  }
+
+  // Sort, keeping only the first clause of each number.
+  qsort(table->nums, table->num_nums, sizeof(fh_switch_num), switch_num_cmp);
+  for (i = j = 0; i < table->num_nums; i++)
+    if (j == 0 || table->nums[i].num != table->nums[j - 1].num)
+      table->nums[j++] = table->nums[i];
+  table->num_nums = j;
+
+  if (ints && j > 0) {
+    long lo = table->nums[0].num, hi = table->nums[j - 1].num;
+    if (hi - lo < SWITCH_DENSITY * j) {
+      table->lo = lo;
+      table->span = hi - lo + 1;
+      table->direct = malloc(table->span * sizeof(int));
+      for (i = 0; i < table->span; i++) table->direct[i] = table->fallback;
+      for (i = 0; i < j; i++)
+        table->direct[(long)table->nums[i].num - lo] = table->nums[i].clause;
+    }
+  }
+  return table;
+}
+
+void
+fh_free_switch_cases(fh_switch_cases *table)
+{
+  HASH_CLEAR(hh, table->strs);
+  free(table->str_entries);
+  free(table->nums);
+  free(table->direct);
+  free(table);
+}
+
+static int
+switch_num_lookup(fh_switch_cases *table, double x)
+{
+  if (table->direct) {
+    if (x >= table->lo && x < table->lo + table->span && x == floor(x))
+      return table->direct[(long)x - table->lo];
+    return table->fallback;
+  }
+
+  int lo = 0, hi = table->num_nums - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    double num = table->nums[mid].num;
+    if (num == x) return table->nums[mid].clause;
+    if (num < x) lo = mid + 1;
+    else hi = mid - 1;
+  }
+  return table->fallback;
+}
+
+/* The position of the clause that a switch on `val` starts at: the first
+ * case with an equal label, else the default, else the number of clauses
+ * (none). SWITCH_LINEAR if the switch has no table. */
+int
+fh_switch_lookup(ast_node *node, js_val *val)
+{
+  fh_node_data *data = fh_get_node_data(node);
+  if (!data->cases) data->cases = switch_cases(node);
+
+  fh_switch_cases *table = data->cases;
+  fh_switch_str *found = NULL;
+
+  if (table->linear) return SWITCH_LINEAR;
+
+  if (IS_NUM(val)) {
+    // NaN compares unequal to everything, so it never matches.
+    if (IS_NAN(val)) return table->fallback;
+    if (IS_INF(val))
+      return switch_num_lookup(table, val->number.is_neg ? -INFINITY : INFINITY);
+    return switch_num_lookup(table, val->number.val);
+  }
+  if (IS_STR(val)) {
+    // Labels are atoms, so a string that was never interned can't match.
+    val = fh_str_flatten(val);
+    char *atom = strlen(val->string.ptr) == val->string.length ?
+      fh_atom_lookup(val->string.ptr) : NULL;
+    if (atom) HASH_FIND(hh, table->strs, &atom, sizeof(char *), found);
+  }
+  return found ? found->clause : table->fallback;
+}
+
+static js_val *
+switch_stmt(js_val *ctx, ast_node *node)
+{
+  js_val *result, *test = fh_eval(ctx, node->e1);
+  ast_node *caseblock = node->e2;
+  int i, n = switch_clauses(caseblock), start = fh_switch_lookup(node, test);
+
+  if (start == SWITCH_LINEAR) {
+    // Compare against each case in turn, then take the default (if any).
+    start = n;
+    for (i = 0; i < n; i++) {
+      ast_node *clause = switch_clause(caseblock, i);
+      if (clause == caseblock->e2)
+        start = i;
+      else if (eq_op(test, fh_eval(ctx, clause->e1), true)->boolean.val) {
+        start = i;
+        break;
       }
     }
   }
 
-  // Take the default case if it exists and we haven't matched 
-  // anything yet.
-  if (defaultclause && !matched) {
-    result = fh_eval(ctx, defaultclause->e2);
-    if (result->signal == S_BREAK)
+  // Cases fall-through to the next when breaks are omitted.
+  for (i = start; i < n; i++) {
+    ast_node *clause = switch_clause(caseblock, i);
+    if (!clause->e2) continue;
+    result = fh_eval(ctx, clause->e2);
+    if (result->signal == S_BREAK) {
       result->signal = S_NONE;
-    return result;
+      return result;
+    }
   }
 
   return JSUNDEF();
@@ -518,15 +731,14 @@ static void
 func_dec_scan(js_val *ctx, ast_node *node)
 {
   // Sweep for function declarations
-  ast_node *child;
-  while (!node->visited) {
-    child = node_pop(node);
+  int i;
+  for (i = 0; i < node->num_items; i++) {
+    ast_node *child = node->items[i];
     if (child->type == NODE_FUNC) {
       char *name = str_from_node(ctx, child->e3)->string.ptr;
       fh_set_prop(ctx, name, JSFUNC(child), P_WRITE | P_ENUM);
     }
   }
-  node_rewind(node);
 }
 
 static void
@@ -537,11 +749,10 @@ var_dec_scan(js_val *ctx, ast_node *node)
   // Don't touch functions (stay within our current scope)
   if (node->type == NODE_FUNC) return;
 
-  // Declare the variable and possibly convert it to an assignment
-  if (node->type == NODE_VAR_DEC) {
-    var_dec(ctx, node, true);    // true to ignore rhs
-    node->val = 1;               // Signals that it has been hoisted
-  }
+  // Declare the variable, keeping the value of a parameter or function of
+  // the same name.
+  if (node->type == NODE_VAR_DEC && !fh_get_prop(ctx, node->e1->sval))
+    fh_set_prop(ctx, node->e1->sval, JSUNDEF(), P_WRITE | P_ENUM);
 
   // Recurse sub nodes, will hit the whole tree.
   if (node->e1) var_dec_scan(ctx, node->e1);
@@ -553,10 +764,9 @@ static js_val *
 stmt_lst(js_val *ctx, ast_node *node)
 {
   js_val *result = NULL;
-  ast_node *child;
-  node_rewind(node);
-  while (!node->visited) {
-    child = node_pop(node);
+  int i;
+  for (i = 0; i < node->num_items; i++) {
+    ast_node *child = node->items[i];
 
     if (child->type == NODE_RETURN)
       return return_stmt(ctx, child);
@@ -569,6 +779,7 @@ stmt_lst(js_val *ctx, ast_node *node)
     result = fh_eval(ctx, child);
     if (result->signal == S_BREAK)
       return result;
+    GC_SAFEPOINT();
   }
   return result ? result : JSUNDEF();
 }
@@ -601,10 +812,9 @@ arr_lit(js_val *ctx, ast_node *node)
 {
   js_val *arr = JSARR();
   if (node->e1 != NULL) {
-    int i = 0;
-    while (!node->e1->visited) {
-      fh_set(arr, JSNUMKEY(i++)->string.ptr, fh_eval(ctx, node_pop(node->e1)));
-    }
+    int i;
+    for (i = 0; i < node->e1->num_items; i++)
+      fh_set_elem(arr, i, fh_eval(ctx, node->e1->items[i]));
     fh_set_len(arr, i);
   }
   return arr;
@@ -616,25 +826,32 @@ arr_lit(js_val *ctx, ast_node *node)
 // ----------------------------------------------------------------------------
 
 static void
-while_stmt(js_val *ctx, ast_node *cnd, ast_node *stmt)
+while_stmt(js_val *ctx, ast_node *node)
 {
   js_val *result;
 
-  while (TO_BOOL(fh_eval(ctx, cnd))->boolean.val) {
-    result = fh_eval(ctx, stmt);
+  while (fh_eval_cond(ctx, node->e1)) {
+    HOTSPOT_BACK_EDGE(node);
+    QUOTA_STEP();
+    if (JIT_LOOP(ctx, node, NULL)) break;
+    result = fh_eval(ctx, node->e2);
     if (result->signal == S_BREAK) break;
   }
 }
 
 static void
-for_stmt(js_val *ctx, ast_node *exp_grp, ast_node *stmt)
+for_stmt(js_val *ctx, ast_node *node)
 {
+  ast_node *exp_grp = node->e1, *stmt = node->e2;
   js_val *result;
 
   if (exp_grp->e1)
     fh_eval(ctx, exp_grp->e1);
 
-  while (TO_BOOL(exp_grp->e2 ? fh_eval(ctx, exp_grp->e2) : JSBOOL(1))->boolean.val) {
+  while (!exp_grp->e2 || fh_eval_cond(ctx, exp_grp->e2)) {
+    HOTSPOT_BACK_EDGE(node);
+    QUOTA_STEP();
+    if (JIT_LOOP(ctx, node, NULL)) break;
     result = fh_eval(ctx, stmt);
     if (result->signal == S_BREAK) break;
     if (exp_grp->e3)
@@ -642,32 +859,47 @@ for_stmt(js_val *ctx, ast_node *exp_grp, ast_node *stmt)
   }
 }
 
+/* The scope an assignment to `name` would set it on (as fh_set_rec). */
+static js_val *
+assign_scope(js_val *ctx, char *name)
+{
+  js_val *scope;
+  for (scope = ctx; scope; scope = scope->object.parent)
+    if (fh_get_prop(scope, name)) return scope;
+  return ctx;
+}
+
 static void
 forin_stmt(js_val *ctx, ast_node *node)
 {
-  js_val *result, *obj, *env, *name;
+  js_val *result, *obj, *env, *name, *keys, *key;
+  unsigned long i;
 
   obj = fh_eval(ctx, node->e2);
-  env = ctx;
 
   if (node->e1->type == NODE_MEMBER) {
     env = member_parent(ctx, node->e1);
     name = member_child(ctx, node->e1);
   }
-  else 
+  else {
     name = str_from_node(ctx, node->e1);
+    env = assign_scope(ctx, name->string.ptr);
+  }
 
-  js_prop *p;
-  while (obj != NULL) {
-    OBJ_ITER(obj, p) {
-      if (p->enumerable) {
-        // Assign to name, possibly undeclared assignment.
-        fh_set_rec(env, name->string.ptr, JSSTR(p->name));
-        result = fh_eval(ctx, node->e3);
-        if (result->signal == S_BREAK) break;
-      }
-    }
-    obj = obj->proto;
+  // The keys are taken before the first pass, and the loop variable is
+  // looked up (possibly undeclared) just the once. A key deleted by an
+  // earlier pass isn't visited.
+  char *atom = fh_intern(name->string.ptr);
+  keys = fh_enum_keys(obj);
+
+  for (i = 0; i < keys->object.length; i++) {
+    key = fh_get_elem(keys, i);
+    if (!fh_has_key(obj, key->string.ptr)) continue;
+    fh_set(env, atom, key);
+    HOTSPOT_BACK_EDGE(node);
+    QUOTA_STEP();
+    result = fh_eval(ctx, node->e3);
+    if (result->signal == S_BREAK) break;
   }
 }
 
@@ -679,17 +911,19 @@ forin_stmt(js_val *ctx, ast_node *node)
 static js_val *
 try_stmt(js_val *ctx, ast_node *node)
 {
-  eval_state *state = fh_new_state(node->line, node->column);
-  state->catch = true;
-  state->ctx = ctx;
-  fh_push_state(state);
+  // The catch frame lives here, so entering a try allocates nothing.
+  fh_catch c;
+  fh_catch_push(&c);
 
   // Try
-  if (!setjmp(state->jmp))
+  if (!setjmp(c.jmp)) {
     fh_eval(ctx, node->e1);
-  // Catch
+    fh_catch_pop(&c);
+  }
+  // Catch (the throw popped the frame on its way here)
   else {
-    fh_set(ctx, node->e2->e1->sval, fh_get(ctx, "FH_LAST_ERROR")); 
+    if (fh->quota_exceeded) fh_throw(fh->callstack, c.error);
+    fh_set(ctx, node->e2->e1->sval, c.error);
     fh_eval(ctx, node->e2->e2);
   }
 
@@ -703,9 +937,9 @@ try_stmt(js_val *ctx, ast_node *node)
 static js_val *
 throw_stmt(js_val *ctx, ast_node *exp)
 {
+  js_val *val = fh_eval(ctx, exp);
   eval_state *state = fh_new_state(exp->line, exp->column);
   fh_push_state(state);
-  js_val *val = fh_eval(ctx, exp);
   fh_throw(state, val);
   return JSUNDEF();
 }
@@ -715,65 +949,96 @@ throw_stmt(js_val *ctx, ast_node *exp)
 // Function Application
 // ----------------------------------------------------------------------------
 
+/* A leaf function's activation can't be reached once its call is over, so
+ * a few are kept to be reused, props and shape included, by later calls.
+ * Calls to such functions then leave no garbage behind. */
+static js_val *
+frame_take(ast_node *func_node)
+{
+  fh_node_data *data = fh_get_node_data(func_node);
+  js_val *scope = data->frames;
+  if (!scope) return JSOBJ();
+
+  data->frames = scope->object.parent;
+  data->num_frames--;
+  return scope;
+}
+
+/* Give back a leaf activation once the call has returned `res`. Its values
+ * are cleared, so it holds nothing alive. (A function handed in and
+ * returned takes the activation for its scope, which keeps it.) */
+static void
+frame_release(ast_node *func_node, js_val *scope, js_val *res)
+{
+  if (IS_FUNC(res) && res->object.scope == scope) return;
+
+  fh_node_data *data = fh_get_node_data(func_node);
+  if (data->num_frames >= FRAME_POOL_MAX) return;
+  if (!data->frames_listed) {
+    unsigned long n = fh->num_frame_pools;
+    if ((n & (n - 1)) == 0)
+      fh->frame_pools = realloc(fh->frame_pools, (n ? n * 2 : 1) * sizeof(unsigned));
+    fh->frame_pools[fh->num_frame_pools++] = func_node->slot;
+    data->frames_listed = true;
+  }
+
+  js_prop *p;
+  for (p = scope->map; p; p = p->hh.next) {
+    p->ptr = JSUNDEF();
+    p->circular = false;
+  }
+  GC_BARRIER(scope, data->frames);
+  scope->object.parent = data->frames;
+  data->frames = scope;
+  data->num_frames++;
+}
+
 static js_val *
 setup_call_env(js_val *ctx, js_val *this, js_val *func, js_args *args)
 {
-  js_val *arguments = JSOBJ();
   ast_node *func_node = func->object.node;
-  js_val *scope = func->object.scope ? func->object.scope : JSOBJ();
+  js_val *scope = func->object.scope;
+  unsigned long i, arglen = ARGLEN(args);
+
+  if (!scope) scope = func_node->leaf ? frame_take(func_node) : JSOBJ();
 
+  GC_BARRIER(scope, ctx);
   scope->object.parent = ctx;
 
   fh_set(scope, "this", this);
-  fh_set(scope, "arguments", arguments);
+
+  // Set up the (array-like) arguments object, if the body can see it.
+  if (func_node->uses_arguments) {
+    js_val *arguments = JSOBJ();
+    fh_set(scope, "arguments", arguments);
+    for (i = 0; i < arglen; i++)
+      fh_set_elem(arguments, i, ARG(args, i));
+    fh_set_class(arguments, "Arguments");
+    fh_set(arguments, "callee", func);
+    fh_set(arguments, "length", JSNUM(arglen));
+  }
 
   // Add the function name as ref to itself (if it has a name)
   // TODO: Take another look at this. Under what circumstances is the name
   // set in the function environemnt?
-  if (func_node->sval != NULL)
-    fh_set(scope, func_node->sval, func);
+  if (func_node->e3 != NULL)
+    fh_set(scope, func_node->e3->sval, func);
 
-  // Set up the (array-like) arguments object.
-  unsigned long i, arglen = ARGLEN(args);
-  for (i = 0; i < arglen; i++)
-    fh_set(arguments, JSNUMKEY(i)->string.ptr, ARG(args, i));
-  fh_set_class(arguments, "Arguments");
-  fh_set(arguments, "callee", func);
-  fh_set(arguments, "length", JSNUM(arglen));
-
-  // Set up params as locals (if any)
+  // Set up params as locals (if any), matched by position with the args.
   if (func_node->e1 != NULL) {
     ast_node *params = func_node->e1;
-    node_rewind(params);
-    // Go through each param and match it by position with an arg.
-    while (!params->visited) {
-      if (args->arg) {
-        fh_set(scope, node_pop(params)->sval, args->arg);
-        if (args->next)
-          args = args->next;
-        else
-          args->arg = NULL;
-      }
-      else {
-        fh_set(scope, node_pop(params)->sval, JSUNDEF());
-      }
-    }
+    for (i = 0; i < (unsigned long)params->num_items; i++)
+      fh_set(scope, params->items[i]->sval, ARG(args, i));
   }
   return scope;
 }
 
-static js_args *
-build_args(js_val *ctx, ast_node *args_node)
+static void
+build_args(js_val *ctx, ast_node *args_node, js_args *args)
 {
-  js_args *args = args_new();
-
-  if (args_node->e1 == NULL) return args;
-  if (!args_node->visited) {
-    args->arg = fh_eval(ctx, node_pop(args_node));
-    args->next = args_node->visited ? NULL : build_args(ctx, args_node);
-  }
-  node_rewind(args_node);
-  return args;
+  int i;
+  for (i = 0; i < args_node->num_items; i++)
+    args_append(args, fh_eval(ctx, args_node->items[i]));
 }
 
 static js_val *
@@ -786,55 +1051,115 @@ call(js_val *ctx, js_val *this, js_val *func, eval_state *state, js_args *args)
   state->this = this;
 
   if (func->object.native) {
-    // Native functions are C functions referenced by pointer.
+    // Native functions are C functions referenced by pointer, and are given
+    // the receiver as their instance.
     js_native_function *native = func->object.nativefn;
-    js_val *instance = func->object.instance;
+    js_val *instance = this;
     state->caller_info = "(built-in function)";
 
     // new Number, new Boolean, etc. return wrapper objects. 
     // Here we resolve the wrapper to the value it wraps.
-    if (instance && IS_OBJ(instance) && instance->object.primitive)
+    if (IS_OBJ(instance) && instance->object.primitive)
       instance = instance->object.primitive;
+    fh_str_flatten(instance);
 
     return native(instance, args, state);
   }
 
-  node_rewind(func->object.node);
-
   if (func->object.node->e3 && func->object.node->e3->sval)
     state->caller_info = func->object.node->e3->sval;
   else
     state->caller_info = "(anonymous function)";
+  state->callee = func->object.node;
+  HOTSPOT_CALL(state);
+  QUOTA_STEP();
 
+  // Parse the body first, if that was put off, to know what it uses.
+  ast_node *body = fh_func_body(func->object.node);
+  bool pooled = func->object.node->leaf && !func->object.scope;
   js_val *func_scope = setup_call_env(ctx, this, func, args);
+  js_val *res;
   state->scope = func_scope;
-  return fh_eval(func_scope, func->object.node->e2);
+
+  if (fh->opt_engine == ENGINE_VM)
+    res = fh_vm_call(func_scope, func->object.node);
+  else {
+    // The return signal stops the body; it mustn't stop the caller too. A
+    // body that ends without one returns undefined, not its last
+    // statement's value.
+    res = fh_eval(func_scope, body);
+    if (res->signal != S_BREAK)
+      res = JSUNDEF();
+    else
+      res->signal = S_NONE;
+  }
+
+  if (pooled) frame_release(func->object.node, func_scope, res);
+  return res;
 }
 
+/* Evaluate the function called by `node`. Methods, as in `x.f()` or
+ * `g().f()`, leave their object in `*recv`. */
 static js_val *
-call_exp(js_val *ctx, ast_node *node)
+callee(js_val *ctx, ast_node *node, js_val **recv)
 {
-  js_val *maybe_func = fh_eval(ctx, node->e1);
+  ast_node *exp = node->e1;
 
+  if (exp->type == NODE_MEMBER) {
+    *recv = member_parent(ctx, exp);
+    return member_get(ctx, exp, *recv);
+  }
+  if (exp->type == NODE_CALL && exp->e2->type != NODE_ARG_LST) {
+    *recv = fh_eval(ctx, exp->e1);
+    return fh_get_proto(*recv, str_from_node(ctx, exp->e2)->string.ptr);
+  }
+  return fh_eval(ctx, exp);
+}
+
+static js_val *
+call_exp(js_val *ctx, ast_node *node)
+{
   // Special treatment for:
   //   CallExpression [ Expression ] 
   //   CallExpression . Identifier
-  if (node->e2->type != NODE_ARG_LST)
-    return fh_get_proto(maybe_func, str_from_node(ctx, node->e2)->string.ptr);
+  if (node->e2->type != NODE_ARG_LST) {
+    js_val *parent = fh_eval(ctx, node->e1);
+    return fh_get_proto(parent, str_from_node(ctx, node->e2)->string.ptr);
+  }
+
+  js_val *recv = NULL;
+  js_val *maybe_func = callee(ctx, node, &recv);
+
+  if (!IS_FUNC(maybe_func))
+    return fh_invoke(ctx, recv, maybe_func, NULL, node);
 
+  js_args args;
+  args_init(&args);
+  build_args(ctx, node->e2, &args);
+  js_val *res = fh_invoke(ctx, recv, maybe_func, &args, node);
+  args_release(&args);
+  return res;
+}
+
+/* Call a function from the call site `node`, which provides the position for
+ * the new stack frame. Shared by both engines. A method call passes its
+ * object as `recv`; other calls pass NULL, and run with the caller's this. */
+js_val *
+fh_invoke(js_val *ctx, js_val *recv, js_val *func, js_args *args, ast_node *node)
+{
   eval_state *state = fh_new_state(node->line, node->column);
 
   state->ctx = ctx;
-  if (!IS_FUNC(maybe_func))
-    fh_throw(state, fh_new_error(E_TYPE, "%s is not a function", fh_typeof(maybe_func)));
-  js_args *args = build_args(ctx, node->e2);
+  state->args = args;
+  if (!IS_FUNC(func))
+    fh_throw(state, fh_new_error(E_TYPE, "%s is not a function", fh_typeof(func)));
 
   // Check for a bound this (see Function#bind)
-  js_val *this = maybe_func->object.bound_this ? 
-    maybe_func->object.bound_this : fh_get(ctx, "this");
+  js_val *this = func->object.bound_this ? func->object.bound_this :
+    recv ? recv : fh_get(ctx, "this");
 
   fh_push_state(state);
-  js_val *res = call(ctx, this, maybe_func, state, args);
+  js_val *res = call(ctx, this, func, state, args);
   fh_pop_state();
   return res;
 }
@@ -845,6 +1170,7 @@ fh_call(js_val *ctx, js_val *this, js_val *func, js_args *args)
   int line = func->object.native ? 0 : func->object.node->line;
   int column = func->object.native ? 0 : func->object.node->column;
   eval_state *state = fh_new_state(line, column);
+  state->args = args;
 
   fh_push_state(state);
   js_val *res = call(ctx, this, func, state, args);
@@ -862,21 +1188,22 @@ static js_val *
 new_exp(js_val *ctx, ast_node *exp)
 {
   js_val *ctr;
-  js_args *args;
+  js_args args;
+  args_init(&args);
 
   // new F(x, y, z)
   if (exp->e1 && exp->e1->type == NODE_MEMBER) {
     ctr = fh_eval(ctx, exp->e1->e2);
-    args = build_args(ctx, exp->e1->e1);
+    build_args(ctx, exp->e1->e1, &args);
   }
   // new F
   else {
     ctr = fh_eval(ctx, exp->e1);
-    args = args_new();
   }
 
   eval_state *state = fh_new_state(exp->line, exp->column);
   state->construct = true;
+  state->args = &args;
 
   if (!IS_FUNC(ctr))
     fh_throw(state, fh_new_error(E_TYPE, "%s is not a function", fh_typeof(ctr)));
@@ -884,14 +1211,17 @@ new_exp(js_val *ctx, ast_node *exp)
   js_val *res, *obj = JSOBJ(), *proto = fh_get(ctr, "prototype");
 
   fh_push_state(state);
-  res = call(ctx, obj, ctr, state, args); 
+  res = call(ctx, obj, ctr, state, &args); 
   fh_pop_state();
+  args_release(&args);
   res = IS_OBJ(res) ? res : obj;
 
   // Automatically set the prototype to use the constructor's "prototype"
   // property if valid and the result's proto member appears to be unmodified.
-  if (IS_OBJ(proto) && res->proto == fh->object_proto)
+  if (IS_OBJ(proto) && res->proto == fh->object_proto) {
+    GC_BARRIER(res, proto);
     res->proto = IS_OBJ(proto) ? proto : fh->object_proto;
+  }
 
   return res;
 }
@@ -905,12 +1235,11 @@ static js_val *
 postfix_exp(js_val *ctx, ast_node *node)
 {
   js_val *old_val = TO_NUM(fh_eval(ctx, node->e1));
-  char *op = node->sval;
-  if (STREQ(op, "++")) {
+  if (node->op == OP_INC) {
     put(ctx, node->e1, add_op(old_val, JSNUM(1)));
     return old_val;
   }
-  if (STREQ(op, "--")) {
+  if (node->op == OP_DEC) {
     put(ctx, node->e1, sub_op(old_val, JSNUM(1)));
     return old_val;
   }
@@ -920,54 +1249,57 @@ postfix_exp(js_val *ctx, ast_node *node)
 static js_val *
 prefix_exp(js_val *ctx, ast_node *node)
 {
-  char *op = node->sval;
-
-  if (STREQ(op, "delete"))
-    return delete_op(ctx, node);
-  if (STREQ(op, "typeof")) {
-    if (node->e1->type == NODE_IDENT)
-      return JSSTR(fh_typeof(fh_get_rec(ctx, node->e1->sval)));
-    return JSSTR(fh_typeof(fh_eval(ctx, node->e1)));
-  }
-  if (STREQ(op, "void")) {
-    fh_eval(ctx, node->e1);
-    return JSUNDEF();
-  }
-  if (STREQ(op, "+"))
-    return TO_NUM(fh_eval(ctx, node->e1));
-  if (STREQ(op, "!"))
-    return JSBOOL(!TO_BOOL(fh_eval(ctx, node->e1))->boolean.val);
-  if (STREQ(op, "-")) {
-    js_val *x = TO_NUM(fh_eval(ctx, node->e1));
-    if (x->number.is_inf) return JSNINF();
-    if (x->number.is_nan) return JSNAN();
-    return JSNUM(-1 * x->number.val);
-  }
+  js_val *old_val, *new_val;
+
+  switch (node->op) {
+    case OP_DELETE:
+      return delete_op(ctx, node);
+    case OP_TYPEOF:
+      if (node->e1->type == NODE_IDENT)
+        return JSSTR(fh_typeof(fh_get_rec(ctx, node->e1->sval)));
+      return JSSTR(fh_typeof(fh_eval(ctx, node->e1)));
+    case OP_VOID:
+      fh_eval(ctx, node->e1);
+      return JSUNDEF();
 
-  js_val *old_val = TO_NUM(fh_eval(ctx, node->e1));
-  js_val *new_val;
+    // Increment and decrement.
+    // TODO: these need to throw a syntax error for strict references
+    case OP_INC:
+    case OP_DEC:
+      old_val = TO_NUM(fh_eval(ctx, node->e1));
+      new_val = node->op == OP_INC ?
+        add_op(old_val, JSNUM(1)) : sub_op(old_val, JSNUM(1));
+      put(ctx, node->e1, new_val);
+      return new_val;
 
-  // Increment and decrement.
-  // TODO: these need to throw a syntax error for strict references
-  if (STREQ(op, "++")) {
-    new_val = add_op(old_val, JSNUM(1));
-    put(ctx, node->e1, new_val);
-    return new_val;
-  }
-  if (STREQ(op, "--")) {
-    new_val = sub_op(old_val, JSNUM(1));
-    put(ctx, node->e1, new_val);
-    return new_val;
+    default:
+      return fh_unary_op(node->op, fh_eval(ctx, node->e1));
   }
+}
 
-  // Bitwise NOT
-  if (STREQ(op, "~")) {
-    old_val = fh_to_int32(old_val);
-    int old_val_int32 = (int)old_val->number.val;
-    return JSNUM(~old_val_int32);
+/* Apply one of the side-effect free prefix operators (+ - ! ~) to an already
+ * evaluated operand. */
+js_val *
+fh_unary_op(enum ast_op op, js_val *x)
+{
+  int x_int32;
+
+  switch (op) {
+    case OP_PLUS:
+      return TO_NUM(x);
+    case OP_NOT:
+      return JSBOOL(!fh_truthy(x));
+    case OP_MINUS:
+      x = TO_NUM(x);
+      if (x->number.is_inf) return x->number.is_neg ? JSINF() : JSNINF();
+      if (x->number.is_nan) return JSNAN();
+      return JSNUM(-1 * x->number.val);
+    case OP_BIT_NOT:
+      x_int32 = (int)fh_to_int32(TO_NUM(x))->number.val;
+      return JSNUM(~x_int32);
+    default:
+      UNREACHABLE();
   }
-
-  UNREACHABLE();
 }
 
 
@@ -978,65 +1310,119 @@ prefix_exp(js_val *ctx, ast_node *node)
 static js_val *
 bin_exp(js_val *ctx, ast_node *node)
 {
-  char *op = node->sval;
-
   // Logical (must short-circuit)
-  if (STREQ(op, "&&")) return and_exp(ctx, node->e1, node->e2);
-  if (STREQ(op, "||")) return or_exp(ctx, node->e1, node->e2);
+  if (node->op == OP_AND) return and_exp(ctx, node->e1, node->e2);
+  if (node->op == OP_OR) return or_exp(ctx, node->e1, node->e2);
 
   // At this point, we can safely evaluate both expressions.
   js_val *a = fh_eval(ctx, node->e1);
   js_val *b = fh_eval(ctx, node->e2);
 
-  // Arithmetic and string operations
-  if (STREQ(op, "+")) return add_op(a, b);
-  if (STREQ(op, "-")) return sub_op(a, b);
-  if (STREQ(op, "*")) return mul_op(a, b); 
-  if (STREQ(op, "/")) return div_op(a, b);
-  if (STREQ(op, "%")) return mod_op(a, b);
-
-  // (In)equality
-  if (STREQ(op, "=="))  return eq_op(a, b, false);
-  if (STREQ(op, "!="))  return neq_op(a, b, false);
-  if (STREQ(op, "===")) return eq_op(a, b, true);
-  if (STREQ(op, "!==")) return neq_op(a, b, true);
-
-  // Relational 
-  if (STREQ(op, "<"))  return lt_op(a, b, false);
-  if (STREQ(op, ">"))  return gt_op(a, b, false);
-  if (STREQ(op, "<=")) return lt_op(a, b, true);
-  if (STREQ(op, ">=")) return gt_op(a, b, true);
-  if (STREQ(op, "instanceof")) {
-    if (!IS_FUNC(b)) {
-      char *fmt = "Expecting a function in 'instanceof' check, got %s";
-      fh_throw(NULL, fh_new_error(E_TYPE, fmt, fh_typeof(b)));
-    }
-    return fh_has_instance(b, a);
+  return fh_bin_op(node->op, a, b);
+}
+
+#define PLAIN_NUMS(a, b) \
+  (T_BOTH(a, b, T_NUMBER) && !(a)->number.is_nan && !(b)->number.is_nan && \
+   !(a)->number.is_inf && !(b)->number.is_inf)
+
+/* Compare two finite numbers. Returns -1 when the operator isn't a
+ * comparison. */
+static int
+num_cmp(enum ast_op op, double a, double b)
+{
+  switch (op) {
+    case OP_EQ:
+    case OP_STRICT_EQ:  return a == b;
+    case OP_NEQ:
+    case OP_STRICT_NEQ: return a != b;
+    case OP_LT:         return a < b;
+    case OP_GT:         return a > b;
+    case OP_LTE:        return a <= b;
+    case OP_GTE:        return a >= b;
+    default:            return -1;
   }
-  if (STREQ(op, "in")) {
-    if (!IS_OBJ(b)) {
-      char *fmt = "Expecting an object with 'in' operator, got %s";
-      fh_throw(NULL, fh_new_error(E_TYPE, fmt, fh_typeof(b)));
-    }
-    return fh_has_property(b, TO_STR(a)->string.ptr);
+}
+
+/* Apply an operator to two finite numbers, skipping the conversions. Returns
+ * NULL when the operator has no fast path. */
+static js_val *
+num_op(enum ast_op op, double a, double b)
+{
+  switch (op) {
+    case OP_ADD:        return JSNUM(a + b);
+    case OP_SUB:        return JSNUM(a - b);
+    case OP_MUL:        return JSNUM(a * b);
+    case OP_DIV:        return JSNUM(a / b);
+    case OP_MOD:        return JSNUM(fmod(a, b));
+    default:            break;
   }
+  int cmp = num_cmp(op, a, b);
+  return cmp < 0 ? NULL : JSBOOL(cmp);
+}
 
-  int a_int32 = fh_to_int32(a)->number.val;
-  int b_int32 = fh_to_int32(b)->number.val;
+/* Apply a (non-logical) binary operator to two evaluated operands. */
+js_val *
+fh_bin_op(enum ast_op op, js_val *a, js_val *b)
+{
+  // Fast path for arithmetic and comparison on plain numbers
+  if (PLAIN_NUMS(a, b)) {
+    js_val *res = num_op(op, a->number.val, b->number.val);
+    if (res) return res;
+  }
+
+  int a_int32, b_int32;
+  unsigned a_uint32, shift_cnt;
+
+  switch (op) {
+    // Arithmetic and string operations
+    case OP_ADD: return add_op(a, b);
+    case OP_SUB: return sub_op(a, b);
+    case OP_MUL: return mul_op(a, b); 
+    case OP_DIV: return div_op(a, b);
+    case OP_MOD: return mod_op(a, b);
+
+    // (In)equality
+    case OP_EQ:         return eq_op(a, b, false);
+    case OP_NEQ:        return neq_op(a, b, false);
+    case OP_STRICT_EQ:  return eq_op(a, b, true);
+    case OP_STRICT_NEQ: return neq_op(a, b, true);
+
+    // Relational 
+    case OP_LT:  return lt_op(a, b, false);
+    case OP_GT:  return gt_op(a, b, false);
+    case OP_LTE: return lt_op(a, b, true);
+    case OP_GTE: return gt_op(a, b, true);
+    case OP_INSTANCEOF:
+      if (!IS_FUNC(b)) {
+        char *fmt = "Expecting a function in 'instanceof' check, got %s";
+        fh_throw(NULL, fh_new_error(E_TYPE, fmt, fh_typeof(b)));
+      }
+      return fh_has_instance(b, a);
+    case OP_IN:
+      if (!IS_OBJ(b)) {
+        char *fmt = "Expecting an object with 'in' operator, got %s";
+        fh_throw(NULL, fh_new_error(E_TYPE, fmt, fh_typeof(b)));
+      }
+      return fh_has_property(b, TO_STR(a)->string.ptr);
+    default:
+      break;
+  }
+
+  a_int32 = fh_to_int32(a)->number.val;
+  b_int32 = fh_to_int32(b)->number.val;
 
   // Bitwise Logical
-  if (STREQ(op, "&")) return JSNUM(a_int32 & b_int32);
-  if (STREQ(op, "^")) return JSNUM(a_int32 ^ b_int32);
-  if (STREQ(op, "|")) return JSNUM(a_int32 | b_int32);
+  if (op == OP_BIT_AND) return JSNUM(a_int32 & b_int32);
+  if (op == OP_BIT_XOR) return JSNUM(a_int32 ^ b_int32);
+  if (op == OP_BIT_OR)  return JSNUM(a_int32 | b_int32);
 
-  unsigned a_uint32 = fh_to_uint32(a)->number.val;
-  unsigned b_uint32 = fh_to_uint32(b)->number.val;
-  unsigned shift_cnt = b_uint32 & 0x1F;
+  a_uint32 = fh_to_uint32(a)->number.val;
+  shift_cnt = (unsigned)fh_to_uint32(b)->number.val & 0x1F;
 
   // Bitwise Shift
-  if (STREQ(op, "<<")) return JSNUM(a_int32 << shift_cnt);
-  if (STREQ(op, ">>")) return JSNUM(a_int32 >> shift_cnt);
-  if (STREQ(op, ">>>")) return JSNUM(a_uint32 >> shift_cnt);
+  if (op == OP_LSHIFT)  return JSNUM(a_int32 << shift_cnt);
+  if (op == OP_RSHIFT)  return JSNUM(a_int32 >> shift_cnt);
+  if (op == OP_URSHIFT) return JSNUM(a_uint32 >> shift_cnt);
 
   UNREACHABLE();
 }
@@ -1059,22 +1445,85 @@ base_exp(js_val *ctx, ast_node *node)
   }
 }
 
+/* Evaluate a condition to a C bool. Comparisons, `!`, `&&` and `||` are
+ * decided here, without materializing a value that only feeds control
+ * flow. */
+bool
+fh_eval_cond(js_val *ctx, ast_node *node)
+{
+  if (node->type != NODE_EXP || node->sub_type == NODE_UNARY_POST)
+    return fh_truthy(fh_eval(ctx, node));
+
+  HEAP_PROFILE_AT(node);
+  HOTSPOT_ENTER(node);
+  if (node->sub_type == NODE_UNARY_PRE) {
+    if (node->op == OP_NOT) return !fh_eval_cond(ctx, node->e1);
+    return fh_truthy(prefix_exp(ctx, node));
+  }
+  if (node->op == OP_AND)
+    return fh_eval_cond(ctx, node->e1) && fh_eval_cond(ctx, node->e2);
+  if (node->op == OP_OR)
+    return fh_eval_cond(ctx, node->e1) || fh_eval_cond(ctx, node->e2);
+
+  js_val *a = fh_eval(ctx, node->e1);
+  js_val *b = fh_eval(ctx, node->e2);
+  if (PLAIN_NUMS(a, b)) {
+    int cmp = num_cmp(node->op, a->number.val, b->number.val);
+    if (cmp >= 0) return cmp;
+  }
+  return fh_truthy(fh_bin_op(node->op, a, b));
+}
+
 
 // ----------------------------------------------------------------------------
 // Evaluation
 // ----------------------------------------------------------------------------
 
+/* The value of a literal node, materialized once into the constant pool.
+ * Shared by both engines. */
+js_val *
+fh_literal(ast_node *node)
+{
+  fh_node_data *data = fh_get_node_data(node);
+  if (data->constant) return data->constant;
+
+  js_val *val;
+  switch (node->type) {
+    case NODE_BOOL:  val = JSBOOL(node->val); break;
+    case NODE_STR:
+    case NODE_IDENT: val = JSSTR(node->sval); break;   // e.g. the key in `x.y`
+    case NODE_NUM:   val = JSNUM(node->val); break;
+    case NODE_NULL:  val = JSNULL(); break;
+    default: UNREACHABLE(); return NULL;
+  }
+
+  data->constant = fh_add_literal(node, val);
+  return val;
+}
+
+/* Run a program (or eval code) with the engine selected by `--engine`. */
+js_val *
+fh_run(js_val *ctx, ast_node *node)
+{
+  fh_gc_stack_from(&ctx);
+  if (fh->opt_engine == ENGINE_VM)
+    return fh_vm_eval(ctx, node);
+  return fh_eval(ctx, node);
+}
+
 js_val * 
 fh_eval(js_val *ctx, ast_node *node)
 {
   if (!node) return JSUNDEF();
+  HEAP_PROFILE_AT(node);
+  HOTSPOT_ENTER(node);
 
   switch (node->type) {
-    case NODE_BOOL:        return JSBOOL(node->val);
-    case NODE_STR:         return JSSTR(node->sval);
+    case NODE_BOOL:
+    case NODE_STR:
+    case NODE_NUM:
+    case NODE_NULL:        return fh_literal(node);
     case NODE_REGEXP:      return JSRE(node->sval);
-    case NODE_NUM:         return JSNUM(node->val);
-    case NODE_NULL:        return JSNULL();
     case NODE_FUNC:        return JSFUNC(node);
 
     case NODE_OBJ:         return obj_lit(ctx, node);
@@ -1089,7 +1538,7 @@ fh_eval(js_val *ctx, ast_node *node)
     case NODE_SWITCH_STMT: return switch_stmt(ctx, node);
     case NODE_ASGN:        return assign_exp(ctx, node);
     case NODE_RETURN:      return return_stmt(ctx, node);
-    case NODE_VAR_DEC:     return var_dec(ctx, node, false);
+    case NODE_VAR_DEC:     return var_dec(ctx, node);
     case NODE_BREAK:       return break_stmt();
     case NODE_TRY_STMT:    return try_stmt(ctx, node);
     case NODE_THROW:       return throw_stmt(ctx, node->e1);
@@ -1102,8 +1551,8 @@ fh_eval(js_val *ctx, ast_node *node)
     case NODE_PROP_LST:    return eval_each(ctx, node);
 
     case NODE_PROP:        fh_set(ctx, node->e1->sval, fh_eval(ctx, node->e2)); break;
-    case NODE_WHILE:       while_stmt(ctx, node->e1, node->e2); break;
-    case NODE_FOR:         for_stmt(ctx, node->e1, node->e2); break;
+    case NODE_WHILE:       while_stmt(ctx, node); break;
+    case NODE_FOR:         for_stmt(ctx, node); break;
     case NODE_FORIN:       forin_stmt(ctx, node); break;
     case NODE_EMPT_STMT:   break;
 
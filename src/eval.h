@@ -28,7 +28,18 @@
                            ((a)->type == (t2) && (b)->type == (t1)))
 
 js_val * fh_eval(js_val *, ast_node *);
+bool fh_eval_cond(js_val *, ast_node *);
+js_val * fh_run(js_val *, ast_node *);
+js_val * fh_literal(ast_node *);
+bool fh_switch_table(ast_node *);
+int fh_switch_lookup(ast_node *, js_val *);
+void fh_free_switch_cases(fh_switch_cases *);
 js_val * fh_call(js_val *, js_val *, js_val *, js_args *);
+js_val * fh_invoke(js_val *, js_val *, js_val *, js_args *, ast_node *);
 js_val * fh_eq(js_val *, js_val *, bool);
+js_val * fh_bin_op(enum ast_op, js_val *, js_val *);
+js_val * fh_unary_op(enum ast_op, js_val *);
+void fh_assign_member(js_val *, char *, js_val *, enum ast_op);
+void fh_assign_elem(js_val *, unsigned long, js_val *, enum ast_op);
 
 #endif
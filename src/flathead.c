@@ -17,40 +17,147 @@
  */
 
 #include <math.h>
+#include <unistd.h>
 
 #include "flathead.h"
 #include "props.h"
 #include "debug.h"
 #include "str.h"
+#include "numconv.h"
 #include "gc.h"
 #include "eval.h"
 #include "args.h"
+#include "heapprof.h"
+#include "hotspots.h"
+#include "jit.h"
+#include "quota.h"
+#include "cpuprof.h"
+#include "output.h"
+#include "timers.h"
+#include "loop.h"
+#include "vm.h"
+#include "runtime/runtime.h"
 
 
 // ----------------------------------------------------------------------------
 // Value Constructors
 // ----------------------------------------------------------------------------
 
-js_val *
-fh_new_val(js_type type)
+static void
+init_val(js_val *val, js_type type)
 {
-  js_val *val = fh_malloc(true);
-
   val->map = NULL;
+  val->shape = fh_root_shape();
+  val->slots = NULL;
+  val->slots_cap = 0;
+  val->elements = NULL;
+  val->elements_cap = 0;
+  val->dense = false;
+  val->typed = NULL;
+  val->string.ptr = NULL;
+  val->string.left = val->string.right = NULL;
+  val->string.depth = 0;
   val->type = type;
   val->signal = S_NONE;
   val->proto = NULL;
-  val->marked = false;
   val->flagged = false;
+  val->shared = false;
+}
+
+js_val *
+fh_new_val(js_type type)
+{
+  js_val *val = fh_malloc(true);
+  if (fh->heap_profiling) fh_heap_profile_alloc();
+  init_val(val, type);
+  return val;
+}
+
+static js_val *
+shared_val(js_type type, js_val *proto)
+{
+  js_val *val = calloc(1, sizeof(js_val));
+  init_val(val, type);
+  val->proto = proto;
+  val->shared = true;
+  return val;
+}
 
+static js_val *
+shared_number(double x, bool is_nan, bool is_inf, bool is_neg, js_val *proto)
+{
+  js_val *val = shared_val(T_NUMBER, proto);
+  val->number.val = x;
+  val->number.is_nan = is_nan;
+  val->number.is_inf = is_inf;
+  val->number.is_neg = is_neg;
   return val;
 }
 
+/* Copy a value into a new, unshared cell. */
 js_val *
-fh_new_number(double x, bool is_nan, bool is_inf, bool is_neg)
+fh_unshare(js_val *val)
+{
+  if (!val->shared) return val;
+
+  if (IS_STR(val)) {
+    js_val *flat = fh_str_flatten(val);
+    return JSSTRN(flat->string.ptr, flat->string.length);
+  }
+
+  js_val *copy = fh_new_val(val->type);
+  copy->number = val->number;
+  copy->boolean = val->boolean;
+  copy->proto = val->proto;
+  return copy;
+}
+
+/* Small integers, NaN and the infinities are immutable cells shared by every
+ * use, so arithmetic on them doesn't allocate. The integer cells are built a
+ * block at a time, once Number.prototype exists. Returns NULL for any other
+ * number. */
+static js_val *
+cached_number(double x, bool is_nan, bool is_inf, bool is_neg)
 {
-  js_val *val = fh_new_val(T_NUMBER);
+  js_val **cell;
+  long i = 0;
+
+  if (is_nan)
+    cell = &fh->num_special[0];
+  else if (is_inf)
+    cell = &fh->num_special[is_neg ? 2 : 1];
+  else {
+    if (x < NUM_CACHE_MIN || x >= NUM_CACHE_MAX || x != (long)x) return NULL;
+    if (x == 0 && signbit(x)) return NULL;
+    i = (long)x - NUM_CACHE_MIN;
+    cell = &fh->num_cache[i / NUM_CACHE_BLOCK];
+  }
 
+  if (*cell == NULL) {
+    js_val *proto = fh->number_proto;
+    if (!proto) return NULL;
+
+    if (is_nan || is_inf)
+      *cell = shared_number(is_nan ? NAN : x, is_nan, is_inf, is_neg, proto);
+    else {
+      long j, start = i - i % NUM_CACHE_BLOCK;
+      *cell = calloc(NUM_CACHE_BLOCK, sizeof(js_val));
+      for (j = 0; j < NUM_CACHE_BLOCK; j++) {
+        js_val *val = &(*cell)[j];
+        init_val(val, T_NUMBER);
+        val->number.val = start + j + NUM_CACHE_MIN;
+        val->proto = proto;
+        val->shared = true;
+      }
+    }
+  }
+
+  return is_nan || is_inf ? *cell : &(*cell)[i % NUM_CACHE_BLOCK];
+}
+
+js_val *
+fh_new_number(double x, bool is_nan, bool is_inf, bool is_neg)
+{
   if (isnan(x)) 
     is_nan = true;
   if (isinf(x)) {
@@ -58,11 +165,16 @@ fh_new_number(double x, bool is_nan, bool is_inf, bool is_neg)
     is_neg = x < 0;
   }
 
+  js_val *val = cached_number(x, is_nan, is_inf, is_neg);
+  if (val) return val;
+
+  val = fh_new_val(T_NUMBER);
+
   val->number.val = x;
   val->number.is_nan = is_nan;
   val->number.is_inf = is_inf;
   val->number.is_neg = is_neg;
-  val->proto = fh_try_get_proto("Number");
+  val->proto = fh->number_proto;
 
   return val;
 }
@@ -70,25 +182,146 @@ fh_new_number(double x, bool is_nan, bool is_inf, bool is_neg)
 js_val *
 fh_new_string(char *x)
 {
+  return fh_new_string_len(x, strlen(x));
+}
+
+/* Make a string of the `len` bytes at `x`, which needn't be NUL-terminated
+ * (or free of NULs). */
+js_val *
+fh_new_string_len(const char *x, size_t len)
+{
+  js_val *val = fh_new_val(T_STRING);
+
+  val->string.ptr = malloc(len + 1);
+  memcpy(val->string.ptr, x, len);
+  val->string.ptr[len] = '\0';
+  fh_set_len(val, len);
+  val->proto = fh->string_proto;
+
+  return val;
+}
+
+/* Concatenate two strings. Long results are left as ropes, so a string that
+ * is grown piece by piece isn't copied in full at every step. */
+js_val *
+fh_concat(js_val *a, js_val *b)
+{
+  unsigned long len = a->string.length + b->string.length;
+  unsigned depth = a->string.depth > b->string.depth ?
+    a->string.depth : b->string.depth;
+
   js_val *val = fh_new_val(T_STRING);
+  if (len < ROPE_MIN_LENGTH || depth >= ROPE_MAX_DEPTH) {
+    fh_str_flatten(a);
+    fh_str_flatten(b);
+    val->string.ptr = malloc(len + 1);
+    memcpy(val->string.ptr, a->string.ptr, a->string.length);
+    memcpy(val->string.ptr + a->string.length, b->string.ptr, b->string.length);
+    val->string.ptr[len] = '\0';
+  }
+  else {
+    val->string.left = a;
+    val->string.right = b;
+    val->string.depth = depth + 1;
+  }
+  fh_set_len(val, len);
+  val->proto = fh->string_proto;
+
+  return val;
+}
+
+static void
+rope_copy(js_val *val, char *dst)
+{
+  while (!val->string.ptr) {
+    rope_copy(val->string.left, dst);
+    dst += val->string.left->string.length;
+    val = val->string.right;
+  }
+  memcpy(dst, val->string.ptr, val->string.length);
+}
+
+/* Copy the contents of a rope into a flat buffer. Anything that reads
+ * `string.ptr` of a value that didn't come through TO_STR must call this. */
+js_val *
+fh_str_flatten(js_val *val)
+{
+  if (!IS_STR(val) || val->string.ptr) return val;
 
-  val->string.ptr = malloc((strlen(x) + 1) * sizeof(char));
-  val->string.ptr[strlen(x)] = '\0';
-  strcpy(val->string.ptr, x);
-  fh_set_len(val, strlen(x));
-  val->proto = fh_try_get_proto("String");
+  char *buf = malloc(val->string.length + 1);
+  rope_copy(val, buf);
+  buf[val->string.length] = '\0';
 
+  val->string.ptr = buf;
+  val->string.left = val->string.right = NULL;
+  val->string.depth = 0;
   return val;
 }
 
 js_val *
 fh_new_boolean(bool x)
 {
+  // Share a cell for each value once Boolean.prototype exists.
+  js_val **cell = &fh->bools[x ? 1 : 0];
+  if (*cell) return *cell;
+
+  js_val *proto = fh->boolean_proto;
+  if (proto) {
+    *cell = shared_val(T_BOOLEAN, proto);
+    (*cell)->boolean.val = x;
+    return *cell;
+  }
+
   js_val *val = fh_new_val(T_BOOLEAN);
 
   val->boolean.val = x;
-  val->proto = fh_try_get_proto("Boolean");
+  val->proto = proto;
+
+  return val;
+}
+
+js_val *
+fh_undef()
+{
+  if (!fh->undef) fh->undef = shared_val(T_UNDEF, NULL);
+  return fh->undef;
+}
+
+js_val *
+fh_null()
+{
+  if (!fh->null) fh->null = shared_val(T_NULL, NULL);
+  return fh->null;
+}
+
+/* Keep a value alive for the life of the program and make it immutable.
+ * Literals are materialized into this pool once per AST node. */
+js_val *
+fh_add_constant(js_val *val)
+{
+  if (val->shared) return val;
+
+  if (fh->num_constants == fh->constants_cap) {
+    fh->constants_cap = fh->constants_cap ? fh->constants_cap * 2 : 64;
+    fh->constants = realloc(fh->constants, fh->constants_cap * sizeof(js_val *));
+    fh->constant_slots = realloc(fh->constant_slots,
+        fh->constants_cap * sizeof(unsigned));
+  }
+  fh->constant_slots[fh->num_constants] = 0;
+  fh->constants[fh->num_constants++] = val;
+  val->shared = true;
+  return val;
+}
 
+/* Add the value of the literal `node` to the pool, noting where it is, so
+ * fh_forget_node can take it out again. */
+js_val *
+fh_add_literal(ast_node *node, js_val *val)
+{
+  if (val->shared) return val;
+  fh_add_constant(val);
+  fh->constant_slots[fh->num_constants - 1] = node->slot;
+  fh_get_node_data(node)->constant_at = fh->num_constants;
   return val;
 }
 
@@ -105,7 +338,6 @@ fh_new_object()
   val->object.bound_this = NULL;
   val->object.bound_args = NULL;
   val->object.scope = NULL;
-  val->object.instance = NULL;
   val->object.node = NULL;
   val->proto = fh->object_proto;
 
@@ -118,6 +350,7 @@ fh_new_array()
   js_val *val = fh_new_object();
 
   fh_set_class(val, "Array");
+  val->dense = true;
   fh_set_len(val, 0);
   val->proto = fh->array_proto;
 
@@ -141,7 +374,7 @@ fh_new_function(struct ast_node *node)
   val->object.generator = false;
   val->object.node = node;
   val->object.scope = NULL;
-  val->object.instance = NULL;
+  if (node) fh_get_node_data(node)->func_marked = true;
   val->object.bound_this = NULL;
   val->object.bound_args = NULL;
   val->proto = fh->function_proto;
@@ -152,13 +385,27 @@ fh_new_function(struct ast_node *node)
   return val;
 }
 
+/* Native functions are most of what the bootstrap allocates, so they are kept
+ * lean: they share one empty name and get no `prototype` object of their own,
+ * as with the built-in functions of ES5. Constructors define theirs. */
 js_val *
 fh_new_native_function(js_native_function func, int length)
 {
-  js_val *val = fh_new_function(NULL);
+  js_val *val = fh_new_object();
+
+  if (!fh->native_name)
+    fh->native_name = fh_add_constant(JSSTR(""));
+
+  fh_set_class(val, "Function");
+  fh_set(val, "name", fh->native_name);
+  fh_set(val, "arguments", JSNULL());
+  fh_set(val, "caller", JSNULL());
 
   val->object.native = true;
   val->object.nativefn = func;
+  val->object.provide_this = false;
+  val->object.generator = false;
+  val->proto = fh->function_proto;
   fh_set_len(val, length);
 
   return val;
@@ -169,7 +416,7 @@ fh_new_regexp(char *re)
 {
   js_val *val = fh_new_val(T_OBJECT);
 
-  val->proto = fh_try_get_proto("RegExp");
+  val->proto = fh->regexp_proto;
 
   // Process the trailing options: re = /pattern/[imgy]{0,4}
   int i = strlen(re) - 1;
@@ -184,8 +431,11 @@ fh_new_regexp(char *re)
   }
 
   // Store the inner pattern 
-  if (i > 1)
-    fh_set(val, "source", JSSTR(fh_str_slice(re, 1, i)));
+  if (i > 1) {
+    char *source = fh_str_slice(re, 1, i);
+    fh_set(val, "source", JSSTR(source));
+    free(source);
+  }
 
   fh_set_class(val, "RegExp");
   return val;
@@ -195,7 +445,7 @@ js_val *
 fh_new_error(char *name, const char *tpl, ...)
 {
   js_val *val = fh_new_val(T_OBJECT);
-  val->proto = fh_try_get_proto("Error");
+  val->proto = fh->error_proto;
   fh_set_class(val, "Error");
 
   va_list ap;
@@ -216,6 +466,7 @@ fh_new_error(char *name, const char *tpl, ...)
 
   fh_set(val, "name", JSSTR(name));
   fh_set(val, "message", JSSTR(msg));
+  free(msg);
   return val;
 }
 
@@ -238,8 +489,10 @@ fh_pop_state()
 {
   if (fh->callstack) {
     eval_state *pop = fh->callstack;
+    HOTSPOT_RETURN(pop);
     fh->callstack = pop->parent;
-    free(pop);
+    pop->parent = fh->state_pool;
+    fh->state_pool = pop;
   }
 }
 
@@ -253,20 +506,31 @@ fh_push_state(eval_state *state)
 eval_state *
 fh_new_state(int line, int column)
 {
-  eval_state *state = malloc(sizeof(eval_state));
-  memset(state, 0, sizeof(eval_state));
+  PROF_SAFE_POINT();
+
+  // States are reused once popped, so calls don't allocate them.
+  eval_state *state = fh->state_pool;
+  if (state)
+    fh->state_pool = state->parent;
+  else
+    state = malloc(sizeof(eval_state));
 
   state->line = line;
   state->column = column;
   state->caller_info = NULL;
+  state->callee = NULL;
+#ifdef FH_HOTSPOTS
+  state->hot_timed = false;
+#endif
   state->script_name = fh->script_name;
 
   state->ctx = NULL;
   state->this = NULL;
   state->scope = NULL;
+  state->args = NULL;
   state->parent = NULL;
   state->construct = false;
-  state->catch = false;
+  state->vm_frames = fh->vm_frames;
 
   return state;
 }
@@ -277,16 +541,78 @@ fh_new_global_state()
   fh_state *state = malloc(sizeof(fh_state));
 
   state->gc_state = GC_STATE_NONE;
-  memset(state->gc_arenas, 0, sizeof(state->gc_arenas));
+  state->gc_arenas = NULL;
   state->gc_num_arenas = 0;
-  state->gc_runs = 0;
-  state->gc_time = 0;
-  state->gc_last_start = 0;
+  state->gc_arenas_cap = 0;
+  state->gc_alloc_arena = 0;
+  memset(&state->gc_stats, 0, sizeof(gc_stats));
+  state->gc_stats.epoch = fh_gc_now();
+  memset(state->gc_recent, 0, sizeof(state->gc_recent));
+  state->gc_recent_pos = 0;
+  memset(&state->gc_gray, 0, sizeof(gc_stack));
+  memset(&state->gc_new, 0, sizeof(gc_stack));
+  memset(&state->gc_remembered, 0, sizeof(gc_stack));
+  state->gc_young = 0;
+  state->gc_stack_base = NULL;
+  state->gc_used = 0;
+  state->gc_external = 0;
+  state->gc_threshold = 0;
+  state->gc_step_work = 0;
+  state->gc_debt = 0;
+  state->gc_oom = false;
+  state->gc_compact_pending = false;
+  state->heap_profiling = false;
+  state->alloc_node = NULL;
+  state->alloc_sites = NULL;
+  state->num_alloc_sites = 0;
+  state->alloc_sites_cap = 0;
 
   state->global = NULL;
+  state->modules = NULL;
   state->function_proto = NULL;
   state->object_proto = NULL;
+  state->array_proto = NULL;
+  state->string_proto = NULL;
+  state->number_proto = NULL;
+  state->boolean_proto = NULL;
+  state->regexp_proto = NULL;
+  state->error_proto = NULL;
+  state->buffer_proto = NULL;
   state->callstack = NULL;
+  state->state_pool = NULL;
+  state->catches = NULL;
+  state->vm_frames = NULL;
+  state->vm_chunks = NULL;
+  state->node_data = NULL;
+  state->node_data_cap = 0;
+  state->frame_pools = NULL;
+  state->num_frame_pools = 0;
+  memset(&state->script_cache, 0, sizeof(fh_cache_stats));
+  memset(&state->eval_cache, 0, sizeof(fh_cache_stats));
+  state->eval_trees = NULL;
+  memset(&state->module_cache, 0, sizeof(fh_cache_stats));
+  state->timers = NULL;
+  state->clock_origin = fh_clock_ms();
+  state->loop = NULL;
+  state->quota_ticks = 0;
+  state->quota_batch = 0;
+  state->quota_steps = 0;
+  state->quota_deadline = 0;
+  state->quota_exceeded = QUOTA_NONE;
+  state->forked_worker = false;
+  state->root_shape = NULL;
+  state->key_strings = NULL;
+  memset(state->num_cache, 0, sizeof(state->num_cache));
+  memset(state->num_special, 0, sizeof(state->num_special));
+  memset(state->num_strings, 0, sizeof(state->num_strings));
+  state->undef = NULL;
+  state->null = NULL;
+  state->bools[0] = state->bools[1] = NULL;
+  state->native_name = NULL;
+  state->constants = NULL;
+  state->constant_slots = NULL;
+  state->num_constants = 0;
+  state->constants_cap = 0;
 
   state->script_name = "main";
 
@@ -295,10 +621,175 @@ fh_new_global_state()
   state->opt_print_ast = false;
   state->opt_keep_history_file = true;
   state->opt_history_filename = ".flathead_history";
+  state->opt_engine = ENGINE_AST;
+  state->opt_initial_heap = 0;
+  state->opt_max_heap = 0;
+  state->opt_heap_grow = GC_HEAP_GROW;
+  state->opt_gc_pause = GC_PAUSE;
+  state->opt_heap_profile = NULL;
+  state->opt_gc_stats = NULL;
+  state->opt_gc_compact = false;
+  state->opt_startup_time = false;
+  state->opt_parse_cache = NULL;
+  state->opt_isolates = false;
+  state->opt_eager_parse = false;
+  state->opt_jit = fh_jit_available() ? JIT_BASELINE : JIT_OFF;
+  state->opt_jit_log = false;
+  state->opt_max_steps = 0;
+  state->opt_timeout = 0;
+  state->opt_heap_quota = 0;
+
+  return state;
+}
+
+/* Create an independent interpreter, with its own heap, prototypes and global
+ * object, and enter it. It takes its options and stack base from `options`,
+ * which may be NULL; without a base, the stack is scanned from this call's
+ * frame, and from those of later calls into fh_run that are older. Only atoms
+ * are shared between isolates. */
+fh_state *
+fh_new_isolate(fh_state *options)
+{
+  fh_state *state = fh_new_global_state();
+
+  if (options) {
+    state->gc_stack_base = options->gc_stack_base;
+    state->opt_interactive = options->opt_interactive;
+    state->opt_print_tokens = options->opt_print_tokens;
+    state->opt_print_ast = options->opt_print_ast;
+    state->opt_keep_history_file = options->opt_keep_history_file;
+    state->opt_history_filename = options->opt_history_filename;
+    state->opt_engine = options->opt_engine;
+    state->opt_initial_heap = options->opt_initial_heap;
+    state->opt_max_heap = options->opt_max_heap;
+    state->opt_heap_grow = options->opt_heap_grow;
+    state->opt_gc_pause = options->opt_gc_pause;
+    state->opt_heap_profile = options->opt_heap_profile;
+    state->opt_gc_stats = options->opt_gc_stats;
+    state->opt_gc_compact = options->opt_gc_compact;
+    state->opt_startup_time = options->opt_startup_time;
+    state->opt_parse_cache = options->opt_parse_cache;
+    state->opt_isolates = options->opt_isolates;
+    state->opt_eager_parse = options->opt_eager_parse;
+    state->opt_jit = options->opt_jit;
+    state->opt_jit_log = options->opt_jit_log;
+    state->opt_max_steps = options->opt_max_steps;
+    state->opt_timeout = options->opt_timeout;
+    state->opt_heap_quota = options->opt_heap_quota;
+  }
 
+  fh_enter_isolate(state);
+  fh_gc_stack_from(&state);
+  state->heap_profiling = state->opt_heap_profile != NULL;
+  state->global = fh_bootstrap();
   return state;
 }
 
+/* Make `state` the isolate that evaluation and allocation use, returning the
+ * one that was. */
+fh_state *
+fh_enter_isolate(fh_state *state)
+{
+  fh_state *prev = fh;
+  fh = state;
+  return prev;
+}
+
+/* The current isolate's data for `node`. */
+fh_node_data *
+fh_get_node_data(ast_node *node)
+{
+  unsigned long slot = node->slot;
+  assert(slot);
+  if (slot >= fh->node_data_cap) {
+    unsigned long cap = fh->node_data_cap ? fh->node_data_cap : 256;
+    while (cap <= slot) cap *= 2;
+    fh->node_data = realloc(fh->node_data, cap * sizeof(fh_node_data));
+    memset(fh->node_data + fh->node_data_cap, 0,
+        (cap - fh->node_data_cap) * sizeof(fh_node_data));
+    fh->node_data_cap = cap;
+  }
+  return &fh->node_data[slot];
+}
+
+/* Drop what the current isolate keeps for `node`, as its tree is about to be
+ * freed. A literal's value is no longer kept alive by the constant pool: the
+ * last entry takes its place. */
+void
+fh_forget_node(ast_node *node)
+{
+  unsigned long i;
+
+  if (fh->alloc_node == node) fh->alloc_node = NULL;
+  if (node->slot >= fh->node_data_cap) return;
+
+  fh_node_data *data = &fh->node_data[node->slot];
+  if (data->frames_listed) {
+    for (i = 0; fh->frame_pools[i] != node->slot; i++);
+    fh->frame_pools[i] = fh->frame_pools[--fh->num_frame_pools];
+  }
+  if (data->cases) fh_free_switch_cases(data->cases);
+  if (data->chunk) fh_vm_free_chunk(data->chunk);
+  fh_jit_free(data->jit);
+  if (data->constant_at) {
+    unsigned long at = data->constant_at - 1, last = --fh->num_constants;
+    fh->constants[at] = fh->constants[last];
+    fh->constant_slots[at] = fh->constant_slots[last];
+    if (fh->constant_slots[at])
+      fh->node_data[fh->constant_slots[at]].constant_at = at + 1;
+  }
+  memset(data, 0, sizeof(*data));
+}
+
+/* Free an isolate and everything in its heap, with the trees of the strings
+ * it eval'd. The ASTs of its scripts are left, as other isolates may be
+ * running them too. */
+void
+fh_free_isolate(fh_state *state)
+{
+  fh_state *prev = fh_enter_isolate(state);
+  unsigned long n;
+  int i;
+
+  fh_free_eval_cache();
+  fh_gc_free_heap();
+  fh_vm_free_chunks();
+
+  for (i = 0; i < 3; i++)
+    free(state->num_special[i]);
+  for (i = 0; i < NUM_CACHE_BLOCKS; i++)
+    free(state->num_cache[i]);
+  free(state->undef);
+  free(state->null);
+  free(state->bools[0]);
+  free(state->bools[1]);
+  free(state->constants);
+  free(state->constant_slots);
+  for (n = 0; n < state->node_data_cap; n++) {
+    if (state->node_data[n].cases)
+      fh_free_switch_cases(state->node_data[n].cases);
+    fh_jit_free(state->node_data[n].jit);
+  }
+  free(state->node_data);
+  free(state->frame_pools);
+  free(state->alloc_sites);
+  fh_free_timers(state);
+  fh_free_loop(state);
+  if (state->root_shape)
+    fh_free_shapes(state->root_shape);
+  fh_free_key_strings();
+
+  while (state->state_pool) {
+    eval_state *next = state->state_pool->parent;
+    free(state->state_pool);
+    state->state_pool = next;
+  }
+
+  // Left first, so a profiler signal never finds the isolate half freed.
+  fh_enter_isolate(prev == state ? NULL : prev);
+  free(state);
+}
+
 
 // ----------------------------------------------------------------------------
 // Value Checks & Casting
@@ -322,7 +813,7 @@ fh_to_primitive(js_val *val, js_type hint)
   // them that is callable, or a type error otherwise.
 
   js_val *maybe_func, *res;
-  js_args *args;
+  js_args args;
   char *types[2] = {"valueOf", "toString"};
   int reverse = hint == T_STRING;
 
@@ -334,8 +825,8 @@ fh_to_primitive(js_val *val, js_type hint)
   for (i = reverse; i <= 1 && i >= 0; reverse ? i-- : i++) {
     maybe_func = fh_get_proto(val, types[i]);
     if (fh_is_callable(maybe_func)) {
-      args = args_new();
-      res = fh_call(fh->global, val, maybe_func, args);
+      args_init(&args);
+      res = fh_call(fh->global, val, maybe_func, &args);
       if (!IS_OBJ(res)) return res;
     }
   }
@@ -353,11 +844,8 @@ fh_to_number(js_val *val)
     return JSNUM(1);
   }
   if (IS_STR(val)) {
-    // TODO: check spec
-    char *err;
-    double d = strtod(val->string.ptr, &err);
-    if (*err != 0) return JSNAN();
-    return JSNUM(d);
+    fh_str_flatten(val);
+    return JSNUM(fh_str_to_num(val->string.ptr, val->string.length));
   }
   if (IS_OBJ(val))
     return fh_to_number(fh_to_primitive(val, T_NUMBER));
@@ -406,6 +894,27 @@ fh_to_uint32(js_val *val)
   return JSNUM(int32_bit);
 }
 
+/* The strings of small integers, which are mostly index keys, are made once
+ * and kept as constants. */
+static js_val *
+number_string(double x)
+{
+  char buf[FH_NUM_BUF];
+  size_t len;
+
+  if (x >= 0 && x < NUM_STR_CACHE && x == (long)x) {
+    js_val **cell = &fh->num_strings[(long)x];
+    if (!*cell) {
+      len = fh_uint_format((long)x, buf);
+      *cell = fh_add_constant(JSSTRN(buf, len));
+    }
+    return *cell;
+  }
+
+  len = fh_num_format(x, buf);
+  return JSSTRN(buf, len);
+}
+
 js_val *
 fh_to_string(js_val *val)
 {
@@ -416,24 +925,14 @@ fh_to_string(js_val *val)
     return JSSTR("false");
   }
   if (IS_NUM(val)) {
-    // TODO: check spec
     if (val->number.is_nan) return JSSTR("NaN");
-    if (val->number.is_inf) return JSSTR("Infinity");
-    char *fmt = "%f";
-    if (fmod(val->number.val, 1) == 0) 
-      fmt = "%.0f";
-    if (fabs(val->number.val) > 1e21)
-      fmt = "%g";
-    int size = snprintf(NULL, 0, fmt, val->number.val) + 1;
-    char *num = malloc(size);
-    snprintf(num, size, fmt, val->number.val);
-    num[size - 1] = '\0';
-    return JSSTR(num);
+    if (val->number.is_inf) return JSSTR(val->number.is_neg ? "-Infinity" : "Infinity");
+    return number_string(val->number.val);
   }
   if (IS_OBJ(val))
     return fh_to_string(fh_to_primitive(val, T_STRING));
 
-  return val;
+  return fh_str_flatten(val);
 }
 
 js_val *
@@ -448,37 +947,41 @@ fh_to_object(js_val *val)
   obj->object.primitive = val;
   if (IS_BOOL(val)) {
     fh_set_class(obj, "Boolean");
-    obj->proto = fh_try_get_proto("Boolean");
+    obj->proto = fh->boolean_proto;
   }
   if (IS_NUM(val)) {
     fh_set_class(obj, "Number");
-    obj->proto = fh_try_get_proto("Number");
+    obj->proto = fh->number_proto;
   }
   if (IS_STR(val)) {
     fh_set_class(obj, "String");
-    obj->proto = fh_try_get_proto("String");
+    obj->proto = fh->string_proto;
   }
   return obj;
 }
 
+/* ToBoolean (ECMA 9.2) as a C bool, for values that only feed control flow. */
+bool
+fh_truthy(js_val *val)
+{
+  if (IS_BOOL(val)) return val->boolean.val;
+  if (IS_UNDEF(val) || IS_NULL(val)) return false;
+  if (IS_NUM(val)) return !IS_NAN(val) && val->number.val != 0;
+  if (IS_STR(val)) return val->string.length != 0;
+  return true;
+}
+
 js_val *
 fh_to_boolean(js_val *val)
 {
-  if (IS_UNDEF(val) || IS_NULL(val)) 
-    return JSBOOL(0);
-  if (IS_NUM(val))
-    return JSBOOL(!IS_NAN(val) && val->number.val != 0);
-  if (IS_STR(val))
-    return JSBOOL(val->string.length != 0);
-  if (IS_OBJ(val))
-    return JSBOOL(1);
-  return val;
+  return IS_BOOL(val) ? val : JSBOOL(fh_truthy(val));
 }
 
 js_val *
 fh_cast(js_val *val, js_type type)
 {
-  if (val->type == type) return val;
+  if (val->type == type)
+    return type == T_STRING ? fh_str_flatten(val) : val;
 
   switch (type) {
     case T_NULL: return JSNULL();
@@ -495,26 +998,47 @@ fh_cast(js_val *val, js_type type)
 // Error Handling
 // ----------------------------------------------------------------------------
 
+void
+fh_catch_push(fh_catch *c)
+{
+  c->error = NULL;
+  c->callstack = fh->callstack;
+  c->vm_frames = fh->vm_frames;
+  c->parent = fh->catches;
+  fh->catches = c;
+}
+
+void
+fh_catch_pop(fh_catch *c)
+{
+  fh->catches = c->parent;
+}
+
 void
 fh_throw(eval_state *state, js_val *error)
 {
-  // Search the callstack for a catch
-  eval_state *tmp = state;
-  while(tmp != NULL) {
-    if (tmp->catch) {
-      fh_set(tmp->ctx, "FH_LAST_ERROR", error); 
+  fh_catch *c = fh->catches;
 
-      // Pop all frames up to and including the catch.
-      while (fh->callstack != tmp)
-        fh_pop_state();
+  // A script over its quota unwinds to the outermost frame, whose catcher
+  // cleans up and throws it on to the top level.
+  if (c && fh->quota_exceeded)
+    while (c->parent) c = c->parent;
+
+  if (c) {
+    c->error = error;
+    fh->catches = c->parent;
+
+    // Pop the states pushed since the catch frame, the thrower's included.
+    while (fh->callstack && fh->callstack != c->callstack)
       fh_pop_state();
+    fh->vm_frames = c->vm_frames;
 
-      longjmp(tmp->jmp, 1);
-      UNREACHABLE();
-    }
-    tmp = tmp->parent;
+    longjmp(c->jmp, 1);
+    UNREACHABLE();
   }
 
+  // Whatever the script printed comes before the error.
+  fh_output_flush();
   fprintf(stderr, "%s\n", TO_STR(fh_to_primitive(error, T_STRING))->string.ptr);
 
   while (state != NULL) {
@@ -528,12 +1052,25 @@ fh_throw(eval_state *state, js_val *error)
     state = state->parent;
   }
 
-  // Catch errors within REPL: clear callstack and start over.
-  if (fh->opt_interactive) {
-    fh->callstack = NULL;
+  // Catch errors within REPL: clear callstack and start over. An isolate's
+  // error likewise ends only its own script.
+  if (fh->opt_interactive || fh->opt_isolates) {
+    while (fh->callstack)
+      fh_pop_state();
+    fh->catches = NULL;
+    fh->vm_frames = NULL;
     longjmp(fh->repl_jmp, 1); 
   }
-  exit(1);
+  fh_exit(fh->quota_exceeded ? QUOTA_EXIT_STATUS : 1);
+}
+
+/* End the process. A forked worker ends with _exit, as the atexit handlers
+ * and stdio buffers it copied are the parent's. */
+void
+fh_exit(int status)
+{
+  if (fh->forked_worker) _exit(status);
+  exit(status);
 }
 
 
@@ -590,17 +1127,11 @@ fh_has_property(js_val *obj, char *prop)
   return JSBOOL(!IS_UNDEF(val));
 }
 
+/* The prototype of the global constructor named `type`, for those that don't
+ * have a slot of their own on the state (the Error subclasses). */
 js_val *
 fh_try_get_proto(char *type)
 {
-  // Try to avoid a lookup.
-  if (STREQ(type, "Function") && fh->function_proto)
-    return fh->function_proto;
-  if (STREQ(type, "Object") && fh->object_proto)
-    return fh->object_proto;
-  if (STREQ(type, "Array") && fh->array_proto)
-    return fh->array_proto;
-
   js_val *global = fh->global;
   if (global != NULL) {
     js_val *obj = fh_get(global, type);
@@ -615,8 +1146,11 @@ fh_set_len(js_val *val, unsigned long len)
 {
   if (IS_STR(val))
     val->string.length = len;
-  if (IS_ARR(val))
+  if (IS_ARR(val)) {
+    if (len < val->object.length && val->dense)
+      fh_truncate_elems(val, len);
     val->object.length = len;
+  }
   fh_set_prop(val, "length", JSNUM(len), 0);
 }
 
@@ -27,6 +27,16 @@
 #include <assert.h>
 #include <limits.h>
 
+#include "atom.h"
+
+/* Property maps and shape transitions are keyed by atom pointers, so they
+ * use the hash stored with the atom and compare the pointers. (A hash
+ * function chosen with `make hashfn=...` hashes the pointer bytes instead.) */
+#ifndef HASH_FUNCTION
+#define HASH_FUNCTION(key,keylen,num_bkts,hashv,bkt) \
+  do { (hashv) = ATOM_HASH(*(char **)(key)); (bkt) = (hashv) & ((num_bkts) - 1); } while (0)
+#endif
+
 #include "../ext/uthash.h"
 #include "version.h"
 
@@ -34,12 +44,33 @@
 #define INFINITY       (1.0/0.0)
 #endif
 
-#define MAX_ARENAS     10
+#define GC_RECENT      16       // latest allocations treated as roots
+#define GC_HEAP_GROW   0.5      // default survival ratio that grows the heap
+#define GC_PAUSE       5        // default pause target (ms) of a marking step
+#define GC_STEP        64       // allocations between incremental marking steps
+#define GC_NURSERY     10000    // young values that trigger a minor collection
+#define GC_COMPACT_WASTE 0.5    // vacant share of the occupied arenas that compacts
+#define MAX_SHAPE_PROPS 64
+#define SWITCH_TABLE_MIN 4      // literal cases before a switch is hashed
+#define SWITCH_LINEAR  -1       // fh_switch_lookup of a switch without a table
+#define SWITCH_DENSITY 4        // integer labels per slot of a direct table, at most
+#define SWITCH_MAX_INT 1e9      // integer labels a direct table may index
+#define FRAME_POOL_MAX 4        // spare activations kept per leaf function
+
+#define NUM_CACHE_MIN    -1024    // integers in [MIN, MAX) are shared cells
+#define NUM_CACHE_MAX    65536
+#define NUM_CACHE_BLOCK  1024
+#define NUM_CACHE_BLOCKS ((NUM_CACHE_MAX - NUM_CACHE_MIN) / NUM_CACHE_BLOCK)
+#define NUM_STR_CACHE    1024     // strings of integers in [0, MAX) are shared
+
+#define ROPE_MIN_LENGTH  256      // shorter concatenations are copied at once
+#define ROPE_MAX_DEPTH   1024     // deeper ropes are flattened
 
 #define JSBOOL(x)      fh_new_boolean(x)
 #define JSSTR(x)       fh_new_string(x)
-#define JSNULL()       fh_new_val(T_NULL)
-#define JSUNDEF()      fh_new_val(T_UNDEF)
+#define JSSTRN(x,n)    fh_new_string_len((x),(n))
+#define JSNULL()       fh_null()
+#define JSUNDEF()      fh_undef()
 #define JSNUM(x)       fh_new_number((x),0,0,0)
 #define JSNAN()        fh_new_number(0,1,0,0)
 #define JSINF()        fh_new_number(INFINITY,0,1,0)
@@ -85,7 +116,8 @@
 #define ARGLEN(args)   args_len(args)
 
 #define STREQ(a,b)     (strcmp((a),(b)) == 0)
-#define OBJ_ITER(o,p)  js_prop *_tmp; HASH_ITER(hh,(o)->map,(p),_tmp)
+#define OBJ_ITER(o,p)  js_prop_iter _it; \
+                       for ((p) = fh_iter_first(&_it,(o)); (p); (p) = fh_iter_next(&_it))
 
 #define DEF(o,k,v)     fh_set_prop((o),(k),(v),P_BUILTIN)
 #define DEF2(o,k,v,f)  fh_set_prop((o),(k),(v),(f))
@@ -101,14 +133,120 @@ struct js_val;
 struct js_args;
 struct ast_node;
 struct gc_arena;
+struct vm_frame;
 
 typedef enum {
   GC_STATE_STARTING,
-  GC_STATE_MARK,
-  GC_STATE_SWEEP,
+  GC_STATE_MARK,      // marking incrementally, between mutator steps
+  GC_STATE_ATOMIC,    // finishing the mark with the mutator stopped
+  GC_STATE_MINOR,     // collecting the young generation
+  GC_STATE_SWEEP,     // sweeping arenas lazily, between mutator steps
+  GC_STATE_COMPACT,   // moving values out of sparse arenas
   GC_STATE_NONE
 } gc_state;
 
+typedef struct {
+  struct js_val **vals;
+  unsigned long len;
+  unsigned long cap;
+} gc_stack;
+
+#define GC_PAUSE_BUCKETS 10     // buckets of the pause histogram
+
+/* A collection (or compaction) in numbers, times in microseconds. */
+typedef struct {
+  const char *type;           // "minor", "major" or "compact"
+  long start;
+  long pause;                 // the sum of its pauses
+  long max_pause;
+  unsigned long pauses;
+  unsigned long marked;
+  unsigned long swept;
+  unsigned long moved;
+  size_t heap_before;
+  size_t heap_after;
+  unsigned long used_before;  // slots
+  unsigned long used_after;
+} gc_collection;
+
+typedef struct {
+  unsigned long major_runs;
+  unsigned long minor_runs;
+  unsigned long compactions;
+  long epoch;                 // when the runtime started
+  long pause_start;
+  int pause_depth;
+  bool ending;                // the collection ends with the pause
+  gc_collection current;
+  gc_collection last;
+  long total_pause;
+  long max_pause;
+  unsigned long histogram[GC_PAUSE_BUCKETS];
+} gc_stats;
+
+/* A switch whose labels are all number or string literals finds its clause
+ * through a table rather than comparing with each. Clauses are numbered in
+ * source order, the default included. */
+typedef struct {
+  double num;
+  int clause;
+} fh_switch_num;
+
+typedef struct {
+  char *atom;
+  int clause;
+  UT_hash_handle hh;
+} fh_switch_str;
+
+typedef struct {
+  bool linear;                // some label isn't a literal: compare in turn
+  fh_switch_num *nums;        // sorted, never NaN or -0
+  int num_nums;
+  int *direct;                // clauses of the integers lo.., if dense
+  long lo;
+  long span;
+  fh_switch_str *strs;        // keyed by the string's atom
+  fh_switch_str *str_entries;
+  int fallback;               // the default clause, or past the last
+} fh_switch_cases;
+
+/* What an isolate keeps for an AST node, at the node's slot, as the tree
+ * itself is shared and never written to by evaluation. */
+typedef struct {
+  struct js_val *constant;    // a literal's value, once materialized
+  unsigned long constant_at;  // its index in fh->constants + 1, if it's there
+  struct vm_chunk *chunk;     // a program's or function's bytecode
+  fh_switch_cases *cases;     // a switch's table, once it has run
+  struct js_val *frames;      // a leaf function's spare activations
+  int num_frames;
+  bool frames_listed;         // in fh->frame_pools
+  bool func_marked;           // a function's value was marked (see grammar.y)
+  struct jit_loop *jit;    // a loop's iteration count or machine code
+} fh_node_data;
+
+/* Lookups in one of the caches of parsed scripts and loaded modules. */
+typedef struct {
+  unsigned long hits;
+  unsigned long misses;
+} fh_cache_stats;
+
+typedef enum {
+  ENGINE_AST,
+  ENGINE_VM
+} fh_engine;
+
+typedef enum {
+  JIT_OFF,
+  JIT_BASELINE                // compile hot numeric loops (jit.c)
+} fh_jit_mode;
+
+typedef enum {
+  QUOTA_NONE,
+  QUOTA_STEPS,                // ran more than --max-steps
+  QUOTA_TIME,                 // ran past its --timeout
+  QUOTA_HEAP                  // filled its --heap-quota (quota.c)
+} fh_quota;
+
 typedef enum {
   S_BREAK = 1,
   S_NOOP,
@@ -136,44 +274,143 @@ typedef enum {
 
 typedef struct {
   gc_state gc_state;
-  struct gc_arena *gc_arenas[MAX_ARENAS];
+  struct gc_arena **gc_arenas;
   int gc_num_arenas;
-  int gc_runs;
-  long gc_last_start;
-  long gc_time;
+  int gc_arenas_cap;
+  int gc_alloc_arena;                 // where the last allocation was made
+  gc_stats gc_stats;
+  struct js_val *gc_recent[GC_RECENT]; // may still be unrooted C temporaries
+  int gc_recent_pos;
+  gc_stack gc_gray;                   // marked values whose children aren't
+  gc_stack gc_new;                    // values allocated while marking
+  gc_stack gc_remembered;             // old objects pointing to young values
+  unsigned long gc_young;             // values allocated since the last GC
+  void *gc_stack_base;                // the C stack is scanned up to here
+  unsigned long gc_used;              // occupied slots in all arenas
+  unsigned long gc_external;          // bytes of buffers owned by values
+  unsigned long gc_threshold;         // used slots that start a cycle
+  unsigned long gc_step_work;         // values to mark per step
+  int gc_debt;                        // allocations since the last step
+  bool gc_oom;                        // making the out of memory error
+  bool gc_compact_pending;            // compact at the next safe point
+  bool heap_profiling;                // counting allocations by site
+  struct ast_node *alloc_node;        // where allocations are counted
+  struct fh_alloc_site *alloc_sites;
+  unsigned long num_alloc_sites;
+  unsigned long alloc_sites_cap;      // a power of two
 
   bool opt_interactive;
   bool opt_print_tokens;
   bool opt_print_ast;
   bool opt_keep_history_file;
   const char *opt_history_filename;
+  fh_engine opt_engine;
+  size_t opt_initial_heap;            // bytes the heap grows to without a GC
+  size_t opt_max_heap;                // bytes (0 for no limit)
+  double opt_heap_grow;               // grow when more survives a GC
+  double opt_gc_pause;                // ms a marking step may take (0: no limit)
+  const char *opt_heap_profile;       // file the heap profile is written to
+  FILE *opt_gc_stats;                 // stream of GC stats as JSON lines
+  bool opt_gc_compact;                // compact fragmented heaps
+  bool opt_startup_time;              // report the time spent starting up
+  const char *opt_parse_cache;        // directory of cached ASTs
+  bool opt_isolates;                  // run each script in its own isolate
+  bool opt_eager_parse;               // parse function bodies up front
+  fh_jit_mode opt_jit;
+  bool opt_jit_log;                   // report what the JIT does on stderr
+  unsigned long opt_max_steps;        // loop iterations and calls (0: no limit)
+  double opt_timeout;                 // ms a script may run (0: no limit)
+  size_t opt_heap_quota;              // bytes of heap, past which it's stopped
+
+  unsigned long quota_ticks;          // steps left in the batch (0: no quotas)
+  unsigned long quota_batch;          // steps in the batch
+  unsigned long quota_steps;          // steps in the batches before it
+  double quota_deadline;              // on fh_clock_ms() (0 for none)
+  fh_quota quota_exceeded;            // why the script was terminated
 
   jmp_buf repl_jmp;                   // used to handle errors within REPL
+  bool forked_worker;                 // leaves with _exit (see fh_exit)
   char *script_name;
   struct eval_state *callstack;
-
-  struct js_val *function_proto;    // cache prototype pointers
+  struct eval_state *state_pool;      // popped states, reused by fh_new_state
+  struct fh_catch *catches;           // innermost catch frame
+  struct vm_frame *vm_frames;         // active bytecode frames (GC roots)
+  struct vm_chunk *vm_chunks;         // compiled code, for its caches
+  fh_node_data *node_data;            // indexed by node slot
+  unsigned long node_data_cap;
+  unsigned *frame_pools;              // slots of functions with spare frames
+  unsigned long num_frame_pools;
+  fh_cache_stats script_cache;        // trees of scripts loaded by path
+  fh_cache_stats eval_cache;          // trees of eval'd strings
+  struct fh_eval_cache *eval_trees;   // and the trees themselves
+  fh_cache_stats module_cache;        // modules loaded by require()
+  struct fh_timer *timers;            // console.time and friends, by name
+  double clock_origin;                // fh_clock_ms() at performance.now() 0
+  struct fh_loop *loop;               // timers and watches, once there are any
+
+  struct js_shape *root_shape;      // shape of objects without properties
+  struct fh_key_string *key_strings;  // strings of shaped names, by atom
+  struct js_val *num_cache[NUM_CACHE_BLOCKS];   // shared integer cells
+  struct js_val *num_special[3];    // shared NaN, Infinity and -Infinity
+  struct js_val *num_strings[NUM_STR_CACHE];    // strings of small integers
+  struct js_val *undef;             // shared undefined, null, false & true
+  struct js_val *null;
+  struct js_val *bools[2];
+  struct js_val *native_name;       // shared name of native functions
+  struct js_val **constants;        // literal pool (GC roots)
+  unsigned *constant_slots;         // the slot of each one's literal, or 0
+  unsigned long num_constants;
+  unsigned long constants_cap;
+
+  struct js_val *function_proto;    // the builtin prototypes, as bootstrapped
   struct js_val *object_proto;
   struct js_val *array_proto;
+  struct js_val *string_proto;
+  struct js_val *number_proto;
+  struct js_val *boolean_proto;
+  struct js_val *regexp_proto;
+  struct js_val *error_proto;
+  struct js_val *buffer_proto;
   struct js_val *global;
+  struct js_val *modules;           // require.cache, by resolved path
 } fh_state;
 
 typedef struct eval_state {
   int line;
   int column;
   char *caller_info;
+  struct ast_node *callee;        // the function called, unless native
   char *script_name;
   bool construct;
-  bool catch;
   struct js_val *ctx;
   struct js_val *this;
   struct js_val *scope;
-  jmp_buf jmp;
+  struct js_args *args;           // arguments of a call (GC roots)
+  struct vm_frame *vm_frames;     // VM frames live when the state was created
+#ifdef FH_HOTSPOTS
+  bool hot_timed;                 // a call being timed for --hotspots
+  double hot_start;
+#endif
   struct eval_state *parent;
 } eval_state;
 
+/* Where a throw lands: a try statement, or a native running script code that
+ * must see its errors. Frames live on the C stack of their catcher, which
+ * pushes one with fh_catch_push before its setjmp and pops it if nothing was
+ * thrown. fh_throw jumps to the innermost frame, popping it and the call
+ * states pushed after it, with the error in `error`. A terminated script
+ * jumps to the outermost frame instead, and its catcher must throw the error
+ * again once it has cleaned up. */
+typedef struct fh_catch {
+  jmp_buf jmp;
+  struct js_val *error;
+  struct eval_state *callstack;   // call states when the frame was pushed
+  struct vm_frame *vm_frames;
+  struct fh_catch *parent;
+} fh_catch;
+
 typedef struct {
-  char *name;
+  char *name;                     // an atom
   bool writable;
   bool enumerable;
   bool configurable;
@@ -182,6 +419,42 @@ typedef struct {
   UT_hash_handle hh;
 } js_prop;
 
+/* Iterates the own props of an object: dense elements first (presented
+ * through a scratch prop, so changes to their flags are not kept), then the
+ * map. The next map prop is fetched ahead, so the current one may be deleted. */
+typedef struct {
+  struct js_val *obj;
+  unsigned long index;            // next dense element
+  js_prop *next;                  // next map prop
+  js_prop scratch;
+  char name[24];
+} js_prop_iter;
+
+/* Shapes (hidden classes) describe the property names of an object in the
+ * order they were added. Objects built the same way share a shape, and the
+ * props of an object are also kept in `slots`, indexed by the order in the
+ * shape. Lookup caches can then key on the shape and store a slot offset.
+ * Objects that delete properties or grow past MAX_SHAPE_PROPS drop their
+ * shape (NULL) and are only reachable through the map. A shape that's been
+ * enumerated keeps the strings of its names, so its objects' keys are made
+ * once, and each name's string is shared by the shapes that have it. */
+typedef struct js_shape {
+  char *name;                     // the property added by this transition (an atom)
+  unsigned long count;            // number of properties in the shape
+  struct js_val **keys;           // name strings in order (constants), once used
+  struct js_shape *parent;
+  struct js_shape *transitions;   // child shapes, hashed by property name
+  UT_hash_handle hh;
+} js_shape;
+
+/* The string of a name that shapes hold, made once per isolate and kept as a
+ * constant: every shape with the name shares it. */
+typedef struct fh_key_string {
+  char *name;                     // an atom
+  struct js_val *str;
+  UT_hash_handle hh;
+} fh_key_string;
+
 typedef struct {
   double val;
   bool is_nan;
@@ -189,18 +462,25 @@ typedef struct {
   bool is_neg;
 } js_number;
 
+/* A string built by `+` may be left as a rope: `ptr` is NULL and the contents
+ * are the concatenation of `left` and `right`, which fh_str_flatten copies out
+ * the first time they're needed. */
 typedef struct {
   unsigned long length;
   char *ptr;
+  struct js_val *left;
+  struct js_val *right;
+  unsigned depth;             // rope depth (0 when flat)
 } js_string;
 
 typedef struct {
   bool val;
 } js_boolean;
 
-/* The standard API for natively defined functions provides an instance (when
- * applicable), the arguments as values in linked-list format, and the evaluation
- * state, which contains information that may be used for error reporting.
+/* The standard API for natively defined functions provides the receiver (the
+ * `this` of the call, unwrapped if it's a primitive wrapper), the arguments as a counted vector (`args->argc` values at
+ * `args->argv`, see args.h), and the evaluation state, which contains
+ * information that may be used for error reporting.
  */
 typedef struct js_val * (js_native_function)(struct js_val *, struct js_args *, eval_state *); 
 
@@ -209,18 +489,41 @@ typedef struct {
   bool generator;
   bool provide_this;
   bool extensible;            // [[Extensible]]
-  char class[10];             // [[Class]]
+  char class[20];             // [[Class]]
   struct js_val *primitive;   // [[PrimitiveValue]]
   struct js_val *bound_this;  // [[BoundThis]]
   struct js_args *bound_args; // [[BoundArguments]]
   struct js_val *scope;       // [[Scope]]
-  struct js_val *instance;
   struct js_val *parent;
   struct ast_node *node;
   unsigned long length;
   js_native_function *nativefn;
 } js_object;
 
+/* ArrayBuffers own a block of bytes, and typed arrays are views of one. A
+ * view's elements are stored packed, and only boxed when read. */
+typedef enum {
+  TA_BUFFER,                  // an ArrayBuffer
+  TA_INT8,
+  TA_UINT8,
+  TA_UINT8_CLAMPED,
+  TA_INT16,
+  TA_UINT16,
+  TA_INT32,
+  TA_UINT32,
+  TA_FLOAT32,
+  TA_FLOAT64,
+  TA_READER                   // a file reader's state and buffer (fs.c)
+} js_typed_kind;
+
+typedef struct {
+  js_typed_kind kind;
+  unsigned char *data;        // the first element (owned by the buffer)
+  unsigned long length;       // in elements (in bytes for a buffer or reader)
+  unsigned long offset;       // in bytes, into the buffer
+  struct js_val *buffer;      // the ArrayBuffer viewed (NULL for a buffer)
+} js_typed;
+
 /* TODO: Store non-objects more efficiently. A lot of space is currenlty wasted
  * for JS primitives. `js_val` should only store a pointer to the `js_obj`.
  * Maybe the GC can keep separate heaps for objects and values. */
@@ -235,12 +538,26 @@ typedef struct js_val {
   struct js_val *proto;
   bool marked;
   bool flagged; 
+  bool shared;        // a canonical cell outside the arenas; never mutate it
+  bool young;         // allocated since the last collection
+  bool remembered;    // old, but in the remembered set
+  bool forwarded;     // moved by a compaction (to object.parent)
   js_prop *map;
+  js_shape *shape;
+  js_prop **slots;    // props in shape order (while the shape is set)
+  unsigned long slots_cap;
+  struct js_val **elements; // dense array elements (NULL for holes)
+  unsigned long elements_cap;
+  bool dense;         // index props live in `elements` rather than the map
+  js_typed *typed;    // buffer storage (typed arrays are dense, no elements)
 } js_val;
 
 js_val * fh_new_val(js_type);
 js_val * fh_new_number(double, bool, bool, bool);
 js_val * fh_new_string(char *);
+js_val * fh_new_string_len(const char *, size_t);
+js_val * fh_concat(js_val *, js_val *);
+js_val * fh_str_flatten(js_val *);
 js_val * fh_new_boolean(bool);
 js_val * fh_new_object();
 js_val * fh_new_array();
@@ -248,9 +565,19 @@ js_val * fh_new_function(struct ast_node *);
 js_val * fh_new_native_function(js_native_function, int);
 js_val * fh_new_regexp(char *);
 js_val * fh_new_error(char *, const char *, ...);
+js_val * fh_unshare(js_val *);
+js_val * fh_undef(void);
+js_val * fh_null(void);
+js_val * fh_add_constant(js_val *);
+js_val * fh_add_literal(struct ast_node *, js_val *);
 
 js_prop * fh_new_prop(js_prop_flags);
 fh_state * fh_new_global_state();
+fh_state * fh_new_isolate(fh_state *);
+fh_node_data * fh_get_node_data(struct ast_node *);
+void fh_forget_node(struct ast_node *);
+fh_state * fh_enter_isolate(fh_state *);
+void fh_free_isolate(fh_state *);
 
 eval_state * fh_new_state(int, int);
 void fh_push_state(eval_state *);
@@ -258,9 +585,15 @@ void fh_pop_state();
 
 js_val * fh_eval_file(FILE *, js_val *);
 js_val * fh_eval_string(char *, js_val *);
+void fh_unmark_evicted_funcs(void);
+void fh_free_eval_cache(void);
+js_val * fh_eval_path(char *, js_val *);
+bool fh_parse_path(char *, struct ast_node **);
+struct ast_node * fh_func_body(struct ast_node *);
 js_val * fh_try_get_proto(char *);
 
 bool fh_is_callable(js_val *);
+bool fh_truthy(js_val *);
 js_val * fh_to_primitive(js_val *, js_type);
 js_val * fh_to_number(js_val *);
 js_val * fh_to_int(js_val *);
@@ -278,6 +611,11 @@ char * fh_typeof(js_val *);
 void fh_set_len(js_val *, unsigned long);
 void fh_set_class(js_val *, char *);
 void fh_throw(eval_state *, js_val *);
+void fh_exit(int);
+void fh_catch_push(fh_catch *);
+void fh_catch_pop(fh_catch *);
+js_prop * fh_iter_first(js_prop_iter *, js_val *);
+js_prop * fh_iter_next(js_prop_iter *);
 
 extern fh_state *fh;
 
@@ -16,11 +16,45 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <math.h>
 #include <stddef.h>
 #include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 
 #include "gc.h"
+#include "args.h"
 #include "debug.h"
+#include "vm.h"
+#include "heapprof.h"
+#include "loop.h"
+#include "quota.h"
+#include "runtime/lib/fs.h"
+
+// Vacant slots are zeroed, so they have no type and the marker never follows
+// this pointer.
+#define NEXT_FREE(val) ((val)->object.parent)
+
+// Where a compaction moved a value, until the references are fixed.
+#define FORWARD(val) ((val)->object.parent)
+#define GC_FIX(ref) \
+  do { if ((ref) && (ref)->forwarded) (ref) = FORWARD(ref); } while (0)
+
+// The stack scan reads whole frames, redzones included.
+#if defined(__SANITIZE_ADDRESS__)
+#define NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#else
+#define NO_SANITIZE_ADDRESS
+#endif
+
+static void gc_push(gc_stack *, js_val *);
+static void gc_start(void);
+static void gc_step(void);
+static void gc_finish(void);
+static void gc_minor(void);
+static void gc_sweep_rest(void);
+static bool gc_fragmented(void);
+static void fh_gc_sweep(gc_arena *);
 
 #ifdef FH_GC_PROFILE
 #define GC_PRINT(indent, ...) printf("%*s", indent, ""); printf(__VA_ARGS__)
@@ -40,7 +74,7 @@
 
 /* GC Overview
  *
- * Bi-color, non-incremental, mark & sweep, stop-the-world garbage collection.
+ * Generational, tri-color, incremental mark & sweep garbage collection.
  *
  * Arenas
  * ------
@@ -48,29 +82,93 @@
  * contiguous blocks of memory which are slotted to hold Flathead's js_val
  * structs. The arena size is determined by the SLOTS_PER_ARENA define. The
  * size is then that number of slots multiplied by the size of a js_val struct.
- * The system will create arenas on demand, when space cannot be freed from an
- * existing arena, and the MAX_ARENAS define has not been exceeded.
- *
  * At the start of each arena is a metadata section which stores usage
- * information and the list of vacant slots.
+ * information: an occupancy bitmap, a bump index below which every slot has
+ * been handed out at least once, and a free list of the vacant slots below
+ * it. The free list is threaded through the vacant slots themselves.
+ *
+ * The heap grows an arena at a time. Below the initial heap size
+ * (--initial-heap) a full heap simply grows. Past it, a full heap is
+ * collected first, and after each collection the heap is resized so that
+ * the surviving values fill at most the `opt_heap_grow` fraction of it
+ * (--heap-grow). Arenas left empty above that size are freed. The heap never
+ * grows past --max-heap; a program that fills it gets a RangeError (made in
+ * an arena past the limit).
  *
  * Allocation
  * ----------
+ * Allocation pops the free list of the arena that served the last
+ * allocation, or bumps its index, in constant time. Only when that arena is
+ * full are the others tried.
  *
  * Mark Phase
  * ----------
+ * Unmarked values are white, marked values on the gray stack are gray and
+ * the other marked values are black. A cycle starts once the used slots
+ * pass a threshold (half the free slots after the last collection), by
+ * shading the roots gray. Then every GC_STEP allocations the marker pops
+ * gray values and shades what they reference, until it has done a step's
+ * worth of work or used up the pause target (--gc-pause). The work per step
+ * is paced from the heap usage, so marking should be done well before the
+ * heap fills up; when it isn't, the rest is marked at once.
+ *
+ * While marking, the program keeps running. Storing a white value into a
+ * black object goes through the write barrier (GC_BARRIER), which shades the
+ * value. Values allocated during a cycle are black. The roots aren't behind
+ * the barrier, and neither are the members of new values, so once the gray
+ * stack is empty both are scanned again, with the program stopped, before
+ * the sweep.
  *
  * Sweep Phase
  * -----------
+ * The sweep visits occupied slots only, a bitmap word at a time, and pushes
+ * the unmarked ones onto the free list. It's lazy: the mark leaves every
+ * arena unswept, and the program resumes right away. The allocator sweeps
+ * an arena before allocating from it, and every GC_STEP allocations the
+ * next unswept arena is swept too. Once all are swept the heap is resized,
+ * and the next collection may start.
+ *
+ * Generations
+ * -----------
+ * Values are young from their allocation until they survive a collection.
+ * Each arena has a second bitmap of its young slots. After every GC_NURSERY
+ * allocations, a minor collection marks from the roots as usual but never
+ * enters an old value, so the runtime reachable from the global object isn't
+ * traced again. Old objects that point to young values are roots of the
+ * minor collection too: the write barrier adds them to the remembered set.
+ * Then only the young slots are swept, and the survivors become old where
+ * they are. Minor collections wait while a full cycle is marking.
+ *
+ * Both collections treat the C stack as a root. Any word on it that points
+ * into an occupied slot keeps that value alive, so temporaries held in C
+ * locals survive the frequent minor collections.
+ *
+ * Compaction
+ * ----------
+ * With --gc-compact, a full cycle that leaves the occupied arenas more than
+ * GC_COMPACT_WASTE vacant asks for a compaction at the next safe point
+ * (GC_SAFEPOINT), which the evaluators reach between top-level statements.
+ * There, the only C code running is the evaluator loop, whose values are all
+ * in locals or in the GC roots. Values referenced from the C stack are
+ * pinned; the others move from the sparsest arenas into the densest ones,
+ * leaving a forwarding pointer behind. Then every reference in the heap and
+ * the roots is fixed, the inline caches are flushed, and the emptied arenas
+ * are freed by the resize.
+ *
+ * Statistics
+ * ----------
+ * Every stretch of GC work done with the program stopped is a pause: a minor
+ * collection, a marking step, the finish of the mark or the sweep of an
+ * arena. Pauses are timed in microseconds and counted in a histogram, and
+ * each collection sums its own (see gc.info() and --gc-stats).
  *
  * Issues & Enhancement Ideas
  * --------------------------
- * - Arena free lists should be bitmaps. Integer arrays are a huge waste of
- *   space.
  * - Store the color (e.g. black or white) of the js_val instead of explicitly
  *   labeling them marked or unmarked. Then we can flip the color semantics
  *   after each run and save some time unmarking.
- * - Tri- or quad-color incremental algorithm a la LuaJIT.
+ * - Sweep arenas on helper threads. Freeing a value's payloads (strings,
+ *   property tables) doesn't touch the rest of the heap.
  * - Utility structs (e.g. js_args, js_prop, eval_state, ast_nodes) need to be
  *   garbage collected or freed by hand, whichever is more appropriate.
  * - Strings need to be stored within the arena somehow. Maybe they can be
@@ -79,56 +177,369 @@
  */
 
 
+const long fh_gc_pause_bounds[GC_PAUSE_BUCKETS - 1] = {
+  100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000
+};
+
+/* Microseconds on the wall clock. */
+long
+fh_gc_now()
+{
+  struct timeval t;
+  gettimeofday(&t, NULL);
+  return t.tv_sec * 1000000L + t.tv_usec;
+}
+
+static void
+gc_print_stats(FILE *out, gc_collection *c)
+{
+  fprintf(out, "{\"type\": \"%s\", \"start_us\": %ld, \"pause_us\": %ld, "
+      "\"max_pause_us\": %ld, \"pauses\": %lu, \"marked\": %lu, \"swept\": %lu, "
+      "\"moved\": %lu, "
+      "\"heap_before\": %zu, \"heap_after\": %zu, \"used_before\": %lu, "
+      "\"used_after\": %lu}\n",
+      c->type, c->start - fh->gc_stats.epoch, c->pause,
+      c->max_pause, c->pauses, c->marked, c->swept, c->moved, c->heap_before,
+      c->heap_after, c->used_before, c->used_after);
+  fflush(out);
+}
+
+/* Write the totals of the collections so far, with the process's peak
+ * resident size (in kilobytes on Linux, bytes on macOS), as a last line. */
+void
+fh_gc_print_totals(FILE *out)
+{
+  gc_stats *stats = &fh->gc_stats;
+  struct rusage usage;
+  long max_rss = getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+
+  fprintf(out, "{\"type\": \"total\", \"runs\": %lu, \"minor_runs\": %lu, "
+      "\"pause_us\": %ld, \"max_pause_us\": %ld, \"max_rss\": %ld}\n",
+      stats->major_runs, stats->minor_runs, stats->total_pause,
+      stats->max_pause, max_rss);
+  fflush(out);
+}
+
+static void
+gc_collection_begin(const char *type)
+{
+  gc_collection *c = &fh->gc_stats.current;
+  memset(c, 0, sizeof(gc_collection));
+  c->type = type;
+  c->start = fh_gc_now();
+  c->heap_before = fh_heap_size();
+  c->used_before = fh->gc_used;
+  if (STREQ(type, "major")) fh->gc_stats.major_runs++;
+  else if (STREQ(type, "minor")) fh->gc_stats.minor_runs++;
+  else fh->gc_stats.compactions++;
+}
+
+/* The collection is over once the pause it ends in is. */
+static void
+gc_collection_end()
+{
+  fh->gc_stats.ending = true;
+}
+
+/* Pauses nest, e.g. a marking step finishing the mark is one pause. */
+static void
+gc_pause_begin()
+{
+  if (fh->gc_stats.pause_depth++ == 0)
+    fh->gc_stats.pause_start = fh_gc_now();
+}
+
+static void
+gc_pause_end()
+{
+  gc_stats *stats = &fh->gc_stats;
+  if (--stats->pause_depth > 0) return;
+
+  long pause = fh_gc_now() - stats->pause_start;
+  int i = 0;
+  while (i < GC_PAUSE_BUCKETS - 1 && pause > fh_gc_pause_bounds[i]) i++;
+  stats->histogram[i]++;
+  stats->total_pause += pause;
+  stats->max_pause = MAX(stats->max_pause, pause);
+
+  gc_collection *c = &stats->current;
+  c->pause += pause;
+  c->max_pause = MAX(c->max_pause, pause);
+  c->pauses++;
+
+  if (stats->ending) {
+    stats->ending = false;
+    c->heap_after = fh_heap_size();
+    c->used_after = fh->gc_used;
+    stats->last = *c;
+    if (fh->opt_gc_stats) gc_print_stats(fh->opt_gc_stats, c);
+  }
+}
+
+static int
+arenas_for(size_t bytes)
+{
+  return bytes / ARENA_BYTES;
+}
+
+static bool
+can_grow()
+{
+  // A heap limit smaller than an arena still allows one, and the limit is
+  // lifted to make the error reporting that it's been reached.
+  return !fh->opt_max_heap || !fh->gc_num_arenas || fh->gc_oom ||
+    fh->gc_num_arenas < arenas_for(fh->opt_max_heap);
+}
+
 static gc_arena *
 fh_new_arena()
 {
   gc_arena *arena = malloc(sizeof(gc_arena));
+  if (!arena) return NULL;
 
   arena->num_slots = SLOTS_PER_ARENA;
   arena->used_slots = 0;
+  arena->young_slots = 0;
+  arena->unswept = false;
+  arena->evacuate = false;
+  arena->bump = 0;
+  arena->free = NULL;
 
-  memset(arena->freelist, 0, sizeof(arena->freelist));
+  memset(arena->used, 0, sizeof(arena->used));
+  memset(arena->young, 0, sizeof(arena->young));
+
+  if (fh->gc_num_arenas == fh->gc_arenas_cap) {
+    fh->gc_arenas_cap = fh->gc_arenas_cap ? fh->gc_arenas_cap * 2 : 8;
+    fh->gc_arenas = realloc(fh->gc_arenas, fh->gc_arenas_cap * sizeof(gc_arena *));
+  }
+  fh->gc_arenas[fh->gc_num_arenas++] = arena;
   return arena;
 }
 
-static gc_arena *
-fh_get_arena()
+static void
+fh_free_arena(int index)
 {
-  // Currently 1 arena, but room for more.
-  gc_arena *arena = NULL;
-  if (fh->gc_num_arenas == 0) {
-    arena = fh_new_arena();
-    fh->gc_arenas[0] = arena;
-    fh->gc_num_arenas++;
+  gc_arena *arena = fh->gc_arenas[index];
+
+  // Forget recent allocations made in the arena (they're all garbage now).
+  int i;
+  for (i = 0; i < GC_RECENT; i++) {
+    js_val *val = fh->gc_recent[i];
+    if (val >= arena->slots && val < arena->slots + arena->num_slots)
+      fh->gc_recent[i] = NULL;
+  }
+
+  free(arena);
+  fh->gc_arenas[index] = fh->gc_arenas[--fh->gc_num_arenas];
+  fh->gc_alloc_arena = 0;
+}
+
+/* Occupy a vacant slot of the arena, or return NULL when it's full. */
+static js_val *
+arena_take(gc_arena *arena)
+{
+  js_val *val;
+  if (arena->free) {
+    val = arena->free;
+    arena->free = NEXT_FREE(val);
+    NEXT_FREE(val) = NULL;
+  }
+  else if (arena->bump < arena->num_slots) {
+    // Fresh slots are zeroed like vacant ones, since values are only
+    // partly initialized before they're reachable.
+    val = &arena->slots[arena->bump++];
+    memset(val, 0, sizeof(js_val));
   }
   else
-    arena = fh->gc_arenas[0];
-  return arena;
+    return NULL;
+
+  long i = val - arena->slots;
+  arena->used[i / 64] |= 1ULL << (i % 64);
+  arena->used_slots++;
+  fh->gc_used++;
+  return val;
+}
+
+static js_val *
+arena_alloc(gc_arena *arena)
+{
+  js_val *val = arena_take(arena);
+  if (!val) return NULL;
+
+  long i = val - arena->slots;
+  arena->young[i / 64] |= 1ULL << (i % 64);
+  arena->young_slots++;
+  fh->gc_young++;
+
+  val->young = true;
+  val->remembered = false;
+
+  // Values allocated while marking are black, but their members are set
+  // outside the write barrier, so they're scanned again at the finish.
+  val->marked = fh->gc_state == GC_STATE_MARK;
+  if (val->marked)
+    gc_push(&fh->gc_new, val);
+
+  fh->gc_recent[fh->gc_recent_pos] = val;
+  fh->gc_recent_pos = (fh->gc_recent_pos + 1) % GC_RECENT;
+  return val;
+}
+
+static js_val *
+heap_alloc()
+{
+  int i, n = fh->gc_num_arenas;
+  for (i = 0; i < n; i++) {
+    int index = (fh->gc_alloc_arena + i) % n;
+    gc_arena *arena = fh->gc_arenas[index];
+    if (arena->unswept) {
+      gc_pause_begin();
+      fh_gc_sweep(arena);
+      gc_pause_end();
+    }
+    if (arena->used_slots == arena->num_slots) continue;
+    fh->gc_alloc_arena = index;
+    return arena_alloc(arena);
+  }
+  return NULL;
+}
+
+static js_val *
+grow_alloc()
+{
+  if (!can_grow()) return NULL;
+  gc_arena *arena = fh_new_arena();
+  if (!arena) return NULL;
+  fh->gc_alloc_arena = fh->gc_num_arenas - 1;
+  return arena_alloc(arena);
+}
+
+/* Used slots, with the bytes of buffers outside the heap counted as the
+ * slots they would fill, so that dropping buffers starts cycles to free
+ * them. */
+static unsigned long
+gc_load()
+{
+  return fh->gc_used + fh->gc_external / sizeof(js_val);
+}
+
+/* Resize the heap after a collection, according to the growth policy. */
+static void
+fh_gc_resize()
+{
+  int i, target = ceil(fh_heap_used() / (fh->opt_heap_grow * SLOTS_PER_ARENA));
+  int min = arenas_for(fh->opt_initial_heap);
+  if (target < min) target = min;
+  if (target < 1) target = 1;
+
+  while (fh->gc_num_arenas < target && can_grow())
+    if (!fh_new_arena()) break;
+
+  for (i = fh->gc_num_arenas - 1; i >= 0 && fh->gc_num_arenas > target; i--) {
+    if (fh->gc_arenas[i]->used_slots == 0)
+      fh_free_arena(i);
+  }
+
+  // Start the next cycle halfway through the free slots.
+  unsigned long total = fh->gc_num_arenas * SLOTS_PER_ARENA;
+  fh->gc_threshold = gc_load() + (total - fh->gc_used) / 2;
+}
+
+/* Count `bytes` more (or, negative, fewer) of buffers owned by values. */
+void
+fh_gc_external(long bytes)
+{
+  fh->gc_external += bytes;
+}
+
+size_t
+fh_heap_size()
+{
+  return fh->gc_num_arenas * ARENA_BYTES;
+}
+
+/* Used slots that start a cycle. Until the first collection, that's half
+ * the initial heap. */
+static unsigned long
+gc_threshold()
+{
+  if (!fh->gc_threshold)
+    fh->gc_threshold = MAX(arenas_for(fh->opt_initial_heap), 1) * SLOTS_PER_ARENA / 2;
+  return fh->gc_threshold;
+}
+
+unsigned long
+fh_heap_used()
+{
+  return fh->gc_used;
 }
 
 js_val *
 fh_malloc(bool first_attempt)
 {
-  if (fh->gc_state != GC_STATE_NONE) {
+  gc_state state = fh->gc_state;
+  if (state != GC_STATE_NONE && state != GC_STATE_MARK && state != GC_STATE_SWEEP) {
     fprintf(stderr, "Error: politely refusing to allocate during garbage collection");
-    exit(EXIT_FAILURE);
+    fh_exit(EXIT_FAILURE);
   }
 
-  gc_arena *arena = fh_get_arena();
-  int i;
-  for (i = 0; i < arena->num_slots; i++) {
-    if (!arena->freelist[i]) {
-      arena->freelist[i] = true;
-      arena->used_slots++;
-      return &arena->slots[i];
+  if (state == GC_STATE_MARK || state == GC_STATE_SWEEP) {
+    if (++fh->gc_debt >= GC_STEP) {
+      fh->gc_debt = 0;
+      gc_step();
     }
   }
+  // Nothing is rooted until the runtime has been bootstrapped.
+  else if (fh->global) {
+    if (fh->gc_young >= GC_NURSERY)
+      gc_minor();
+    if (gc_load() >= gc_threshold())
+      gc_start();
+  }
+
+  js_val *val = heap_alloc();
+  if (val) return val;
+
+  // Grow freely up to the initial heap size.
+  if (fh->gc_num_arenas < arenas_for(fh->opt_initial_heap) || !fh->gc_num_arenas)
+    if ((val = grow_alloc())) return val;
+
   if (first_attempt) {
-    fh_gc();
+    // Everything is swept by now, and resizing the heap may grow it.
+    if (fh->gc_state == GC_STATE_SWEEP) {
+      gc_sweep_rest();
+      if ((val = heap_alloc())) return val;
+    }
+    if (fh->gc_state == GC_STATE_NONE && fh->gc_young) {
+      gc_minor();
+      if ((val = heap_alloc())) return val;
+    }
+
+    // The heap filled up before the marker was done (or before it started),
+    // so finish the mark at once. The allocation below sweeps what it needs.
+    if (fh->gc_state != GC_STATE_MARK) gc_start();
+    gc_finish();
     return fh_malloc(false);
   } 
-  fprintf(stderr, "Error: process out of memory");
-  exit(EXIT_FAILURE);
+
+  // Everything survived and the policy didn't grow the heap (e.g. a growth
+  // ratio of 1), so grow by an arena.
+  if ((val = grow_alloc())) return val;
+
+  // A script can't catch hitting a quota set for it, but can catch hitting
+  // its own limit.
+  if (fh->opt_heap_quota && !fh->gc_oom)
+    fh_terminate(QUOTA_HEAP);
+  if (fh->opt_max_heap && !fh->gc_oom) {
+    fh->gc_oom = true;
+    js_val *err = fh_new_error(E_RANGE, "out of memory (heap limit of %zu bytes)",
+        fh->opt_max_heap);
+    fh->gc_oom = false;
+    fh_throw(fh->callstack, err);
+  }
+
+  fprintf(stderr, "Error: process out of memory\n");
+  fh_exit(EXIT_FAILURE);
   UNREACHABLE();
 }
 
@@ -138,23 +549,27 @@ fh_gc_debug()
 #ifdef FH_GC_PROFILE
 
   gc_state state = fh->gc_state;
-  long clockt = clock() / (CLOCKS_PER_SEC / 1000);
 
   if (state == GC_STATE_STARTING) {
     puts("GC: starting");
-    fh->gc_last_start = clockt;
-    fh->gc_runs++;
   }
   if (state == GC_STATE_MARK) {
     puts("GC: mark phase");
   }
+  if (state == GC_STATE_ATOMIC) {
+    puts("GC: finishing mark phase");
+  }
+  if (state == GC_STATE_MINOR) {
+    puts("GC: minor collection");
+  }
   if (state == GC_STATE_SWEEP) {
     puts("GC: sweep phase");
   }
+  if (state == GC_STATE_COMPACT) {
+    puts("GC: compacting");
+  }
   if (state == GC_STATE_NONE) {
-    long delta = clockt - fh->gc_last_start;
-    printf("GC: finished|inactive (last run: %ld ms)\n", delta);
-    fh->gc_time += delta;
+    printf("GC: finished|inactive (paused %ld us so far)\n", fh->gc_stats.current.pause);
   }
 
   long total_slots = 0, used_slots = 0;
@@ -165,12 +580,12 @@ fh_gc_debug()
   }
 
   printf(
-    "  %ld slots | %ld/%ld used slots | %ld/%ld vacant slots | %ld usage KB | %d runs\n",
+    "  %ld slots | %ld/%ld used slots | %ld/%ld vacant slots | %ld usage KB | %lu runs\n",
     total_slots,
     used_slots, total_slots,
     total_slots - used_slots, total_slots,
     (total_slots * sizeof(js_val)) / 1000,
-    fh->gc_runs
+    fh->gc_stats.major_runs
   );
 
 #endif
@@ -181,68 +596,303 @@ fh_gc_debug_arena(gc_arena *arena)
 {
 #ifdef FH_GC_PROFILE_VERBOSE
   for (int i = 0; i < arena->num_slots; i++) {
-    printf("slot[%4d]: (USED %d) (MARKED %d)\n", i, arena->freelist[i], arena->freelist[i] && arena->slots[i].marked);
+    bool used = arena->used[i / 64] & (1ULL << (i % 64));
+    printf("slot[%4d]: (USED %d) (MARKED %d)\n", i, used, used && arena->slots[i].marked);
   }
 #endif
 }
 
 static void
-fh_gc_mark(js_val *val, int depth)
+gc_push(gc_stack *stack, js_val *val)
+{
+  if (stack->len == stack->cap) {
+    stack->cap = stack->cap ? stack->cap * 2 : 256;
+    stack->vals = realloc(stack->vals, stack->cap * sizeof(js_val *));
+  }
+  stack->vals[stack->len++] = val;
+}
+
+/* Shade a white value gray: mark it and queue it for scanning. */
+static void
+gc_shade(js_val *val)
 {
   if (val && val->flagged) puts("Attempting to mark flagged val");
   if (!val || val->marked) return; 
+  // A minor collection leaves the old generation alone.
+  if (fh->gc_state == GC_STATE_MINOR && !val->young) return;
 
   val->marked = true;
+  fh->gc_stats.current.marked++;
+  gc_push(&fh->gc_gray, val);
+}
 
-  GC_DEBUG_VERBOSE(depth, val);
+/* Blacken a value by shading everything it references. Returns the amount
+ * of work done, roughly the number of references followed. */
+static unsigned long
+gc_scan(js_val *val)
+{
+  unsigned long work = 1;
 
-  GC_PRINT_VERBOSE(depth, "Marking prototype\n");
-  fh_gc_mark(val->proto, depth + 1);
+  GC_DEBUG_VERBOSE(0, val);
 
-  if (IS_OBJ(val)) {
-    GC_PRINT_VERBOSE(depth, "Marking primitive\n");
-    fh_gc_mark(val->object.primitive, depth + 1);
+  GC_PRINT_VERBOSE(0, "Marking prototype\n");
+  gc_shade(val->proto);
 
-    GC_PRINT_VERBOSE(depth, "Marking bound this\n");
-    fh_gc_mark(val->object.bound_this, depth + 1);
+  if (IS_OBJ(val)) {
+    GC_PRINT_VERBOSE(0, "Marking object members\n");
+    gc_shade(val->object.primitive);
+    gc_shade(val->object.bound_this);
+    gc_shade(val->object.scope);
+    gc_shade(val->object.parent);
+    if (val->object.node)
+      fh_get_node_data(val->object.node)->func_marked = true;
 
-    GC_PRINT_VERBOSE(depth, "Marking scope\n");
-    fh_gc_mark(val->object.scope, depth + 1);
+    js_args *bound = val->object.bound_args;
+    if (bound) {
+      unsigned i;
+      for (i = 0; i < bound->argc; i++)
+        gc_shade(bound->argv[i]);
+      work += bound->argc;
+    }
+  }
 
-    GC_PRINT_VERBOSE(depth, "Marking instance\n");
-    fh_gc_mark(val->object.instance, depth + 1);
+  if (IS_STR(val) && val->string.left) {
+    GC_PRINT_VERBOSE(0, "Marking rope\n");
+    gc_shade(val->string.left);
+    gc_shade(val->string.right);
+  }
 
-    GC_PRINT_VERBOSE(depth, "Marking parent\n");
-    fh_gc_mark(val->object.parent, depth + 1);
+  if (val->elements) {
+    unsigned long i;
+    GC_PRINT_VERBOSE(0, "Marking elements\n");
+    for (i = 0; i < val->elements_cap; i++) {
+      if (val->elements[i] && val->elements[i] != val)
+        gc_shade(val->elements[i]);
+    }
+    work += val->elements_cap;
   }
 
+  if (val->typed)
+    gc_shade(val->typed->buffer);
+
   if (val->map) {
     js_prop *prop;
-    OBJ_ITER(val, prop) {
+    for (prop = val->map; prop; prop = prop->hh.next, work++) {
       if (prop->ptr && !prop->circular) {
-        GC_PRINT_VERBOSE(depth, "Marking %s\n", prop->name);
-        fh_gc_mark(prop->ptr, depth + 1);
+        GC_PRINT_VERBOSE(0, "Marking %s\n", prop->name);
+        gc_shade(prop->ptr);
       }
     }
   }
+  return work;
+}
+
+static int
+cmp_arenas(const void *a, const void *b)
+{
+  const gc_arena *x = *(gc_arena * const *)a, *y = *(gc_arena * const *)b;
+  return x < y ? -1 : x > y;
+}
+
+/* Shade whatever looks like a pointer into an occupied slot, given the
+ * arenas sorted by address. */
+static void
+gc_shade_maybe(void *ptr, gc_arena **arenas, int n)
+{
+  int lo = 0, hi = n - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    gc_arena *arena = arenas[mid];
+    if ((char *)ptr < (char *)arena->slots) hi = mid - 1;
+    else if ((char *)ptr >= (char *)(arena->slots + arena->num_slots)) lo = mid + 1;
+    else {
+      long i = ((char *)ptr - (char *)arena->slots) / sizeof(js_val);
+      if (arena->used[i / 64] & (1ULL << (i % 64)))
+        gc_shade(&arena->slots[i]);
+      return;
+    }
+  }
+}
+
+/* Have the stack scan reach `frame`, a local of a caller into the
+ * interpreter, if it's older than the base so far. The stack grows down. */
+void
+fh_gc_stack_from(void *frame)
+{
+  if (!fh->gc_stack_base || (char *)frame > (char *)fh->gc_stack_base)
+    fh->gc_stack_base = frame;
+}
+
+/* C code holds its temporaries in locals, out of reach of the other roots,
+ * so treat everything on the C stack (and in registers) that could point to
+ * a value as a root. */
+NO_SANITIZE_ADDRESS static void
+gc_mark_stack()
+{
+  if (!fh->gc_stack_base || !fh->gc_num_arenas) return;
+
+  // Spill the callee-saved registers into this frame. (setjmp won't do: glibc
+  // mangles the frame and stack pointers it saves.)
+  void *here;
+  __builtin_unwind_init();
+
+  int n = fh->gc_num_arenas;
+  gc_arena **arenas = malloc(n * sizeof(gc_arena *));
+  memcpy(arenas, fh->gc_arenas, n * sizeof(gc_arena *));
+  qsort(arenas, n, sizeof(gc_arena *), cmp_arenas);
+  char *min = (char *)arenas[0]->slots;
+  char *max = (char *)(arenas[n - 1]->slots + arenas[n - 1]->num_slots);
+
+  char *top = (char *)&here, *base = fh->gc_stack_base;
+  if (top > base) { char *tmp = top; top = base; base = tmp; }
+  void **word = (void **)((uintptr_t)top & ~(sizeof(void *) - 1));
+  for (; (char *)word < base; word++) {
+    char *ptr = *word;
+    if (ptr >= min && ptr < max)
+      gc_shade_maybe(ptr, arenas, n);
+  }
+  free(arenas);
+}
+
+static void
+gc_shade_root(js_val **ref)
+{
+  gc_shade(*ref);
+}
+
+static void
+gc_mark_roots()
+{
+  gc_mark_stack();
+  gc_shade(fh->global);
+  gc_shade(fh->modules);
+  // The prototypes outlive their constructors being overwritten.
+  gc_shade(fh->function_proto);
+  gc_shade(fh->object_proto);
+  gc_shade(fh->array_proto);
+  gc_shade(fh->string_proto);
+  gc_shade(fh->number_proto);
+  gc_shade(fh->boolean_proto);
+  gc_shade(fh->regexp_proto);
+  gc_shade(fh->error_proto);
+  gc_shade(fh->buffer_proto);
+  eval_state *top;
+  for (top = fh->callstack; top; top = top->parent) {
+    gc_shade(top->scope);
+    if (top->args) {
+      unsigned i;
+      for (i = 0; i < top->args->argc; i++)
+        gc_shade(top->args->argv[i]);
+    }
+  }
+  // A value being built (e.g. a string whose length is being set) isn't
+  // reachable from any scope yet, so keep the latest allocations alive.
+  int r;
+  for (r = 0; r < GC_RECENT; r++)
+    gc_shade(fh->gc_recent[r]);
+  unsigned long c;
+  for (c = 0; c < fh->num_constants; c++)
+    gc_shade(fh->constants[c]);
+  vm_frame *frame;
+  for (frame = fh->vm_frames; frame; frame = frame->parent) {
+    int i;
+    gc_shade(frame->ctx);
+    gc_shade(frame->result);
+    gc_shade(frame->ret);
+    for (i = 0; i < frame->chunk->max_stack; i++)
+      gc_shade(frame->stack[i]);
+    for (i = 0; i < frame->chunk->num_regs; i++)
+      gc_shade(frame->regs[i]);
+    for (i = 0; i < frame->chunk->num_iters; i++) {
+      gc_shade(frame->iters[i].obj);
+      gc_shade(frame->iters[i].keys);
+    }
+  }
+  for (c = 0; c < fh->num_frame_pools; c++)
+    gc_shade(fh->node_data[fh->frame_pools[c]].frames);
+  fh_loop_each_root(gc_shade_root);
+}
+
+/* Scan gray values until none are left, or, given a budget, until that much
+ * work is done or the pause target has passed. Returns whether the gray
+ * stack was emptied. */
+static bool
+gc_drain(unsigned long budget)
+{
+  clock_t start = clock();
+  clock_t limit = fh->opt_gc_pause * CLOCKS_PER_SEC / 1000;
+  unsigned long work = 0, n = 0;
+
+  while (fh->gc_gray.len) {
+    if (budget && work >= budget) return false;
+    if (budget && limit && ++n % 32 == 0 && clock() - start >= limit)
+      return false;
+    work += gc_scan(fh->gc_gray.vals[--fh->gc_gray.len]);
+  }
+  return true;
+}
+
+void
+fh_gc_barrier(js_val *obj, js_val *val)
+{
+  if (!val) return;
+
+  // An old object pointing to a young value is a root of the next minor
+  // collection.
+  if (val->young && !obj->young && !obj->remembered) {
+    obj->remembered = true;
+    gc_push(&fh->gc_remembered, obj);
+  }
+
+  // Storing a white value into a black object would hide it from the
+  // marker, so shade it. (Gray and white objects are still to be scanned.)
+  if (fh->gc_state == GC_STATE_MARK && obj->marked && !val->marked)
+    gc_shade(val);
+}
+
+/* Forget the remembered set, once nothing is young anymore. */
+static void
+gc_forget()
+{
+  unsigned long n;
+  for (n = 0; n < fh->gc_remembered.len; n++)
+    fh->gc_remembered.vals[n]->remembered = false;
+  fh->gc_remembered.len = 0;
+  fh->gc_young = 0;
 }
 
 static void
 fh_gc_free_val(js_val *val)
 {
-  // Free the object hashtable 
+  free(val->slots);
+  free(val->elements);
+
+  if (val->typed) {
+    js_typed *typed = val->typed;
+    if (typed->kind == TA_BUFFER || typed->kind == TA_READER)
+      fh->gc_external -= typed->length;
+    if (typed->kind == TA_BUFFER) free(typed->data);
+    if (typed->kind == TA_READER) fs_reader_free(typed->data);
+    free(typed);
+  }
+
+  // Free the object hashtable and its props (their names are atoms).
   //
   // Note we're not freeing the values pointed at, only the pointers to them
   // and the hashtable overhead.
-  /* if (val->map) { */
-  /*   js_prop *prop, *tmp; */
-  /*   HASH_ITER(hh, val->map, prop, tmp) { */
-  /*     HASH_DEL(val->map, prop); */
-  /*     if (prop != NULL) { */
-  /*       free(prop); */
-  /*     } */
-  /*   } */
-  /* } */
+  if (val->map) {
+    js_prop *prop = val->map, *next;
+    HASH_CLEAR(hh, val->map);
+    for (; prop; prop = next) {
+      next = prop->hh.next;
+      free(prop);
+    }
+  }
+
+  if (IS_OBJ(val) && val->object.bound_args) {
+    args_release(val->object.bound_args);
+    free(val->object.bound_args);
+  }
 
   // Free any strings (dynamically alloc-ed outside slots)
   if (IS_STR(val) && val->string.ptr != NULL) {
@@ -252,57 +902,558 @@ fh_gc_free_val(js_val *val)
   memset(val, 0, sizeof(js_val));
 }
 
+static void
+fh_gc_free_slot(gc_arena *arena, int w, int bit)
+{
+  js_val *val = &arena->slots[w * 64 + bit];
+  if (val->flagged) puts("GC: freeing flagged val");
+  fh_gc_free_val(val);
+  fh->gc_stats.current.swept++;
+  arena->used[w] &= ~(1ULL << bit);
+  arena->used_slots--;
+  fh->gc_used--;
+  NEXT_FREE(val) = arena->free;
+  arena->free = val;
+}
+
+/* Free the unmarked values of an arena left unswept by the last cycle. */
 static void
 fh_gc_sweep(gc_arena *arena)
 {
-  js_val val;
-  int sweeped_count = 0;
-  for (int i = 0; i < arena->num_slots; i++) {
-    if (!arena->freelist[i]) return;
-    val = arena->slots[i];
-    if (!val.marked) {
-      if (val.flagged) puts("GC: freeing flagged val");
-      arena->freelist[i] = false;
-      fh_gc_free_val(&val);
-      arena->used_slots--;
-      sweeped_count++;
-    } else {
-      arena->slots[i].marked = false;
+  arena->unswept = false;
+
+  int w;
+  for (w = 0; w < ARENA_WORDS; w++) {
+    uint64_t bits = arena->used[w];
+    while (bits) {
+      int bit = __builtin_ctzll(bits);
+      bits &= bits - 1;
+
+      js_val *val = &arena->slots[w * 64 + bit];
+      if (val->marked) {
+        val->marked = false;
+        continue;
+      }
+      fh_gc_free_slot(arena, w, bit);
     }
   }
 }
 
-void
-fh_gc()
+/* Make every value old, e.g. once a full cycle has marked them all. */
+static void
+gc_promote(gc_arena *arena)
+{
+  int w;
+  for (w = 0; w < ARENA_WORDS && arena->young_slots; w++) {
+    uint64_t bits = arena->young[w];
+    while (bits) {
+      int bit = __builtin_ctzll(bits);
+      bits &= bits - 1;
+      arena->slots[w * 64 + bit].young = false;
+      arena->young_slots--;
+    }
+    arena->young[w] = 0;
+  }
+}
+
+/* Free the unmarked young values and promote the others. */
+static void
+fh_gc_sweep_young(gc_arena *arena)
 {
-  gc_arena *arena = fh_get_arena();
+  int w;
+  for (w = 0; w < ARENA_WORDS && arena->young_slots; w++) {
+    uint64_t bits = arena->young[w];
+    while (bits) {
+      int bit = __builtin_ctzll(bits);
+      bits &= bits - 1;
 
-  fh_gc_debug_arena(arena);
+      js_val *val = &arena->slots[w * 64 + bit];
+      if (val->marked)
+        val->marked = val->young = false;
+      else
+        fh_gc_free_slot(arena, w, bit);
+      arena->young_slots--;
+    }
+    arena->young[w] = 0;
+  }
+}
 
-  // Start
+/* Collect the young generation: trace from the roots and the remembered set
+ * without entering old values, then sweep the young values only. */
+static void
+gc_minor()
+{
+  int i;
+  gc_pause_begin();
+  gc_collection_begin("minor");
+  fh->gc_state = GC_STATE_MINOR;
+  fh_gc_debug();
+
+  gc_mark_roots();
+  unsigned long n;
+  for (n = 0; n < fh->gc_remembered.len; n++)
+    gc_scan(fh->gc_remembered.vals[n]);
+  gc_drain(0);
+  gc_forget();
+
+  for (i = 0; i < fh->gc_num_arenas; i++) {
+    if (fh->gc_arenas[i]->young_slots)
+      fh_gc_sweep_young(fh->gc_arenas[i]);
+  }
+
+  fh->gc_state = GC_STATE_NONE;
+  fh_gc_debug();
+  gc_collection_end();
+  gc_pause_end();
+}
+
+/* Begin a cycle: shade the roots and pace the marking steps to finish well
+ * before the free slots run out. */
+static void
+gc_start()
+{
+  gc_pause_begin();
+  gc_collection_begin("major");
   fh->gc_state = GC_STATE_STARTING;
   fh_gc_debug();
 
-  // Mark
+  fh_unmark_evicted_funcs();
+  gc_mark_roots();
+
+  unsigned long total = fh->gc_num_arenas * SLOTS_PER_ARENA;
+  unsigned long free = total > fh->gc_used ? total - fh->gc_used : 1;
+  fh->gc_step_work = GC_STEP * (1 + 4 * fh->gc_used / free);
+  fh->gc_debt = 0;
+
   fh->gc_state = GC_STATE_MARK;
-  fh_gc_mark(fh->global, 0);
-  if (fh->callstack) {
-    eval_state *top = fh->callstack; 
-    while (top) {
-      fh_gc_mark(top->scope, 0);
-      top = top->parent;
+  fh_gc_debug();
+  gc_pause_end();
+}
+
+/* Finish the mark atomically: re-shade the roots (which are not behind the
+ * write barrier) and the values allocated since the start, and mark what's
+ * left. Then every arena awaits the sweep. */
+static void
+gc_finish()
+{
+  int i;
+  gc_pause_begin();
+  fh->gc_state = GC_STATE_ATOMIC;
+
+  gc_mark_roots();
+  unsigned long n;
+  for (n = 0; n < fh->gc_new.len; n++)
+    gc_scan(fh->gc_new.vals[n]);
+  fh->gc_new.len = 0;
+  gc_drain(0);
+  gc_forget();
+  fh_gc_debug();
+
+  // The survivors are old, and the barrier must see them as old right away,
+  // before their arenas are swept.
+  for (i = 0; i < fh->gc_num_arenas; i++) {
+    gc_promote(fh->gc_arenas[i]);
+    fh->gc_arenas[i]->unswept = true;
+  }
+  fh->gc_state = GC_STATE_SWEEP;
+  fh_gc_debug();
+  gc_pause_end();
+}
+
+/* Sweep the next unswept arena. Once none are left, resize the heap and end
+ * the cycle. */
+static void
+gc_sweep_step()
+{
+  int i;
+  gc_pause_begin();
+  for (i = 0; i < fh->gc_num_arenas; i++) {
+    if (fh->gc_arenas[i]->unswept) {
+      fh_gc_sweep(fh->gc_arenas[i]);
+      gc_pause_end();
+      return;
     }
   }
+  fh_gc_resize();
+  fh->gc_state = GC_STATE_NONE;
   fh_gc_debug();
+  if (fh->opt_heap_profile)
+    fh_heap_profile_dump();
+  if (fh->opt_gc_compact && gc_fragmented())
+    fh->gc_compact_pending = true;
+  gc_collection_end();
+  gc_pause_end();
+}
 
-  // Sweep
-  fh->gc_state = GC_STATE_SWEEP;
-  fh_gc_sweep(arena);
+static void
+gc_sweep_rest()
+{
+  if (fh->gc_state != GC_STATE_SWEEP) return;
+  gc_pause_begin();
+  while (fh->gc_state == GC_STATE_SWEEP)
+    gc_sweep_step();
+  gc_pause_end();
+}
+
+/* Whether the occupied arenas are vacant enough for a compaction to free at
+ * least two of them. */
+static bool
+gc_fragmented()
+{
+  int i, occupied = 0;
+  for (i = 0; i < fh->gc_num_arenas; i++)
+    if (fh->gc_arenas[i]->used_slots) occupied++;
+
+  unsigned long slots = occupied * SLOTS_PER_ARENA;
+  int needed = (fh->gc_used + SLOTS_PER_ARENA - 1) / SLOTS_PER_ARENA;
+  return occupied - needed >= 2 && slots - fh->gc_used > slots * GC_COMPACT_WASTE;
+}
+
+static int
+cmp_arena_use(const void *a, const void *b)
+{
+  return (*(gc_arena **)a)->used_slots - (*(gc_arena **)b)->used_slots;
+}
+
+/* Pin the values that can't be moved: those the C stack may point to, and
+ * those referenced from C structures outside the arenas. */
+static void
+gc_pin()
+{
+  int i;
+  gc_mark_stack();
+  for (i = 0; i < GC_RECENT; i++)
+    gc_shade(fh->gc_recent[i]);
+
+  // AST nodes point at their literals too.
+  unsigned long c;
+  for (c = 0; c < fh->num_constants; c++)
+    gc_shade(fh->constants[c]);
+
+  // The shared cells point at their prototypes.
+  for (i = 0; i < 3; i++)
+    if (fh->num_special[i]) gc_shade(fh->num_special[i]->proto);
+  for (i = 0; i < NUM_CACHE_BLOCKS; i++)
+    if (fh->num_cache[i]) gc_shade(fh->num_cache[i]->proto);
+  for (i = 0; i < 2; i++)
+    if (fh->bools[i]) gc_shade(fh->bools[i]->proto);
+
+  // Pins are marks; they needn't be scanned.
+  fh->gc_gray.len = 0;
+}
+
+/* Move a value to a target arena, leaving a forwarding pointer. */
+static void
+gc_move(gc_arena *from, int slot, gc_arena *to)
+{
+  js_val *val = &from->slots[slot];
+  js_val *copy = arena_take(to);
+  *copy = *val;
+
+  if (val->young) {
+    long i = copy - to->slots;
+    to->young[i / 64] |= 1ULL << (i % 64);
+    to->young_slots++;
+  }
+  val->forwarded = true;
+  FORWARD(val) = copy;
+  fh->gc_stats.current.moved++;
+}
+
+static void
+gc_fix_val(js_val *val)
+{
+  GC_FIX(val->proto);
+
+  if (IS_OBJ(val)) {
+    GC_FIX(val->object.primitive);
+    GC_FIX(val->object.bound_this);
+    GC_FIX(val->object.scope);
+    GC_FIX(val->object.parent);
+
+    js_args *bound = val->object.bound_args;
+    if (bound) {
+      unsigned i;
+      for (i = 0; i < bound->argc; i++)
+        GC_FIX(bound->argv[i]);
+    }
+  }
+
+  if (IS_STR(val)) {
+    GC_FIX(val->string.left);
+    GC_FIX(val->string.right);
+  }
+
+  unsigned long i;
+  for (i = 0; val->elements && i < val->elements_cap; i++)
+    GC_FIX(val->elements[i]);
+
+  if (val->typed)
+    GC_FIX(val->typed->buffer);
+
+  js_prop *prop;
+  for (prop = val->map; prop; prop = prop->hh.next)
+    GC_FIX(prop->ptr);
+}
+
+static void
+gc_fix_root(js_val **ref)
+{
+  GC_FIX(*ref);
+}
+
+static void
+gc_fix_roots()
+{
+  GC_FIX(fh->global);
+  GC_FIX(fh->modules);
+  GC_FIX(fh->function_proto);
+  GC_FIX(fh->object_proto);
+  GC_FIX(fh->array_proto);
+  GC_FIX(fh->string_proto);
+  GC_FIX(fh->number_proto);
+  GC_FIX(fh->boolean_proto);
+  GC_FIX(fh->regexp_proto);
+  GC_FIX(fh->error_proto);
+  GC_FIX(fh->buffer_proto);
+
+  eval_state *top;
+  for (top = fh->callstack; top; top = top->parent) {
+    GC_FIX(top->ctx);
+    GC_FIX(top->this);
+    GC_FIX(top->scope);
+    if (top->args) {
+      unsigned i;
+      for (i = 0; i < top->args->argc; i++)
+        GC_FIX(top->args->argv[i]);
+    }
+  }
+
+  vm_frame *frame;
+  for (frame = fh->vm_frames; frame; frame = frame->parent) {
+    int i;
+    GC_FIX(frame->ctx);
+    GC_FIX(frame->result);
+    GC_FIX(frame->ret);
+    for (i = 0; i < frame->chunk->max_stack; i++)
+      GC_FIX(frame->stack[i]);
+    for (i = 0; i < frame->chunk->num_regs; i++)
+      GC_FIX(frame->regs[i]);
+    for (i = 0; i < frame->chunk->num_iters; i++) {
+      GC_FIX(frame->iters[i].obj);
+      GC_FIX(frame->iters[i].keys);
+    }
+  }
+
+  unsigned long n;
+  for (n = 0; n < fh->num_frame_pools; n++)
+    GC_FIX(fh->node_data[fh->frame_pools[n]].frames);
+  fh_loop_each_root(gc_fix_root);
+
+  for (n = 0; n < fh->gc_remembered.len; n++)
+    GC_FIX(fh->gc_remembered.vals[n]);
+}
+
+/* Free the slots left behind by moved values (their payloads went with
+ * them) and unpin the others. */
+static void
+gc_compact_release(gc_arena *arena)
+{
+  int w;
+  for (w = 0; w < ARENA_WORDS; w++) {
+    uint64_t bits = arena->used[w];
+    while (bits) {
+      int bit = __builtin_ctzll(bits);
+      bits &= bits - 1;
+
+      js_val *val = &arena->slots[w * 64 + bit];
+      val->marked = false;
+      if (!val->forwarded) continue;
+
+      if (arena->young[w] & (1ULL << bit)) {
+        arena->young[w] &= ~(1ULL << bit);
+        arena->young_slots--;
+      }
+      memset(val, 0, sizeof(js_val));
+      arena->used[w] &= ~(1ULL << bit);
+      arena->used_slots--;
+      fh->gc_used--;
+      NEXT_FREE(val) = arena->free;
+      arena->free = val;
+    }
+  }
+  arena->evacuate = false;
+}
+
+/* Evacuate the sparsest arenas into the densest. Run at a safe point only,
+ * with no collection under way. */
+static void
+gc_compact()
+{
+  int i, k, n = fh->gc_num_arenas;
+  gc_pause_begin();
+  gc_collection_begin("compact");
+  fh->gc_state = GC_STATE_COMPACT;
   fh_gc_debug();
 
-  // Stop
+  gc_pin();
+
+  // Take sources from the sparse end for as long as the rest has room for
+  // everything in them.
+  gc_arena **order = malloc(n * sizeof(gc_arena *));
+  memcpy(order, fh->gc_arenas, n * sizeof(gc_arena *));
+  qsort(order, n, sizeof(gc_arena *), cmp_arena_use);
+
+  unsigned long needed = 0, room = fh->gc_num_arenas * SLOTS_PER_ARENA - fh->gc_used;
+  int sources = 0;
+  for (k = 0; k < n; k++) {
+    unsigned long vacant = order[k]->num_slots - order[k]->used_slots;
+    if (needed + order[k]->used_slots > room - vacant) break;
+    needed += order[k]->used_slots;
+    room -= vacant;
+    order[k]->evacuate = true;
+    sources++;
+  }
+
+  // Fill the densest arenas first.
+  int target = n - 1;
+  for (k = 0; k < sources; k++) {
+    gc_arena *arena = order[k];
+    int w;
+    for (w = 0; w < ARENA_WORDS; w++) {
+      uint64_t bits = arena->used[w];
+      while (bits) {
+        int bit = __builtin_ctzll(bits);
+        bits &= bits - 1;
+
+        if (arena->slots[w * 64 + bit].marked) continue;
+        while (order[target]->used_slots == order[target]->num_slots) target--;
+        gc_move(arena, w * 64 + bit, order[target]);
+      }
+    }
+  }
+
+  for (i = 0; i < n; i++) {
+    gc_arena *arena = fh->gc_arenas[i];
+    if (arena->evacuate) continue;
+    int w;
+    for (w = 0; w < ARENA_WORDS; w++) {
+      uint64_t bits = arena->used[w];
+      while (bits) {
+        int bit = __builtin_ctzll(bits);
+        bits &= bits - 1;
+        gc_fix_val(&arena->slots[w * 64 + bit]);
+      }
+    }
+  }
+  for (k = 0; k < sources; k++) {
+    // Pinned values stay behind in the sources.
+    gc_arena *arena = order[k];
+    int w;
+    for (w = 0; w < ARENA_WORDS; w++) {
+      uint64_t bits = arena->used[w];
+      while (bits) {
+        int bit = __builtin_ctzll(bits);
+        bits &= bits - 1;
+        js_val *val = &arena->slots[w * 64 + bit];
+        if (!val->forwarded) gc_fix_val(val);
+      }
+    }
+  }
+  gc_fix_roots();
+  fh_vm_flush_caches();
+
+  for (i = 0; i < n; i++)
+    gc_compact_release(fh->gc_arenas[i]);
+  free(order);
+
+  fh_gc_resize();
+  fh->gc_alloc_arena = 0;
   fh->gc_state = GC_STATE_NONE;
   fh_gc_debug();
+  gc_collection_end();
+  gc_pause_end();
+}
 
-  fh_gc_debug_arena(arena);
+/* Compact once the heap is fragmented, or whenever asked to. */
+void
+fh_gc_compact()
+{
+  fh->gc_compact_pending = true;
+}
+
+void
+fh_gc_safepoint()
+{
+  // Not within a call or a try (whose C frames may hold values elsewhere),
+  // nor during a cycle.
+  if (fh->callstack || fh->gc_state != GC_STATE_NONE) return;
+  fh->gc_compact_pending = false;
+  gc_compact();
+}
+
+/* Do a step's worth of marking, finishing the mark once the gray stack is
+ * empty, or sweep an arena. */
+static void
+gc_step()
+{
+  gc_pause_begin();
+  if (fh->gc_state == GC_STATE_SWEEP)
+    gc_sweep_step();
+  else if (gc_drain(fh->gc_step_work))
+    gc_finish();
+  gc_pause_end();
+}
+
+void
+fh_gc()
+{
+  int i;
+  for (i = 0; i < fh->gc_num_arenas; i++)
+    fh_gc_debug_arena(fh->gc_arenas[i]);
+
+  // Finish any cycle in progress, then run a whole one.
+  if (fh->gc_state == GC_STATE_MARK)
+    gc_finish();
+  gc_sweep_rest();
+  gc_start();
+  gc_finish();
+  gc_sweep_rest();
+
+  for (i = 0; i < fh->gc_num_arenas; i++)
+    fh_gc_debug_arena(fh->gc_arenas[i]);
+}
+
+/* Free every value and arena of the heap, e.g. once its isolate is done. */
+void
+fh_gc_free_heap()
+{
+  int i, w;
+  for (i = 0; i < fh->gc_num_arenas; i++) {
+    gc_arena *arena = fh->gc_arenas[i];
+    for (w = 0; w < ARENA_WORDS; w++) {
+      uint64_t bits = arena->used[w];
+      while (bits) {
+        int bit = __builtin_ctzll(bits);
+        bits &= bits - 1;
+        fh_gc_free_val(&arena->slots[w * 64 + bit]);
+      }
+    }
+    free(arena);
+  }
+  free(fh->gc_arenas);
+  fh->gc_arenas = NULL;
+  fh->gc_num_arenas = fh->gc_arenas_cap = 0;
+  fh->gc_alloc_arena = 0;
+  fh->gc_used = 0;
+  fh->gc_external = 0;
+
+  free(fh->gc_gray.vals);
+  free(fh->gc_new.vals);
+  free(fh->gc_remembered.vals);
+  memset(&fh->gc_gray, 0, sizeof(gc_stack));
+  memset(&fh->gc_new, 0, sizeof(gc_stack));
+  memset(&fh->gc_remembered, 0, sizeof(gc_stack));
+  memset(fh->gc_recent, 0, sizeof(fh->gc_recent));
+  fh->gc_state = GC_STATE_NONE;
 }
@@ -19,18 +19,54 @@
 #ifndef GC_H
 #define GC_H
 
+#include <stdint.h>
+
 #include "flathead.h"
 
 #define SLOTS_PER_ARENA 10000
+#define ARENA_BYTES     sizeof(gc_arena)
+
+#define ARENA_WORDS     ((SLOTS_PER_ARENA + 63) / 64)
 
 typedef struct gc_arena {
   int num_slots;
   int used_slots;
-  bool freelist[SLOTS_PER_ARENA];
+  int bump;                       // slots from here on have never been used
+  js_val *free;                   // vacant slots below `bump`, linked
+  int young_slots;
+  bool unswept;                   // holds the garbage of the last cycle
+  bool evacuate;                  // being emptied by a compaction
+  uint64_t used[ARENA_WORDS];     // occupancy, a bit per slot
+  uint64_t young[ARENA_WORDS];    // slots allocated since the last GC
   js_val slots[SLOTS_PER_ARENA];
 } gc_arena;
 
+// Call before storing `val` into a member of `obj`.
+#define GC_BARRIER(obj,val) \
+  do { \
+    if (fh->gc_state == GC_STATE_MARK || ((val) && (val)->young && !(obj)->young)) \
+      fh_gc_barrier((obj), (val)); \
+  } while (0)
+
+// Upper bounds (µs) of the pause histogram buckets; the last is unbounded.
+extern const long fh_gc_pause_bounds[GC_PAUSE_BUCKETS - 1];
+
+// Call where no C code holds values but in locals and the GC roots, e.g.
+// between top-level statements.
+#define GC_SAFEPOINT() \
+  do { if (fh->gc_compact_pending) fh_gc_safepoint(); } while (0)
+
 js_val * fh_malloc(bool);
 void fh_gc(void);
+void fh_gc_barrier(js_val *, js_val *);
+void fh_gc_compact(void);
+void fh_gc_safepoint(void);
+void fh_gc_stack_from(void *);
+void fh_gc_free_heap(void);
+size_t fh_heap_size(void);
+unsigned long fh_heap_used(void);
+void fh_gc_external(long);
+long fh_gc_now(void);
+void fh_gc_print_totals(FILE *);
 
 #endif
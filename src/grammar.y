@@ -21,21 +21,33 @@
   #include <stdio.h>
   #include <math.h>
   #include <stdlib.h>
+  #include <string.h>
   #include <getopt.h>
   #include <setjmp.h>
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
 
 #ifndef FH_NO_REPL
   #include <readline/readline.h>
   #include <readline/history.h>
 #endif
 
-  #include "lex.yy.h"
   #include "src/flathead.h"
+  #include "src/vm.h"
   #include "src/nodes.h"
   #include "src/eval.h"
   #include "src/runtime/runtime.h"
   #include "src/debug.h"
   #include "src/cli.h"
+  #include "src/astcache.h"
+  #include "src/output.h"
+  #include "src/cpuprof.h"
+  #include "src/hotspots.h"
+  #include "src/jit.h"
+  #include "src/quota.h"
+  #include "src/server.h"
+  #include "src/loop.h"
 
   #define YYDEBUG 0
 
@@ -99,16 +111,56 @@
   #define NEW_WHILE(cnd,blck)        NEW_NODE(NODE_WHILE,cnd,blck,0,0,0)
   #define NEW_WITH(exp,stmt)         NEW_NODE(NODE_WITH_STMT,exp,stmt,0,0,0)
 
-  void yyerror(const char *);
-  int yycolumn;
-  int yydebug;
-  int fh_get_input(char *, int);
-  ast_node *root;
-  eval_state *state;
   fh_state *fh;
 
 %}
 
+%code requires {
+  #include <stdbool.h>
+  #include <stdio.h>
+
+  struct ast_node;
+  struct ast_arena;
+
+  /* The state of one parse, shared by the scanner and the parser, so parses
+   * can nest (as eval and load do) and don't touch any globals. */
+  typedef struct fh_parser {
+    void *scanner;                // the flex scanner
+    FILE *file;                   // input read through fh_get_input, if any
+    char *path;                   // file the input was mapped from, if any
+    bool interactive;             // input is read from the REPL
+    int column;
+    int prev_token;               // the scanner's last token
+    struct ast_node *root;
+    struct ast_arena *arena;      // where the tree's nodes are
+
+    // Function bodies are skipped, and parsed when first called.
+    bool lazy;
+    int head;                     // how far into a function's head we are
+    int last_token;               // the parser's last token
+    bool skip_next;               // the next token starts a body to skip
+    int held;                     // a token to return next, or 0
+    int held_line;
+    int held_column;
+    bool capturing;               // recording what's scanned, while skipping
+    char *capture;
+    size_t capture_len;
+    size_t capture_cap;
+  } fh_parser;
+}
+
+%code {
+  #include "lex.yy.h"
+
+  void yyerror(YYLTYPE *, void *, fh_parser *, const char *);
+  int fh_get_input(fh_parser *, char *, int);
+  int fh_scan(YYSTYPE *, YYLTYPE *, void *);
+  int yylex(YYSTYPE *, YYLTYPE *, void *);
+}
+
+%define api.pure full
+%lex-param {void *scanner}
+%parse-param {void *scanner} {fh_parser *parser}
 %error-verbose
 %locations
 
@@ -140,6 +192,11 @@
 %token<val> TRY CATCH FINALLY
 
 
+/* FUNCTION BODIES (skipped, to be parsed when called) */
+
+%token<node> LAZYBODY
+
+
 /* ASSOCIATIVITY */
 
 %left '+' '-' '*' '%' '/' AND OR
@@ -277,7 +334,7 @@
 %%
 
 Program                  : SourceElements
-                             { root = $1; }
+                             { parser->root = $1; }
                          ;
 
 SourceElements           : SourceElement
@@ -632,6 +689,8 @@ FormalParameterList      : Identifier
 
 FunctionBody             : SourceElements
                              { $$ = $1; }
+                         | LAZYBODY
+                             { $$ = $1; }
                          |
                              { $$ = NULL; }
                          ;
@@ -1115,21 +1174,27 @@ ArgumentList             : AssignmentExpression
 %%
 
 void 
-yyerror(const char *s) 
+yyerror(YYLTYPE *loc, void *scanner, fh_parser *parser, const char *s) 
 {
-  eval_state *state = fh_new_state(yylloc.first_line, yylloc.first_column);
+  eval_state *state = fh_new_state(loc->first_line, loc->first_column);
   fh_push_state(state);
   // Show the offending line.
-  if (yyin) {
+  FILE *file = parser->file;
+  if (file)
+    rewind(file);
+  else if (parser->path)
+    file = fopen(parser->path, "r");
+  if (file) {
     char buf[1000];
     int i = 1;
-    rewind(yyin);
-    while (fgets(buf, sizeof buf, yyin) != NULL) {
-      if (yylloc.first_line == i++) { 
+    while (fgets(buf, sizeof buf, file) != NULL) {
+      if (loc->first_line == i++) { 
         cfprintf(stderr, ANSI_RED, "%s", buf);
-        cfprintf(stderr, ANSI_GRAY, "%*s\n", yylloc.first_column + 1, "^");
+        cfprintf(stderr, ANSI_GRAY, "%*s\n", loc->first_column + 1, "^");
       }
     }
+    if (file != parser->file)
+      fclose(file);
   }
   // Trim the "syntax error: " prefix so we can use `fh_throw`.
   fh_throw(state, fh_new_error(E_SYNTAX, strlen(s) >= 14 ? s + 14 : s));
@@ -1137,10 +1202,10 @@ yyerror(const char *s)
 
 // This is our replacement function when we redefine YY_INPUT
 int 
-fh_get_input(char *buf, int size)
+fh_get_input(fh_parser *parser, char *buf, int size)
 {
   // For the REPL:
-  if (fh->opt_interactive) {
+  if (parser->interactive) {
 #ifdef FH_NO_REPL
     fprintf(stderr, "Error: REPL not available. Build with readline.");
     exit(1);
@@ -1149,6 +1214,9 @@ fh_get_input(char *buf, int size)
       read_history(fh->opt_history_filename);
     }
 
+    // Show everything printed so far before the prompt.
+    fh_output_flush();
+
     char *line;
     line = readline("> ");
     if (!line)
@@ -1177,26 +1245,397 @@ fh_get_input(char *buf, int size)
   }
   // For file or stdin:
   else {
-    if (!yyin)
+    if (!parser->file)
       fh_throw(NULL, fh_new_error(E_ERROR, "invalid input file"));
-    int result = fread(buf, sizeof(char), size, yyin);
-    if (result == 0 && ferror(yyin))
+    int result = fread(buf, sizeof(char), size, parser->file);
+    if (result == 0 && ferror(parser->file))
       fh_throw(NULL, fh_new_error(E_ERROR, "error while reading input file"));
     return result;
   }
   return strlen(buf);
 }
 
+// ----------------------------------------------------------------------------
+// Lazy Function Bodies
+// ----------------------------------------------------------------------------
+
+/* Function bodies are only scanned at first: the tokens between the braces
+ * are counted off and the source recorded, for a full parse (and the nodes
+ * it makes) when the function is first called. Scanning still finds any
+ * error in the tokens, and a body that doesn't end. Functions straight
+ * after a '(', as in `(function() { ... })()`, are likely to be called
+ * right away, and are parsed up front. */
+
+enum { HEAD_NONE, HEAD_NAME, HEAD_PARAMS, HEAD_BODY };
+
+/* Record scanned text, while a body is being skipped. */
+void
+fh_capture(fh_parser *parser, char *text, int len)
+{
+  if (!parser->capturing) return;
+  if (parser->capture_len + len + 1 > parser->capture_cap) {
+    parser->capture_cap = (parser->capture_len + len + 1) * 2;
+    parser->capture = realloc(parser->capture, parser->capture_cap);
+  }
+  memcpy(parser->capture + parser->capture_len, text, len);
+  parser->capture_len += len;
+  parser->capture[parser->capture_len] = '\0';
+}
+
+/* Take back the column and the capture of a match the scanner rejects. */
+void
+fh_unmatch(fh_parser *parser, int len)
+{
+  parser->column -= len;
+  if (parser->capturing) parser->capture_len -= len;
+}
+
+/* Scan to the end of the body whose '{' was just returned, and return the
+ * body as a LAZYBODY, with its '}' held for the next token. */
+static int
+skip_body(YYSTYPE *lval, YYLTYPE *lloc, void *scanner, fh_parser *parser)
+{
+  int line = lloc->last_line, column = parser->column, depth = 1, token;
+  int num_tokens = 0;
+
+  parser->capturing = true;
+  parser->capture_len = 0;
+  do {
+    token = fh_scan(lval, lloc, scanner);
+    if (token == '{') depth++;
+    else if (token == '}') depth--;
+    num_tokens++;
+  } while (token > 0 && depth > 0);
+  parser->capturing = false;
+  if (token <= 0 || num_tokens == 1) return token;
+
+  // The capture ends with the closing brace.
+  parser->capture_len--;
+
+  parser->held = '}';
+  parser->held_line = lloc->first_line;
+  parser->held_column = lloc->first_column;
+
+  char *text = malloc(parser->capture_len + 1);
+  memcpy(text, parser->capture, parser->capture_len);
+  text[parser->capture_len] = '\0';
+  lval->node = node_lazy_new(text, line, column);
+  lloc->first_line = lloc->last_line = line;
+  lloc->first_column = lloc->last_column = column;
+  return LAZYBODY;
+}
+
+/* The parser's scanner: the flex scanner, with the bodies of functions
+ * skipped when parsing is lazy. */
+int
+yylex(YYSTYPE *lval, YYLTYPE *lloc, void *scanner)
+{
+  fh_parser *parser = yyget_extra(scanner);
+  int token;
+
+  if (parser->held) {
+    token = parser->held;
+    parser->held = 0;
+    lloc->first_line = lloc->last_line = parser->held_line;
+    lloc->first_column = lloc->last_column = parser->held_column;
+    return token;
+  }
+  if (parser->skip_next) {
+    parser->skip_next = false;
+    return skip_body(lval, lloc, scanner, parser);
+  }
+
+  token = fh_scan(lval, lloc, scanner);
+  if (!parser->lazy) return token;
+
+  // Follow the head of a function through to its body.
+  switch (parser->head) {
+    case HEAD_NAME:
+      parser->head = token == '(' ? HEAD_PARAMS :
+        token == IDENT ? HEAD_NAME : HEAD_NONE;
+      break;
+    case HEAD_PARAMS:
+      if (token == ')') parser->head = HEAD_BODY;
+      else if (token != IDENT && token != ',') parser->head = HEAD_NONE;
+      break;
+    case HEAD_BODY:
+      parser->skip_next = token == '{';
+      parser->head = HEAD_NONE;
+      break;
+  }
+  if (token == FUNCTION && parser->last_token != '(')
+    parser->head = HEAD_NAME;
+
+  parser->last_token = token;
+  return token;
+}
+
+/* Whether function bodies are skipped, to be parsed when first called. */
+static bool
+parse_lazily()
+{
+  return !fh->opt_eager_parse && !fh->opt_print_ast;
+}
+
+static void
+parser_init(fh_parser *parser)
+{
+  memset(parser, 0, sizeof(*parser));
+  parser->lazy = parse_lazily();
+  yylex_init_extra(parser, &parser->scanner);
+  yyset_lineno(1, parser->scanner);
+}
+
+/* Parse the input opened on the parser's scanner, into an arena of its own,
+ * then free the scanner. */
+static ast_node *
+parser_run(fh_parser *parser)
+{
+  parser->arena = node_arena_new();
+  ast_arena *prev = node_arena_use(parser->arena);
+  yyparse(parser->scanner, parser);
+  node_arena_use(prev);
+  yylex_destroy(parser->scanner);
+  free(parser->capture);
+  return parser->root;
+}
+
+/* The body of a function, parsed now if that was put off. The parse is kept
+ * for the function's other calls, in this isolate and in others. */
+ast_node *
+fh_func_body(ast_node *func)
+{
+  ast_node *body = func->e2;
+  if (!body || body->type != NODE_LAZY_BODY) return body;
+
+  if (!body->val) {
+    fh_parser parser;
+    parser_init(&parser);
+    yyset_lineno(body->line, parser.scanner);
+    parser.column = body->column;
+    yy_scan_string(body->sval, parser.scanner);
+    node_resolve_lazy(func, parser_run(&parser));
+  }
+  return body->e1;
+}
+
 js_val *
 fh_eval_file(FILE *file, js_val *ctx)
 {
-  yyrestart(file);
-  yyparse();
+  fh_parser parser;
+  parser_init(&parser);
+  parser.file = file;
+  parser.interactive = fh->opt_interactive;
+  parser.lazy = parser.lazy && !parser.interactive;
+  yyset_in(file, parser.scanner);
+  ast_node *ast = parser_run(&parser);
 
   if (fh->opt_print_ast) 
-    node_print(root, true, 0);
+    node_print(ast, true, 0);
+
+  return fh_run(ctx, ast);
+}
+
+/* The trees of recently eval'd strings, so code eval'd over and over is only
+ * parsed once. The least recently used entry makes way for a new string.
+ *
+ * An evicted tree is freed once it's done running. One with functions waits
+ * until no value of them is left: each major collection clears the marks of
+ * the waiting trees' functions, marking a function's value (or making one)
+ * sets it again, and a tree whose functions stayed unmarked through a whole
+ * collection, and aren't running, is freed on the next miss. (A tree that
+ * threw out of its run is never known to be done.)
+ *
+ * Each isolate has a cache of its own, so only the isolate freeing a tree
+ * ever kept data for its nodes, and their slots can be reused. The trees
+ * left go with the isolate. */
+
+#define EVAL_CACHE_SIZE 64
+
+typedef struct eval_tree {
+  ast_node *ast;
+  ast_arena *arena;
+  ast_node **funcs;             // its function nodes
+  unsigned num_funcs;
+  unsigned running;             // runs in progress
+  bool evicted;
+  struct eval_tree *next;       // in the cache's waiting trees
+} eval_tree;
+
+typedef struct {
+  uint64_t hash;
+  char *source;                 // NULL for a vacant entry
+  eval_tree *tree;
+  unsigned long used;           // when it was last looked up
+} eval_entry;
+
+typedef struct fh_eval_cache {
+  eval_entry entries[EVAL_CACHE_SIZE];
+  unsigned long clock;
+  eval_tree *waiting;           // evicted, with functions
+  unsigned long waited_runs;    // major collections when last checked
+} fh_eval_cache;
+
+static fh_eval_cache *
+eval_cache()
+{
+  if (!fh->eval_trees) fh->eval_trees = calloc(1, sizeof(fh_eval_cache));
+  return fh->eval_trees;
+}
+
+static void
+eval_tree_free(eval_tree *tree)
+{
+  node_arena_free(tree->arena, fh_forget_node);
+  free(tree->funcs);
+  free(tree);
+}
+
+static void
+eval_tree_release(eval_tree *tree)
+{
+  if (!tree || tree->running || !tree->evicted) return;
+#ifndef FH_HOTSPOTS
+  // Hotspot counts keep their nodes to the end.
+  if (!tree->num_funcs)
+    eval_tree_free(tree);
+  else {
+    tree->next = eval_cache()->waiting;
+    eval_cache()->waiting = tree;
+  }
+#endif
+}
 
-  return fh_eval(ctx, root);
+/* Collect the function nodes of a new tree. */
+static void
+eval_tree_funcs(eval_tree *tree)
+{
+  node_block *block;
+  unsigned long i;
+
+  tree->funcs = NULL;
+  tree->num_funcs = 0;
+  if (!tree->arena->has_funcs) return;
+  for (block = tree->arena->blocks; block; block = block->next) {
+    for (i = 0; i < block->used; i++) {
+      if (block->nodes[i].type != NODE_FUNC) continue;
+      if ((tree->num_funcs & (tree->num_funcs - 1)) == 0)
+        tree->funcs = realloc(tree->funcs,
+            (tree->num_funcs ? tree->num_funcs * 2 : 1) * sizeof(ast_node *));
+      tree->funcs[tree->num_funcs++] = &block->nodes[i];
+    }
+  }
+}
+
+/* Clear the marks of the waiting trees' functions, as a major collection
+ * starts. */
+void
+fh_unmark_evicted_funcs()
+{
+  eval_tree *tree;
+  unsigned i;
+  if (!fh->eval_trees) return;
+  for (tree = fh->eval_trees->waiting; tree; tree = tree->next)
+    for (i = 0; i < tree->num_funcs; i++)
+      fh_get_node_data(tree->funcs[i])->func_marked = false;
+}
+
+/* Free the waiting trees none of whose functions is still referenced or
+ * running, once a collection has finished since the last look. */
+static void
+free_dead_trees()
+{
+  fh_eval_cache *cache = eval_cache();
+  eval_tree **link = &cache->waiting, *tree;
+  eval_state *state;
+  unsigned i;
+
+  if (fh->gc_state != GC_STATE_NONE ||
+      cache->waited_runs == fh->gc_stats.major_runs)
+    return;
+  cache->waited_runs = fh->gc_stats.major_runs;
+
+  for (state = fh->callstack; state; state = state->parent)
+    if (state->callee)
+      fh_get_node_data(state->callee)->func_marked = true;
+
+  while ((tree = *link)) {
+    for (i = 0; i < tree->num_funcs; i++)
+      if (fh_get_node_data(tree->funcs[i])->func_marked) break;
+    if (i < tree->num_funcs)
+      link = &tree->next;
+    else {
+      *link = tree->next;
+      eval_tree_free(tree);
+    }
+  }
+}
+
+static eval_tree *
+parse_eval_string(char *string)
+{
+  size_t len = strlen(string);
+  uint64_t hash = fh_ast_cache_hash(string, len);
+  fh_eval_cache *cache = eval_cache();
+  eval_entry *entry, *oldest = &cache->entries[0];
+  int i;
+
+  for (i = 0; i < EVAL_CACHE_SIZE; i++) {
+    entry = &cache->entries[i];
+    if (entry->source && entry->hash == hash && STREQ(entry->source, string)) {
+      entry->used = ++cache->clock;
+      fh->eval_cache.hits++;
+      return entry->tree;
+    }
+    if (entry->used < oldest->used) oldest = entry;
+  }
+  fh->eval_cache.misses++;
+  free_dead_trees();
+
+  // The scanner writes to its buffer, so it gets a copy of the string.
+  fh_parser parser;
+  parser_init(&parser);
+  yy_scan_string(string, parser.scanner);
+  eval_tree *tree = malloc(sizeof(eval_tree));
+  tree->ast = parser_run(&parser);
+  tree->arena = parser.arena;
+  eval_tree_funcs(tree);
+  tree->running = 0;
+  tree->evicted = false;
+
+  if (oldest->tree) {
+    oldest->tree->evicted = true;
+    eval_tree_release(oldest->tree);
+  }
+  free(oldest->source);
+  oldest->source = memcpy(malloc(len + 1), string, len + 1);
+  oldest->hash = hash;
+  oldest->tree = tree;
+  oldest->used = ++cache->clock;
+  return tree;
+}
+
+/* Free the current isolate's cached and waiting trees, as it's freed. */
+void
+fh_free_eval_cache()
+{
+  fh_eval_cache *cache = fh->eval_trees;
+  int i;
+
+  if (!cache) return;
+#ifndef FH_HOTSPOTS
+  eval_tree *tree;
+  for (i = 0; i < EVAL_CACHE_SIZE; i++)
+    if (cache->entries[i].tree) eval_tree_free(cache->entries[i].tree);
+  while ((tree = cache->waiting)) {
+    cache->waiting = tree->next;
+    eval_tree_free(tree);
+  }
+#endif
+  for (i = 0; i < EVAL_CACHE_SIZE; i++)
+    free(cache->entries[i].source);
+  free(cache);
+  fh->eval_trees = NULL;
 }
 
 js_val *
@@ -1206,41 +1645,366 @@ fh_eval_string(char *string, js_val *ctx)
   bool tmp = fh->opt_interactive;
   fh->opt_interactive = false;
 
-  eval_state *prior_state = fh_new_state(yylloc.first_line, yylloc.last_line);
-  yycolumn = 0;
-  yylineno = 1;
-
-  YY_BUFFER_STATE buffer = yy_scan_string(string);
-  yyparse();
+  eval_tree *tree = parse_eval_string(string);
 
   if (fh->opt_print_ast) 
-    node_print(root, true, 0);
+    node_print(tree->ast, true, 0);
+
+  tree->running++;
+  js_val *res = fh_run(ctx, tree->ast);
+  tree->running--;
+  eval_tree_release(tree);
+  fh->opt_interactive = tmp;
+  return res;
+}
+
+/* Map the file at `path` so the scanner can work on it in place, which needs
+ * two NULs after the end. The rest of the page a file ends in reads as zeros,
+ * so that's free unless the file fills its last page; then, and for empty
+ * files, it's read into a buffer instead. Sets `mapped` to the length of the
+ * mapping, or 0 for a buffer. Returns NULL if the file can't be read. */
+static char *
+map_source(char *path, size_t *len, size_t *mapped)
+{
+  struct stat st;
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) return NULL;
+  if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return NULL;
+  }
+
+  char *source = NULL;
+  size_t size = st.st_size, page = sysconf(_SC_PAGESIZE);
+  *len = size;
+  *mapped = 0;
+
+  if (size > 0 && size % page != 0 && size % page <= page - 2) {
+    source = mmap(NULL, size + 2, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (source == MAP_FAILED)
+      source = NULL;
+    else
+      *mapped = size + 2;
+  }
+
+  if (!source) {
+    source = malloc(size + 2);
+    size_t done = 0;
+    ssize_t n;
+    while (done < size && (n = read(fd, source + done, size - done)) > 0)
+      done += n;
+    if (done != size) {
+      free(source);
+      source = NULL;
+    }
+    else
+      source[size] = source[size + 1] = '\0';
+  }
+
+  close(fd);
+  return source;
+}
+
+/* Evaluate the script at `path`, or return NULL if it can't be read. With a
+ * parse cache, a script that hasn't changed since it was cached isn't parsed
+ * again. */
+js_val *
+fh_eval_path(char *path, js_val *ctx)
+{
+  bool tmp = fh->opt_interactive;
+  fh->opt_interactive = false;
+  char *prev_script = fh->script_name;
+  fh->script_name = fh_intern(path);    // kept by stack frames (and profiles)
+
+  ast_node *ast;
+  js_val *res = NULL;
+  if (fh_parse_path(path, &ast))
+    res = fh_run(ctx, ast);
 
-  js_val *res = fh_eval(ctx, root);
-  yy_delete_buffer(buffer);
+  fh->script_name = prev_script;
   fh->opt_interactive = tmp;
-  yylineno = prior_state->line;
-  yycolumn = prior_state->column;
   return res;
 }
 
+/* The trees of scripts parsed so far, by path, for scripts loaded again. An
+ * entry holds while the file's identity, size and modification time are the
+ * same. Like the trees, they're shared by every isolate. */
+typedef struct parsed_script {
+  char *path;                   // an atom
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+  ast_node *ast;
+  UT_hash_handle hh;
+} parsed_script;
+
+static parsed_script *parsed_scripts;
+
+/* Parse the script at `path` into `ast` (NULL for an empty script) without
+ * running it. Returns false if the file can't be read. */
+bool
+fh_parse_path(char *path, ast_node **out)
+{
+  struct stat st;
+  parsed_script *script = NULL;
+  char *key = fh_intern(path);
+
+  if (stat(path, &st) == 0) {
+    HASH_FIND(hh, parsed_scripts, &key, sizeof(char *), script);
+    if (script && script->dev == st.st_dev && script->ino == st.st_ino &&
+        script->size == st.st_size && script->mtime == st.st_mtime) {
+      fh->script_cache.hits++;
+      if (fh->opt_print_ast && script->ast)
+        node_print(script->ast, true, 0);
+      *out = script->ast;
+      return true;
+    }
+  }
+
+  size_t len, mapped;
+  char *source = map_source(path, &len, &mapped);
+  if (!source) return false;
+  fh->script_cache.misses++;
+
+  // Hash the source before the scanner writes to it.
+  ast_node *ast = NULL;
+  uint64_t hash = 0;
+  if (fh->opt_parse_cache) {
+    hash = fh_ast_cache_hash(source, len);
+    ast = fh_ast_cache_load(path, len, hash, parse_lazily());
+  }
+  if (!ast) {
+    fh_parser parser;
+    parser_init(&parser);
+    parser.path = path;
+    yy_scan_buffer(source, len + 2, parser.scanner);
+    ast = parser_run(&parser);
+    if (fh->opt_parse_cache)
+      fh_ast_cache_store(path, len, hash, parser.lazy, ast);
+  }
+
+  if (mapped)
+    munmap(source, mapped);
+  else
+    free(source);
+
+  if (fh->opt_print_ast && ast) 
+    node_print(ast, true, 0);
+
+  if (!script) {
+    script = malloc(sizeof(parsed_script));
+    script->path = key;
+    HASH_ADD(hh, parsed_scripts, path, sizeof(char *), script);
+  }
+  script->dev = st.st_dev;
+  script->ino = st.st_ino;
+  script->size = st.st_size;
+  script->mtime = st.st_mtime;
+  script->ast = ast;
+
+  *out = ast;
+  return true;
+}
+
+/* Run each script in a fresh isolate of its own, one after another in this
+ * process. An uncaught error ends only the script that threw it. A script
+ * given more than once is parsed once, and its tree shared. */
+static int
+run_isolates(fh_state *options, int argc, char **argv)
+{
+  // On the heap, as they're written to between setjmp and longjmp.
+  ast_node **asts = calloc(argc, sizeof(ast_node *));
+  bool *parsed = calloc(argc, sizeof(bool));
+  volatile int status = 0;
+  int i, j;
+
+  for (i = 0; i < argc; i++) {
+    long bootstrap_start = fh_gc_now();
+    fh_state *isolate = fh_new_isolate(options);
+    long bootstrap_end = fh_gc_now();
+    unsigned long bootstrap_values = fh_heap_used();
+
+    for (j = 0; j < i && !parsed[i]; j++) {
+      if (parsed[j] && STREQ(argv[j], argv[i])) {
+        asts[i] = asts[j];
+        parsed[i] = true;
+      }
+    }
+
+    isolate->script_name = argv[i];
+    fh_quota_start();
+    if (!setjmp(isolate->repl_jmp)) {
+      if (!parsed[i] && !(parsed[i] = fh_parse_path(argv[i], &asts[i])))
+        fh_throw(NULL, fh_new_error(E_ERROR, "invalid input file"));
+      fh_run(isolate->global, asts[i]);
+      fh_loop_run();
+    }
+    else status = isolate->quota_exceeded ? QUOTA_EXIT_STATUS : 1;
+
+    if (isolate->opt_gc_stats)
+      fh_gc_print_totals(isolate->opt_gc_stats);
+    if (isolate->opt_startup_time) {
+      fprintf(stderr, "%s: bootstrap: %.3f ms (%lu values), script: %.3f ms\n",
+          argv[i], (bootstrap_end - bootstrap_start) / 1000.0,
+          bootstrap_values, (fh_gc_now() - bootstrap_end) / 1000.0);
+    }
+    if (isolate->opt_heap_profile)
+      fh_gc();
+    fh_free_isolate(isolate);
+  }
+
+  free(asts);
+  free(parsed);
+  return status;
+}
+
+#define EACH_LINE_BUFSIZE 65536   // bytes of input read at a time
+
+/* Write what a line handler returned, if anything, as a line of output. */
+static void
+each_line_output(js_val *res)
+{
+  if (IS_UNDEF(res)) return;
+  js_val *str = fh_to_string(res);
+  fh_write(stdout, str->string.ptr, str->string.length);
+  fh_write(stdout, "\n", 1);
+}
+
+/* Call the global `onLine(line, number)` of the script just run for each line
+ * of `in`, then `onEnd()` if there is one. Whatever they return, other than
+ * undefined, is written out as a line. Input is read, and output written, in
+ * large blocks. */
+static int
+run_each_line(FILE *in)
+{
+  js_val *on_line = fh_get(fh->global, "onLine");
+  if (!IS_FUNC(on_line)) {
+    fprintf(stderr, "--each-line needs the script to define onLine()\n");
+    return 1;
+  }
+  char *buf = malloc(EACH_LINE_BUFSIZE);
+  char *line = NULL;
+  size_t line_len = 0, line_cap = 0, n;
+  unsigned long number = 0;
+  js_args args;
+  bool eof = false;
+
+  while (!eof) {
+    n = fread(buf, 1, EACH_LINE_BUFSIZE, in);
+    eof = n == 0;
+    char *p = buf, *end = buf + n;
+    while (p < end || (eof && line_len)) {
+      char *nl = memchr(p, '\n', end - p);
+      size_t len = (nl ? nl : end) - p;
+      if (line_len + len + 1 > line_cap) {
+        line_cap = (line_len + len + 1) * 2;
+        line = realloc(line, line_cap);
+      }
+      memcpy(line + line_len, p, len);
+      line_len += len;
+      p += len;
+      // A line without its newline waits for more input, unless there is none.
+      if (!nl && !eof) break;
+      if (nl) p++;
+
+      line[line_len] = '\0';
+      line_len = 0;
+      args_init(&args);
+      args_append(&args, JSSTR(line));
+      args_append(&args, JSNUM(++number));
+      each_line_output(fh_call(fh->global, JSUNDEF(), on_line, &args));
+    }
+  }
+
+  js_val *on_end = fh_get(fh->global, "onEnd");
+  if (IS_FUNC(on_end)) {
+    args_init(&args);
+    each_line_output(fh_call(fh->global, JSUNDEF(), on_end, &args));
+  }
+
+  free(buf);
+  free(line);
+  fflush(stdout);
+  return 0;
+}
+
+/* End the GC stats with their totals, however the process exits. */
+static void
+gc_stats_at_exit()
+{
+  if (fh && fh->opt_gc_stats) fh_gc_print_totals(fh->opt_gc_stats);
+}
+
 int
 main(int argc, char **argv)
 {
   // Create the global state object
   fh = fh_new_global_state();
+  fh->gc_stack_base = &argc;
+  long started = fh_gc_now();
+  fh_output_init();
+
+  // Heap settings from the environment, which the options below override.
+  char *env;
+  if ((env = getenv("FH_INITIAL_HEAP")))
+    fh_parse_size(env, &fh->opt_initial_heap);
+  if ((env = getenv("FH_MAX_HEAP")))
+    fh_parse_size(env, &fh->opt_max_heap);
+  if ((env = getenv("FH_HEAP_GROW")))
+    fh_parse_ratio(env, &fh->opt_heap_grow);
+  if ((env = getenv("FH_GC_PAUSE")))
+    fh_parse_ms(env, &fh->opt_gc_pause);
+  if ((env = getenv("FH_HEAP_PROFILE")) && *env)
+    fh->opt_heap_profile = env;
+  if ((env = getenv("FH_PARSE_CACHE")) && *env)
+    fh->opt_parse_cache = env;
+  char *gc_stats = getenv("FH_GC_STATS");
+  bool each_line = false, prof = false;
+  char *prof_file = NULL, *server = NULL, *end;
+  int prof_rate = PROF_DEFAULT_RATE, hotspots = 0;
+
+  enum {
+    OPT_INITIAL_HEAP = 256, OPT_MAX_HEAP, OPT_HEAP_GROW, OPT_GC_PAUSE,
+    OPT_HEAP_PROFILE, OPT_GC_STATS, OPT_GC_COMPACT, OPT_STARTUP_TIME,
+    OPT_PARSE_CACHE, OPT_ISOLATES, OPT_EAGER_PARSE, OPT_EACH_LINE, OPT_PROF,
+    OPT_PROF_RATE, OPT_HOTSPOTS, OPT_JIT, OPT_JIT_LOG, OPT_MAX_STEPS,
+    OPT_TIMEOUT, OPT_HEAP_QUOTA, OPT_SERVER
+  };
 
-  int c = 0, fakeind = 0, optind = 1;
+  int c = 0, fakeind = 0;
   static struct option long_options[] = {
     {"version", no_argument, NULL, 'v'},
     {"help", no_argument, NULL, 'h'},
     {"interactive", no_argument, NULL, 'i'},
     {"nodes", no_argument, NULL, 'n'},
     {"tokens", no_argument, NULL, 't'},
+    {"engine", required_argument, NULL, 'e'},
+    {"initial-heap", required_argument, NULL, OPT_INITIAL_HEAP},
+    {"max-heap", required_argument, NULL, OPT_MAX_HEAP},
+    {"heap-grow", required_argument, NULL, OPT_HEAP_GROW},
+    {"gc-pause", required_argument, NULL, OPT_GC_PAUSE},
+    {"heap-profile", required_argument, NULL, OPT_HEAP_PROFILE},
+    {"gc-stats", optional_argument, NULL, OPT_GC_STATS},
+    {"gc-compact", no_argument, NULL, OPT_GC_COMPACT},
+    {"startup-time", no_argument, NULL, OPT_STARTUP_TIME},
+    {"parse-cache", required_argument, NULL, OPT_PARSE_CACHE},
+    {"isolates", no_argument, NULL, OPT_ISOLATES},
+    {"eager-parse", no_argument, NULL, OPT_EAGER_PARSE},
+    {"each-line", no_argument, NULL, OPT_EACH_LINE},
+    {"prof", optional_argument, NULL, OPT_PROF},
+    {"prof-rate", required_argument, NULL, OPT_PROF_RATE},
+    {"hotspots", optional_argument, NULL, OPT_HOTSPOTS},
+    {"jit", required_argument, NULL, OPT_JIT},
+    {"jit-log", no_argument, NULL, OPT_JIT_LOG},
+    {"max-steps", required_argument, NULL, OPT_MAX_STEPS},
+    {"timeout", required_argument, NULL, OPT_TIMEOUT},
+    {"heap-quota", required_argument, NULL, OPT_HEAP_QUOTA},
+    {"server", required_argument, NULL, OPT_SERVER},
     {NULL, 0, NULL, 0}
   };
 
-  while ((c = getopt_long(argc, argv, "vhint", long_options, &fakeind)) != -1) {
+  while ((c = getopt_long(argc, argv, "vhinte:", long_options, &fakeind)) != -1) {
     switch (c) {
       case 0: break;
       case 'v': fh_print_version(); return 0;
@@ -1248,9 +2012,141 @@ main(int argc, char **argv)
       case 'i': fh->opt_interactive = true; break;
       case 'n': fh->opt_print_ast = true; break;
       case 't': fh->opt_print_tokens = true; break;
+      case 'e':
+        if (STREQ(optarg, "vm")) fh->opt_engine = ENGINE_VM;
+        else if (STREQ(optarg, "ast")) fh->opt_engine = ENGINE_AST;
+        else {
+          fprintf(stderr, "Unknown engine: %s\n", optarg);
+          return 1;
+        }
+        break;
+      case OPT_INITIAL_HEAP:
+      case OPT_MAX_HEAP:
+        if (!fh_parse_size(optarg, c == OPT_MAX_HEAP ?
+              &fh->opt_max_heap : &fh->opt_initial_heap)) {
+          fprintf(stderr, "Invalid heap size: %s\n", optarg);
+          return 1;
+        }
+        break;
+      case OPT_HEAP_GROW:
+        if (!fh_parse_ratio(optarg, &fh->opt_heap_grow)) {
+          fprintf(stderr, "Invalid heap growth ratio: %s\n", optarg);
+          return 1;
+        }
+        break;
+      case OPT_GC_PAUSE:
+        if (!fh_parse_ms(optarg, &fh->opt_gc_pause)) {
+          fprintf(stderr, "Invalid GC pause target: %s\n", optarg);
+          return 1;
+        }
+        break;
+      case OPT_HEAP_PROFILE: fh->opt_heap_profile = optarg; break;
+      case OPT_GC_STATS: gc_stats = optarg ? optarg : "-"; break;
+      case OPT_GC_COMPACT: fh->opt_gc_compact = true; break;
+      case OPT_STARTUP_TIME: fh->opt_startup_time = true; break;
+      case OPT_PARSE_CACHE: fh->opt_parse_cache = optarg; break;
+      case OPT_ISOLATES: fh->opt_isolates = true; break;
+      case OPT_EAGER_PARSE: fh->opt_eager_parse = true; break;
+      case OPT_EACH_LINE: each_line = true; break;
+      case OPT_PROF:
+        prof = true;
+        prof_file = optarg;
+        break;
+      case OPT_PROF_RATE:
+        prof_rate = atoi(optarg);
+        if (prof_rate < 1 || prof_rate > 100000) {
+          fprintf(stderr, "Invalid sampling rate: %s\n", optarg);
+          return 1;
+        }
+        break;
+      case OPT_HOTSPOTS:
+        hotspots = optarg ? atoi(optarg) : HOT_DEFAULT_TOP;
+        if (hotspots < 1) {
+          fprintf(stderr, "Invalid number of hot spots: %s\n", optarg);
+          return 1;
+        }
+        break;
+      case OPT_JIT:
+        if (STREQ(optarg, "off")) fh->opt_jit = JIT_OFF;
+        else if (!STREQ(optarg, "baseline")) {
+          fprintf(stderr, "Unknown JIT tier: %s\n", optarg);
+          return 1;
+        }
+        else if (fh_jit_available()) fh->opt_jit = JIT_BASELINE;
+        else {
+          fprintf(stderr, "The JIT isn't available in this build\n");
+          return 1;
+        }
+        break;
+      case OPT_JIT_LOG: fh->opt_jit_log = true; break;
+      case OPT_SERVER: server = optarg; break;
+      case OPT_MAX_STEPS:
+        fh->opt_max_steps = strtoul(optarg, &end, 10);
+        if (end == optarg || *end || !fh->opt_max_steps) {
+          fprintf(stderr, "Invalid number of steps: %s\n", optarg);
+          return 1;
+        }
+        break;
+      case OPT_TIMEOUT:
+        if (!fh_parse_ms(optarg, &fh->opt_timeout) || !fh->opt_timeout) {
+          fprintf(stderr, "Invalid timeout: %s\n", optarg);
+          return 1;
+        }
+        break;
+      case OPT_HEAP_QUOTA:
+        if (!fh_parse_size(optarg, &fh->opt_heap_quota) || !fh->opt_heap_quota) {
+          fprintf(stderr, "Invalid heap quota: %s\n", optarg);
+          return 1;
+        }
+        break;
       default: break;
     }
-    optind++;
+  }
+
+  // A heap quota caps the heap, and compiled loops don't count their steps.
+  if (fh->opt_heap_quota &&
+      (!fh->opt_max_heap || fh->opt_max_heap > fh->opt_heap_quota))
+    fh->opt_max_heap = fh->opt_heap_quota;
+  if (fh->opt_max_steps || fh->opt_timeout)
+    fh->opt_jit = JIT_OFF;
+
+  if (gc_stats) {
+    if (!*gc_stats || STREQ(gc_stats, "-"))
+      fh->opt_gc_stats = stderr;
+    else if (!(fh->opt_gc_stats = fopen(gc_stats, "w"))) {
+      fprintf(stderr, "Can't write GC stats to %s\n", gc_stats);
+      return 1;
+    }
+    if (!fh->opt_isolates) atexit(gc_stats_at_exit);
+  }
+
+  if (prof && !fh_prof_start(prof_file, prof_rate)) {
+    fprintf(stderr, "Can't start the CPU profiler\n");
+    return 1;
+  }
+  if (hotspots && !fh_hotspots_start(hotspots)) {
+    fprintf(stderr, "--hotspots needs a build with `make hotspots=on`\n");
+    return 1;
+  }
+
+  if (fh->opt_isolates) {
+    if (optind == argc) {
+      fprintf(stderr, "--isolates needs at least one script\n");
+      return 1;
+    }
+    return run_isolates(fh, argc - optind, argv + optind);
+  }
+  if (server) {
+    if (fh->opt_interactive || each_line) {
+      fprintf(stderr, "--server runs the scripts its clients send\n");
+      return 1;
+    }
+    fh->global = fh_bootstrap();
+    return fh_serve(server, argc - optind, argv + optind);
+  }
+  if (each_line && optind == argc) {
+    fprintf(stderr, "--each-line needs a script\n");
+    return 1;
   }
 
   static FILE *source = NULL;
@@ -1266,8 +2162,15 @@ main(int argc, char **argv)
     fh->script_name = "(repl)";
   }
 
+  // Count allocations from the start, runtime included.
+  fh->heap_profiling = fh->opt_heap_profile != NULL;
+
   // Bootstrap our runtime
+  long bootstrap_start = fh_gc_now();
   fh->global = fh_bootstrap();
+  long bootstrap_end = fh_gc_now();
+  unsigned long bootstrap_values = fh_heap_used();
+  fh_quota_start();
 
   // We can operate as a REPL or in file/stdin mode.
   if (fh->opt_interactive) {
@@ -1276,12 +2179,42 @@ main(int argc, char **argv)
       // Normally errors cause the program to exit, but we'd like the REPL to
       // continue. Use setjmp here and longjmp in `fh_throw` to simulate
       // exception handling.
-      if (!setjmp(fh->repl_jmp))
+      if (!setjmp(fh->repl_jmp)) {
         DEBUG(fh_eval_file(source, fh->global));
+        fh_loop_run();
+      }
     }
   } 
+  else if (source && source != stdin) {
+    fclose(source);
+    if (!fh_eval_path(fh->script_name, fh->global))
+      fh_throw(NULL, fh_new_error(E_ERROR, "invalid input file"));
+  }
   else
     fh_eval_file(source, fh->global);
 
-  return 0;
+  // Stream the input through the script's line handler.
+  int status = each_line ? run_each_line(stdin) : 0;
+
+  // Then whatever the script left waiting: timers and watches.
+  fh_loop_run();
+
+  if (fh->opt_startup_time) {
+    long end = fh_gc_now();
+    fprintf(stderr, "startup: %.3f ms, bootstrap: %.3f ms (%lu values), "
+        "script: %.3f ms\n", (bootstrap_end - started) / 1000.0,
+        (bootstrap_end - bootstrap_start) / 1000.0, bootstrap_values,
+        (end - bootstrap_end) / 1000.0);
+  }
+
+  // Collecting writes the final profile.
+  if (fh->opt_heap_profile)
+    fh_gc();
+
+#ifdef FH_DEBUG
+  if (fh->opt_engine == ENGINE_VM)
+    fh_vm_print_ic_stats(stderr);
+#endif
+
+  return status;
 }
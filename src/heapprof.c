@@ -0,0 +1,306 @@
+/*
+ * heapprof.c -- Heap profiling by type, class and allocation site
+ *
+ * Copyright (c) 2012-2013 Nick Reynolds
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* The live census walks the arenas, so it's only as exact as the last mark:
+ * values in arenas awaiting the sweep count when they were marked. Callers
+ * that want the survivors of the moment collect first.
+ *
+ * Allocation sites are counted as values are made, while `heap_profiling` is
+ * set. The evaluators note the node they're at with HEAP_PROFILE_AT, and the
+ * site is that node's position. */
+
+#include "heapprof.h"
+#include "args.h"
+#include "gc.h"
+#include "nodes.h"
+#include "props.h"
+
+#define NUM_TYPE_NAMES 6
+
+typedef struct {
+  unsigned long count;
+  unsigned long bytes;
+} heap_tally;
+
+typedef struct class_tally {
+  char *name;                     // an atom
+  heap_tally tally;
+  UT_hash_handle hh;
+} class_tally;
+
+typedef struct {
+  heap_tally live;
+  heap_tally types[NUM_TYPE_NAMES];
+  class_tally *classes;
+} heap_census;
+
+static char *type_names[NUM_TYPE_NAMES] = {
+  "number", "string", "boolean", "object", "function", "undefined"
+};
+
+static fh_alloc_site *
+site_slot(fh_alloc_site *sites, unsigned long cap, int line, int column)
+{
+  unsigned long i = ((unsigned)line * 31 + (unsigned)column) & (cap - 1);
+  while (sites[i].count && (sites[i].line != line || sites[i].column != column))
+    i = (i + 1) & (cap - 1);
+  return &sites[i];
+}
+
+static void
+grow_sites()
+{
+  unsigned long i, cap = fh->alloc_sites_cap ? fh->alloc_sites_cap * 2 : 256;
+  fh_alloc_site *sites = calloc(cap, sizeof(fh_alloc_site));
+  for (i = 0; i < fh->alloc_sites_cap; i++) {
+    fh_alloc_site *site = &fh->alloc_sites[i];
+    if (site->count)
+      *site_slot(sites, cap, site->line, site->column) = *site;
+  }
+  free(fh->alloc_sites);
+  fh->alloc_sites = sites;
+  fh->alloc_sites_cap = cap;
+}
+
+void
+fh_heap_profile_alloc()
+{
+  int line = 0, column = 0;
+  if (fh->alloc_node) {
+    line = fh->alloc_node->line;
+    column = fh->alloc_node->column;
+  }
+
+  if (fh->num_alloc_sites * 2 >= fh->alloc_sites_cap)
+    grow_sites();
+
+  fh_alloc_site *site = site_slot(fh->alloc_sites, fh->alloc_sites_cap, line, column);
+  if (!site->count) {
+    site->line = line;
+    site->column = column;
+    fh->num_alloc_sites++;
+  }
+  site->count++;
+}
+
+/* Bytes held by a value, including what it owns outside its slot. */
+static unsigned long
+val_bytes(js_val *val)
+{
+  unsigned long bytes = sizeof(js_val);
+  if (IS_STR(val) && val->string.ptr)
+    bytes += val->string.length + 1;
+  bytes += val->slots_cap * sizeof(js_prop *);
+  bytes += val->elements_cap * sizeof(js_val *);
+  bytes += HASH_COUNT(val->map) * sizeof(js_prop);
+  if (IS_OBJ(val) && val->object.bound_args)
+    bytes += sizeof(js_args) + val->object.bound_args->cap * sizeof(js_val *);
+  return bytes;
+}
+
+static void
+tally_add(heap_tally *tally, unsigned long bytes)
+{
+  tally->count++;
+  tally->bytes += bytes;
+}
+
+static void
+census_add(heap_census *census, js_val *val)
+{
+  unsigned long bytes = val_bytes(val);
+  tally_add(&census->live, bytes);
+
+  int i;
+  char *type = fh_typeof(val);
+  for (i = 0; i < NUM_TYPE_NAMES; i++) {
+    if (STREQ(type, type_names[i])) {
+      tally_add(&census->types[i], bytes);
+      break;
+    }
+  }
+
+  if (!IS_OBJ(val)) return;
+  class_tally *cls;
+  char *name = fh_intern(val->object.class);
+  HASH_FIND(hh, census->classes, &name, sizeof(char *), cls);
+  if (!cls) {
+    cls = calloc(1, sizeof(class_tally));
+    cls->name = name;
+    HASH_ADD(hh, census->classes, name, sizeof(char *), cls);
+  }
+  tally_add(&cls->tally, bytes);
+}
+
+static void
+heap_census_take(heap_census *census)
+{
+  memset(census, 0, sizeof(heap_census));
+
+  int i, w;
+  for (i = 0; i < fh->gc_num_arenas; i++) {
+    gc_arena *arena = fh->gc_arenas[i];
+    for (w = 0; w < ARENA_WORDS; w++) {
+      uint64_t bits = arena->used[w];
+      while (bits) {
+        int bit = __builtin_ctzll(bits);
+        bits &= bits - 1;
+
+        js_val *val = &arena->slots[w * 64 + bit];
+        if (arena->unswept && !val->marked) continue;
+        census_add(census, val);
+      }
+    }
+  }
+}
+
+static void
+heap_census_free(heap_census *census)
+{
+  class_tally *cls, *tmp;
+  HASH_ITER(hh, census->classes, cls, tmp) {
+    HASH_DEL(census->classes, cls);
+    free(cls);
+  }
+}
+
+static int
+cmp_sites(const void *a, const void *b)
+{
+  const fh_alloc_site *x = a, *y = b;
+  if (x->count != y->count) return x->count > y->count ? -1 : 1;
+  if (x->line != y->line) return x->line - y->line;
+  return x->column - y->column;
+}
+
+/* The sites most allocated at first. Free the copy after use. */
+static fh_alloc_site *
+sorted_sites()
+{
+  fh_alloc_site *sites = malloc((fh->num_alloc_sites + 1) * sizeof(fh_alloc_site));
+  unsigned long i, n = 0;
+  for (i = 0; i < fh->alloc_sites_cap; i++) {
+    if (fh->alloc_sites[i].count)
+      sites[n++] = fh->alloc_sites[i];
+  }
+  qsort(sites, n, sizeof(fh_alloc_site), cmp_sites);
+  return sites;
+}
+
+static js_val *
+tally_object(heap_tally *tally)
+{
+  js_val *obj = JSOBJ();
+  fh_set_prop(obj, "count", JSNUM(tally->count), P_DEFAULT);
+  fh_set_prop(obj, "bytes", JSNUM(tally->bytes), P_DEFAULT);
+  return obj;
+}
+
+/* Build the profile as an object:
+ *
+ *   { live: {count, bytes}, types: {object: {count, bytes}, ...},
+ *     classes: {Array: {count, bytes}, ...},
+ *     sites: [{line, column, count}, ...] }
+ *
+ * with the sites most allocated at first. */
+js_val *
+fh_heap_profile()
+{
+  heap_census census;
+  heap_census_take(&census);
+
+  js_val *profile = JSOBJ();
+  js_val *types = JSOBJ(), *classes = JSOBJ(), *sites = JSARR();
+  fh_set_prop(profile, "live", tally_object(&census.live), P_DEFAULT);
+  fh_set_prop(profile, "types", types, P_DEFAULT);
+  fh_set_prop(profile, "classes", classes, P_DEFAULT);
+  fh_set_prop(profile, "sites", sites, P_DEFAULT);
+
+  int i;
+  for (i = 0; i < NUM_TYPE_NAMES; i++)
+    fh_set_prop(types, type_names[i], tally_object(&census.types[i]), P_DEFAULT);
+
+  class_tally *cls;
+  for (cls = census.classes; cls; cls = cls->hh.next)
+    fh_set_prop(classes, cls->name, tally_object(&cls->tally), P_DEFAULT);
+  heap_census_free(&census);
+
+  unsigned long n;
+  fh_alloc_site *sorted = sorted_sites();
+  for (n = 0; n < fh->num_alloc_sites; n++) {
+    js_val *entry = JSOBJ();
+    fh_set_prop(entry, "line", JSNUM(sorted[n].line), P_DEFAULT);
+    fh_set_prop(entry, "column", JSNUM(sorted[n].column), P_DEFAULT);
+    fh_set_prop(entry, "count", JSNUM(sorted[n].count), P_DEFAULT);
+    fh_set_elem(sites, n, entry);
+  }
+  fh_set_len(sites, n);
+  free(sorted);
+
+  return profile;
+}
+
+static void
+print_tally(FILE *out, char *name, heap_tally *tally)
+{
+  fprintf(out, "\"%s\": {\"count\": %lu, \"bytes\": %lu}", name, tally->count, tally->bytes);
+}
+
+/* Write the profile as JSON to the --heap-profile file, replacing the last
+ * one. This allocates no values, so it's safe at the end of a collection. */
+void
+fh_heap_profile_dump()
+{
+  FILE *out = fopen(fh->opt_heap_profile, "w");
+  if (!out) {
+    fprintf(stderr, "Error: can't write heap profile to %s\n", fh->opt_heap_profile);
+    return;
+  }
+
+  heap_census census;
+  heap_census_take(&census);
+
+  fputs("{\n  ", out);
+  print_tally(out, "live", &census.live);
+  fputs(",\n  \"types\": {", out);
+
+  int i;
+  for (i = 0; i < NUM_TYPE_NAMES; i++) {
+    fputs(i ? ",\n    " : "\n    ", out);
+    print_tally(out, type_names[i], &census.types[i]);
+  }
+
+  fputs("\n  },\n  \"classes\": {", out);
+  class_tally *cls;
+  for (cls = census.classes; cls; cls = cls->hh.next) {
+    fputs(cls == census.classes ? "\n    " : ",\n    ", out);
+    print_tally(out, cls->name, &cls->tally);
+  }
+  heap_census_free(&census);
+
+  fputs("\n  },\n  \"sites\": [", out);
+  unsigned long n;
+  fh_alloc_site *sorted = sorted_sites();
+  for (n = 0; n < fh->num_alloc_sites; n++) {
+    fprintf(out, "%s{\"line\": %d, \"column\": %d, \"count\": %lu}",
+        n ? ",\n    " : "\n    ", sorted[n].line, sorted[n].column, sorted[n].count);
+  }
+  free(sorted);
+  fputs("\n  ]\n}\n", out);
+  fclose(out);
+}
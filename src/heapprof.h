@@ -0,0 +1,41 @@
+/*
+ * heapprof.h -- Heap profiling by type, class and allocation site
+ *
+ * Copyright (c) 2012-2013 Nick Reynolds
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef HEAPPROF_H
+#define HEAPPROF_H
+
+#include "flathead.h"
+
+/* Allocations counted at a source position (line 0 for the runtime). The
+ * sites are an open-addressed table, since uthash tables here are keyed by
+ * atoms. */
+typedef struct fh_alloc_site {
+  int line;
+  int column;
+  unsigned long count;          // 0 for a vacant entry
+} fh_alloc_site;
+
+// Call with the node being evaluated, if it may allocate.
+#define HEAP_PROFILE_AT(node) \
+  do { if (fh->heap_profiling && (node)) fh->alloc_node = (node); } while (0)
+
+void fh_heap_profile_alloc(void);
+js_val * fh_heap_profile(void);
+void fh_heap_profile_dump(void);
+
+#endif
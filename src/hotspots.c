@@ -0,0 +1,205 @@
+/*
+ * hotspots.c -- Execution counts and times by source location
+ *
+ * Copyright (c) 2012-2013 Nick Reynolds
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* In a build with FH_HOTSPOTS (`make hotspots=on`), --hotspots counts how
+ * many times the tree-walker evaluates each node, how many times each loop
+ * goes round, and how many times each function is called and for how long,
+ * then prints the busiest source locations at exit. Without it, the hooks
+ * compile to nothing.
+ *
+ * The counts are kept by node slot, so every node gets one in these builds.
+ * Slots are numbered across the process, and so are the counts: isolates
+ * add to the same table. A function's time is inclusive, from the call to
+ * the pop of its state (a throw pops it too), and is only taken for its
+ * outermost activation, so recursion isn't counted twice. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hotspots.h"
+#include "nodes.h"
+#include "output.h"
+#include "timers.h"
+
+typedef struct {
+  struct ast_node *node;        // NULL until the slot is first counted
+  const char *script;
+  unsigned long count;
+  unsigned long back_edges;
+  unsigned long calls;
+  unsigned long active;         // activations of a function under way
+  double time;                  // in ms, inclusive
+} hot_entry;
+
+static struct {
+  bool started;
+  int top;
+  hot_entry *entries;
+  unsigned long cap;
+} hot;
+
+bool fh_hotspots_on = false;
+
+#ifdef FH_HOTSPOTS
+
+static hot_entry *
+hot_get(struct ast_node *node)
+{
+  unsigned long slot = node->slot;
+  if (slot >= hot.cap) {
+    unsigned long cap = hot.cap ? hot.cap : 1024;
+    while (cap <= slot) cap *= 2;
+    hot.entries = realloc(hot.entries, cap * sizeof(hot_entry));
+    memset(hot.entries + hot.cap, 0, (cap - hot.cap) * sizeof(hot_entry));
+    hot.cap = cap;
+  }
+  hot_entry *entry = &hot.entries[slot];
+  if (!entry->node) {
+    entry->node = node;
+    entry->script = fh->script_name;
+  }
+  return entry;
+}
+
+void
+fh_hot_enter(struct ast_node *node)
+{
+  if (node->slot) hot_get(node)->count++;
+}
+
+void
+fh_hot_back_edge(struct ast_node *node)
+{
+  hot_get(node)->back_edges++;
+}
+
+void
+fh_hot_call(eval_state *state)
+{
+  hot_entry *entry = hot_get(state->callee);
+  entry->calls++;
+  state->hot_timed = true;
+  state->hot_start = entry->active++ ? -1 : fh_clock_ms();
+}
+
+void
+fh_hot_return(eval_state *state)
+{
+  hot_entry *entry = hot_get(state->callee);
+  state->hot_timed = false;
+  entry->active--;
+  if (state->hot_start >= 0)
+    entry->time += fh_clock_ms() - state->hot_start;
+}
+
+#endif
+
+/* Start counting, to report the `top` busiest locations at exit. */
+bool
+fh_hotspots_start(int top)
+{
+#ifdef FH_HOTSPOTS
+  hot.top = top > 0 ? top : HOT_DEFAULT_TOP;
+  fh_hotspots_on = true;
+  if (!hot.started) {
+    hot.started = true;
+    atexit(fh_hotspots_report);
+  }
+  return true;
+#else
+  (void)top;
+  return false;
+#endif
+}
+
+static int
+by_count(const void *a, const void *b)
+{
+  const hot_entry *x = *(hot_entry * const *)a, *y = *(hot_entry * const *)b;
+  unsigned long cx = x->count + x->back_edges, cy = y->count + y->back_edges;
+  return cx < cy ? 1 : cx > cy ? -1 : 0;
+}
+
+static int
+by_time(const void *a, const void *b)
+{
+  const hot_entry *x = *(hot_entry * const *)a, *y = *(hot_entry * const *)b;
+  return x->time < y->time ? 1 : x->time > y->time ? -1 : 0;
+}
+
+static void
+print_location(hot_entry *entry)
+{
+  struct ast_node *node = entry->node;
+  const char *name = node_name(node);
+
+  fprintf(stderr, "  %s:%d:%d %s", entry->script ? entry->script : "(unknown)",
+      node->line, node->column, name ? name : "node");
+  if (node->type == NODE_FUNC)
+    fprintf(stderr, " %s", node->e3 && node->e3->sval ?
+        node->e3->sval : "(anonymous function)");
+  fprintf(stderr, "\n");
+}
+
+/* Print the locations evaluated most often (loops by their iterations too)
+ * and the functions that took the most time, to stderr. */
+void
+fh_hotspots_report()
+{
+  hot_entry **counted, **called;
+  unsigned long i, num_counted = 0, num_called = 0;
+  int n;
+
+  if (!fh_hotspots_on) return;
+  fh_hotspots_on = false;
+
+  // Whatever the script printed comes before the report.
+  fh_output_flush();
+
+  counted = malloc((hot.cap + 1) * sizeof(hot_entry *));
+  called = malloc((hot.cap + 1) * sizeof(hot_entry *));
+  for (i = 0; i < hot.cap; i++) {
+    hot_entry *entry = &hot.entries[i];
+    if (!entry->node) continue;
+    if (entry->count || entry->back_edges) counted[num_counted++] = entry;
+    if (entry->calls) called[num_called++] = entry;
+  }
+  qsort(counted, num_counted, sizeof(hot_entry *), by_count);
+  qsort(called, num_called, sizeof(hot_entry *), by_time);
+
+  fprintf(stderr, "Hot spots by count:\n");
+  fprintf(stderr, "  %12s %12s  location\n", "count", "iterations");
+  for (n = 0; n < hot.top && (unsigned long)n < num_counted; n++) {
+    fprintf(stderr, "  %12lu %12lu", counted[n]->count, counted[n]->back_edges);
+    print_location(counted[n]);
+  }
+
+  fprintf(stderr, "Hot functions by inclusive time:\n");
+  fprintf(stderr, "  %12s %12s  location\n", "calls", "time (ms)");
+  for (n = 0; n < hot.top && (unsigned long)n < num_called; n++) {
+    fprintf(stderr, "  %12lu %12.3f", called[n]->calls, called[n]->time);
+    print_location(called[n]);
+  }
+
+  free(counted);
+  free(called);
+  free(hot.entries);
+  hot.entries = NULL;
+  hot.cap = 0;
+}
@@ -0,0 +1,60 @@
+/*
+ * hotspots.h -- Execution counts and times by source location
+ *
+ * Copyright (c) 2012-2013 Nick Reynolds
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef HOTSPOTS_H
+#define HOTSPOTS_H
+
+#include "flathead.h"
+
+#define HOT_DEFAULT_TOP 20      // locations in each table of the report
+
+#ifdef FH_HOTSPOTS
+
+// Whether --hotspots is counting.
+extern bool fh_hotspots_on;
+
+// Call as the tree-walker evaluates a node, and at each loop iteration.
+#define HOTSPOT_ENTER(node) \
+  do { if (fh_hotspots_on) fh_hot_enter(node); } while (0)
+#define HOTSPOT_BACK_EDGE(node) \
+  do { if (fh_hotspots_on) fh_hot_back_edge(node); } while (0)
+
+// Call as a call state starts running a function, and as it's popped.
+#define HOTSPOT_CALL(state) \
+  do { if (fh_hotspots_on) fh_hot_call(state); } while (0)
+#define HOTSPOT_RETURN(state) \
+  do { if ((state)->hot_timed) fh_hot_return(state); } while (0)
+
+void fh_hot_enter(struct ast_node *);
+void fh_hot_back_edge(struct ast_node *);
+void fh_hot_call(eval_state *);
+void fh_hot_return(eval_state *);
+
+#else
+
+#define HOTSPOT_ENTER(node) ((void)0)
+#define HOTSPOT_BACK_EDGE(node) ((void)0)
+#define HOTSPOT_CALL(state) ((void)0)
+#define HOTSPOT_RETURN(state) ((void)0)
+
+#endif
+
+bool fh_hotspots_start(int);
+void fh_hotspots_report(void);
+
+#endif
@@ -0,0 +1,1056 @@
+/*
+ * jit.c -- Baseline compiler of hot numeric loops to machine code
+ *
+ * Copyright (c) 2012-2013 Nick Reynolds
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* A `while` or `for` loop whose body has run JIT_HOT_LOOP times is compiled
+ * to x86-64 machine code, one template per node, if all it does is
+ * arithmetic on variables that hold numbers: assignments and updates,
+ * if/else, break, nested loops, the arithmetic, bitwise and comparison
+ * operators, and the Math functions of one argument. Anything else (a call,
+ * a property, a string, `continue`) leaves the loop to the interpreter.
+ *
+ * Each variable gets a slot of a frame of doubles, read in when the code is
+ * entered and written back when it leaves. Entry is guarded on the variables
+ * holding numbers and on the Math functions being the built-in ones, neither
+ * of which the loop can change. The operations whose results only agree
+ * with the interpreter's for some operands are guarded where they run:
+ * division and modulo want finite numbers (and a divisor that isn't 0), the
+ * bitwise operators numbers that truncate to an int64, which is then taken
+ * as an int32, and Math functions finite numbers. A failed guard
+ * deoptimizes: the slots are put back as they were at the start of the
+ * iteration, which had no other effects, and the interpreter runs it again.
+ * A loop that keeps deoptimizing is left to the interpreter.
+ *
+ * The code is entered at the start of the body, once the loop's condition
+ * has held, and runs to the end of the loop. The VM also gets the value of
+ * the last expression statement, its completion value, from a slot. */
+
+// MAP_ANONYMOUS is outside POSIX.
+#define _DEFAULT_SOURCE
+
+#include <math.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jit.h"
+#include "props.h"
+#include "runtime/lib/Math.h"
+
+#ifdef FH_JIT
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define SLOT_RESULT 0           // the last expression statement's value
+#define SLOT_HAS_RESULT 1       // 1 once there is one
+#define NUM_FIXED_SLOTS 2
+
+typedef struct {
+  char *name;                 // the variable, or NULL
+  double val;                 // a constant's value
+  bool stored;                // assigned in the loop (and saved each iteration)
+} jit_slot;
+
+typedef struct {
+  const char *name;
+  js_native_function *native;
+  double (*fn)(double);
+} jit_math;
+
+typedef struct {
+  ast_node *node;
+  const char *reason;
+  int label;                  // of its stub, while compiling
+} jit_guard;
+
+typedef struct {
+  size_t at;
+  int label;
+} jit_fixup;
+
+typedef enum {
+  LOOP_COUNTING,
+  LOOP_COMPILED,
+  LOOP_FAILED
+} jit_loop_state;
+
+struct jit_loop {
+  jit_loop_state state;
+  unsigned long count;        // iterations, or ones to interpret after a deopt
+  int deopts;
+  int (*entry)(double *);     // 0 at the end of the loop, or 1 + a guard
+  void *code;
+  size_t code_size;
+  jit_slot *slots;
+  int num_slots;
+  double *frame;              // the slots, then their copies at the iteration start
+  const jit_math **calls;
+  int num_calls;
+  jit_guard *guards;
+  int num_guards;
+};
+
+typedef struct {
+  unsigned char *buf;
+  size_t len;
+  size_t cap;
+  int *labels;                // offsets, -1 until placed
+  int num_labels;
+  jit_fixup *fixups;
+  int num_fixups;
+  jit_slot *slots;
+  int num_slots;
+  const jit_math **calls;
+  int num_calls;
+  jit_guard *guards;
+  int num_guards;
+  int depth;                  // doubles pushed on the machine stack
+  int exit;                   // label after the innermost loop
+  int save;                   // labels of the routines made at the end
+  int deopt;
+  bool completion;            // keep the completion value
+  ast_node *error_node;
+  const char *error;
+  jmp_buf fail;
+} jit_compiler;
+
+static const jit_math math_fns[] = {
+  {"abs", math_abs, fabs},
+  {"acos", math_acos, acos},
+  {"asin", math_asin, asin},
+  {"atan", math_atan, atan},
+  {"ceil", math_ceil, ceil},
+  {"cos", math_cos, cos},
+  {"exp", math_exp, exp},
+  {"floor", math_floor, floor},
+  {"log", math_log, log},
+  {"sin", math_sin, sin},
+  {"sqrt", math_sqrt, sqrt},
+  {"tan", math_tan, tan},
+};
+
+// Instruction prefixes and SSE2 opcodes (after 0F).
+#define SD 0xF2
+#define PD 0x66
+
+enum {
+  MOVSD_LOAD = 0x10,
+  MOVSD_STORE = 0x11,
+  MOVAPD = 0x28,
+  UCOMISD = 0x2E,
+  XORPD = 0x57,
+  ADDSD = 0x58,
+  MULSD = 0x59,
+  SUBSD = 0x5C,
+  DIVSD = 0x5E
+};
+
+// Condition codes, for jcc (0F 80+cc) after ucomisd.
+enum {
+  CC_B = 0x2,
+  CC_AE = 0x3,
+  CC_E = 0x4,
+  CC_NE = 0x5,
+  CC_BE = 0x6,
+  CC_A = 0x7,
+  CC_P = 0xA
+};
+
+static void compile_exp(jit_compiler *, ast_node *);
+static void compile_stmt(jit_compiler *, ast_node *);
+
+
+// ----------------------------------------------------------------------------
+// Emitting code
+// ----------------------------------------------------------------------------
+
+static void
+fail(jit_compiler *c, ast_node *node, const char *why)
+{
+  c->error = why;
+  c->error_node = node;
+  longjmp(c->fail, 1);
+}
+
+static void
+put_bytes(jit_compiler *c, const unsigned char *bytes, size_t n)
+{
+  if (c->len + n > c->cap) {
+    c->cap = c->cap ? c->cap * 2 : 1024;
+    c->buf = realloc(c->buf, c->cap);
+  }
+  memcpy(c->buf + c->len, bytes, n);
+  c->len += n;
+}
+
+static void
+put(jit_compiler *c, int n, ...)
+{
+  unsigned char bytes[16];
+  va_list ap;
+  int i;
+
+  va_start(ap, n);
+  for (i = 0; i < n; i++)
+    bytes[i] = va_arg(ap, int);
+  va_end(ap);
+  put_bytes(c, bytes, n);
+}
+
+static void
+put32(jit_compiler *c, uint32_t x)
+{
+  unsigned char bytes[4] = {x, x >> 8, x >> 16, x >> 24};
+  put_bytes(c, bytes, 4);
+}
+
+static void
+put64(jit_compiler *c, uint64_t x)
+{
+  put32(c, x);
+  put32(c, x >> 32);
+}
+
+static int
+new_label(jit_compiler *c)
+{
+  c->labels = realloc(c->labels, (c->num_labels + 1) * sizeof(int));
+  c->labels[c->num_labels] = -1;
+  return c->num_labels++;
+}
+
+static void
+place(jit_compiler *c, int label)
+{
+  c->labels[label] = c->len;
+}
+
+/* A rel32 to a label, filled in once the code is done. */
+static void
+put_target(jit_compiler *c, int label)
+{
+  c->fixups = realloc(c->fixups, (c->num_fixups + 1) * sizeof(jit_fixup));
+  c->fixups[c->num_fixups++] = (jit_fixup){c->len, label};
+  put32(c, 0);
+}
+
+static void
+jmp(jit_compiler *c, int label)
+{
+  put(c, 1, 0xE9);
+  put_target(c, label);
+}
+
+static void
+jcc(jit_compiler *c, int cc, int label)
+{
+  put(c, 2, 0x0F, 0x80 | cc);
+  put_target(c, label);
+}
+
+/* op xmm, [rbx + slot * 8] */
+static void
+sse_slot(jit_compiler *c, int prefix, int op, int xmm, int slot)
+{
+  put(c, 4, prefix, 0x0F, op, 0x83 | xmm << 3);
+  put32(c, slot * 8);
+}
+
+/* op dst, src */
+static void
+sse_reg(jit_compiler *c, int prefix, int op, int dst, int src)
+{
+  put(c, 4, prefix, 0x0F, op, 0xC0 | dst << 3 | src);
+}
+
+static void
+push_xmm0(jit_compiler *c)
+{
+  put(c, 4, 0x48, 0x83, 0xEC, 0x08);            // sub rsp, 8
+  put(c, 5, SD, 0x0F, MOVSD_STORE, 0x04, 0x24); // movsd [rsp], xmm0
+  c->depth++;
+}
+
+static void
+pop_xmm(jit_compiler *c, int xmm)
+{
+  put(c, 5, SD, 0x0F, MOVSD_LOAD, 0x04 | xmm << 3, 0x24);
+  put(c, 4, 0x48, 0x83, 0xC4, 0x08);            // add rsp, 8
+  c->depth--;
+}
+
+/* Call a C function of doubles, keeping the stack 16-byte aligned. */
+static void
+call_c(jit_compiler *c, uintptr_t fn)
+{
+  bool pad = c->depth % 2;
+  if (pad) put(c, 4, 0x48, 0x83, 0xEC, 0x08);
+  put(c, 2, 0x48, 0xB8);                        // mov rax, fn
+  put64(c, fn);
+  put(c, 2, 0xFF, 0xD0);                        // call rax
+  if (pad) put(c, 4, 0x48, 0x83, 0xC4, 0x08);
+}
+
+static void
+epilogue(jit_compiler *c)
+{
+  put(c, 4, 0x48, 0x8D, 0x65, 0xF8);            // lea rsp, [rbp - 8]
+  put(c, 3, 0x5B, 0x5D, 0xC3);                  // pop rbx; pop rbp; ret
+}
+
+
+// ----------------------------------------------------------------------------
+// Slots & guards
+// ----------------------------------------------------------------------------
+
+static int
+add_slot(jit_compiler *c, char *name, double val, bool stored)
+{
+  c->slots = realloc(c->slots, (c->num_slots + 1) * sizeof(jit_slot));
+  c->slots[c->num_slots] = (jit_slot){name, val, stored};
+  return c->num_slots++;
+}
+
+static int
+var_slot(jit_compiler *c, ast_node *ident, bool store)
+{
+  int i;
+  for (i = NUM_FIXED_SLOTS; i < c->num_slots; i++) {
+    if (c->slots[i].name && STREQ(c->slots[i].name, ident->sval)) {
+      c->slots[i].stored |= store;
+      return i;
+    }
+  }
+  return add_slot(c, ident->sval, 0, store);
+}
+
+static int
+const_slot(jit_compiler *c, double val)
+{
+  int i;
+  for (i = NUM_FIXED_SLOTS; i < c->num_slots; i++)
+    if (!c->slots[i].name && memcmp(&c->slots[i].val, &val, sizeof(double)) == 0)
+      return i;
+  return add_slot(c, NULL, val, false);
+}
+
+/* Deoptimize when the flags meet the condition. */
+static void
+guard(jit_compiler *c, int cc, ast_node *node, const char *reason)
+{
+  int label = new_label(c);
+  c->guards = realloc(c->guards, (c->num_guards + 1) * sizeof(jit_guard));
+  c->guards[c->num_guards++] = (jit_guard){node, reason, label};
+  jcc(c, cc, label);
+}
+
+/* x - x is NaN, and unordered with itself, for NaN and the infinities. */
+static void
+guard_finite(jit_compiler *c, int xmm, ast_node *node, const char *reason)
+{
+  sse_reg(c, PD, MOVAPD, 7, xmm);
+  sse_reg(c, SD, SUBSD, 7, 7);
+  sse_reg(c, PD, UCOMISD, 7, 7);
+  guard(c, CC_P, node, reason);
+}
+
+static void
+guard_nonzero(jit_compiler *c, int xmm, ast_node *node, const char *reason)
+{
+  sse_reg(c, PD, XORPD, 7, 7);
+  sse_reg(c, PD, UCOMISD, xmm, 7);
+  guard(c, CC_E, node, reason);
+}
+
+/* Truncate xmm0 into eax, or xmm1 into ecx. cvttsd2si gives INT64_MIN for
+ * NaN and anything an int64 can't hold; the low half of the rest is the
+ * number's int32. */
+static void
+to_int32(jit_compiler *c, int xmm, ast_node *node)
+{
+  put(c, 5, SD, 0x48, 0x0F, 0x2C, 0xC0 | xmm << 3 | xmm);  // cvttsd2si
+  put(c, 2, 0x48, 0xBA);                                    // mov rdx, INT64_MIN
+  put64(c, 0x8000000000000000ULL);
+  put(c, 3, 0x48, 0x39, 0xD0 | xmm);                        // cmp r64, rdx
+  guard(c, CC_E, node, "bitwise operand out of range");
+}
+
+
+// ----------------------------------------------------------------------------
+// Expressions
+// ----------------------------------------------------------------------------
+
+/* The slot of an operand that can be used straight from memory. */
+static int
+leaf_slot(jit_compiler *c, ast_node *node)
+{
+  if (node->type == NODE_IDENT) return var_slot(c, node, false);
+  if (node->type == NODE_NUM) return const_slot(c, node->val);
+  return -1;
+}
+
+/* Evaluate `a` into xmm0 and `b` into xmm1, in that order. */
+static void
+compile_operands(jit_compiler *c, ast_node *a, ast_node *b)
+{
+  int slot = leaf_slot(c, b);
+
+  compile_exp(c, a);
+  if (slot >= 0) {
+    sse_slot(c, SD, MOVSD_LOAD, 1, slot);
+    return;
+  }
+  push_xmm0(c);
+  compile_exp(c, b);
+  sse_reg(c, PD, MOVAPD, 1, 0);
+  pop_xmm(c, 0);
+}
+
+/* xmm0 = xmm0 op xmm1 */
+static void
+compile_op(jit_compiler *c, enum ast_op op, ast_node *node)
+{
+  switch (op) {
+    case OP_ADD: sse_reg(c, SD, ADDSD, 0, 1); return;
+    case OP_SUB: sse_reg(c, SD, SUBSD, 0, 1); return;
+    case OP_MUL: sse_reg(c, SD, MULSD, 0, 1); return;
+    case OP_DIV:
+      guard_finite(c, 0, node, "division of a non-finite number");
+      guard_finite(c, 1, node, "division by a non-finite number");
+      guard_nonzero(c, 1, node, "division by zero");
+      sse_reg(c, SD, DIVSD, 0, 1);
+      return;
+    case OP_MOD:
+      guard_finite(c, 0, node, "modulo of a non-finite number");
+      guard_finite(c, 1, node, "modulo by a non-finite number");
+      call_c(c, (uintptr_t)fmod);
+      return;
+    case OP_BIT_AND: case OP_BIT_OR: case OP_BIT_XOR:
+    case OP_LSHIFT: case OP_RSHIFT: case OP_URSHIFT:
+      break;
+    default:
+      fail(c, node, "operator without numeric operands");
+  }
+
+  to_int32(c, 0, node);
+  to_int32(c, 1, node);
+  switch (op) {
+    case OP_BIT_AND: put(c, 2, 0x21, 0xC8); break;          // and eax, ecx
+    case OP_BIT_OR:  put(c, 2, 0x09, 0xC8); break;          // or eax, ecx
+    case OP_BIT_XOR: put(c, 2, 0x31, 0xC8); break;          // xor eax, ecx
+    case OP_LSHIFT:  put(c, 2, 0xD3, 0xE0); break;          // shl eax, cl
+    case OP_RSHIFT:  put(c, 2, 0xD3, 0xF8); break;          // sar eax, cl
+    case OP_URSHIFT:
+      put(c, 2, 0xD3, 0xE8);                                // shr eax, cl
+      put(c, 5, SD, 0x48, 0x0F, 0x2A, 0xC0);                // cvtsi2sd xmm0, rax
+      return;
+    default: break;
+  }
+  put(c, 4, SD, 0x0F, 0x2A, 0xC0);                          // cvtsi2sd xmm0, eax
+}
+
+static void
+compile_store(jit_compiler *c, ast_node *ref)
+{
+  if (ref->type != NODE_IDENT) fail(c, ref, "assignment to a property");
+  sse_slot(c, SD, MOVSD_STORE, 0, var_slot(c, ref, true));
+}
+
+/* x++, x--, ++x and --x, as the interpreter: the old value plus or minus 1. */
+static void
+compile_update(jit_compiler *c, ast_node *node, bool postfix)
+{
+  if (node->e1->type != NODE_IDENT) fail(c, node, "update of a property");
+
+  int slot = var_slot(c, node->e1, true), one = const_slot(c, 1);
+  int op = node->op == OP_INC ? ADDSD : SUBSD;
+  int res = postfix ? 1 : 0;
+
+  sse_slot(c, SD, MOVSD_LOAD, 0, slot);
+  if (postfix) sse_reg(c, PD, MOVAPD, 1, 0);
+  sse_slot(c, SD, op, res, one);
+  sse_slot(c, SD, MOVSD_STORE, res, slot);
+}
+
+static void
+compile_unary(jit_compiler *c, ast_node *node)
+{
+  switch (node->op) {
+    case OP_INC:
+    case OP_DEC:
+      compile_update(c, node, false);
+      break;
+    case OP_PLUS:
+      compile_exp(c, node->e1);
+      break;
+    case OP_MINUS:
+      compile_exp(c, node->e1);
+      put(c, 5, PD, 0x48, 0x0F, 0x7E, 0xC0);                // movq rax, xmm0
+      put(c, 5, 0x48, 0x0F, 0xBA, 0xF8, 0x3F);              // btc rax, 63
+      put(c, 5, PD, 0x48, 0x0F, 0x6E, 0xC0);                // movq xmm0, rax
+      break;
+    case OP_BIT_NOT:
+      compile_exp(c, node->e1);
+      to_int32(c, 0, node);
+      put(c, 2, 0xF7, 0xD0);                                // not eax
+      put(c, 4, SD, 0x0F, 0x2A, 0xC0);                      // cvtsi2sd xmm0, eax
+      break;
+    default:
+      fail(c, node, "operator without a numeric result");
+  }
+}
+
+/* Assignments, compound ones (which, like the interpreter, evaluate their
+ * right side first), and the comma operator. */
+static void
+compile_assign(jit_compiler *c, ast_node *node)
+{
+  if (node->op == OP_NONE) {
+    compile_exp(c, node->e1);
+    compile_exp(c, node->e2);
+    return;
+  }
+  if (node->e1->type != NODE_IDENT) fail(c, node, "assignment to a property");
+
+  compile_exp(c, node->e2);
+  if (node->op != OP_ASGN) {
+    sse_reg(c, PD, MOVAPD, 1, 0);
+    sse_slot(c, SD, MOVSD_LOAD, 0, var_slot(c, node->e1, false));
+    compile_op(c, node->op, node);
+  }
+  compile_store(c, node->e1);
+}
+
+/* Math.f(x), with f guarded on entry to be the built-in. */
+static void
+compile_call(jit_compiler *c, ast_node *node)
+{
+  ast_node *callee = node->e1, *args = node->e2;
+  const jit_math *math = NULL;
+  size_t i;
+  int j;
+
+  if (callee->type != NODE_MEMBER || callee->val ||
+      callee->e2->type != NODE_IDENT || !STREQ(callee->e2->sval, "Math") ||
+      args->type != NODE_ARG_LST || args->num_items != 1)
+    fail(c, node, "call");
+  for (i = 0; i < sizeof(math_fns) / sizeof(jit_math); i++)
+    if (STREQ(math_fns[i].name, callee->e1->sval)) math = &math_fns[i];
+  if (!math) fail(c, node, "call");
+
+  for (j = 0; j < c->num_calls && c->calls[j] != math; j++);
+  if (j == c->num_calls) {
+    c->calls = realloc(c->calls, (c->num_calls + 1) * sizeof(jit_math *));
+    c->calls[c->num_calls++] = math;
+  }
+
+  compile_exp(c, args->items[0]);
+  guard_finite(c, 0, node, "Math function of a non-finite number");
+  call_c(c, (uintptr_t)math->fn);
+}
+
+static bool
+is_comparison(enum ast_op op)
+{
+  return op == OP_LT || op == OP_GT || op == OP_LTE || op == OP_GTE ||
+    op == OP_EQ || op == OP_NEQ || op == OP_STRICT_EQ || op == OP_STRICT_NEQ;
+}
+
+/* Jump to `label` when the condition is `when`, and fall through otherwise.
+ * ucomisd sets ZF, PF and CF for unordered operands (a NaN), which every
+ * comparison with one must treat as false. */
+static void
+compile_cond(jit_compiler *c, ast_node *node, bool when, int label)
+{
+  enum ast_op op = node->op;
+  int skip;
+
+  if (node->type == NODE_BOOL) {
+    if ((node->val != 0) == when) jmp(c, label);
+    return;
+  }
+
+  if (node->type == NODE_EXP && node->sub_type == NODE_UNARY_PRE && op == OP_NOT) {
+    compile_cond(c, node->e1, !when, label);
+    return;
+  }
+
+  if (node->type == NODE_EXP && (op == OP_AND || op == OP_OR)) {
+    if ((op == OP_AND) != when) {
+      compile_cond(c, node->e1, when, label);
+      compile_cond(c, node->e2, when, label);
+      return;
+    }
+    skip = new_label(c);
+    compile_cond(c, node->e1, !when, skip);
+    compile_cond(c, node->e2, when, label);
+    place(c, skip);
+    return;
+  }
+
+  if (node->type == NODE_EXP && node->sub_type != NODE_UNARY_PRE &&
+      node->sub_type != NODE_UNARY_POST && is_comparison(op)) {
+    compile_operands(c, node->e1, node->e2);
+    if (op == OP_LT || op == OP_LTE)
+      sse_reg(c, PD, UCOMISD, 1, 0);
+    else
+      sse_reg(c, PD, UCOMISD, 0, 1);
+
+    switch (op) {
+      case OP_LT: case OP_GT:
+        jcc(c, when ? CC_A : CC_BE, label);
+        return;
+      case OP_LTE: case OP_GTE:
+        jcc(c, when ? CC_AE : CC_B, label);
+        return;
+      default:
+        break;
+    }
+    bool equal = (op == OP_EQ || op == OP_STRICT_EQ) == when;
+    if (equal) {
+      skip = new_label(c);
+      jcc(c, CC_P, skip);
+      jcc(c, CC_E, label);
+      place(c, skip);
+    }
+    else {
+      jcc(c, CC_P, label);
+      jcc(c, CC_NE, label);
+    }
+    return;
+  }
+
+  // A number is false when it's 0 or NaN, which both set ZF.
+  compile_exp(c, node);
+  sse_reg(c, PD, XORPD, 1, 1);
+  sse_reg(c, PD, UCOMISD, 0, 1);
+  jcc(c, when ? CC_NE : CC_E, label);
+}
+
+/* Evaluate a numeric expression into xmm0. */
+static void
+compile_exp(jit_compiler *c, ast_node *node)
+{
+  int other, end;
+
+  switch (node->type) {
+    case NODE_NUM:
+      sse_slot(c, SD, MOVSD_LOAD, 0, const_slot(c, node->val));
+      break;
+    case NODE_IDENT:
+      sse_slot(c, SD, MOVSD_LOAD, 0, var_slot(c, node, false));
+      break;
+    case NODE_ASGN:
+      compile_assign(c, node);
+      break;
+    case NODE_CALL:
+      compile_call(c, node);
+      break;
+    case NODE_TERN:
+      other = new_label(c);
+      end = new_label(c);
+      compile_cond(c, node->e1, false, other);
+      compile_exp(c, node->e2);
+      jmp(c, end);
+      place(c, other);
+      compile_exp(c, node->e3);
+      place(c, end);
+      break;
+    case NODE_EXP:
+      if (node->sub_type == NODE_UNARY_POST)
+        compile_update(c, node, true);
+      else if (node->sub_type == NODE_UNARY_PRE)
+        compile_unary(c, node);
+      else
+        compile_operands(c, node->e1, node->e2), compile_op(c, node->op, node);
+      break;
+    default:
+      fail(c, node, "expression without a numeric value");
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Statements
+// ----------------------------------------------------------------------------
+
+/* A loop. The one compiled is entered at the start of its body, with its
+ * condition known to hold, and saves its slots there on each iteration. */
+static void
+compile_loop(jit_compiler *c, ast_node *node, bool outer)
+{
+  ast_node *init = NULL, *test = node->e1, *update = NULL, *body = node->e2;
+  int start = new_label(c), check = new_label(c), exit = new_label(c);
+  int parent_exit = c->exit;
+
+  if (node->type == NODE_FOR) {
+    init = node->e1->e1;
+    test = node->e1->e2;
+    update = node->e1->e3;
+  }
+
+  if (!outer) {
+    if (init && init->type == NODE_VAR_DEC_LST)
+      compile_stmt(c, init);
+    else if (init)
+      compile_exp(c, init);
+    jmp(c, check);
+  }
+
+  place(c, start);
+  if (outer) {
+    put(c, 1, 0xE8);                              // call save
+    put_target(c, c->save);
+  }
+  c->exit = exit;
+  compile_stmt(c, body);
+  if (update) compile_exp(c, update);
+  place(c, check);
+  if (test)
+    compile_cond(c, test, true, start);
+  else
+    jmp(c, start);
+  place(c, exit);
+  c->exit = parent_exit;
+}
+
+static void
+compile_stmt(jit_compiler *c, ast_node *node)
+{
+  int i, other, end;
+
+  if (!node) return;
+
+  switch (node->type) {
+    case NODE_STMT_LST:
+    case NODE_VAR_DEC_LST:
+      for (i = 0; i < node->num_items; i++)
+        compile_stmt(c, node->items[i]);
+      break;
+
+    case NODE_BLOCK:
+    case NODE_VAR_STMT:
+      compile_stmt(c, node->e1);
+      break;
+
+    case NODE_EMPT_STMT:
+      break;
+
+    case NODE_VAR_DEC:
+      if (node->e2) {
+        compile_exp(c, node->e2);
+        compile_store(c, node->e1);
+      }
+      break;
+
+    case NODE_EXP_STMT:
+      compile_exp(c, node->e1);
+      if (c->completion) {
+        sse_slot(c, SD, MOVSD_STORE, 0, SLOT_RESULT);
+        sse_slot(c, SD, MOVSD_LOAD, 0, const_slot(c, 1));
+        sse_slot(c, SD, MOVSD_STORE, 0, SLOT_HAS_RESULT);
+      }
+      break;
+
+    case NODE_IF:
+      other = new_label(c);
+      compile_cond(c, node->e1, false, other);
+      compile_stmt(c, node->e2);
+      if (node->e3) {
+        end = new_label(c);
+        jmp(c, end);
+        place(c, other);
+        compile_stmt(c, node->e3);
+        place(c, end);
+      }
+      else
+        place(c, other);
+      break;
+
+    case NODE_BREAK:
+      jmp(c, c->exit);
+      break;
+
+    case NODE_WHILE:
+    case NODE_FOR:
+      compile_loop(c, node, false);
+      break;
+
+    default:
+      fail(c, node, "statement");
+  }
+}
+
+/* The routine the loop calls at the start of each iteration to save its
+ * slots, and the one failed guards go through to put them back. */
+static void
+compile_save(jit_compiler *c, bool restore)
+{
+  int i, copy;
+  for (i = 0; i < c->num_slots; i++) {
+    if (!c->slots[i].stored) continue;
+    copy = c->num_slots + i;
+    sse_slot(c, SD, MOVSD_LOAD, 0, restore ? copy : i);
+    sse_slot(c, SD, MOVSD_STORE, 0, restore ? i : copy);
+  }
+}
+
+/* Compile a loop into `loop`. The code is called with the frame in rdi,
+ * which it keeps in rbx, and returns 0 at the end of the loop, or 1 plus
+ * the index of a failed guard. */
+static bool
+compile(jit_loop *loop, ast_node *node)
+{
+  jit_compiler *c = calloc(1, sizeof(jit_compiler));
+  volatile bool ok = false;
+  int i;
+
+  c->completion = fh->opt_engine == ENGINE_VM;
+  c->save = new_label(c);
+  c->deopt = new_label(c);
+  add_slot(c, NULL, 0, true);       // SLOT_RESULT
+  add_slot(c, NULL, 0, true);       // SLOT_HAS_RESULT
+
+  if (setjmp(c->fail)) {
+    if (fh->opt_jit_log)
+      fprintf(stderr, "jit: can't compile the loop at %s:%d:%d: %s at %d:%d\n",
+        fh->script_name, node->line, node->column, c->error,
+        c->error_node->line, c->error_node->column);
+    goto done;
+  }
+
+  put(c, 1, 0x55);                                // push rbp
+  put(c, 3, 0x48, 0x89, 0xE5);                    // mov rbp, rsp
+  put(c, 1, 0x53);                                // push rbx
+  put(c, 4, 0x48, 0x83, 0xEC, 0x08);              // sub rsp, 8
+  put(c, 3, 0x48, 0x89, 0xFB);                    // mov rbx, rdi
+  compile_loop(c, node, true);
+  put(c, 2, 0x31, 0xC0);                          // xor eax, eax
+  epilogue(c);
+
+  place(c, c->save);
+  compile_save(c, false);
+  put(c, 1, 0xC3);                                // ret
+
+  for (i = 0; i < c->num_guards; i++) {
+    place(c, c->guards[i].label);
+    put(c, 1, 0xB8);                              // mov eax, 1 + i
+    put32(c, 1 + i);
+    jmp(c, c->deopt);
+  }
+  place(c, c->deopt);
+  compile_save(c, true);
+  epilogue(c);
+
+  for (i = 0; i < c->num_fixups; i++) {
+    int32_t rel = c->labels[c->fixups[i].label] - (int)(c->fixups[i].at + 4);
+    memcpy(c->buf + c->fixups[i].at, &rel, 4);
+  }
+
+  // Written, then made executable.
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t size = (c->len + page - 1) / page * page;
+  void *code = mmap(NULL, size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code == MAP_FAILED) {
+    if (fh->opt_jit_log)
+      fprintf(stderr, "jit: no memory for the code of the loop at %s:%d:%d\n",
+        fh->script_name, node->line, node->column);
+    goto done;
+  }
+  memcpy(code, c->buf, c->len);
+  mprotect(code, size, PROT_READ | PROT_EXEC);
+
+  loop->code = code;
+  loop->code_size = size;
+  *(void **)&loop->entry = code;
+  loop->slots = c->slots;
+  loop->num_slots = c->num_slots;
+  loop->frame = calloc(2 * c->num_slots, sizeof(double));
+  for (i = 0; i < c->num_slots; i++)
+    loop->frame[i] = c->slots[i].val;
+  loop->calls = c->calls;
+  loop->num_calls = c->num_calls;
+  loop->guards = c->guards;
+  loop->num_guards = c->num_guards;
+  c->slots = NULL;
+  c->calls = NULL;
+  c->guards = NULL;
+  ok = true;
+
+  if (fh->opt_jit_log)
+    fprintf(stderr, "jit: compiled the loop at %s:%d:%d (%d slots, %lu bytes)\n",
+      fh->script_name, node->line, node->column, loop->num_slots,
+      (unsigned long)c->len);
+
+done:
+  free(c->buf);
+  free(c->labels);
+  free(c->fixups);
+  free(c->slots);
+  free(c->calls);
+  free(c->guards);
+  free(c);
+  return ok;
+}
+
+
+// ----------------------------------------------------------------------------
+// Running
+// ----------------------------------------------------------------------------
+
+/* Count a deopt, and interpret for a while before entering again, or for
+ * good after too many. */
+static fh_jit_result
+deopt(jit_loop *loop, ast_node *node, ast_node *at, const char *why,
+    const char *name)
+{
+  if (fh->opt_jit_log)
+    fprintf(stderr, "jit: deoptimized the loop at %s:%d:%d: %s%s at %d:%d\n",
+      fh->script_name, node->line, node->column, name ? name : "", why,
+      at->line, at->column);
+
+  if (++loop->deopts < JIT_MAX_DEOPTS) {
+    loop->count = JIT_BACKOFF << (loop->deopts - 1);
+    return JIT_INTERPRET;
+  }
+  if (fh->opt_jit_log)
+    fprintf(stderr, "jit: left the loop at %s:%d:%d to the interpreter\n",
+      fh->script_name, node->line, node->column);
+  loop->state = LOOP_FAILED;
+  return JIT_NEVER;
+}
+
+/* Read the variables in, run the code, and write them back. */
+static fh_jit_result
+enter(js_val *ctx, ast_node *node, jit_loop *loop, js_val **result)
+{
+  double *frame = loop->frame;
+  js_prop *prop;
+  int i, status;
+
+  for (i = 0; i < loop->num_calls; i++) {
+    js_prop *math = fh_get_prop_rec(ctx, "Math");
+    prop = math && IS_OBJ(math->ptr) ?
+      fh_get_prop(math->ptr, (char *)loop->calls[i]->name) : NULL;
+    if (!prop || !IS_FUNC(prop->ptr) || !prop->ptr->object.native ||
+        prop->ptr->object.nativefn != loop->calls[i]->native)
+      return deopt(loop, node, node, " isn't the built-in Math function",
+        loop->calls[i]->name);
+  }
+
+  for (i = NUM_FIXED_SLOTS; i < loop->num_slots; i++) {
+    jit_slot *slot = &loop->slots[i];
+    if (!slot->name) continue;
+    prop = fh_get_prop_rec(ctx, slot->name);
+    if (!prop || !IS_NUM(prop->ptr) || (slot->stored && !prop->writable))
+      return deopt(loop, node, node, " isn't a number variable", slot->name);
+    frame[i] = prop->ptr->number.is_nan ? NAN : prop->ptr->number.val;
+  }
+  frame[SLOT_HAS_RESULT] = 0;
+
+  status = loop->entry(frame);
+
+  for (i = NUM_FIXED_SLOTS; i < loop->num_slots; i++)
+    if (loop->slots[i].stored)
+      fh_set_rec(ctx, loop->slots[i].name, JSNUM(frame[i]));
+  if (result && frame[SLOT_HAS_RESULT])
+    *result = JSNUM(frame[SLOT_RESULT]);
+
+  if (status == 0) return JIT_DONE;
+  jit_guard *failed = &loop->guards[status - 1];
+  return deopt(loop, node, failed->node, failed->reason, NULL);
+}
+
+/* Count an iteration of the loop `node`, compiling the loop once it's hot,
+ * and run the rest of the loop in machine code if it is. */
+fh_jit_result
+fh_jit_loop(js_val *ctx, ast_node *node, js_val **result)
+{
+  fh_node_data *data = fh_get_node_data(node);
+  jit_loop *loop = data->jit;
+
+  if (!loop) loop = data->jit = calloc(1, sizeof(jit_loop));
+
+  switch (loop->state) {
+    case LOOP_FAILED:
+      return JIT_NEVER;
+    case LOOP_COUNTING:
+      if (++loop->count < JIT_HOT_LOOP) return JIT_INTERPRET;
+      if (!compile(loop, node)) {
+        loop->state = LOOP_FAILED;
+        return JIT_NEVER;
+      }
+      loop->state = LOOP_COMPILED;
+      loop->count = 0;
+      break;
+    case LOOP_COMPILED:
+      if (loop->count) {
+        loop->count--;
+        return JIT_INTERPRET;
+      }
+      break;
+  }
+  return enter(ctx, node, loop, result);
+}
+
+bool
+fh_jit_available()
+{
+  return true;
+}
+
+void
+fh_jit_free(jit_loop *loop)
+{
+  if (!loop) return;
+  if (loop->code) munmap(loop->code, loop->code_size);
+  free(loop->slots);
+  free(loop->frame);
+  free(loop->calls);
+  free(loop->guards);
+  free(loop);
+}
+
+#else
+
+fh_jit_result
+fh_jit_loop(js_val *ctx, ast_node *node, js_val **result)
+{
+  return JIT_NEVER;
+}
+
+bool
+fh_jit_available()
+{
+  return false;
+}
+
+void
+fh_jit_free(jit_loop *loop)
+{
+}
+
+#endif
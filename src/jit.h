@@ -0,0 +1,58 @@
+/*
+ * jit.h -- Baseline compiler of hot numeric loops to machine code
+ *
+ * Copyright (c) 2012-2013 Nick Reynolds
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef JIT_H
+#define JIT_H
+
+#include "flathead.h"
+#include "nodes.h"
+
+#if defined(__x86_64__) && !defined(FH_NO_JIT)
+#define FH_JIT
+#endif
+
+#define JIT_HOT_LOOP 1000       // iterations before a loop is compiled
+#define JIT_MAX_DEOPTS 8        // deopts before a loop is left to interpret
+#define JIT_BACKOFF 64          // iterations interpreted after the first deopt
+
+typedef enum {
+  JIT_INTERPRET,                // run this iteration in the interpreter
+  JIT_DONE,                     // the loop ran to its end in machine code
+  JIT_NEVER                     // the loop won't be compiled
+} fh_jit_result;
+
+typedef struct jit_loop jit_loop;
+
+#ifdef FH_JIT
+
+// Call at the start of each iteration of a `while` or `for` loop's body.
+// Breaks out of the loop when the compiled code ran the rest of it.
+#define JIT_LOOP(ctx, node, result) \
+  (fh->opt_jit && fh_jit_loop(ctx, node, result) == JIT_DONE)
+
+#else
+
+#define JIT_LOOP(ctx, node, result) (0)
+
+#endif
+
+fh_jit_result fh_jit_loop(js_val *, ast_node *, js_val **);
+bool fh_jit_available(void);
+void fh_jit_free(jit_loop *);
+
+#endif
@@ -0,0 +1,381 @@
+/*
+ * loop.c -- The event loop: timers and file descriptor watches
+ *
+ * Copyright (c) 2012-2013 Nick Reynolds
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Once its script has run, an isolate runs what the script left waiting:
+ * timers, in a binary heap by when they're due, and callbacks for file
+ * descriptors, with a poll() that sleeps until the next timer is due. The
+ * loop ends when nothing is left.
+ *
+ * Callbacks are called like any other (fh_call), from the loop's own frame,
+ * so an error they don't catch goes down the usual fh_throw path. A task is
+ * taken off the heap (or put back, if it repeats) before its callback runs,
+ * and the loop's state is consistent at every call; the task being run is
+ * kept in `current`, so it's freed even if its callback never returns.
+ *
+ * A callback keeps the scope it was handed over in, as a function returned
+ * from a call keeps the scope of that call: it would otherwise run in the
+ * global scope, long after that one is gone. Callbacks and their arguments
+ * are GC roots (see fh_loop_each_root), as nothing else may refer to them. */
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <poll.h>
+#include <string.h>
+
+#include "loop.h"
+#include "args.h"
+#include "eval.h"
+#include "gc.h"
+#include "quota.h"
+#include "timers.h"
+
+static fh_loop *
+get_loop()
+{
+  if (!fh->loop) {
+    fh->loop = calloc(1, sizeof(fh_loop));
+    fh->loop->next_id = 1;
+  }
+  return fh->loop;
+}
+
+static void
+capture_scope(js_val *callback, js_val *ctx)
+{
+  if (!callback->object.native && !callback->object.scope && ctx) {
+    GC_BARRIER(callback, ctx);
+    callback->object.scope = ctx;
+  }
+}
+
+/* Call a callback within the scope it keeps, which is the environment of its
+ * calls. */
+static void
+run_callback(js_val *callback, js_args *args)
+{
+  js_val *scope = callback->object.scope;
+  js_val *ctx = scope && scope->object.parent ? scope->object.parent : fh->global;
+  fh_call(ctx, JSUNDEF(), callback, args);
+}
+
+static void
+free_task(fh_task *task)
+{
+  args_release(task->args);
+  free(task->args);
+  free(task);
+}
+
+
+// ----------------------------------------------------------------------------
+// Timer Heap
+// ----------------------------------------------------------------------------
+
+static bool
+sooner(fh_task *a, fh_task *b)
+{
+  return a->due < b->due || (a->due == b->due && a->id < b->id);
+}
+
+static void
+sift_up(fh_loop *loop, unsigned long i)
+{
+  fh_task *task = loop->tasks[i];
+  while (i > 0 && sooner(task, loop->tasks[(i - 1) / 2])) {
+    loop->tasks[i] = loop->tasks[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  loop->tasks[i] = task;
+}
+
+static void
+sift_down(fh_loop *loop, unsigned long i)
+{
+  fh_task *task = loop->tasks[i];
+  unsigned long child, n = loop->num_tasks;
+  while ((child = i * 2 + 1) < n) {
+    if (child + 1 < n && sooner(loop->tasks[child + 1], loop->tasks[child]))
+      child++;
+    if (!sooner(loop->tasks[child], task)) break;
+    loop->tasks[i] = loop->tasks[child];
+    i = child;
+  }
+  loop->tasks[i] = task;
+}
+
+static void
+heap_push(fh_loop *loop, fh_task *task)
+{
+  if (loop->num_tasks == loop->tasks_cap) {
+    loop->tasks_cap = loop->tasks_cap ? loop->tasks_cap * 2 : 16;
+    loop->tasks = realloc(loop->tasks, loop->tasks_cap * sizeof(fh_task *));
+  }
+  loop->tasks[loop->num_tasks] = task;
+  sift_up(loop, loop->num_tasks++);
+}
+
+static fh_task *
+heap_remove(fh_loop *loop, unsigned long i)
+{
+  fh_task *task = loop->tasks[i];
+  if (i < --loop->num_tasks) {
+    loop->tasks[i] = loop->tasks[loop->num_tasks];
+    sift_down(loop, i);
+    sift_up(loop, i);
+  }
+  return task;
+}
+
+/* Run `callback` with `args` after `delay` ms, and then every `delay` ms if
+ * it repeats, within `ctx`. Returns the timer's id. */
+unsigned long
+fh_loop_timer(js_val *ctx, js_val *callback, double delay, bool repeat,
+    js_args *args)
+{
+  fh_loop *loop = get_loop();
+  fh_task *task = malloc(sizeof(fh_task));
+
+  // An interval of 0 would never let the loop move on.
+  if (isnan(delay) || delay < 0) delay = 0;
+  if (repeat && delay < 1) delay = 1;
+
+  task->id = loop->next_id++;
+  task->due = fh_clock_ms() + delay;
+  task->interval = repeat ? delay : -1;
+  task->callback = callback;
+  task->args = args_copy(args);
+  capture_scope(callback, ctx);
+  heap_push(loop, task);
+  return task->id;
+}
+
+
+// ----------------------------------------------------------------------------
+// Watches
+// ----------------------------------------------------------------------------
+
+/* Run `callback` with `fd` whenever poll() finds it ready for `events`,
+ * within `ctx`. Returns the watch's id. */
+unsigned long
+fh_loop_watch(js_val *ctx, int fd, short events, js_val *callback)
+{
+  fh_loop *loop = get_loop();
+
+  if (loop->num_watches == loop->watches_cap) {
+    loop->watches_cap = loop->watches_cap ? loop->watches_cap * 2 : 8;
+    loop->watches = realloc(loop->watches, loop->watches_cap * sizeof(fh_watch));
+  }
+  fh_watch *watch = &loop->watches[loop->num_watches++];
+  watch->id = loop->next_id++;
+  watch->fd = fd;
+  watch->events = events;
+  watch->callback = callback;
+  capture_scope(callback, ctx);
+  return watch->id;
+}
+
+static long
+find_watch(fh_loop *loop, unsigned long id)
+{
+  unsigned long i;
+  for (i = 0; i < loop->num_watches; i++)
+    if (loop->watches[i].id == id) return i;
+  return -1;
+}
+
+static void
+remove_watch(fh_loop *loop, unsigned long i)
+{
+  memmove(loop->watches + i, loop->watches + i + 1,
+      (loop->num_watches - i - 1) * sizeof(fh_watch));
+  loop->num_watches--;
+}
+
+/* Stop a timer or a watch. Returns whether there was one with that id. A
+ * repeating timer stopped from its own callback is freed once that
+ * returns. */
+bool
+fh_loop_cancel(unsigned long id)
+{
+  fh_loop *loop = fh->loop;
+  unsigned long i;
+  long w;
+
+  if (!loop) return false;
+  for (i = 0; i < loop->num_tasks; i++) {
+    if (loop->tasks[i]->id != id) continue;
+    fh_task *task = heap_remove(loop, i);
+    if (task == loop->current)
+      task->interval = -1;
+    else
+      free_task(task);
+    return true;
+  }
+  if ((w = find_watch(loop, id)) >= 0) {
+    remove_watch(loop, w);
+    return true;
+  }
+  return false;
+}
+
+
+// ----------------------------------------------------------------------------
+// Running
+// ----------------------------------------------------------------------------
+
+// What a callback that threw left behind.
+static void
+finish_current(fh_loop *loop)
+{
+  if (loop->current && loop->current->interval < 0)
+    free_task(loop->current);
+  loop->current = NULL;
+}
+
+/* Run the timers that were due when this pass began. Those set by the
+ * callbacks wait for the next pass, after the watches have had a turn. */
+static void
+run_timers(fh_loop *loop)
+{
+  double now = fh_clock_ms();
+  unsigned long last_id = loop->next_id;
+
+  while (loop->num_tasks && loop->tasks[0]->due <= now &&
+         loop->tasks[0]->id < last_id) {
+    fh_task *task = heap_remove(loop, 0);
+    if (task->interval >= 0) {
+      task->due = now + task->interval;
+      heap_push(loop, task);
+    }
+    loop->current = task;
+    run_callback(task->callback, task->args);
+    finish_current(loop);
+  }
+}
+
+/* Run the callbacks of the watches poll() found ready. A watch stopped by
+ * an earlier callback in the same pass is skipped. */
+static void
+run_watches(fh_loop *loop, struct pollfd *fds, unsigned long *ids,
+    unsigned long n)
+{
+  unsigned long i;
+  js_args args;
+
+  for (i = 0; i < n; i++) {
+    long w;
+    if (!fds[i].revents || (w = find_watch(loop, ids[i])) < 0) continue;
+    // A closed descriptor would be reported ready forever.
+    if (fds[i].revents & POLLNVAL) {
+      remove_watch(loop, w);
+      continue;
+    }
+    js_val *callback = loop->watches[w].callback;
+    args_init(&args);
+    args_append(&args, JSNUM(fds[i].fd));
+    run_callback(callback, &args);
+  }
+}
+
+/* Run the current isolate's loop until there are no timers or watches. */
+void
+fh_loop_run()
+{
+  fh_loop *loop = fh->loop;
+  unsigned long n, i;
+
+  if (!loop) return;
+  finish_current(loop);
+
+  while (loop->num_tasks || loop->num_watches) {
+    int timeout = -1;
+    if (loop->num_tasks) {
+      double wait = ceil(loop->tasks[0]->due - fh_clock_ms());
+      timeout = wait <= 0 ? 0 : wait >= INT_MAX ? INT_MAX : (int)wait;
+    }
+    timeout = fh_quota_poll_timeout(timeout);
+
+    // Snapshot the watches, as callbacks may add and remove them.
+    n = loop->num_watches;
+    if (n > loop->poll_cap) {
+      loop->poll_cap = n * 2;
+      loop->poll_fds = realloc(loop->poll_fds,
+          loop->poll_cap * sizeof(struct pollfd));
+      loop->poll_ids = realloc(loop->poll_ids,
+          loop->poll_cap * sizeof(unsigned long));
+    }
+    struct pollfd *fds = loop->poll_fds;
+    unsigned long *ids = loop->poll_ids;
+    for (i = 0; i < n; i++) {
+      fds[i].fd = loop->watches[i].fd;
+      fds[i].events = loop->watches[i].events;
+      fds[i].revents = 0;
+      ids[i] = loop->watches[i].id;
+    }
+
+    if (poll(fds, n, timeout) < 0) {
+      if (errno == EINTR) continue;
+      fh_throw(NULL, fh_new_error(E_ERROR, "poll: %s", strerror(errno)));
+    }
+    run_watches(loop, fds, ids, n);
+    run_timers(loop);
+  }
+}
+
+/* Call `fn` with each callback and argument the loop holds, to mark them or,
+ * when they've moved, fix them. */
+void
+fh_loop_each_root(void (*fn)(js_val **))
+{
+  fh_loop *loop = fh->loop;
+  unsigned long i, j;
+
+  if (!loop) return;
+  for (i = 0; i < loop->num_tasks; i++) {
+    fh_task *task = loop->tasks[i];
+    fn(&task->callback);
+    for (j = 0; j < task->args->argc; j++)
+      fn(&task->args->argv[j]);
+  }
+  if (loop->current) {
+    fn(&loop->current->callback);
+    for (j = 0; j < loop->current->args->argc; j++)
+      fn(&loop->current->args->argv[j]);
+  }
+  for (i = 0; i < loop->num_watches; i++)
+    fn(&loop->watches[i].callback);
+}
+
+void
+fh_free_loop(fh_state *state)
+{
+  fh_loop *loop = state->loop;
+  unsigned long i;
+
+  if (!loop) return;
+  for (i = 0; i < loop->num_tasks; i++)
+    if (loop->tasks[i] != loop->current) free_task(loop->tasks[i]);
+  if (loop->current) free_task(loop->current);
+  free(loop->tasks);
+  free(loop->watches);
+  free(loop->poll_fds);
+  free(loop->poll_ids);
+  free(loop);
+  state->loop = NULL;
+}
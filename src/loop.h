@@ -0,0 +1,68 @@
+/*
+ * loop.h -- The event loop: timers and file descriptor watches
+ *
+ * Copyright (c) 2012-2013 Nick Reynolds
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LOOP_H
+#define LOOP_H
+
+#include "flathead.h"
+
+struct pollfd;
+
+/* A callback to run once its time comes, and again every `interval` ms if
+ * it repeats (setTimeout and setInterval). */
+typedef struct fh_task {
+  unsigned long id;
+  double due;                   // on fh_clock_ms()
+  double interval;              // or -1, to run once
+  struct js_val *callback;
+  struct js_args *args;         // what it's called with
+} fh_task;
+
+/* A callback to run whenever a file descriptor is ready. */
+typedef struct fh_watch {
+  unsigned long id;
+  int fd;
+  short events;                 // POLLIN or POLLOUT
+  struct js_val *callback;
+} fh_watch;
+
+/* What an isolate has waiting to run after its script. Timers are a binary
+ * heap, soonest first (and in the order they were set, at the same time). */
+typedef struct fh_loop {
+  fh_task **tasks;
+  unsigned long num_tasks;
+  unsigned long tasks_cap;
+  fh_task *current;             // the one-off task being run
+  fh_watch *watches;
+  unsigned long num_watches;
+  unsigned long watches_cap;
+  struct pollfd *poll_fds;      // the watches, as last passed to poll()
+  unsigned long *poll_ids;
+  unsigned long poll_cap;
+  unsigned long next_id;
+} fh_loop;
+
+unsigned long fh_loop_timer(struct js_val *, struct js_val *, double, bool,
+                            struct js_args *);
+unsigned long fh_loop_watch(struct js_val *, int, short, struct js_val *);
+bool fh_loop_cancel(unsigned long);
+void fh_loop_run(void);
+void fh_loop_each_root(void (*)(struct js_val **));
+void fh_free_loop(fh_state *);
+
+#endif
@@ -21,18 +21,135 @@
 #include <string.h>
 
 #include "nodes.h"
+#include "atom.h"
+
+#define ARENA_FIRST_BLOCK 16       // nodes
+#define ARENA_MAX_BLOCK 4096
+
+static ast_arena *arena;          // where new nodes go, if anywhere
+static ast_arena *arenas;
+
+// Slots of freed trees, for new nodes to take.
+static unsigned *free_slots;
+static unsigned long num_free_slots;
+static unsigned long free_slots_cap;
+
+ast_arena *
+node_arena_new()
+{
+  ast_arena *a = calloc(1, sizeof(ast_arena));
+  a->next = arenas;
+  if (arenas) arenas->prev = a;
+  arenas = a;
+  return a;
+}
+
+/* Allocate new nodes from `to` (or on their own, if NULL), and return the
+ * arena they were allocated from until now. */
+ast_arena *
+node_arena_use(ast_arena *to)
+{
+  ast_arena *prev = arena;
+  arena = to;
+  return prev;
+}
+
+/* Free a tree's arena along with its nodes. `forget` is given each node with
+ * a slot beforehand, to drop what's kept for it; the slot is then reused. */
+void
+node_arena_free(ast_arena *a, void (*forget)(ast_node *))
+{
+  node_block *block, *next;
+  unsigned long i;
+
+  for (block = a->blocks; block; block = next) {
+    next = block->next;
+    for (i = 0; i < block->used; i++) {
+      ast_node *node = &block->nodes[i];
+      free(node->items);
+      if (!node->slot) continue;
+      forget(node);
+      if (num_free_slots == free_slots_cap) {
+        free_slots_cap = free_slots_cap ? free_slots_cap * 2 : 256;
+        free_slots = realloc(free_slots, free_slots_cap * sizeof(unsigned));
+      }
+      free_slots[num_free_slots++] = node->slot;
+    }
+    free(block);
+  }
+  if (a->prev) a->prev->next = a->next;
+  else arenas = a->next;
+  if (a->next) a->next->prev = a->prev;
+  free(a);
+}
 
 ast_node *
 node_alloc()
 {
   // Allocate and return a new node
-  struct ast_node *node = calloc(1, sizeof(*node));
+  struct ast_node *node;
+  if (!arena)
+    node = calloc(1, sizeof(*node));
+  else {
+    node_block *block = arena->blocks;
+    if (!block || block->used == block->cap) {
+      unsigned long cap = block ? block->cap * 2 : ARENA_FIRST_BLOCK;
+      if (cap > ARENA_MAX_BLOCK) cap = ARENA_MAX_BLOCK;
+      block = calloc(1, sizeof(node_block) + cap * sizeof(ast_node));
+      block->cap = cap;
+      block->next = arena->blocks;
+      arena->blocks = block;
+    }
+    node = &block->nodes[block->used++];
+    arena->num_nodes++;
+  }
   node->type = NODE_UNKNOWN;
   node->sub_type = NODE_UNKNOWN;
-  node->visited = false;
   return node;
 }
 
+static enum ast_op
+node_op(enum ast_node_type type, enum ast_node_type sub_type, char *s)
+{
+  static const struct { char *str; enum ast_op op; } binary_ops[] = {
+    {"+", OP_ADD}, {"-", OP_SUB}, {"*", OP_MUL}, {"/", OP_DIV}, {"%", OP_MOD},
+    {"==", OP_EQ}, {"!=", OP_NEQ}, {"===", OP_STRICT_EQ},
+    {"!==", OP_STRICT_NEQ}, {"<", OP_LT}, {">", OP_GT}, {"<=", OP_LTE},
+    {">=", OP_GTE}, {"instanceof", OP_INSTANCEOF}, {"in", OP_IN},
+    {"&", OP_BIT_AND}, {"^", OP_BIT_XOR}, {"|", OP_BIT_OR}, {"<<", OP_LSHIFT},
+    {">>", OP_RSHIFT}, {">>>", OP_URSHIFT}, {"&&", OP_AND}, {"||", OP_OR}
+  };
+  static const struct { char *str; enum ast_op op; } unary_ops[] = {
+    {"delete", OP_DELETE}, {"void", OP_VOID}, {"typeof", OP_TYPEOF},
+    {"++", OP_INC}, {"--", OP_DEC}, {"+", OP_PLUS}, {"-", OP_MINUS},
+    {"!", OP_NOT}, {"~", OP_BIT_NOT}
+  };
+  char buf[8];
+  unsigned i;
+
+  if (s == NULL) return OP_NONE;
+
+  if (type == NODE_EXP && sub_type != NODE_UNKNOWN) {
+    for (i = 0; i < sizeof(unary_ops) / sizeof(unary_ops[0]); i++)
+      if (strcmp(s, unary_ops[i].str) == 0) return unary_ops[i].op;
+    return OP_NONE;
+  }
+
+  if (type == NODE_ASGN) {
+    // Compound assignments resolve to the operator without the "=".
+    size_t len = strlen(s);
+    if (len == 1) return OP_ASGN;
+    if (len >= sizeof(buf)) return OP_NONE;
+    memcpy(buf, s, len - 1);
+    buf[len - 1] = '\0';
+    s = buf;
+  }
+
+  for (i = 0; i < sizeof(binary_ops) / sizeof(binary_ops[0]); i++)
+    if (strcmp(s, binary_ops[i].str) == 0) return binary_ops[i].op;
+  return OP_NONE;
+}
+
 ast_node *
 node_new(enum ast_node_type type, ast_node *e1, ast_node *e2, ast_node *e3, 
          double x, char *s, int line, int column)
@@ -60,37 +177,118 @@ node_new(enum ast_node_type type, ast_node *e1, ast_node *e2, ast_node *e3,
   if (type == NODE_NUM || type == NODE_BOOL || type == NODE_MEMBER) 
     node->val = x;
 
-  node->sval = NULL;
-  if (s != NULL) {
-    node->sval = malloc((strlen(s) + 1) * sizeof(char));
-    strcpy(node->sval, s);
-    node->sval[strlen(s)] = '\0';
-  }
+  // Names and literals are interned, so lookups by them don't rehash.
+  node->sval = s != NULL ? fh_intern(s) : NULL;
+
+  if (type == NODE_EXP || type == NODE_ASGN)
+    node->op = node_op(type, node->sub_type, s);
+  else if (type == NODE_VAR_DEC)
+    node->op = OP_ASGN;           // evaluated once hoisted, as an assignment
+
+  node_finish(node);
   return node;
 }
 
-ast_node *
-node_pop(ast_node *node)
+static bool
+is_list(enum ast_node_type type)
 {
-  if (node->e2 != NULL && !node->e2->visited)
-    return node_pop(node->e2);
-  node->visited = true;
-  return node->e1;
+  switch (type) {
+    case NODE_ARG_LST: case NODE_CLAUSE_LST: case NODE_EL_LST:
+    case NODE_PARAM_LST: case NODE_PROP_LST: case NODE_SRC_LST:
+    case NODE_STMT_LST: case NODE_VAR_DEC_LST:
+      return true;
+    default:
+      return false;
+  }
+}
+
+/* Whether the body of a function may refer to its `arguments` object: by
+ * name, or through a direct eval. Nested functions have their own. */
+static bool
+refs_arguments(ast_node *node)
+{
+  if (!node || node->type == NODE_FUNC) return false;
+  if (node->type == NODE_IDENT && node->sval &&
+      (strcmp(node->sval, "arguments") == 0 || strcmp(node->sval, "eval") == 0))
+    return true;
+  return refs_arguments(node->e1) || refs_arguments(node->e2) ||
+    refs_arguments(node->e3);
+}
+
+/* Whether a function body could leave anything holding on to its activation
+ * object: a function it creates, or one it calls (as the callee's scope has
+ * the caller's for a parent), `arguments` or eval. Bodies not parsed yet
+ * might. */
+static bool
+may_keep_scope(ast_node *node)
+{
+  if (!node) return false;
+  switch (node->type) {
+    case NODE_FUNC: case NODE_CALL: case NODE_NEW: case NODE_LAZY_BODY:
+      return true;
+    default:
+      break;
+  }
+  if (node->type == NODE_IDENT && node->sval &&
+      (strcmp(node->sval, "arguments") == 0 || strcmp(node->sval, "eval") == 0))
+    return true;
+  return may_keep_scope(node->e1) || may_keep_scope(node->e2) ||
+    may_keep_scope(node->e3);
 }
 
-bool
-node_empty(ast_node *node)
+/* Analyze a node once its children are in place, so evaluation never writes
+ * to the tree and one parse can be run by any number of isolates.
+ *
+ * Lists are chains through `e2`, from the last element back. A new head
+ * takes over the element array of the chain it extends, so only heads have
+ * one. Literals, functions, programs, switches and loops get a slot for the
+ * values each isolate keeps for them. */
+static unsigned
+new_slot()
 {
-  return node->visited;
+  static unsigned next_slot = 1;
+  return num_free_slots ? free_slots[--num_free_slots] : next_slot++;
 }
 
 void
-node_rewind(ast_node *node)
+node_finish(ast_node *node)
 {
-  // Unset visited on a node linked list.
-  if (!node->e1) return;
-  node->visited = false;
-  if (node->e2 != NULL) node_rewind(node->e2);
+  enum ast_node_type type = node->type;
+
+  if (is_list(type) && node->e1) {
+    ast_node *tail = node->e2;
+    int n = 0;
+    if (tail && tail->type == type) {
+      node->items = tail->items;
+      n = tail->num_items;
+      tail->items = NULL;
+      tail->num_items = 0;
+    }
+    // Grow by doubling: at each power of two.
+    if ((n & (n - 1)) == 0)
+      node->items = realloc(node->items, (n ? n * 2 : 1) * sizeof(ast_node *));
+    node->items[n] = node->e1;
+    node->num_items = n + 1;
+  }
+
+  switch (type) {
+    case NODE_FUNC:
+      node->uses_arguments = refs_arguments(node->e2);
+      node->leaf = !may_keep_scope(node->e2);
+      node->slot = new_slot();
+      if (arena) arena->has_funcs = true;
+      break;
+    case NODE_BOOL: case NODE_STR: case NODE_IDENT: case NODE_NUM:
+    case NODE_NULL: case NODE_SRC_LST: case NODE_SWITCH_STMT:
+    case NODE_WHILE: case NODE_FOR:
+      node->slot = new_slot();
+      break;
+    default:
+#ifdef FH_HOTSPOTS
+      node->slot = new_slot();    // for its counts
+#endif
+      break;
+  }
 }
 
 int
@@ -105,71 +303,119 @@ node_count(ast_node *node)
   return count;
 }
 
-void 
-node_print(ast_node *node, bool rec, int depth)
+/* A function body whose parse is put off until the function is first
+ * called: the source between its braces, which starts at `line` and
+ * `column`. */
+ast_node *
+node_lazy_new(char *text, int line, int column)
+{
+  ast_node *node = node_alloc();
+  node->type = NODE_LAZY_BODY;
+  node->sval = text;
+  node->line = line;
+  node->column = column;
+  return node;
+}
+
+/* Fill in the parsed body of a function whose parse was put off. The only
+ * write to a tree after parsing, it's made once, before the body first
+ * runs. */
+void
+node_resolve_lazy(ast_node *func, ast_node *body)
+{
+  func->uses_arguments = refs_arguments(body);
+  func->leaf = !may_keep_scope(body);
+  func->e2->e1 = body;
+  func->e2->val = 1;
+}
+
+/* What kind of node this is, in words, or NULL for an unknown type. */
+const char *
+node_name(ast_node *node)
 {
-  if (depth) printf("%*s", depth, " ");
   switch (node->type) {
-    case NODE_ARG_LST:     printf("argument list"); break;
-    case NODE_ARR:         printf("array literal"); break;
-    case NODE_ASGN:        printf("assignment"); break;
-    case NODE_BLOCK:       printf("block"); break;
-    case NODE_BREAK:       printf("break"); break;
-    case NODE_CALL:        printf("call expression"); break;
-    case NODE_CASE_BLOCK:  printf("case block"); break;
-    case NODE_CATCH:       printf("catch"); break;
-    case NODE_CLAUSE:      printf("case clause"); break;
-    case NODE_CLAUSE_LST:  printf("case clause list"); break;
-    case NODE_CONT:        printf("continue"); break;
-    case NODE_DOWHILE:     printf("dowhile"); break;
-    case NODE_ELISION:     printf("elision"); break;
-    case NODE_EL_LST:      printf("element list"); break;
-    case NODE_EMPT_STMT:   printf("empty statement"); break;
-    case NODE_EXPGRP:      printf("expression group"); break;
-    case NODE_EXP_STMT:    printf("expression statement"); break;
-    case NODE_FINALLY:     printf("finally"); break;
-    case NODE_FOR:         printf("for"); break;
-    case NODE_FORIN:       printf("for-in"); break;
-    case NODE_FUNC:        printf("function"); break;
-    case NODE_IF:          printf("if"); break;
-    case NODE_MEMBER:      printf("member expression"); break;
-    case NODE_NEW:         printf("new expression"); break;
-    case NODE_OBJ:         printf("object"); break;
-    case NODE_PARAM_LST:   printf("parameter list"); break;
-    case NODE_PROP:        printf("property"); break;
-    case NODE_PROP_LST:    printf("property list"); break;
-    case NODE_RETURN:      printf("return"); break;
-    case NODE_SRC_LST:     printf("source list"); break;
-    case NODE_STMT_LST:    printf("statement list"); break;
-    case NODE_SWITCH_STMT: printf("switch statement"); break;
-    case NODE_TERN:        printf("conditional expression"); break;
-    case NODE_THIS:        printf("this"); break;
-    case NODE_THROW:       printf("throw"); break;
-    case NODE_TRY_STMT:    printf("try statement"); break;
-    case NODE_VAR_DEC:     printf("variable declaration"); break;
-    case NODE_VAR_DEC_LST: printf("variable declaration list"); break;
-    case NODE_VAR_STMT:    printf("variable statement"); break;
-    case NODE_WHILE:       printf("while"); break;
-    case NODE_WITH_STMT:   printf("with statement"); break;
+    case NODE_ARG_LST:     return "argument list";
+    case NODE_ARR:         return "array literal";
+    case NODE_ASGN:        return "assignment";
+    case NODE_BLOCK:       return "block";
+    case NODE_BREAK:       return "break";
+    case NODE_CALL:        return "call expression";
+    case NODE_CASE_BLOCK:  return "case block";
+    case NODE_CATCH:       return "catch";
+    case NODE_CLAUSE:      return "case clause";
+    case NODE_CLAUSE_LST:  return "case clause list";
+    case NODE_CONT:        return "continue";
+    case NODE_DOWHILE:     return "dowhile";
+    case NODE_ELISION:     return "elision";
+    case NODE_EL_LST:      return "element list";
+    case NODE_EMPT_STMT:   return "empty statement";
+    case NODE_EXPGRP:      return "expression group";
+    case NODE_EXP_STMT:    return "expression statement";
+    case NODE_FINALLY:     return "finally";
+    case NODE_FOR:         return "for";
+    case NODE_FORIN:       return "for-in";
+    case NODE_FUNC:        return "function";
+    case NODE_IF:          return "if";
+    case NODE_LAZY_BODY:   return "function body (not parsed yet)";
+    case NODE_MEMBER:      return "member expression";
+    case NODE_NEW:         return "new expression";
+    case NODE_OBJ:         return "object";
+    case NODE_PARAM_LST:   return "parameter list";
+    case NODE_PROP:        return "property";
+    case NODE_PROP_LST:    return "property list";
+    case NODE_RETURN:      return "return";
+    case NODE_SRC_LST:     return "source list";
+    case NODE_STMT_LST:    return "statement list";
+    case NODE_SWITCH_STMT: return "switch statement";
+    case NODE_TERN:        return "conditional expression";
+    case NODE_THIS:        return "this";
+    case NODE_THROW:       return "throw";
+    case NODE_TRY_STMT:    return "try statement";
+    case NODE_VAR_DEC:     return "variable declaration";
+    case NODE_VAR_DEC_LST: return "variable declaration list";
+    case NODE_VAR_STMT:    return "variable statement";
+    case NODE_WHILE:       return "while";
+    case NODE_WITH_STMT:   return "with statement";
 
     // Literals
-    case NODE_BOOL:        printf("bool (%d)\n", (int)node->val); return;
-    case NODE_IDENT:       printf("identifier (%s)\n", node->sval); return;
-    case NODE_NULL:        printf("null (NULL)\n"); return;
-    case NODE_NUM:         printf("number (%f)\n", node->val); return;
-    case NODE_REGEXP:      printf("regexp (%s)\n", node->sval); return;
-    case NODE_STR:         printf("string (%s)\n", node->sval); return;
+    case NODE_BOOL:        return "bool";
+    case NODE_IDENT:       return "identifier";
+    case NODE_NULL:        return "null";
+    case NODE_NUM:         return "number";
+    case NODE_REGEXP:      return "regexp";
+    case NODE_STR:         return "string";
 
     // Expressions
     case NODE_EXP:
-      printf("expression ");
-      if (node->sub_type == NODE_UNARY_PRE) printf("(unary prefix)");
-      else if (node->sub_type == NODE_UNARY_POST) printf("(unary postfix)");
-      else printf ("(binary)");
-      break;
+      if (node->sub_type == NODE_UNARY_PRE) return "expression (unary prefix)";
+      if (node->sub_type == NODE_UNARY_POST) return "expression (unary postfix)";
+      return "expression (binary)";
+
+    default:
+      return NULL;
+  }
+}
+
+void 
+node_print(ast_node *node, bool rec, int depth)
+{
+  const char *name = node_name(node);
+
+  if (depth) printf("%*s", depth, " ");
+  switch (node->type) {
+    case NODE_LAZY_BODY: printf("%s\n", name); return;
+
+    // Literals
+    case NODE_BOOL:      printf("%s (%d)\n", name, (int)node->val); return;
+    case NODE_IDENT:     printf("%s (%s)\n", name, node->sval); return;
+    case NODE_NULL:      printf("%s (NULL)\n", name); return;
+    case NODE_NUM:       printf("%s (%f)\n", name, node->val); return;
+    case NODE_REGEXP:    printf("%s (%s)\n", name, node->sval); return;
+    case NODE_STR:       printf("%s (%s)\n", name, node->sval); return;
 
     default:
-      printf("unknown type: %d", node->type);
+      if (name) printf("%s", name);
+      else printf("unknown type: %d", node->type);
   }
   printf("\n");
   if (!rec) return;
@@ -21,6 +21,8 @@
 
 #include <stdbool.h>
 
+struct vm_chunk;
+
 enum ast_node_type {
   NODE_ARG_LST,
   NODE_ARR,
@@ -48,6 +50,7 @@ enum ast_node_type {
   NODE_FUNC,
   NODE_IDENT,
   NODE_IF,
+  NODE_LAZY_BODY,
   NODE_MEMBER,
   NODE_NEW,
   NODE_NULL,
@@ -76,26 +79,97 @@ enum ast_node_type {
   NODE_WHILE,
 };
 
+/* Operators of expression and assignment nodes, resolved at parse time.
+ * Compound assignments (e.g. "+=") store their binary operator. */
+enum ast_op {
+  OP_NONE,
+  OP_ASGN,
+
+  // Binary
+  OP_ADD,
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+  OP_MOD,
+  OP_EQ,
+  OP_NEQ,
+  OP_STRICT_EQ,
+  OP_STRICT_NEQ,
+  OP_LT,
+  OP_GT,
+  OP_LTE,
+  OP_GTE,
+  OP_INSTANCEOF,
+  OP_IN,
+  OP_BIT_AND,
+  OP_BIT_XOR,
+  OP_BIT_OR,
+  OP_LSHIFT,
+  OP_RSHIFT,
+  OP_URSHIFT,
+  OP_AND,
+  OP_OR,
+
+  // Unary
+  OP_DELETE,
+  OP_VOID,
+  OP_TYPEOF,
+  OP_INC,
+  OP_DEC,
+  OP_PLUS,
+  OP_MINUS,
+  OP_NOT,
+  OP_BIT_NOT
+};
+
 typedef struct ast_node {
   struct ast_node *e1;
   struct ast_node *e2;
   struct ast_node *e3;
   char *sval;
   double val;
+  struct ast_node **items;    // lists: the elements in order, on the head
   enum ast_node_type type;
   enum ast_node_type sub_type;
-  bool visited;
+  enum ast_op op;
   int line;
   int column;
+  int num_items;
+  unsigned slot;              // index of the node's data in each isolate
+  bool uses_arguments;        // functions: body may see `arguments`
+  bool leaf;                  // functions: the activation can't outlive a call
 } ast_node;
 
+/* The nodes of a parse, bump-allocated in blocks that double in size, so a
+ * tree is laid out in the order it was parsed and can be freed in one go.
+ * A tree with functions only is once none of its function values is left,
+ * as they point into it (see the eval cache in grammar.y). */
+typedef struct node_block {
+  struct node_block *next;
+  unsigned long used;
+  unsigned long cap;
+  ast_node nodes[];
+} node_block;
+
+typedef struct ast_arena {
+  node_block *blocks;         // the newest first
+  unsigned long num_nodes;
+  bool has_funcs;
+  struct ast_arena *prev;     // all arenas not freed
+  struct ast_arena *next;
+} ast_arena;
+
+ast_arena * node_arena_new(void);
+ast_arena * node_arena_use(ast_arena *);
+void node_arena_free(ast_arena *, void (*)(ast_node *));
 ast_node * node_alloc(void);
 ast_node * node_new(enum ast_node_type, ast_node *, ast_node *, ast_node *, 
                     double, char *, int, int);
-ast_node * node_pop(ast_node *);
-void node_rewind(ast_node *);
-bool node_empty(ast_node *);
+void node_finish(ast_node *);
+ast_node * node_lazy_new(char *, int, int);
+void node_resolve_lazy(ast_node *, ast_node *);
 int node_count(ast_node *);
+const char * node_name(ast_node *);
 void node_print(ast_node *, bool, int);
 
 #endif
@@ -0,0 +1,278 @@
+/*
+ * numconv.c -- Conversions between numbers and strings
+ *
+ * Copyright (c) 2012-2013 Nick Reynolds
+ *  
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *  
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "numconv.h"
+#include "str.h"
+
+#define EXACT_DIGITS 15       // decimal digits any double holds exactly
+#define MAX_SAFE_INT 9007199254740992.0
+
+static const char digit_pairs[] =
+  "000102030405060708091011121314151617181920212223242526272829"
+  "303132333435363738394041424344454647484950515253545556575859"
+  "606162636465666768697071727374757677787980818283848586878889"
+  "90919293949596979899";
+
+static size_t
+copy_str(char *buf, const char *str)
+{
+  size_t len = strlen(str);
+  memcpy(buf, str, len + 1);
+  return len;
+}
+
+/* Write the decimal digits of `n`, NUL-terminated, and return their count.
+ * The digits are made two at a time, from the end. */
+size_t
+fh_uint_format(unsigned long n, char *buf)
+{
+  char tmp[24], *p = tmp + sizeof(tmp);
+  size_t len;
+
+  while (n >= 100) {
+    unsigned d = (n % 100) * 2;
+    n /= 100;
+    *--p = digit_pairs[d + 1];
+    *--p = digit_pairs[d];
+  }
+  if (n >= 10) {
+    *--p = digit_pairs[n * 2 + 1];
+    *--p = digit_pairs[n * 2];
+  }
+  else
+    *--p = '0' + n;
+
+  len = tmp + sizeof(tmp) - p;
+  memcpy(buf, p, len);
+  buf[len] = '\0';
+  return len;
+}
+
+/* Step a %e buffer up by one in its last digit, in place. A carry
+ * out of the leading digit leaves 1.000... and bumps the exponent. */
+static void
+next_decimal(char *buf)
+{
+  char *e = strchr(buf, 'e'), *p = e - 1;
+  char tmp[FH_NUM_BUF];
+
+  for (; p >= buf; p--) {
+    if (*p == '.') continue;
+    if (*p != '9') {
+      (*p)++;
+      return;
+    }
+    *p = '0';
+  }
+  buf[0] = '1';
+  snprintf(tmp, sizeof(tmp), "%.*se%+03d", (int)(e - buf), buf, atoi(e + 1) + 1);
+  strcpy(buf, tmp);
+}
+
+/* The fewest significant digits that read back as `x` (positive and finite),
+ * without trailing zeros, taking the closest when there's a choice, as the
+ * spec asks. `*point` is set to where the decimal point goes, counted from
+ * the left of the digits.
+ *
+ * A double always round-trips through 17 digits. For normal numbers, any
+ * shorter result shows up at 15 digits as trailing zeros; subnormals hold
+ * fewer bits, so their search starts at one digit. At an exact power of two
+ * the numbers that read back as `x` reach twice as far above it as below,
+ * so when the closest digits miss, the ones just above may still hit. */
+static int
+shortest_digits(double x, char *digits, int *point)
+{
+  char buf[FH_NUM_BUF];
+  int prec, exp, k = 0, i;
+  bool pow2 = frexp(x, &exp) == 0.5 && x >= DBL_MIN;
+
+  for (prec = x < DBL_MIN ? 1 : EXACT_DIGITS; prec < 17; prec++) {
+    snprintf(buf, sizeof(buf), "%.*e", prec - 1, x);
+    if (strtod(buf, NULL) == x) break;
+    if (pow2) {
+      next_decimal(buf);
+      if (strtod(buf, NULL) == x) break;
+    }
+  }
+  if (prec == 17)
+    snprintf(buf, sizeof(buf), "%.16e", x);
+
+  // The buffer holds d.dddde[+-]xx, or de[+-]xx at one digit.
+  for (i = 0; buf[i] != 'e'; i++)
+    if (buf[i] != '.') digits[k++] = buf[i];
+  *point = atoi(buf + i + 1) + 1;
+
+  while (k > 1 && digits[k - 1] == '0') k--;
+  return k;
+}
+
+/* Write the string of a number as Number.prototype.toString does (with the
+ * default radix), NUL-terminated, and return its length. */
+size_t
+fh_num_format(double x, char *buf)
+{
+  char digits[20], *out = buf;
+  int k, n, i;
+
+  if (isnan(x)) return copy_str(buf, "NaN");
+  if (x == 0) return copy_str(buf, "0");
+  if (x < 0) {
+    *out++ = '-';
+    x = -x;
+  }
+  if (isinf(x)) return 1 + copy_str(out, "Infinity");
+
+  // Integers that doubles hold exactly are written as they are.
+  if (x < MAX_SAFE_INT && x <= ULONG_MAX && x == floor(x))
+    return (out - buf) + fh_uint_format((unsigned long)x, out);
+
+  k = shortest_digits(x, digits, &n);
+
+  if (k <= n && n <= 21) {
+    memcpy(out, digits, k);
+    out += k;
+    for (i = k; i < n; i++) *out++ = '0';
+  }
+  else if (0 < n && n <= 21) {
+    memcpy(out, digits, n);
+    out += n;
+    *out++ = '.';
+    memcpy(out, digits + n, k - n);
+    out += k - n;
+  }
+  else if (-6 < n && n <= 0) {
+    *out++ = '0';
+    *out++ = '.';
+    for (i = n; i < 0; i++) *out++ = '0';
+    memcpy(out, digits, k);
+    out += k;
+  }
+  else {
+    *out++ = digits[0];
+    if (k > 1) {
+      *out++ = '.';
+      memcpy(out, digits + 1, k - 1);
+      out += k - 1;
+    }
+    *out++ = 'e';
+    *out++ = n - 1 < 0 ? '-' : '+';
+    out += fh_uint_format(abs(n - 1), out);
+  }
+
+  *out = '\0';
+  return out - buf;
+}
+
+static bool
+is_digit(char c)
+{
+  return c >= '0' && c <= '9';
+}
+
+/* strtod, on a span that may not be NUL-terminated. */
+static double
+span_strtod(const char *str, size_t len)
+{
+  char tmp[64], *num = len < sizeof(tmp) ? tmp : malloc(len + 1);
+  memcpy(num, str, len);
+  num[len] = '\0';
+  double val = strtod(num, NULL);
+  if (num != tmp) free(num);
+  return val;
+}
+
+/* Parse the longest prefix of `str` that is a decimal number (with optional
+ * sign, fraction and exponent) or an Infinity, into `*out`. Returns the
+ * length of the prefix, or 0 if there's no number. Integers short enough to
+ * be exact are added up directly; the others are left to strtod. */
+size_t
+fh_num_parse_prefix(const char *str, size_t len, double *out)
+{
+  size_t i = 0, int_digits = 0, frac_digits = 0, j;
+  bool neg = false, exact = true;
+  double val = 0;
+
+  if (i < len && (str[i] == '+' || str[i] == '-'))
+    neg = str[i++] == '-';
+  if (len - i >= 8 && memcmp(str + i, "Infinity", 8) == 0) {
+    *out = neg ? -INFINITY : INFINITY;
+    return i + 8;
+  }
+
+  for (; i < len && is_digit(str[i]); i++, int_digits++)
+    val = val * 10 + (str[i] - '0');
+  if (i < len && str[i] == '.') {
+    for (j = i + 1; j < len && is_digit(str[j]); j++) frac_digits++;
+    if (int_digits + frac_digits > 0) i = j;
+  }
+  if (int_digits + frac_digits == 0) return 0;
+
+  // An exponent only counts if it has digits.
+  if (i < len && (str[i] == 'e' || str[i] == 'E')) {
+    j = i + 1;
+    if (j < len && (str[j] == '+' || str[j] == '-')) j++;
+    if (j < len && is_digit(str[j])) {
+      while (j < len && is_digit(str[j])) j++;
+      i = j;
+      exact = false;
+    }
+  }
+
+  if (exact && frac_digits == 0 && int_digits <= EXACT_DIGITS)
+    *out = neg ? -val : val;
+  else
+    *out = span_strtod(str, i);
+  return i;
+}
+
+/* The number a string denotes (ToNumber), NaN if it isn't one. Surrounding
+ * whitespace is ignored, and an empty string is 0. */
+double
+fh_str_to_num(const char *str, size_t len)
+{
+  size_t end = fh_str_space_suffix(str, len),
+         start = fh_str_space_prefix(str, end), i;
+  double val = 0;
+
+  str += start;
+  len = end - start;
+  if (len == 0) return 0;
+
+  if (len > 2 && str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+    for (i = 2; i < len; i++) {
+      char c = str[i];
+      int d = is_digit(c) ? c - '0' :
+              c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+              c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+      if (d < 0) return NAN;
+      val = val * 16 + d;
+    }
+    return val;
+  }
+
+  if (fh_num_parse_prefix(str, len, &val) != len) return NAN;
+  return val;
+}
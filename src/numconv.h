@@ -0,0 +1,31 @@
+/*
+ * numconv.h -- Conversions between numbers and strings
+ *
+ * Copyright (c) 2012-2013 Nick Reynolds
+ *  
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *  
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef NUMCONV_H
+#define NUMCONV_H
+
+#include <stddef.h>
+
+#define FH_NUM_BUF 32     // room for any number written by fh_num_format
+
+size_t fh_uint_format(unsigned long, char *);
+size_t fh_num_format(double, char *);
+size_t fh_num_parse_prefix(const char *, size_t, double *);
+double fh_str_to_num(const char *, size_t);
+
+#endif
@@ -0,0 +1,132 @@
+/*
+ * output.c -- Buffered output for the console and print
+ *
+ * Copyright (c) 2012-2013 Nick Reynolds
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* stdout and stderr get large buffers when they aren't terminals, and
+ * values are formatted into an fh_buf and written with a single call, so a
+ * script printing many lines makes few system calls. Whatever is pending is
+ * written out at exit, before an uncaught error is reported, and before the
+ * REPL reads a line. Switching from one stream to the other flushes the
+ * first, to keep their output in order where both go to the same place. */
+
+#include <string.h>
+#include <unistd.h>
+
+#include "output.h"
+#include "cli.h"
+
+static FILE *last_stream;
+static int stdin_tty = -1;
+
+
+// ----------------------------------------------------------------------------
+// Buffers
+// ----------------------------------------------------------------------------
+
+static void
+buf_reserve(fh_buf *buf, size_t more)
+{
+  if (buf->len + more + 1 <= buf->cap) return;
+  buf->cap = (buf->len + more + 1) * 2;
+  buf->data = realloc(buf->data, buf->cap);
+}
+
+void
+fh_buf_append(fh_buf *buf, const char *str, size_t len)
+{
+  buf_reserve(buf, len);
+  memcpy(buf->data + buf->len, str, len);
+  buf->len += len;
+  buf->data[buf->len] = '\0';
+}
+
+void
+fh_buf_vprintf(fh_buf *buf, const char *tpl, va_list ap)
+{
+  va_list copy;
+  va_copy(copy, ap);
+  int len = vsnprintf(NULL, 0, tpl, copy);
+  va_end(copy);
+  if (len < 0) return;
+
+  buf_reserve(buf, len);
+  vsnprintf(buf->data + buf->len, len + 1, tpl, ap);
+  buf->len += len;
+}
+
+void
+fh_buf_printf(fh_buf *buf, const char *tpl, ...)
+{
+  va_list ap;
+  va_start(ap, tpl);
+  fh_buf_vprintf(buf, tpl, ap);
+  va_end(ap);
+}
+
+// Like fh_buf_printf, in color when that's in use.
+void
+fh_buf_cprintf(fh_buf *buf, const char *color, const char *tpl, ...)
+{
+  bool use_colors = fh_use_colors();
+  if (use_colors) fh_buf_append(buf, color, strlen(color));
+
+  va_list ap;
+  va_start(ap, tpl);
+  fh_buf_vprintf(buf, tpl, ap);
+  va_end(ap);
+
+  if (use_colors) fh_buf_append(buf, ANSI_RESET, strlen(ANSI_RESET));
+}
+
+
+// ----------------------------------------------------------------------------
+// Streams
+// ----------------------------------------------------------------------------
+
+// Call before anything is written.
+void
+fh_output_init(void)
+{
+  if (!isatty(fileno(stdout)))
+    setvbuf(stdout, NULL, _IOFBF, FH_OUTPUT_BUFSIZE);
+  if (!isatty(fileno(stderr)))
+    setvbuf(stderr, NULL, _IOFBF, FH_OUTPUT_BUFSIZE);
+}
+
+void
+fh_output_flush(void)
+{
+  fflush(stdout);
+  fflush(stderr);
+}
+
+void
+fh_write(FILE *stream, const char *data, size_t len)
+{
+  if (last_stream && last_stream != stream)
+    fflush(last_stream);
+  last_stream = stream;
+  if (len) fwrite(data, 1, len, stream);
+}
+
+// Colors are for people: the REPL, or a script run from a terminal.
+bool
+fh_use_colors(void)
+{
+  if (stdin_tty < 0) stdin_tty = isatty(fileno(stdin));
+  return fh->opt_interactive || stdin_tty;
+}
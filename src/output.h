@@ -0,0 +1,43 @@
+/*
+ * output.h -- Buffered output for the console and print
+ *
+ * Copyright (c) 2012-2013 Nick Reynolds
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "flathead.h"
+
+#define FH_OUTPUT_BUFSIZE 65536   // stdio buffer of a redirected stream
+
+/* A growable buffer that output is formatted into, to be written at once. */
+typedef struct {
+  char *data;
+  size_t len;
+  size_t cap;
+} fh_buf;
+
+void fh_buf_append(fh_buf *, const char *, size_t);
+void fh_buf_printf(fh_buf *, const char *, ...);
+void fh_buf_cprintf(fh_buf *, const char *, const char *, ...);
+void fh_buf_vprintf(fh_buf *, const char *, va_list);
+
+void fh_output_init(void);
+void fh_output_flush(void);
+void fh_write(FILE *, const char *, size_t);
+bool fh_use_colors(void);
+
+#endif
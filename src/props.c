@@ -16,7 +16,463 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <math.h>
+#include <stdint.h>
+
 #include "props.h"
+#include "gc.h"
+#include "numconv.h"
+
+
+// ----------------------------------------------------------------------------
+// Shapes
+// ----------------------------------------------------------------------------
+
+static js_shape *
+shape_new(js_shape *parent, char *name)
+{
+  js_shape *shape = calloc(1, sizeof(js_shape));
+  shape->parent = parent;
+  if (parent) {
+    shape->count = parent->count + 1;
+    shape->name = name;
+    HASH_ADD(hh, parent->transitions, name, sizeof(char *), shape);
+  }
+  return shape;
+}
+
+js_shape *
+fh_root_shape()
+{
+  if (!fh->root_shape)
+    fh->root_shape = shape_new(NULL, NULL);
+  return fh->root_shape;
+}
+
+/* Free a shape and every shape that transitions from it. */
+void
+fh_free_shapes(js_shape *shape)
+{
+  js_shape *child, *tmp;
+  HASH_ITER(hh, shape->transitions, child, tmp) {
+    HASH_DEL(shape->transitions, child);
+    fh_free_shapes(child);
+  }
+  free(shape->keys);
+  free(shape);
+}
+
+/* Free the current isolate's table of name strings (the strings themselves
+ * are constants, freed with its heap). */
+void
+fh_free_key_strings()
+{
+  fh_key_string *key, *tmp;
+  HASH_ITER(hh, fh->key_strings, key, tmp) {
+    HASH_DEL(fh->key_strings, key);
+    free(key);
+  }
+}
+
+static void
+shape_drop(js_val *obj)
+{
+  obj->shape = NULL;
+  free(obj->slots);
+  obj->slots = NULL;
+  obj->slots_cap = 0;
+}
+
+/* Transition the object's shape to include a newly added prop. */
+static void
+shape_add(js_val *obj, js_prop *prop)
+{
+  js_shape *shape = obj->shape, *next = NULL;
+  if (!shape) return;
+  if (shape->count >= MAX_SHAPE_PROPS) {
+    shape_drop(obj);
+    return;
+  }
+
+  HASH_FIND(hh, shape->transitions, &prop->name, sizeof(char *), next);
+  if (!next) next = shape_new(shape, prop->name);
+
+  if (next->count > obj->slots_cap) {
+    obj->slots_cap = obj->slots_cap ? obj->slots_cap * 2 : 4;
+    obj->slots = realloc(obj->slots, obj->slots_cap * sizeof(js_prop *));
+  }
+  obj->slots[shape->count] = prop;
+  obj->shape = next;
+}
+
+/* Move the donor's props into the object, replacing its own, and rebuild the
+ * object's shape from the map's (insertion-ordered) props. */
+void
+fh_replace_map(js_val *obj, js_val *donor)
+{
+  js_prop *prop;
+
+  obj->map = donor->map;
+  donor->map = NULL;
+  shape_drop(donor);
+  donor->shape = fh_root_shape();
+
+  shape_drop(obj);
+  obj->shape = fh_root_shape();
+  for (prop = obj->map; prop; prop = prop->hh.next)
+    shape_add(obj, prop);
+
+  free(obj->elements);
+  obj->elements = donor->elements;
+  obj->elements_cap = donor->elements_cap;
+  obj->dense = donor->dense;
+  donor->elements = NULL;
+  donor->elements_cap = 0;
+
+  // The values were stored through the (young) donor's barrier, not the
+  // object's: an old object must be remembered if any of them is young, and
+  // an object already marked must shade them while marking is under way.
+  if (!obj->young || fh->gc_state == GC_STATE_MARK) {
+    unsigned long i;
+    for (prop = obj->map; prop; prop = prop->hh.next)
+      GC_BARRIER(obj, prop->ptr);
+    for (i = 0; i < obj->elements_cap; i++)
+      GC_BARRIER(obj, obj->elements[i]);
+  }
+}
+
+// ----------------------------------------------------------------------------
+// Elements
+// ----------------------------------------------------------------------------
+
+/* Arrays keep their index props in a vector of values rather than the map.
+ * Holes are NULL. An array is only moved to the map (made sparse) when an
+ * index is set far past its length, or when an element needs its own
+ * flags or a js_prop of its own. */
+
+#define ELEMENTS_SLACK 1024
+
+/* Is the name a canonical array index (0 .. 2^32 - 2)? */
+bool
+fh_is_index(char *name, unsigned long *index)
+{
+  unsigned long long i = 0;
+  char *c = name;
+
+  if (*c == '\0' || (*c == '0' && c[1] != '\0')) return false;
+  for (; *c; c++) {
+    if (*c < '0' || *c > '9' || c - name >= 10) return false;
+    i = i * 10 + (*c - '0');
+  }
+  if (i >= 4294967295ULL) return false;
+
+  *index = i;
+  return true;
+}
+
+/* Is the value a number that is an array index? */
+bool
+fh_num_index(js_val *val, unsigned long *index)
+{
+  if (!IS_NUM(val) || val->number.is_nan || val->number.is_inf) return false;
+
+  double d = val->number.val;
+  if (d < 0 || d >= 4294967295.0 || d != (unsigned long)d) return false;
+
+  *index = d;
+  return true;
+}
+
+static char *
+index_key(char *buf, unsigned long i)
+{
+  fh_uint_format(i, buf);
+  return buf;
+}
+
+/* Read a typed array element, unboxed. */
+double
+fh_typed_load(js_typed *t, unsigned long i)
+{
+  switch (t->kind) {
+    case TA_INT8: return ((int8_t *)t->data)[i];
+    case TA_UINT8:
+    case TA_UINT8_CLAMPED: return t->data[i];
+    case TA_INT16: return ((int16_t *)t->data)[i];
+    case TA_UINT16: return ((uint16_t *)t->data)[i];
+    case TA_INT32: return ((int32_t *)t->data)[i];
+    case TA_UINT32: return ((uint32_t *)t->data)[i];
+    case TA_FLOAT32: return ((float *)t->data)[i];
+    case TA_FLOAT64: return ((double *)t->data)[i];
+    default: UNREACHABLE();
+  }
+  return 0;
+}
+
+/* The integer types wrap modulo 2^n, as ToInt32 and friends do. */
+static uint32_t
+typed_wrap(double d)
+{
+  if (isnan(d) || isinf(d)) return 0;
+  d = fmod(trunc(d), 4294967296.0);
+  return d < 0 ? (uint32_t)(d + 4294967296.0) : (uint32_t)d;
+}
+
+static uint8_t
+typed_clamp(double d)
+{
+  if (isnan(d) || d <= 0) return 0;
+  if (d >= 255) return 255;
+  return (uint8_t)nearbyint(d);
+}
+
+/* Write a typed array element, converting it to the element type. */
+void
+fh_typed_store(js_typed *t, unsigned long i, double d)
+{
+  switch (t->kind) {
+    case TA_INT8: ((int8_t *)t->data)[i] = (int8_t)typed_wrap(d); break;
+    case TA_UINT8: t->data[i] = (uint8_t)typed_wrap(d); break;
+    case TA_UINT8_CLAMPED: t->data[i] = typed_clamp(d); break;
+    case TA_INT16: ((int16_t *)t->data)[i] = (int16_t)typed_wrap(d); break;
+    case TA_UINT16: ((uint16_t *)t->data)[i] = (uint16_t)typed_wrap(d); break;
+    case TA_INT32: ((int32_t *)t->data)[i] = (int32_t)typed_wrap(d); break;
+    case TA_UINT32: ((uint32_t *)t->data)[i] = typed_wrap(d); break;
+    case TA_FLOAT32: ((float *)t->data)[i] = (float)d; break;
+    case TA_FLOAT64: ((double *)t->data)[i] = d; break;
+    default: UNREACHABLE();
+  }
+}
+
+/* The number value of a value to store in a typed array. */
+double
+fh_typed_num(js_val *val)
+{
+  js_val *num = TO_NUM(val);
+  return num->number.is_nan ? NAN : num->number.val;
+}
+
+/* Move the elements of a dense array into its map. Typed arrays have no
+ * other place to keep their elements, so they stay dense. */
+void
+fh_make_sparse(js_val *obj)
+{
+  if (!obj->dense || obj->typed) return;
+
+  js_val **elements = obj->elements;
+  unsigned long i, cap = obj->elements_cap;
+  char key[24];
+
+  obj->dense = false;
+  obj->elements = NULL;
+  obj->elements_cap = 0;
+  for (i = 0; i < cap; i++)
+    if (elements[i]) fh_set(obj, index_key(key, i), elements[i]);
+  free(elements);
+}
+
+/* Return the own element at an index, or NULL if there is none. */
+js_val *
+fh_get_elem(js_val *obj, unsigned long i)
+{
+  if (obj->typed && obj->dense)
+    return i < obj->typed->length ? 
+      JSNUM(fh_typed_load(obj->typed, i)) : NULL;
+  if (obj->dense)
+    return i < obj->elements_cap ? obj->elements[i] : NULL;
+
+  char key[24];
+  js_prop *prop = fh_get_prop(obj, index_key(key, i));
+  return prop ? prop->ptr : NULL;
+}
+
+/* Same as `fh_get_elem`, but missing elements are undefined. */
+js_val *
+fh_get_index(js_val *obj, unsigned long i)
+{
+  js_val *val = fh_get_elem(obj, i);
+  return val ? val : JSUNDEF();
+}
+
+void
+fh_set_elem(js_val *obj, unsigned long i, js_val *val)
+{
+  // Typed arrays have a fixed length, and drop stores past it.
+  if (obj->typed && obj->dense) {
+    if (i < obj->typed->length)
+      fh_typed_store(obj->typed, i, fh_typed_num(val));
+    return;
+  }
+
+  if (obj->dense && i >= obj->elements_cap) {
+    unsigned long cap = obj->elements_cap,
+                  len = MAX(obj->object.length, cap);
+
+    if (i > len + ELEMENTS_SLACK && i > len * 2)
+      fh_make_sparse(obj);
+    else {
+      cap = MAX(MAX(cap * 2, i + 1), 8);
+      obj->elements = realloc(obj->elements, cap * sizeof(js_val *));
+      memset(obj->elements + obj->elements_cap, 0,
+             (cap - obj->elements_cap) * sizeof(js_val *));
+      obj->elements_cap = cap;
+    }
+  }
+
+  if (obj->dense) {
+    GC_BARRIER(obj, val);
+    obj->elements[i] = val;
+    return;
+  }
+
+  char key[24];
+  fh_set(obj, index_key(key, i), val);
+}
+
+bool
+fh_del_elem(js_val *obj, unsigned long i)
+{
+  if (obj->typed && obj->dense) return false;
+  if (obj->dense) {
+    if (i >= obj->elements_cap || !obj->elements[i]) return false;
+    obj->elements[i] = NULL;
+    return true;
+  }
+
+  char key[24];
+  return fh_del_prop(obj, index_key(key, i));
+}
+
+/* Drop the elements at and above `len` (for a shrinking length). */
+void
+fh_truncate_elems(js_val *obj, unsigned long len)
+{
+  unsigned long i;
+  for (i = len; i < obj->elements_cap; i++)
+    obj->elements[i] = NULL;
+}
+
+static bool
+dense_index(js_val *obj, char *name, unsigned long *i)
+{
+  return obj->dense && fh_is_index(name, i);
+}
+
+// ----------------------------------------------------------------------------
+// Iteration
+// ----------------------------------------------------------------------------
+
+js_prop *
+fh_iter_first(js_prop_iter *it, js_val *obj)
+{
+  it->obj = obj;
+  it->index = 0;
+  it->next = obj->map;
+  return fh_iter_next(it);
+}
+
+js_prop *
+fh_iter_next(js_prop_iter *it)
+{
+  js_val *obj = it->obj;
+
+  if (obj->typed && obj->dense && it->index < obj->typed->length) {
+    js_prop *prop = &it->scratch;
+    prop->name = index_key(it->name, it->index);
+    prop->writable = prop->enumerable = true;
+    prop->configurable = false;
+    prop->ptr = JSNUM(fh_typed_load(obj->typed, it->index++));
+    prop->circular = false;
+    return prop;
+  }
+
+  for (; obj->dense && it->index < obj->elements_cap; it->index++) {
+    js_val *val = obj->elements[it->index];
+    if (!val) continue;
+
+    js_prop *prop = &it->scratch;
+    prop->name = index_key(it->name, it->index++);
+    prop->writable = prop->enumerable = prop->configurable = true;
+    prop->ptr = val;
+    prop->circular = val == obj;
+    return prop;
+  }
+
+  js_prop *prop = it->next;
+  if (prop) it->next = prop->hh.next;
+  return prop;
+}
+
+/* The string of a name, made the first time a shape's keys need it. */
+static js_val *
+key_string(char *name)
+{
+  fh_key_string *key;
+  HASH_FIND(hh, fh->key_strings, &name, sizeof(char *), key);
+  if (!key) {
+    key = malloc(sizeof(fh_key_string));
+    key->name = name;
+    key->str = fh_add_constant(JSSTR(name));
+    HASH_ADD(hh, fh->key_strings, name, sizeof(char *), key);
+  }
+  return key->str;
+}
+
+/* The strings of a shape's names, in slot order. */
+static js_val **
+shape_keys(js_shape *shape)
+{
+  if (!shape->keys) {
+    js_shape *s;
+    shape->keys = malloc(shape->count * sizeof(js_val *));
+    for (s = shape; s->parent; s = s->parent)
+      shape->keys[s->count - 1] = key_string(s->name);
+  }
+  return shape->keys;
+}
+
+/* Append the own keys of an object to the array `keys`, as strings and in
+ * the order of OBJ_ITER, leaving out those that aren't enumerable unless
+ * `all` is set. Small indices use the shared strings of integers and a
+ * shaped object its shape's strings, so neither allocates a key. */
+void
+fh_append_keys(js_val *keys, js_val *obj, bool all)
+{
+  unsigned long len = keys->object.length, i;
+  js_prop *p;
+
+  if (obj->shape && obj->shape->count == HASH_COUNT(obj->map)) {
+    if (obj->typed && obj->dense)
+      for (i = 0; i < obj->typed->length; i++)
+        fh_set_elem(keys, len++, TO_STR(JSNUM(i)));
+    for (i = 0; obj->dense && i < obj->elements_cap; i++)
+      if (obj->elements[i])
+        fh_set_elem(keys, len++, TO_STR(JSNUM(i)));
+
+    js_val **names = obj->shape->count ? shape_keys(obj->shape) : NULL;
+    for (i = 0; i < obj->shape->count; i++)
+      if (all || obj->slots[i]->enumerable)
+        fh_set_elem(keys, len++, names[i]);
+  }
+  else {
+    OBJ_ITER(obj, p) {
+      if (all || p->enumerable)
+        fh_set_elem(keys, len++, JSSTR(p->name));
+    }
+  }
+  fh_set_len(keys, len);
+}
+
+/* The keys a for-in visits: the enumerable keys of the object, then of each
+ * of its prototypes. */
+js_val *
+fh_enum_keys(js_val *obj)
+{
+  js_val *keys = JSARR();
+  for (; obj; obj = obj->proto)
+    fh_append_keys(keys, obj, false);
+  return keys;
+}
 
 // ----------------------------------------------------------------------------
 // Get a property
@@ -30,6 +486,10 @@ fh_get(js_val *obj, char *name)
   if (obj->type == T_UNDEF)
     fh_throw(NULL, fh_new_error(E_TYPE, "Cannot read property '%s' of undefined", name));
 
+  unsigned long i;
+  if (dense_index(obj, name, &i))
+    return fh_get_index(obj, i);
+
   // But we'll happily return undefined if a property doesn't exist.
   js_prop *prop = fh_get_prop(obj, name);
   return prop ? prop->ptr : JSUNDEF();
@@ -47,31 +507,51 @@ fh_get_rec(js_val *obj, char *name)
 js_val *
 fh_get_proto(js_val *obj, char *name)
 {
-  js_prop *prop = fh_get_prop_proto(obj, name);
-  js_val *val = prop ? prop->ptr : JSUNDEF();
-  // Store a ref to the instance for natively define methods.
-  if (IS_FUNC(val)) {
-    val->object.instance = obj;
+  js_val *holder, *val = NULL;
+  js_prop *prop;
+  unsigned long i;
+  bool index = fh_is_index(name, &i);
+
+  for (holder = obj; holder && !val; holder = holder->proto) {
+    if (index && holder->dense)
+      val = fh_get_elem(holder, i);
+    else if ((prop = fh_get_prop(holder, name)))
+      val = prop->ptr ? prop->ptr : JSUNDEF();
   }
-  return val;
+  return val ? val : JSUNDEF();
 }
 
-/* Lookup a property on an object and return it. */
-js_prop *
-fh_get_prop(js_val *obj, char *name)
+static js_prop *
+find_prop(js_val *obj, char *atom)
 {
   js_prop *prop = NULL;
   if (obj->map)
-    HASH_FIND_STR(obj->map, name, prop);
+    HASH_FIND(hh, obj->map, &atom, sizeof(char *), prop);
   return prop;
 }
 
+/* Lookup a property on an object and return it. Dense elements have no
+ * js_prop, so asking for one makes the array sparse. */
+js_prop *
+fh_get_prop(js_val *obj, char *name)
+{
+  unsigned long i;
+  if (dense_index(obj, name, &i))
+    fh_make_sparse(obj);
+
+  // A name that was never interned can't be the name of a prop.
+  char *atom = fh_atom_lookup(name);
+  return atom ? find_prop(obj, atom) : NULL;
+}
+
 js_prop *
 fh_get_prop_rec(js_val *obj, char *name)
 {
-  js_prop *prop = fh_get_prop(obj, name);
-  if (prop == NULL && obj->object.parent != NULL)
-    return fh_get_prop_rec(obj->object.parent, name);
+  char *atom = fh_atom_lookup(name);
+  js_prop *prop = NULL;
+  if (!atom) return NULL;
+  while (!(prop = find_prop(obj, atom)) && obj->object.parent != NULL)
+    obj = obj->object.parent;
   return prop;
 }
 
@@ -84,6 +564,26 @@ fh_get_prop_proto(js_val *obj, char *name)
   return prop;
 }
 
+/* Whether the object or one of its prototypes has the key, whatever its
+ * value: a for-in skips the keys it took that were deleted since. Unlike
+ * fh_get_prop, asking about an element leaves an array dense. */
+bool
+fh_has_key(js_val *obj, char *name)
+{
+  unsigned long i;
+  bool index = fh_is_index(name, &i);
+  char *atom = fh_atom_lookup(name);
+
+  for (; obj; obj = obj->proto) {
+    if (index && obj->dense) {
+      if (fh_get_elem(obj, i)) return true;
+    }
+    else if (atom && find_prop(obj, atom))
+      return true;
+  }
+  return false;
+}
+
 
 // ----------------------------------------------------------------------------
 // Set a property
@@ -104,9 +604,20 @@ fh_set(js_val *obj, char *name, js_val *val)
 void
 fh_set_prop(js_val *obj, char *name, js_val *val, js_prop_flags flags)
 {
+  // Elements always have the default flags.
+  unsigned long i;
+  if ((flags == P_IGNORE || flags == P_DEFAULT) && dense_index(obj, name, &i)) {
+    fh_set_elem(obj, i, val);
+    return;
+  }
+
+  if (dense_index(obj, name, &i))
+    fh_make_sparse(obj);
+
   // Get the existing prop or create a new one.
   bool new = false;
-  js_prop *prop = fh_get_prop(obj, name);
+  char *atom = fh_intern(name);
+  js_prop *prop = find_prop(obj, atom);
   if (prop == NULL) {
     prop = fh_new_prop(P_DEFAULT);
     new = true;
@@ -120,15 +631,15 @@ fh_set_prop(js_val *obj, char *name, js_val *val, js_prop_flags flags)
     prop->enumerable = flags & P_ENUM;
   }
 
+  GC_BARRIER(obj, val);
   prop->ptr = val;
   prop->circular = prop->ptr == obj ? 1 : 0; // Do we have a circular reference?
 
   // Add the prop if new
   if (new) {
-    prop->name = malloc((strlen(name) + 1) * sizeof(char));
-    strcpy(prop->name, name);
-    prop->name[strlen(name)] = '\0';
-    HASH_ADD_KEYPTR(hh, obj->map, prop->name, strlen(prop->name), prop);
+    prop->name = atom;
+    HASH_ADD(hh, obj->map, name, sizeof(char *), prop);
+    shape_add(obj, prop);
   }
 }
 
@@ -142,17 +653,18 @@ fh_set_rec(js_val *obj, char *name, js_val *val)
   js_val *parent = NULL;
 
   // Try and find the property in a parent scope.
-  js_prop *prop = fh_get_prop(obj, name);
+  char *atom = fh_intern(name);
+  js_prop *prop = find_prop(obj, atom);
   while (prop == NULL) {
     if (obj->object.parent == NULL) break;
     parent = obj->object.parent;
-    prop = fh_get_prop(parent, name);
+    prop = find_prop(parent, atom);
     obj = parent;
   }
   if (prop != NULL && parent != NULL)
     scope_to_set = parent;
 
-  fh_set(scope_to_set, name, val);
+  fh_set(scope_to_set, atom, val);
 }
 
 // ----------------------------------------------------------------------------
@@ -163,8 +675,13 @@ fh_set_rec(js_val *obj, char *name, js_val *val)
 bool
 fh_del_prop(js_val *obj, char *name)
 {
+  unsigned long i;
+  if (dense_index(obj, name, &i))
+    return fh_del_elem(obj, i);
+
   js_prop *deletee = fh_get_prop(obj, name);
   if (!deletee) return false;
   HASH_DEL(obj->map, deletee);
+  shape_drop(obj);
   return true;
 }
@@ -28,8 +28,26 @@ bool fh_del_prop(js_val *, char *);
 js_prop * fh_get_prop(js_val *, char *);
 js_prop * fh_get_prop_rec(js_val *, char *);
 js_prop * fh_get_prop_proto(js_val *, char *);
+bool fh_has_key(js_val *, char *);
 js_val * fh_get(js_val *, char *);
 js_val * fh_get_proto(js_val *, char *);
 js_val * fh_get_rec(js_val *, char *);
+js_shape * fh_root_shape(void);
+void fh_free_shapes(js_shape *);
+void fh_free_key_strings(void);
+void fh_replace_map(js_val *, js_val *);
+void fh_append_keys(js_val *, js_val *, bool);
+js_val * fh_enum_keys(js_val *);
+bool fh_is_index(char *, unsigned long *);
+bool fh_num_index(js_val *, unsigned long *);
+void fh_make_sparse(js_val *);
+js_val * fh_get_elem(js_val *, unsigned long);
+js_val * fh_get_index(js_val *, unsigned long);
+void fh_set_elem(js_val *, unsigned long, js_val *);
+bool fh_del_elem(js_val *, unsigned long);
+void fh_truncate_elems(js_val *, unsigned long);
+double fh_typed_load(js_typed *, unsigned long);
+void fh_typed_store(js_typed *, unsigned long, double);
+double fh_typed_num(js_val *);
 
 #endif
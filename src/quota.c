@@ -0,0 +1,119 @@
+/*
+ * quota.c -- Step, time and heap limits on a script
+ *
+ * Copyright (c) 2012-2013 Nick Reynolds
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Scripts we don't trust can be given a number of steps (loop iterations
+ * and calls of functions defined in JS), a time to run in and a heap to run
+ * in. The steps are counted down in batches, and the clock is read at the
+ * end of each batch, so the cost to a script without quotas is one test per
+ * step.
+ *
+ * A script over a quota is terminated with an error that no `try` catches:
+ * fh_throw unwinds it to the outermost catch frame, whose catcher throws it
+ * on, so it ends the script as an uncaught error would. A process ends with
+ * QUOTA_EXIT_STATUS, and an isolate leaves the reason in
+ * `fh->quota_exceeded`.
+ *
+ * A native that runs long (sorting a huge array, say) is only stopped once
+ * it returns. Compiled loops don't count their steps, so --max-steps and
+ * --timeout turn the JIT off. */
+
+#include <limits.h>
+#include <math.h>
+
+#include "quota.h"
+#include "timers.h"
+
+/* Steps to count before the next check. */
+static unsigned long
+next_batch()
+{
+  if (!fh->opt_max_steps && !fh->quota_deadline) return 0;
+
+  unsigned long batch = QUOTA_CHECK_STEPS;
+  if (fh->opt_max_steps && fh->opt_max_steps - fh->quota_steps < batch)
+    batch = fh->opt_max_steps - fh->quota_steps + 1;
+  return batch;
+}
+
+/* Start the clock and the count of the current isolate's script. */
+void
+fh_quota_start()
+{
+  fh->quota_steps = 0;
+  fh->quota_exceeded = QUOTA_NONE;
+  fh->quota_deadline = fh->opt_timeout ? fh_clock_ms() + fh->opt_timeout : 0;
+  fh->quota_ticks = fh->quota_batch = next_batch();
+}
+
+/* At the end of a batch of steps: terminate the script if it's over its
+ * steps or its time, and start the next batch otherwise. */
+void
+fh_quota_check()
+{
+  fh->quota_steps += fh->quota_batch;
+  if (fh->opt_max_steps && fh->quota_steps > fh->opt_max_steps)
+    fh_terminate(QUOTA_STEPS);
+  if (fh->quota_deadline && fh_clock_ms() >= fh->quota_deadline)
+    fh_terminate(QUOTA_TIME);
+  fh->quota_ticks = fh->quota_batch = next_batch();
+}
+
+/* A poll() timeout cut short at the deadline, from the event loop. The script
+ * is terminated if it's already past it. */
+int
+fh_quota_poll_timeout(int timeout)
+{
+  if (!fh->quota_deadline) return timeout;
+
+  double left = ceil(fh->quota_deadline - fh_clock_ms());
+  if (left <= 0) fh_terminate(QUOTA_TIME);
+  if (left >= INT_MAX) return timeout;
+  return timeout < 0 || left < timeout ? (int)left : timeout;
+}
+
+/* Stop the script over a quota, past any `try` it's in. */
+void
+fh_terminate(fh_quota why)
+{
+  bool oom = fh->gc_oom;
+  js_val *err;
+
+  fh->quota_exceeded = why;
+  fh->quota_ticks = 0;
+
+  // The heap may be full: making the error is allowed to grow it.
+  fh->gc_oom = true;
+  switch (why) {
+    case QUOTA_STEPS:
+      err = fh_new_error(E_RANGE, "script terminated after %lu steps",
+          fh->opt_max_steps);
+      break;
+    case QUOTA_TIME:
+      err = fh_new_error(E_RANGE, "script terminated after %g ms",
+          fh->opt_timeout);
+      break;
+    default:
+      err = fh_new_error(E_RANGE,
+          "script terminated at its heap quota of %zu bytes",
+          fh->opt_heap_quota);
+      break;
+  }
+  fh->gc_oom = oom;
+
+  fh_throw(fh->callstack, err);
+}
@@ -0,0 +1,37 @@
+/*
+ * quota.h -- Step, time and heap limits on a script
+ *
+ * Copyright (c) 2012-2013 Nick Reynolds
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef QUOTA_H
+#define QUOTA_H
+
+#include "flathead.h"
+
+#define QUOTA_CHECK_STEPS 4096  // steps between looks at the clock
+#define QUOTA_EXIT_STATUS 3     // of a process whose script was stopped
+
+// Call at each loop iteration and function call. Only with --max-steps or
+// --timeout are the steps counted.
+#define QUOTA_STEP() \
+  do { if (fh->quota_ticks && !--fh->quota_ticks) fh_quota_check(); } while (0)
+
+void fh_quota_start(void);
+void fh_quota_check(void);
+int fh_quota_poll_timeout(int);
+void fh_terminate(fh_quota);
+
+#endif
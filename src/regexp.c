@@ -22,46 +22,114 @@
 
 #include "regexp.h"
 #include "flathead.h"
+#include "atom.h"
 
 
-const int regexp_vector_len = 30;
+/* Compiled patterns are kept in a small cache, so a pattern used in a loop
+ * (as by a global replace, which matches once per replacement) is compiled
+ * and studied once. Entries are found by the pattern's atom and the flags,
+ * and the least recently used makes way for a new pattern. Matches are
+ * written to one vector, reused by each call. */
 
+#define REGEXP_CACHE_SIZE 64
 
-/* Gateway to the PCRE library. Compiles a regular expression pattern and
- * returns matches. When compiled with FH_NO_REGEXP, this function is still
- * available, but will throw an error when called. */
-int *
-fh_regexp(char *str, char *pattern, int *count, int offset, bool caseless)
-{
 #ifndef FH_NO_REGEXP
+
+#ifndef PCRE_STUDY_JIT_COMPILE
+#define PCRE_STUDY_JIT_COMPILE 0
+#endif
+
+typedef struct {
+  char *pattern;                // an atom, or NULL for a vacant entry
+  bool caseless;
+  pcre *code;
+  pcre_extra *extra;            // from pcre_study (may be NULL)
+  int ncaptures;
+  unsigned long used;           // when it was last looked up
+} regexp_entry;
+
+static regexp_entry regexp_cache[REGEXP_CACHE_SIZE];
+static regexp_entry *regexp_last;
+static unsigned long regexp_clock;
+
+static int *match_vector;
+static int match_vector_len;
+
+static regexp_entry *
+regexp_compile(char *pattern, bool caseless)
+{
+  pattern = fh_intern(pattern);
+  regexp_entry *entry = regexp_last;
+  if (entry && entry->pattern == pattern && entry->caseless == caseless) {
+    entry->used = ++regexp_clock;
+    return entry;
+  }
+
+  regexp_entry *oldest = &regexp_cache[0];
+  int i;
+  for (i = 0; i < REGEXP_CACHE_SIZE; i++) {
+    entry = &regexp_cache[i];
+    if (entry->pattern == pattern && entry->caseless == caseless) {
+      entry->used = ++regexp_clock;
+      return regexp_last = entry;
+    }
+    if (entry->used < oldest->used) oldest = entry;
+  }
+
   const char *error;
-  int rc;
   int error_offset;
-  int *output_vector = malloc(regexp_vector_len * sizeof(int));
   int options = PCRE_JAVASCRIPT_COMPAT;
   if (caseless) 
     options |= PCRE_CASELESS;
 
-  pcre *regexp = pcre_compile(pattern, options, &error, &error_offset, NULL);
-  if (!regexp) {
+  pcre *code = pcre_compile(pattern, options, &error, &error_offset, NULL);
+  if (!code) {
     char *fmt = "Invalid Regular Expression:\n  %s at offset %d";
     fh_throw(NULL, fh_new_error(E_SYNTAX, fmt, error, error_offset));
   }
 
-  rc = pcre_exec(regexp, NULL, str, strlen(str), offset, 0, 
-                 output_vector, regexp_vector_len);
+  entry = oldest;
+  if (entry->code) {
+    pcre_free_study(entry->extra);
+    pcre_free(entry->code);
+  }
+  entry->pattern = pattern;
+  entry->caseless = caseless;
+  entry->code = code;
+  entry->extra = pcre_study(code, PCRE_STUDY_JIT_COMPILE, &error);
+  pcre_fullinfo(code, entry->extra, PCRE_INFO_CAPTURECOUNT, &entry->ncaptures);
+  entry->used = ++regexp_clock;
+  return regexp_last = entry;
+}
 
-  if (count != NULL)
-    *count = rc > 0 ? rc : 0;
+#endif
 
-  pcre_free(regexp);
+/* Gateway to the PCRE library. Matches a regular expression pattern against
+ * `str` from `offset`, and returns the match vector, or NULL if there's no
+ * match. The vector is reused, and only valid until the next call. When
+ * compiled with FH_NO_REGEXP, this function is still available, but will
+ * throw an error when called. */
+int *
+fh_regexp(char *str, char *pattern, int *count, int offset, bool caseless)
+{
+#ifndef FH_NO_REGEXP
+  regexp_entry *entry = regexp_compile(pattern, caseless);
 
-  if (rc < 0) {
-    free(output_vector);
-    return NULL;
+  // Room for the whole match and each group, with PCRE's workspace, and a
+  // pair to spare past the last group.
+  int len = 3 * (entry->ncaptures + 2);
+  if (len > match_vector_len) {
+    match_vector = realloc(match_vector, len * sizeof(int));
+    match_vector_len = len;
   }
-  
-  return output_vector;
+
+  int rc = pcre_exec(entry->code, entry->extra, str, strlen(str), offset, 0, 
+                     match_vector, match_vector_len);
+
+  if (count != NULL)
+    *count = rc > 0 ? rc : 0;
+
+  return rc < 0 ? NULL : match_vector;
 #else
   fh_throw(NULL, fh_new_error(E_ERROR, "Regular expressions are not available"));
   UNREACHABLE();
@@ -74,17 +142,7 @@ int
 fh_regexp_ncaptures(char *pattern)
 {
 #ifndef FH_NO_REGEXP
-  const char *error;
-  int error_offset;
-  int options = PCRE_JAVASCRIPT_COMPAT;
-  int captures;
-  pcre *regexp = pcre_compile(pattern, options, &error, &error_offset, NULL);
-  if (!regexp) {
-    char *fmt = "Invalid Regular Expression:\n  %s at offset %d";
-    fh_throw(NULL, fh_new_error(E_SYNTAX, fmt, error, error_offset));
-  }
-  pcre_fullinfo(regexp, NULL, PCRE_INFO_CAPTURECOUNT, &captures);
-  return captures;
+  return regexp_compile(pattern, false)->ncaptures;
 #else
   fh_throw(NULL, fh_new_error(E_ERROR, "Regular expressions are not available"));
   UNREACHABLE();
@@ -12,65 +12,216 @@
 #include <string.h>
 
 #include "Array.h"
+#include "../../nodes.h"
 
 
 // ---------------------------------------------------------------------------- 
 // Merge Sort (implements Array#sort)
 // ---------------------------------------------------------------------------- 
 
-static int (*cmp_func)(js_prop *, js_prop *);   // Current Array#sort cmp func
-static js_val *js_cmp_func;                     // JavaScript-defined cmp func
-static eval_state *js_cmp_state;                // Eval state of JS cmp func
+#define SORT_MIN_RUN 16
 
-static void 
-merge(js_prop **left, js_prop **right, 
-          unsigned long l_len, unsigned long r_len, js_prop **out)
+typedef struct {
+  js_val *val;
+  char *key;              // string order, when sorting without a comparator
+  double num;             // number order, for `a - b` style comparators
+} sort_item;
+
+typedef enum {
+  SORT_KEYS,              // no comparator: compare the cached string keys
+  SORT_ASC,               // function(a, b) { return a - b; } on numbers
+  SORT_DESC,              // function(a, b) { return b - a; } on numbers
+  SORT_CALLS              // call the comparator
+} sort_mode;
+
+// Everything a sort needs lives here, so a comparator can sort too.
+typedef struct {
+  sort_mode mode;
+  js_val *func;
+  js_val *ctx;
+  js_val *argv[2];
+  js_args args;
+} sort_ctx;
+
+static bool
+sort_le(sort_ctx *sc, sort_item *a, sort_item *b)
 {
-  unsigned long i, j, k;
-  for (i = j = k = 0; i < l_len && j < r_len; )
-    out[k++] = cmp_func(left[i], right[j]) ? left[i++] : right[j++];
+  switch (sc->mode) {
+    case SORT_KEYS: return strcmp(a->key, b->key) <= 0;
+    case SORT_ASC: return !(a->num - b->num > 0);
+    case SORT_DESC: return !(b->num - a->num > 0);
+    default: break;
+  }
+
+  // The pair is passed as a view of argv, so no argument list is built.
+  sc->argv[0] = a->val;
+  sc->argv[1] = b->val;
+  args_view(&sc->args, sc->argv, 2);
+  js_val *result = fh_call(sc->ctx, JSUNDEF(), sc->func, &sc->args);
+  js_val *num = TO_NUM(result);
 
-  while (i < l_len) out[k++] = left[i++];
-  while (j < r_len) out[k++] = right[j++];
+  // NaN counts as equal.
+  return num->number.is_nan || !(num->number.val > 0);
 }
- 
-static void 
-recur(js_prop **arr, js_prop **tmp, unsigned long len)
+
+static void
+sort_reverse(sort_item *items, unsigned long len)
 {
-  long l = len / 2;
-  if (len <= 1) return;
+  unsigned long i;
+  sort_item tmp;
+  for (i = 0; i < len / 2; i++) {
+    tmp = items[i];
+    items[i] = items[len - 1 - i];
+    items[len - 1 - i] = tmp;
+  }
+}
 
-  recur(tmp, arr, l);
-  recur(tmp + l, arr + l, len - l);
+// Find the run starting at `lo`, reversing it if strictly descending, and
+// extend short runs to SORT_MIN_RUN by insertion. Returns the run's end.
+static unsigned long
+sort_run(sort_ctx *sc, sort_item *items, unsigned long lo, unsigned long len)
+{
+  unsigned long hi = lo + 1, end, j;
+  sort_item item;
+  if (hi == len) return hi;
 
-  merge(tmp, tmp + l, l, len - l, arr);
+  if (sort_le(sc, &items[lo], &items[hi])) {
+    while (++hi < len && sort_le(sc, &items[hi - 1], &items[hi]));
+  }
+  else {
+    while (++hi < len && !sort_le(sc, &items[hi - 1], &items[hi]));
+    sort_reverse(items + lo, hi - lo);
+  }
+
+  end = MIN(lo + SORT_MIN_RUN, len);
+  for (; hi < end; hi++) {
+    item = items[hi];
+    for (j = hi; j > lo && !sort_le(sc, &items[j - 1], &item); j--)
+      items[j] = items[j - 1];
+    items[j] = item;
+  }
+  return hi;
 }
- 
-static void 
-merge_sort(js_prop **arr, unsigned long len)
+
+// Merge the sorted runs [lo, mid) and [mid, hi), with room for the left
+// run in `tmp`.
+static void
+sort_merge(sort_ctx *sc, sort_item *items, sort_item *tmp,
+           unsigned long lo, unsigned long mid, unsigned long hi)
 {
-  js_prop **tmp = malloc(sizeof(js_prop *) * len);
-  memcpy(tmp, arr, sizeof(js_prop *) * len);
+  unsigned long i = 0, j = mid, k = lo, l_len = mid - lo;
 
-  recur(arr, tmp, len);
+  // Runs that are already in order are left alone.
+  if (sort_le(sc, &items[mid - 1], &items[mid])) return;
+
+  memcpy(tmp, items + lo, l_len * sizeof(sort_item));
+  while (i < l_len && j < hi)
+    items[k++] = sort_le(sc, &tmp[i], &items[j]) ? tmp[i++] : items[j++];
+  while (i < l_len) items[k++] = tmp[i++];
+}
+
+// A stable natural merge sort: the existing runs are found first, then
+// merged pairwise until one is left. Sorted input takes n - 1 comparisons.
+static void
+merge_sort(sort_ctx *sc, sort_item *items, unsigned long len)
+{
+  unsigned long num_runs = 0, i, j, lo;
+  unsigned long *runs;
+  sort_item *tmp;
+  if (len <= 1) return;
+
+  runs = malloc(sizeof(unsigned long) * (len / SORT_MIN_RUN + 2));
+  for (lo = 0; lo < len; lo = runs[num_runs])
+    runs[++num_runs] = sort_run(sc, items, lo, len);
+  runs[0] = 0;
+
+  tmp = malloc(sizeof(sort_item) * len);
+  while (num_runs > 1) {
+    for (i = j = 0; i + 1 < num_runs; i += 2) {
+      sort_merge(sc, items, tmp, runs[i], runs[i + 1], runs[i + 2]);
+      runs[++j] = runs[i + 2];
+    }
+    if (i < num_runs) runs[++j] = runs[num_runs];
+    num_runs = j;
+  }
 
   free(tmp);
+  free(runs);
 }
 
-static int
-cmp(js_prop *a, js_prop *b)
+static bool
+is_param(ast_node *node, ast_node *param)
 {
-  return strcmp(TO_STR(a->ptr)->string.ptr, TO_STR(b->ptr)->string.ptr) < 0;
+  return node->type == NODE_IDENT && STREQ(node->sval, param->sval);
 }
 
-static int
-cmp_js(js_prop *a, js_prop *b)
+// Recognize comparators of the form function(a, b) { return a - b; }, or
+// b - a, which can be sorted by number without calling them.
+static sort_mode
+numeric_cmp_mode(js_val *func)
 {
-  js_args *args = args_new();
-  args_append(args, a->ptr);
-  args_append(args, b->ptr);
-  js_val *result = fh_call(js_cmp_state->ctx, JSUNDEF(), js_cmp_func, args);
-  return TO_BOOL(result)->number.val > 0;
+  if (func->object.native) return SORT_CALLS;
+
+  ast_node *params = func->object.node->e1;
+  if (!params || params->num_items != 2) return SORT_CALLS;
+
+  ast_node *a = params->items[0], *b = params->items[1];
+  if (STREQ(a->sval, b->sval)) return SORT_CALLS;
+
+  ast_node *body = fh_func_body(func->object.node);
+  if (!body || body->num_items != 1) return SORT_CALLS;
+
+  ast_node *ret = body->items[0];
+  if (ret->type != NODE_RETURN || !ret->e1) return SORT_CALLS;
+
+  ast_node *exp = ret->e1;
+  if (exp->type != NODE_EXP || exp->op != OP_SUB) return SORT_CALLS;
+
+  if (is_param(exp->e1, a) && is_param(exp->e2, b)) return SORT_ASC;
+  if (is_param(exp->e1, b) && is_param(exp->e2, a)) return SORT_DESC;
+  return SORT_CALLS;
+}
+
+// Work out each item's sort key once, up front.
+static void
+sort_keys(sort_ctx *sc, sort_item *items, unsigned long len, char **buf)
+{
+  unsigned long i, size = 0, cap = 0;
+  size_t *offsets = NULL;
+  js_val *str;
+
+  if (sc->mode == SORT_ASC || sc->mode == SORT_DESC) {
+    for (i = 0; i < len; i++) {
+      js_val *val = items[i].val;
+      items[i].num = val->number.is_nan ? NAN : val->number.val;
+    }
+    return;
+  }
+  if (sc->mode != SORT_KEYS) return;
+
+  // Strings are their own keys. Other values are converted once and copied 
+  // into one buffer, as nothing else holds on to the converted strings.
+  offsets = malloc(sizeof(size_t) * len);
+  for (i = 0; i < len; i++) {
+    if (IS_STR(items[i].val)) {
+      items[i].key = fh_str_flatten(items[i].val)->string.ptr;
+      offsets[i] = (size_t)-1;
+      continue;
+    }
+    str = fh_str_flatten(TO_STR(items[i].val));
+    unsigned long n = strlen(str->string.ptr) + 1;
+    if (size + n > cap) {
+      cap = (size + n) * 2;
+      *buf = realloc(*buf, cap);
+    }
+    memcpy(*buf + size, str->string.ptr, n);
+    offsets[i] = size;
+    size += n;
+  }
+  for (i = 0; i < len; i++) {
+    if (offsets[i] != (size_t)-1) items[i].key = *buf + offsets[i];
+  }
+  free(offsets);
 }
 
 
@@ -100,7 +251,7 @@ arr_new(js_val *instance, js_args *args, eval_state *state)
   
   unsigned i; // num of args will be less than UINT_MAX
   for (i = 0; i < ARGLEN(args); i++) 
-    fh_set(arr, JSNUMKEY(i)->string.ptr, ARG(args, i));
+    fh_set_elem(arr, i, ARG(args, i));
 
   fh_set_len(arr, i);
   return arr;
@@ -131,10 +282,9 @@ arr_proto_pop(js_val *instance, js_args *args, eval_state *state)
   unsigned long len = instance->object.length;
   if (len == 0) return JSUNDEF();
 
-  js_val *key = JSNUMKEY(len - 1);
-  js_val *popped = fh_get(instance, key->string.ptr);
+  js_val *popped = fh_get_index(instance, len - 1);
 
-  fh_del_prop(instance, key->string.ptr);
+  fh_del_elem(instance, len - 1);
   fh_set_len(instance, len - 1);
   return popped;
 }
@@ -146,11 +296,8 @@ arr_proto_push(js_val *instance, js_args *args, eval_state *state)
   unsigned long len = instance->object.length;
   unsigned nargs = ARGLEN(args);
   unsigned i;
-  for (i = 0; i < nargs; i++) {
-    js_val *key = JSNUMKEY(len);
-    fh_set(instance, key->string.ptr, ARG(args, i));
-    len++;
-  }
+  for (i = 0; i < nargs; i++)
+    fh_set_elem(instance, len++, ARG(args, i));
 
   fh_set_len(instance, len);
   return JSNUM(len);
@@ -161,40 +308,22 @@ js_val *
 arr_proto_reverse(js_val *instance, js_args *args, eval_state *state)
 {
   unsigned long len = instance->object.length;
+  if (len == 0) return instance;
+
   unsigned long i = 0, j = len - 1;
-  js_val *tmp;
-  js_prop *iprop, *jprop;
-  char *ik, *jk;
+  js_val *ival, *jval;
 
-  // While i & j converge, swap the values they point to.
-  while (i < j) {
-    ik = JSNUMKEY(i++)->string.ptr;
-    jk = JSNUMKEY(j--)->string.ptr;
+  // While i & j converge, swap the values they point to. Missing elements
+  // (deleted or never set) swap places with the element opposite them.
+  for (; i < j; i++, j--) {
+    ival = fh_get_elem(instance, i);
+    jval = fh_get_elem(instance, j);
 
-    iprop = fh_get_prop(instance, ik);
-    jprop = fh_get_prop(instance, jk);
+    if (jval) fh_set_elem(instance, i, jval);
+    else fh_del_elem(instance, i);
 
-    // Need to do some checks to account for missing properties 
-    // (they may have been deleted or never set)
-    
-    if (jprop)
-      jprop->ptr = jprop->ptr == NULL ? JSUNDEF() : jprop->ptr;
-    if (iprop)
-      iprop->ptr = iprop->ptr == NULL ? JSUNDEF() : iprop->ptr;
-
-    if (!iprop && jprop) {
-      fh_set_prop(instance, ik, jprop->ptr, P_DEFAULT);
-      fh_del_prop(instance, jk);
-    }
-    else if (!jprop && iprop) {
-      fh_set_prop(instance, jk, iprop->ptr, P_DEFAULT);
-      fh_del_prop(instance, ik);
-    }
-    else if (jprop && iprop) {
-      tmp = iprop->ptr;
-      iprop->ptr = jprop->ptr;
-      jprop->ptr = tmp;
-    }
+    if (ival) fh_set_elem(instance, j, ival);
+    else fh_del_elem(instance, j);
   }
 
   return instance;
@@ -204,21 +333,29 @@ arr_proto_reverse(js_val *instance, js_args *args, eval_state *state)
 js_val *
 arr_proto_shift(js_val *instance, js_args *args, eval_state *state)
 {
-  // Shift off first element, but then we have to rename all the keys.
-  
   unsigned long len = instance->object.length;
   if (len == 0) return JSUNDEF();
 
-  js_val *shifted = fh_get(instance, "0");
-  fh_del_prop(instance, "0");
+  js_val *shifted = fh_get_index(instance, 0);
 
-  unsigned long i;
-  for (i = 1; i < len; i++) {
-    js_val *old_key = JSNUMKEY(i);
-    js_val *new_key = JSNUMKEY(i-1);
-    js_prop *prop = fh_get_prop(instance, old_key->string.ptr);
-    fh_del_prop(instance, old_key->string.ptr);
-    fh_set(instance, new_key->string.ptr, prop->ptr);
+  // Dense arrays slide their elements down, others have to rename the keys.
+  if (instance->dense) {
+    unsigned long n = MIN(len, instance->elements_cap);
+    if (n > 0) {
+      memmove(instance->elements, instance->elements + 1, 
+              (n - 1) * sizeof(js_val *));
+      instance->elements[n - 1] = NULL;
+    }
+  }
+  else {
+    unsigned long i;
+    js_val *val;
+    fh_del_elem(instance, 0);
+    for (i = 1; i < len; i++) {
+      val = fh_get_elem(instance, i);
+      fh_del_elem(instance, i);
+      if (val) fh_set_elem(instance, i - 1, val);
+    }
   }
 
   fh_set_len(instance, len - 1);
@@ -232,47 +369,57 @@ arr_proto_sort(js_val *instance, js_args *args, eval_state *state)
   unsigned long len = instance->object.length;
   if (len == 0) return instance;
 
-  js_val *maybe_cmp_func = ARG(args, 0);
-  if (IS_FUNC(maybe_cmp_func)) {
-    cmp_func = cmp_js;
-    js_cmp_func = maybe_cmp_func;
-    js_cmp_state = state;
-  }
-  else {
-    cmp_func = cmp;
-  }
-
-  js_val *sorted = JSARR();
-
-  // Build an array of js_prop pointers from the hashmap.
-  unsigned long i, j;
-  js_prop *prop, *prop_lst[len];
+  sort_ctx sc;
+  sc.mode = SORT_KEYS;
+  sc.func = ARG(args, 0);
+  sc.ctx = state->ctx;
+  if (IS_FUNC(sc.func))
+    sc.mode = numeric_cmp_mode(sc.func);
+
+  // Collect the elements that are present, with undefined ones set aside
+  // for the end. They're never compared.
+  unsigned long i, n = 0, undefs = 0;
+  bool numbers = true, objects = false;
+  js_val *val;
+  sort_item *items = malloc(sizeof(sort_item) * len);
   for (i = 0; i < len; i++) {
-    prop = fh_get_prop(instance, JSNUMKEY(i)->string.ptr);
-    if (!prop) {
-      i--;
+    if (!(val = fh_get_elem(instance, i))) continue;
+    if (IS_UNDEF(val)) {
+      undefs++;
       continue;
     }
-    prop_lst[i] = prop;
+    numbers = numbers && IS_NUM(val);
+    objects = objects || IS_OBJ(val);
+    items[n++].val = val;
   }
 
-  // Do a merge sort of the js_prop pointers array.
-  merge_sort(prop_lst, i);
+  if ((sc.mode == SORT_ASC || sc.mode == SORT_DESC) && !numbers)
+    sc.mode = SORT_CALLS;
 
-  // Rebuild the hashmap (using a donor array).
-  for (j = 0; j < i; j++) {
-    prop = prop_lst[j];
-    free(prop->name);
-    prop->name = JSNUMKEY(j)->string.ptr;
-    HASH_ADD_KEYPTR(hh, sorted->map, prop->name, strlen(prop->name), prop);
+  // Script code may run while sorting (toString or the comparator) and take
+  // the elements out of the array, so keep them reachable until we're done.
+  js_val *volatile pinned = NULL;
+  if (objects || sc.mode == SORT_CALLS) {
+    pinned = JSARR();
+    for (i = 0; i < n; i++)
+      fh_set_elem(pinned, i, items[i].val);
   }
 
-  // Steal the donor array's hashmap.
-  instance->map = sorted->map;
-  sorted->map = NULL;
-
-  fh_set_len(instance, len);
-
+  char *keys = NULL;
+  sort_keys(&sc, items, n, &keys);
+  merge_sort(&sc, items, n);
+
+  // Write them back in order, moving the undefineds and then the holes to
+  // the end.
+  for (i = 0; i < n; i++)
+    fh_set_elem(instance, i, items[i].val);
+  for (; i < n + undefs; i++)
+    fh_set_elem(instance, i, JSUNDEF());
+  for (; i < len; i++)
+    fh_del_elem(instance, i);
+
+  free(keys);
+  free(items);
   return instance;
 }
 
@@ -304,14 +451,14 @@ arr_proto_splice(js_val *instance, js_args *args, eval_state *state)
 
       // Add any new elements
       while (args_ind < args_length) {
-        fh_set(keepers, JSNUMKEY(k)->string.ptr, ARG(args, args_ind));
+        fh_set_elem(keepers, k, ARG(args, args_ind));
         args_ind++;
         k++;
       }
       // Add the spliced region to the rejects, skip over those indices.
       while (splice_len > 0) {
-        val = fh_get(instance, JSNUMKEY(i)->string.ptr);
-        fh_set(rejects, JSNUMKEY(j)->string.ptr, val);
+        val = fh_get_index(instance, i);
+        fh_set_elem(rejects, j, val);
         splice_len--, i++, j++;
       }
       // Don't hit this branch twice.
@@ -319,18 +466,15 @@ arr_proto_splice(js_val *instance, js_args *args, eval_state *state)
 
     }
     else {
-      val = fh_get(instance, JSNUMKEY(i)->string.ptr);
-      fh_set(keepers, JSNUMKEY(k)->string.ptr, val); 
+      val = fh_get_index(instance, i);
+      fh_set_elem(keepers, k, val); 
       k++, i++;
     }
   }
 
-  // We're doing a hotswap of the keepers hash into the instance array.  
+  // We're doing a hotswap of the keepers elements into the instance array.  
   // Still technically mutates the instance array (its pointer hasn't changed)
-  instance->map = keepers->map;
-
-  // GC will take the hash if we don't remove the reference.
-  keepers->map = NULL;
+  fh_replace_map(instance, keepers);
 
   fh_set_len(instance, k);
   fh_set_len(rejects, j);
@@ -349,19 +493,18 @@ arr_proto_unshift(js_val *instance, js_args *args, eval_state *state)
 
   // Add the args
   for (; i < nargs; i++) {
-    fh_set(newarr, JSNUMKEY(i)->string.ptr, ARG(args, i));
+    fh_set_elem(newarr, i, ARG(args, i));
   }
 
   // Add the instance's elements
   js_val *val;
   for (; j < len; j++, i++) {
-    val = fh_get(instance, JSNUMKEY(j)->string.ptr);
-    fh_set(newarr, JSNUMKEY(i)->string.ptr, val);
+    if ((val = fh_get_elem(instance, j)))
+      fh_set_elem(newarr, i, val);
   }
 
   // Replace the map into our instance.
-  instance->map = newarr->map;
-  newarr->map = NULL;
+  fh_replace_map(instance, newarr);
 
   fh_set_len(instance, i);
   return JSNUM(i);
@@ -374,36 +517,29 @@ arr_proto_concat(js_val *instance, js_args *args, eval_state *state)
   unsigned nargs = ARGLEN(args);
   unsigned long len = instance->object.length;
   js_val *concat = JSARR();
-  js_val *key;
 
   unsigned long i = 0, // newarr index
                 j = 0; // args index
 
   // Add the current array to the new array.
-  for (; i < len; i++) {
-    key = JSNUMKEY(i);
-    fh_set(concat, key->string.ptr, fh_get(instance, key->string.ptr));
-  }
+  for (; i < len; i++)
+    fh_set_elem(concat, i, fh_get_index(instance, i));
 
   // Add the arguments to the new array.
   js_val *arg;
   for (; j < nargs; j++, i++) {
-    key = JSNUMKEY(i);
     arg = ARG(args, j);
     // Extract array elements one level deep.
     if (IS_ARR(arg)) {
       unsigned long k;
-      js_val *inner_key;
       for (k = 0; k < arg->object.length; k++) {
-        key = JSNUMKEY(i);
-        inner_key = JSNUMKEY(k);
-        fh_set(concat, key->string.ptr, fh_get(arg, inner_key->string.ptr));
+        fh_set_elem(concat, i, fh_get_index(arg, k));
         // Let the outer loop increment i if we're at the end:
         if (k < arg->object.length - 1) i++;
       }
     } 
     else {
-      fh_set(concat, key->string.ptr, arg);
+      fh_set_elem(concat, i, arg);
     }
   }
 
@@ -414,28 +550,29 @@ arr_proto_concat(js_val *instance, js_args *args, eval_state *state)
 static js_val *
 do_join(js_val *arr, js_val *sep)
 {
-  js_val *result = JSSTR("");
-
   if (IS_UNDEF(sep)) sep = JSSTR(",");
   sep = TO_STR(sep);
 
-  bool first = true;
+  fh_strbuf sb;
+  fh_strbuf_init(&sb);
+
   js_val *el;
   js_val *strval;
   unsigned long i;
 
   for (i = 0; i < arr->object.length; i++) {
-    el = fh_get(arr, JSNUMKEY(i)->string.ptr);
+    el = fh_get_index(arr, i);
 
-    if (!first)
-      result = JSSTR(fh_str_concat(result->string.ptr, sep->string.ptr));
-    else
-      first = false;
+    if (i > 0)
+      fh_strbuf_append(&sb, sep->string.ptr, sep->string.length);
 
-    strval = IS_UNDEF(el) || IS_NULL(el) ? JSSTR("") : TO_STR(el);
-    result = JSSTR(fh_str_concat(result->string.ptr, strval->string.ptr));
+    if (IS_UNDEF(el) || IS_NULL(el)) continue;
+    strval = TO_STR(el);
+    fh_strbuf_append(&sb, strval->string.ptr, strval->string.length);
   }
 
+  js_val *result = JSSTR(sb.buf);
+  free(sb.buf);
   return result;
 }
 
@@ -482,8 +619,8 @@ arr_proto_slice(js_val *instance, js_args *args, eval_state *state)
   js_val *val;
   unsigned long i;
   for (i = 0; j < k && j < len; j++, i++) {
-    val = fh_get(instance, JSNUMKEY(j)->string.ptr);
-    fh_set(slice, JSNUMKEY(i)->string.ptr, val);
+    val = fh_get_index(instance, j);
+    fh_set_elem(slice, i, val);
   }
 
   fh_set_len(slice, i);
@@ -513,11 +650,10 @@ arr_proto_index_of(js_val *instance, js_args *args, eval_state *state)
       i = from->number.val;
   }
 
-  js_val *key, *equals;
+  js_val *equals;
   for (; i < len; i++) {
-    key = JSNUMKEY(i);
     // indexOf uses strict equality
-    equals = fh_eq(fh_get(instance, key->string.ptr), search, true);
+    equals = fh_eq(fh_get_index(instance, i), search, true);
     if (equals->boolean.val) {
       return JSNUM(i);
     }
@@ -541,11 +677,10 @@ arr_proto_last_index_of(js_val *instance, js_args *args, eval_state *state)
       i = from->number.val;
   }
 
-  js_val *key, *equals;
+  js_val *equals;
   for (; i >= 0; i--) {
-    key = JSNUMKEY(i);
     // lastIndexOf uses strict equality
-    equals = fh_eq(fh_get(instance, key->string.ptr), search, true);
+    equals = fh_eq(fh_get_index(instance, i), search, true);
     if (equals->boolean.val) {
       return JSNUM(i);
     }
@@ -562,20 +697,18 @@ arr_proto_filter(js_val *instance, js_args *args, eval_state *state)
   js_val *filtered = JSARR();
   unsigned long len = instance->object.length;
 
-  js_val *ikey, *jkey, *val, *result;
-  js_args *cbargs;
+  js_val *val, *result;
+  js_args cbargs;
   unsigned long i = 0, j = 0;
   for (; i < len; i++) {
-    ikey = JSNUMKEY(i);
-    val = fh_get(instance, ikey->string.ptr);
-    cbargs = args_new();
-    args_append(cbargs, val);
-    args_append(cbargs, JSNUM(i));
-    args_append(cbargs, instance);
-    result = fh_call(state->ctx, this, callback, cbargs);
+    val = fh_get_index(instance, i);
+    args_init(&cbargs);
+    args_append(&cbargs, val);
+    args_append(&cbargs, JSNUM(i));
+    args_append(&cbargs, instance);
+    result = fh_call(state->ctx, this, callback, &cbargs);
     if (TO_BOOL(result)->boolean.val) {
-      jkey = JSNUMKEY(j++);
-      fh_set(filtered, jkey->string.ptr, fh_get(instance, ikey->string.ptr));
+      fh_set_elem(filtered, j++, fh_get_index(instance, i));
     }
   }
 
@@ -591,17 +724,16 @@ arr_proto_for_each(js_val *instance, js_args *args, eval_state *state)
   js_val *this = ARG(args, 1);
   unsigned long len = instance->object.length;
 
-  js_val *key, *val;
-  js_args *cbargs;
+  js_val *val;
+  js_args cbargs;
   unsigned long i;
   for (i = 0; i < len; i++) {
-    key = JSNUMKEY(i);
-    val = fh_get(instance, key->string.ptr);
-    cbargs = args_new();
-    args_append(cbargs, val);
-    args_append(cbargs, JSNUM(i));
-    args_append(cbargs, instance);
-    fh_call(state->ctx, this, callback, cbargs);
+    val = fh_get_index(instance, i);
+    args_init(&cbargs);
+    args_append(&cbargs, val);
+    args_append(&cbargs, JSNUM(i));
+    args_append(&cbargs, instance);
+    fh_call(state->ctx, this, callback, &cbargs);
   }
 
   return JSUNDEF();
@@ -615,17 +747,16 @@ arr_proto_every(js_val *instance, js_args *args, eval_state *state)
   js_val *this = ARG(args, 1);
   unsigned long len = instance->object.length;
 
-  js_val *key, *val, *result;
-  js_args *cbargs;
+  js_val *val, *result;
+  js_args cbargs;
   unsigned long i;
   for (i = 0; i < len; i++) {
-    key = JSNUMKEY(i);
-    val = fh_get(instance, key->string.ptr);
-    cbargs = args_new();
-    args_append(cbargs, val);
-    args_append(cbargs, JSNUM(i));
-    args_append(cbargs, instance);
-    result = fh_call(state->ctx, this, callback, cbargs);
+    val = fh_get_index(instance, i);
+    args_init(&cbargs);
+    args_append(&cbargs, val);
+    args_append(&cbargs, JSNUM(i));
+    args_append(&cbargs, instance);
+    result = fh_call(state->ctx, this, callback, &cbargs);
     if (!TO_BOOL(result)->boolean.val)
       return JSBOOL(0);
   }
@@ -642,18 +773,17 @@ arr_proto_map(js_val *instance, js_args *args, eval_state *state)
   unsigned long len = instance->object.length;
   js_val *map = JSARR();
 
-  js_val *key, *val, *result;
-  js_args *cbargs;
+  js_val *val, *result;
+  js_args cbargs;
   unsigned long i;
   for (i = 0; i < len; i++) {
-    key = JSNUMKEY(i);
-    val = fh_get(instance, key->string.ptr);
-    cbargs = args_new();
-    args_append(cbargs, val);
-    args_append(cbargs, JSNUM(i));
-    args_append(cbargs, instance);
-    result = fh_call(state->ctx, this, callback, cbargs);
-    fh_set(map, key->string.ptr, result);
+    val = fh_get_index(instance, i);
+    args_init(&cbargs);
+    args_append(&cbargs, val);
+    args_append(&cbargs, JSNUM(i));
+    args_append(&cbargs, instance);
+    result = fh_call(state->ctx, this, callback, &cbargs);
+    fh_set_elem(map, i, result);
   }
 
   fh_set_len(map, len);
@@ -668,17 +798,16 @@ arr_proto_some(js_val *instance, js_args *args, eval_state *state)
   js_val *this = ARG(args, 1);
   unsigned long len = instance->object.length;
 
-  js_val *key, *val, *result;
-  js_args *cbargs;
+  js_val *val, *result;
+  js_args cbargs;
   unsigned long i;
   for (i = 0; i < len; i++) {
-    key = JSNUMKEY(i);
-    val = fh_get(instance, key->string.ptr);
-    cbargs = args_new();
-    args_append(cbargs, val);
-    args_append(cbargs, JSNUM(i));
-    args_append(cbargs, instance);
-    result = fh_call(state->ctx, this, callback, cbargs);
+    val = fh_get_index(instance, i);
+    args_init(&cbargs);
+    args_append(&cbargs, val);
+    args_append(&cbargs, JSNUM(i));
+    args_append(&cbargs, instance);
+    result = fh_call(state->ctx, this, callback, &cbargs);
     if (TO_BOOL(result)->boolean.val)
       return JSBOOL(1);
   }
@@ -701,20 +830,19 @@ arr_proto_reduce(js_val *instance, js_args *args, eval_state *state)
     if (len == 0)
       fh_throw(state, fh_new_error(E_RANGE, "Reduce of empty array with no initial value"));
 
-    reduction = fh_get(instance, "0");
+    reduction = fh_get_index(instance, 0);
     i = 1;
   }
 
-  js_val *key, *val;
-  js_args *cbargs;
+  js_val *val;
+  js_args cbargs;
   for (; i < len; i++) {
-    key = JSNUMKEY(i);
-    val = fh_get(instance, key->string.ptr);
-    cbargs = args_new();
-    args_append(cbargs, reduction);
-    args_append(cbargs, val);
-    args_append(cbargs, JSNUM(i));
-    reduction = fh_call(state->ctx, JSUNDEF(), callback, cbargs);
+    val = fh_get_index(instance, i);
+    args_init(&cbargs);
+    args_append(&cbargs, reduction);
+    args_append(&cbargs, val);
+    args_append(&cbargs, JSNUM(i));
+    reduction = fh_call(state->ctx, JSUNDEF(), callback, &cbargs);
   }
 
   return reduction;
@@ -736,7 +864,7 @@ arr_proto_reduce_right(js_val *instance, js_args *args, eval_state *state)
     if (len == 0)
       fh_throw(state, fh_new_error(E_RANGE, "Reduce of empty array with no initial value"));
 
-    reduction = fh_get(instance, JSNUMKEY(i)->string.ptr);
+    reduction = fh_get_index(instance, i);
 
     if (len == 1) return reduction;
     
@@ -746,14 +874,14 @@ arr_proto_reduce_right(js_val *instance, js_args *args, eval_state *state)
     if (len == 0) return reduction;
 
   js_val *val;
-  js_args *cbargs;
+  js_args cbargs;
   do {
-    val = fh_get(instance, JSNUMKEY(i)->string.ptr);
-    cbargs = args_new();
-    args_append(cbargs, reduction);
-    args_append(cbargs, val);
-    args_append(cbargs, JSNUM(i));
-    reduction = fh_call(state->ctx, JSUNDEF(), callback, cbargs);
+    val = fh_get_index(instance, i);
+    args_init(&cbargs);
+    args_append(&cbargs, reduction);
+    args_append(&cbargs, val);
+    args_append(&cbargs, JSNUM(i));
+    reduction = fh_call(state->ctx, JSUNDEF(), callback, &cbargs);
   } while (i--);
 
   return reduction;
@@ -9,9 +9,12 @@ js_val *
 bool_new(js_val *instance, js_args *args, eval_state *state)
 {
   js_val *value = ARG(args, 0);
-  if (state->construct)
-    state->this->object.primitive = TO_BOOL(value);
-  return TO_BOOL(value);
+  js_val *b = TO_BOOL(value);
+  if (state->construct) {
+    GC_BARRIER(state->this, b);
+    state->this->object.primitive = b;
+  }
+  return b;
 }
 
 // Boolean.prototype.toString()
@@ -51,6 +54,7 @@ bootstrap_boolean()
   DEF(prototype, "valueOf", JSNFUNC(bool_proto_value_of, 0));
 
   fh_attach_prototype(prototype, fh->function_proto);
+  fh->boolean_proto = prototype;
 
   return boolean;
 }
@@ -6,6 +6,7 @@
 #include <math.h>
 #include <ctype.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
 #include <time.h>
 
@@ -61,29 +62,124 @@ month_string(int m) {
 // Current Time/Offset
 // ---------------------------------------------------------------------------- 
 
+// Asking libc for the local time of an instant can mean a trip through the tz
+// database, so what it says is kept in spans of seconds with the same DST
+// state and zone name. Offsets are assumed not to change twice within
+// TZ_SPAN_GAP seconds, so a span grows to cover any nearby time that probes
+// the same. The cache is dropped when TZ changes.
+
+#define TZ_SPANS 8
+#define TZ_SPAN_GAP (7 * 24 * 60 * 60)
+
+typedef struct {
+  time_t start;               // inclusive
+  time_t end;                 // inclusive
+  bool dst;
+  char zone[16];
+} tz_span;
+
+static struct {
+  bool ready;
+  char *tz;                   // TZ when the cache was filled (NULL if unset)
+  double offset;              // ms from local standard time to UTC
+  tz_span spans[TZ_SPANS];
+  int num_spans;
+  int next;                   // the span replaced next
+} tz_cache;
+
+static void
+tz_check(void)
+{
+  const char *tz = getenv("TZ");
+
+  if (tz_cache.ready && (tz_cache.tz ? tz && STREQ(tz, tz_cache.tz) : !tz))
+    return;
+
+  free(tz_cache.tz);
+  tz_cache.tz = NULL;
+  if (tz) {
+    size_t len = strlen(tz);
+    tz_cache.tz = malloc(len + 1);
+    memcpy(tz_cache.tz, tz, len + 1);
+  }
+  tzset();
+
+  // The offset of now, read back as standard time.
+  time_t now = time(NULL);
+  struct tm loc_tm, gmt_tm;
+  localtime_r(&now, &loc_tm);
+  gmtime_r(&now, &gmt_tm);
+  time_t gmt_sec = mktime(&loc_tm);
+  time_t loc_sec = mktime(&gmt_tm);
+
+  tz_cache.offset = (loc_sec - gmt_sec) * ms_per_sec;
+  tz_cache.num_spans = 0;
+  tz_cache.next = 0;
+  tz_cache.ready = true;
+}
+
+static const tz_span *
+tz_lookup(double raw_t)
+{
+  time_t t = raw_t / 1000;
+  tz_span probe, *span;
+  struct tm loc_tm;
+  int i;
+
+  tz_check();
+  for (i = 0; i < tz_cache.num_spans; i++) {
+    span = &tz_cache.spans[i];
+    if (span->start <= t && t <= span->end)
+      return span;
+  }
+
+  localtime_r(&t, &loc_tm);
+  probe.start = probe.end = t;
+  probe.dst = loc_tm.tm_isdst > 0;
+  strftime(probe.zone, sizeof probe.zone, "%Z", &loc_tm);
+
+  for (i = 0; i < tz_cache.num_spans; i++) {
+    span = &tz_cache.spans[i];
+    if (span->dst != probe.dst || !STREQ(span->zone, probe.zone))
+      continue;
+    if (t > span->end && t - span->end <= TZ_SPAN_GAP) {
+      span->end = t;
+      return span;
+    }
+    if (t < span->start && span->start - t <= TZ_SPAN_GAP) {
+      span->start = t;
+      return span;
+    }
+  }
+
+  if (tz_cache.num_spans < TZ_SPANS)
+    span = &tz_cache.spans[tz_cache.num_spans++];
+  else {
+    span = &tz_cache.spans[tz_cache.next];
+    tz_cache.next = (tz_cache.next + 1) % TZ_SPANS;
+  }
+  *span = probe;
+  return span;
+}
+
 static double
 dst_offset(double raw_t)
 {
-  time_t t = raw_t / 1000;
-  struct tm *loc_tm = localtime(&t);
-  return loc_tm->tm_isdst ? -ms_per_hr : 0;
+  return tz_lookup(raw_t)->dst ? -ms_per_hr : 0;
 }
 
 static double
 utc_offset()
 {
-  time_t now = time(NULL);
-  struct tm *loc_tm = localtime(&now);
-  time_t gmt_sec = mktime(loc_tm);
-  time_t loc_sec = mktime(gmtime(&now));
-
-  return (loc_sec - gmt_sec) * ms_per_sec;
+  tz_check();
+  return tz_cache.offset;
 }
 
 static double
 utc_time(double t)
 {
-  return t + utc_offset() + dst_offset(t + utc_offset());
+  double offset = utc_offset();
+  return t + offset + dst_offset(t + offset);
 }
 
 double
@@ -103,17 +199,7 @@ local_time(double t)
 static const char *
 tz_string(double t)
 {
-#if defined(_BSD_SOURCE)
-  time_t time = t / 1000;
-  struct tm *loc_tm = localtime(&time);
-  return loc_tm->tm_zone;
-#else
-  static char buf[16];
-  time_t time = t / 1000;
-  strftime(buf, sizeof buf, "%Z", localtime(&time));
-  buf[sizeof buf - 1] = '\0';
-  return buf;
-#endif
+  return tz_lookup(t)->zone;
 }
 
 
@@ -167,8 +253,6 @@ time_from_year(double y)
   return day_from_year(y) * ms_per_day;
 }
 
-static double in_leap_year(double t);
-
 static double
 day_from_month(long m, long y)
 {
@@ -178,14 +262,14 @@ day_from_month(long m, long y)
   else if (m >= 2) day += (m - 1) / 2 - 1;
   else day += m;
 
-  if (m >= 2 && in_leap_year(time_from_year(y))) 
+  if (m >= 2 && days_in_year(y) == 366)
     ++day;
 
   return day;
 }
 
 static double
-year_from_time(double t)
+find_year(double t)
 {
   long lo = floor((t / ms_per_day) / 366) + 1970;
   long hi = floor((t / ms_per_day) / 365) + 1970;
@@ -211,63 +295,68 @@ year_from_time(double t)
   return lo;
 }
 
+// Days before the start of each month, in common and leap years.
+static const int month_start[2][13] = {
+  {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334, 365},
+  {0, 31, 60, 91, 121, 152, 182, 213, 244, 274, 305, 335, 366}
+};
+
+#define CIVIL_DAYS 64   // days kept broken down (a power of two)
+
+/* A day broken down into its year, month and date. The getters and formats
+ * each ask for some of these, and times being worked on tend to share days,
+ * so the last few days seen are kept. */
+typedef struct {
+  bool valid;
+  double day;
+  long year;
+  long month;
+  long date;
+} civil_day;
+
+static const civil_day *
+civil_date(double t)
+{
+  static civil_day days[CIVIL_DAYS], scratch;
+  double d = day(t);
+  civil_day *c = &scratch;
+
+  if (fabs(d) < 1e9) {
+    c = &days[(unsigned long)(long)d & (CIVIL_DAYS - 1)];
+    if (c->valid && c->day == d)
+      return c;
+  }
+
+  long y = find_year(t);
+  const int *starts = month_start[days_in_year(y) == 366];
+  long in_year = d - day_from_year(y), m = 0;
+
+  while (m < 11 && starts[m + 1] <= in_year) m++;
+
+  c->valid = true;
+  c->day = d;
+  c->year = y;
+  c->month = m;
+  c->date = in_year - starts[m] + 1;
+  return c;
+}
+
 static double
-day_within_year(double t)
+year_from_time(double t)
 {
-  return day(t) - day_from_year(year_from_time(t));
+  return civil_date(t)->year;
 }
 
 static double
 date_from_time(double t)
 {
-  long y = year_from_time(t);
-  long d = day(t) - day_from_year(y);
-
-  d -= 31 + 28;
-  if (d < 0)
-    return d < -28 ? d + 31 + 28 + 1 : d + 28 + 1;
-
-  if (in_leap_year(t)) {
-    if (d == 0) return 29;
-    --d;
-  }
-
-  long mdays, mstart;
-  switch (d / 30) {
-    case 0: return d + 1;
-    case 1: mdays = 31; mstart = 31; break;
-    case 2: mdays = 30; mstart = 31+30; break;
-    case 3: mdays = 31; mstart = 31+30+31; break;
-    case 4: mdays = 30; mstart = 31+30+31+30; break;
-    case 5: mdays = 31; mstart = 31+30+31+30+31; break;
-    case 6: mdays = 31; mstart = 31+30+31+30+31+31; break;
-    case 7: mdays = 30; mstart = 31+30+31+30+31+31+30; break;
-    case 8: mdays = 31; mstart = 31+30+31+30+31+31+30+31; break;
-    case 9: mdays = 30; mstart = 31+30+31+30+31+31+30+31+30; break;
-    default: return d - (31+30+31+30+31+31+30+31+30) + 1;
-  }
-  d -= mstart;
-  if (d < 0) d += mdays;
-  return d + 1;
+  return civil_date(t)->date;
 }
 
 static long
 month_from_time(double t)
 {
-  long leap = in_leap_year(t);
-  long day = day_within_year(t);
-  if (0 <= day && day < 31) return 0;
-  if (31 <= day && day < 59 + leap) return 1;
-  if (59 + leap <= day && day < 90 + leap) return 2;
-  if (90 + leap <= day && day < 120 + leap) return 3;
-  if (120 + leap <= day && day < 151 + leap) return 4;
-  if (151 + leap <= day && day < 181 + leap) return 5;
-  if (181 + leap <= day && day < 212 + leap) return 6;
-  if (212 + leap <= day && day < 243 + leap) return 7;
-  if (243 + leap <= day && day < 273 + leap) return 8;
-  if (273 + leap <= day && day < 304 + leap) return 9;
-  if (304 + leap <= day && day < 334 + leap) return 10;
-  return 11;
+  return civil_date(t)->month;
 }
 
 static long
@@ -306,12 +395,6 @@ ms_from_time(double t)
   return res;
 }
 
-static double
-in_leap_year(double t)
-{
-  return days_in_year(year_from_time(t)) == 366;
-}
-
 static double
 make_time(double h, double m, double s, double ms)
 {
@@ -346,9 +429,11 @@ static js_val *
 date_format_loc(double ut, bool incl_date, bool incl_time)
 {
   double t = local_time(ut);
-  js_val *res = JSSTR("");
+  fh_strbuf sb;
   char *fmt;
 
+  fh_strbuf_init(&sb);
+
   if (incl_date) {
     int m = month_from_time(t);
     int y = year_from_time(t);
@@ -362,11 +447,12 @@ date_format_loc(double ut, bool incl_date, bool incl_time)
     char *date = malloc(size);
     snprintf(date, size, fmt, day_string(d), month_string(m), dt, y);
 
-    res->string.ptr = fh_str_concat(res->string.ptr, date);
+    fh_strbuf_append(&sb, date, size - 1);
+    free(date);
   }
 
   if (incl_date && incl_time)
-    res->string.ptr = fh_str_concat(res->string.ptr, " ");
+    fh_strbuf_append(&sb, " ", 1);
 
   if (incl_time) {
     int h = hour_from_time(t);
@@ -385,8 +471,12 @@ date_format_loc(double ut, bool incl_date, bool incl_time)
     char *time = malloc(size);
     snprintf(time, size, fmt, h, m, s, sign, offset_h, offset_m, tz);
 
-    res->string.ptr = fh_str_concat(res->string.ptr, time);
+    fh_strbuf_append(&sb, time, size - 1);
+    free(time);
   }
+
+  js_val *res = JSSTR(sb.buf);
+  free(sb.buf);
   return res;
 }
 
@@ -469,6 +559,16 @@ date_verify_format(char *str, char *fmt)
 // false otherwise. When true, the parsed UTC time in milliseconds is stored in
 // the double.
 
+/* Parse the number between the indices `start` and `end` of `str`. */
+static int
+slice_int(char *str, unsigned start, unsigned end)
+{
+  char *part = fh_str_slice(str, start, end);
+  int n = atoi(part);
+  free(part);
+  return n;
+}
+
 static bool
 date_parse_iso(char *str, double *t)
 {
@@ -479,13 +579,13 @@ date_parse_iso(char *str, double *t)
     return false;
 
   // Pull out the parts
-  int year = atoi(fh_str_slice(str, 0, 4));
-  int month = atoi(fh_str_slice(str, 5, 7)) - 1;
-  int date = atoi(fh_str_slice(str, 8, 10));
-  int hour = atoi(fh_str_slice(str, 11, 13));
-  int min = atoi(fh_str_slice(str, 14, 16));
-  int sec = atoi(fh_str_slice(str, 17, 19));
-  int msec = atoi(fh_str_slice(str, 20, 23));
+  int year = slice_int(str, 0, 4);
+  int month = slice_int(str, 5, 7) - 1;
+  int date = slice_int(str, 8, 10);
+  int hour = slice_int(str, 11, 13);
+  int min = slice_int(str, 14, 16);
+  int sec = slice_int(str, 17, 19);
+  int msec = slice_int(str, 20, 23);
 
   double day = make_day(year, month, date);
   double time = make_time(hour, min, sec, msec);
@@ -512,17 +612,16 @@ date_parse_loc(char *str, double *t)
         date_verify_format(str, fmt_tz4) ||
         date_verify_format(str, fmt_tz5))) return false;
 
-  char *mname = fh_str_slice(str, 4, 7);
-  int date = atoi(fh_str_slice(str, 8, 10));
-  int year = atoi(fh_str_slice(str, 11, 15));
-  int hour = atoi(fh_str_slice(str, 16, 18));
-  int min = atoi(fh_str_slice(str, 19, 21));
-  int sec = atoi(fh_str_slice(str, 22, 24));
+  int date = slice_int(str, 8, 10);
+  int year = slice_int(str, 11, 15);
+  int hour = slice_int(str, 16, 18);
+  int min = slice_int(str, 19, 21);
+  int sec = slice_int(str, 22, 24);
 
   // Get the month as an integer
   int month = 0;
   while (month < 12) {
-    if (STREQ(month_string(month), mname)) break;
+    if (strncmp(month_string(month), str + 4, 3) == 0) break;
     month++;
   };
   // Invalid month
@@ -546,16 +645,15 @@ date_parse_utc(char *str, double *t)
     return false;
 
   // Pull out the parts
-  int date = atoi(fh_str_slice(str, 5, 7));
-  char *mname = fh_str_slice(str, 8, 11);
-  int year = atoi(fh_str_slice(str, 12, 16));
-  int hour = atoi(fh_str_slice(str, 17, 19));
-  int min = atoi(fh_str_slice(str, 20, 22));
-  int sec = atoi(fh_str_slice(str, 23, 25));
+  int date = slice_int(str, 5, 7);
+  int year = slice_int(str, 12, 16);
+  int hour = slice_int(str, 17, 19);
+  int min = slice_int(str, 20, 22);
+  int sec = slice_int(str, 23, 25);
 
   int month = 0;
   while (month < 12) {
-    if (STREQ(month_string(month), mname)) break;
+    if (strncmp(month_string(month), str + 8, 3) == 0) break;
     month++;
   };
   if (month == 12) return false;
@@ -700,6 +798,7 @@ date_new(js_val *instance, js_args *args, eval_state *state)
   }
 
   fh_set_class(state->this, "Date");
+  GC_BARRIER(state->this, utc);
   state->this->object.primitive = utc;
   return state->this;
 }
@@ -734,9 +833,7 @@ date_utc(js_val *instance, js_args *args, eval_state *state)
 js_val *
 date_is_dst(js_val *instance, js_args *args, eval_state *state)
 {
-  time_t now = time(NULL);
-  struct tm *loc_tm = localtime(&now);
-  return JSBOOL(loc_tm->tm_isdst);
+  return JSBOOL(tz_lookup(utc_now())->dst);
 }
 
 
@@ -1023,11 +1120,12 @@ date_proto_set_year(js_val *instance, js_args *args, eval_state *state)
   int y = TO_NUM(ARG(args, 0))->number.val;
   if (y >= 0 && y <= 99)
     y += 1900;
-  js_args *new_args = args_new();
-  args_append(new_args, JSNUM(y));
+  js_args new_args;
+  args_init(&new_args);
+  args_append(&new_args, JSNUM(y));
 
   // Same procedure as setFullYear, but with no additional parameters
-  instance->number.val = utc_time(time_clip(make_date_from_args(new_args, t, 0, 1)));
+  instance->number.val = utc_time(time_clip(make_date_from_args(&new_args, t, 0, 1)));
   return instance;
 }
 
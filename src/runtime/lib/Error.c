@@ -15,7 +15,7 @@ error_new(js_val *instance, js_args *args, eval_state *state)
   if (!IS_UNDEF(msg))
     fh_set(err, "message", TO_STR(msg));
 
-  err->proto = fh_try_get_proto("Error");
+  err->proto = fh->error_proto;
   return err;
 }
 
@@ -94,7 +94,12 @@ error_proto_to_string(js_val *instance, js_args *args, eval_state *state)
 
   if (strlen(name->string.ptr) == 0) return msg;
   if (strlen(msg->string.ptr) == 0) return name;
-  return JSSTR(fh_str_concat(fh_str_concat(name->string.ptr, ": "), msg->string.ptr));
+  char *prefix = fh_str_concat(name->string.ptr, ": ");
+  char *str = fh_str_concat(prefix, msg->string.ptr);
+  js_val *res = JSSTR(str);
+  free(prefix);
+  free(str);
+  return res;
 }
 
 js_val *
@@ -123,6 +128,7 @@ bootstrap_error(js_val *global)
   DEF(prototype, "toString", JSNFUNC(error_proto_to_string, 0));
 
   fh_attach_prototype(prototype, fh->function_proto);
+  fh->error_proto = prototype;
 
 
   // Other Error constructors
@@ -15,7 +15,7 @@ func_new(js_val *instance, js_args *args, eval_state *state)
 
   for (i = 0; arglen > 0 && i < (arglen - 1); i++) {
     if (!arg_lst) {
-      arg_lst = TO_STR(ARG(args, i))->string.ptr;
+      arg_lst = fh_str_concat(TO_STR(ARG(args, i))->string.ptr, "");
     }
     else {
       tmp = arg_lst;
@@ -27,17 +27,27 @@ func_new(js_val *instance, js_args *args, eval_state *state)
     }
   }
 
-  if (arglen <= 1)
-    arg_lst = "";
-
   char *body = arglen > 0 ? TO_STR(ARG(args, i))->string.ptr : "";
   char *fmt = "(function(%s) { %s });";
 
-  int size = snprintf(NULL, 0, fmt, arg_lst, body) + 1;
+  int size = snprintf(NULL, 0, fmt, arg_lst ? arg_lst : "", body) + 1;
   char *func_def = malloc(size);
-  snprintf(func_def, size, fmt, arg_lst, body);
+  snprintf(func_def, size, fmt, arg_lst ? arg_lst : "", body);
+  free(arg_lst);
+
+  // The lexer scans a copy of the source.
+  js_val *func = fh_eval_string(func_def, state->ctx);
+  free(func_def);
+  return func;
+}
 
-  return fh_eval_string(func_def, state->ctx);
+// Function.prototype()
+//
+// Accepts any arguments and returns undefined.
+js_val *
+func_proto(js_val *instance, js_args *args, eval_state *state)
+{
+  return JSUNDEF();
 }
 
 // Function.prototype.apply(thisValue[, argsArray])
@@ -47,13 +57,16 @@ func_proto_apply(js_val *instance, js_args *args, eval_state *state)
   js_val *this = ARG(args, 0);
   js_val *arr = ARG(args, 1);
 
-  js_args *func_args = args_new();
+  js_args func_args;
+  args_init(&func_args);
 
   unsigned long i;
   for (i = 0; i < arr->object.length; i++)
-    args_append(func_args, fh_get(arr, JSNUMKEY(i)->string.ptr));
+    args_append(&func_args, fh_get_index(arr, i));
 
-  return fh_call(state->ctx, this, instance, func_args);
+  js_val *res = fh_call(state->ctx, this, instance, &func_args);
+  args_release(&func_args);
+  return res;
 }
 
 // Function.prototype.apply(thisValue[, arg1[, arg2[, ...]]])
@@ -62,14 +75,13 @@ func_proto_bind(js_val *instance, js_args *args, eval_state *state)
 {
   js_val *this = ARG(args, 0);
 
-  // Shift off the first argument.
-  args->arg = NULL;
-  if (args->next) 
-    args = args->next;
+  // Shift off the first argument, and keep a copy of the rest.
+  js_args rest;
+  args_slice(&rest, args, 1);
 
   js_val *func = JSFUNC(instance->object.node);
   func->object.bound_this = this;
-  func->object.bound_args = args;
+  func->object.bound_args = args_copy(&rest);
   return func;
 }
 
@@ -78,11 +90,10 @@ js_val *
 func_proto_call(js_val *instance, js_args *args, eval_state *state)
 {
   js_val *this = ARG(args, 0);
-  args->arg = NULL;
-  if (args->next)
-    args = args->next;
+  js_args rest;
+  args_slice(&rest, args, 1);
 
-  return fh_call(state->ctx, this, instance, args);
+  return fh_call(state->ctx, this, instance, &rest);
 }
 
 // Function.prototype.isGenerator()
@@ -103,7 +114,7 @@ js_val *
 bootstrap_function()
 {
   js_val *function = JSNFUNC(func_new, 1);
-  js_val *prototype = JSFUNC(NULL);
+  js_val *prototype = JSNFUNC(func_proto, 0);
   function->proto = prototype;
   prototype->proto = fh->object_proto;
 
@@ -9,6 +9,7 @@
 
 js_val * func_new(js_val *, js_args *, eval_state *);
 
+js_val * func_proto(js_val *, js_args *, eval_state *);
 js_val * func_proto_apply(js_val *, js_args *, eval_state *);
 js_val * func_proto_bind(js_val *, js_args *, eval_state *);
 js_val * func_proto_call(js_val *, js_args *, eval_state *);
@@ -0,0 +1,737 @@
+// JSON.c
+// ------
+// JSON.parse and JSON.stringify. The parser builds values in a single pass
+// over the text, and stringify writes into one growable buffer.
+
+#include <math.h>
+#include <string.h>
+
+#include "JSON.h"
+
+#define JSON_MAX_DEPTH 4096     // nesting that parse accepts
+#define JSON_MAX_GAP   10       // characters of indentation per level
+
+
+// ----------------------------------------------------------------------------
+// JSON.parse
+// ----------------------------------------------------------------------------
+
+typedef struct {
+  const char *src;
+  size_t len;
+  size_t pos;
+  unsigned depth;
+  fh_strbuf buf;              // scratch space for strings with escapes
+  eval_state *state;
+} json_parser;
+
+static js_val *parse_value(json_parser *);
+
+static js_val *
+parse_error(json_parser *p)
+{
+  free(p->buf.buf);
+  if (p->pos >= p->len)
+    fh_throw(p->state, fh_new_error(E_SYNTAX, "Unexpected end of JSON input"));
+  fh_throw(p->state, fh_new_error(E_SYNTAX, "Unexpected token %c in JSON at position %lu",
+                                  p->src[p->pos], (unsigned long)p->pos));
+  return NULL;
+}
+
+static void
+skip_space(json_parser *p)
+{
+  while (p->pos < p->len) {
+    char c = p->src[p->pos];
+    if (c != ' ' && c != '\t' && c != '\n' && c != '\r') break;
+    p->pos++;
+  }
+}
+
+static int
+hex_digit(char c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+/* Read the 4 hex digits of a \u escape, at the current position. */
+static long
+parse_hex4(json_parser *p)
+{
+  long code = 0;
+  int i, d;
+  for (i = 0; i < 4; i++) {
+    if (p->pos >= p->len || (d = hex_digit(p->src[p->pos])) < 0) {
+      parse_error(p);
+      return -1;
+    }
+    code = code * 16 + d;
+    p->pos++;
+  }
+  return code;
+}
+
+static void
+append_utf8(fh_strbuf *sb, long code)
+{
+  char out[4];
+  size_t n;
+  if (code < 0x80) {
+    out[0] = code;
+    n = 1;
+  }
+  else if (code < 0x800) {
+    out[0] = 0xC0 | (code >> 6);
+    out[1] = 0x80 | (code & 0x3F);
+    n = 2;
+  }
+  else if (code < 0x10000) {
+    out[0] = 0xE0 | (code >> 12);
+    out[1] = 0x80 | ((code >> 6) & 0x3F);
+    out[2] = 0x80 | (code & 0x3F);
+    n = 3;
+  }
+  else {
+    out[0] = 0xF0 | (code >> 18);
+    out[1] = 0x80 | ((code >> 12) & 0x3F);
+    out[2] = 0x80 | ((code >> 6) & 0x3F);
+    out[3] = 0x80 | (code & 0x3F);
+    n = 4;
+  }
+  fh_strbuf_append(sb, out, n);
+}
+
+/* Decode an escape sequence, after its backslash, into the scratch buffer. */
+static void
+parse_escape(json_parser *p)
+{
+  if (p->pos >= p->len) parse_error(p);
+
+  char c = p->src[p->pos++], out;
+  switch (c) {
+    case '"': case '\\': case '/': out = c; break;
+    case 'b': out = '\b'; break;
+    case 'f': out = '\f'; break;
+    case 'n': out = '\n'; break;
+    case 'r': out = '\r'; break;
+    case 't': out = '\t'; break;
+    case 'u': {
+      long code = parse_hex4(p);
+      // A surrogate pair is one code point; a lone surrogate is kept as is.
+      if (code >= 0xD800 && code < 0xDC00 && p->pos + 6 <= p->len &&
+          p->src[p->pos] == '\\' && p->src[p->pos + 1] == 'u') {
+        size_t pos = p->pos;
+        p->pos += 2;
+        long low = parse_hex4(p);
+        if (low >= 0xDC00 && low < 0xE000)
+          code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+        else
+          p->pos = pos;
+      }
+      append_utf8(&p->buf, code);
+      return;
+    }
+    default:
+      p->pos--;
+      parse_error(p);
+      return;
+  }
+  fh_strbuf_append(&p->buf, &out, 1);
+}
+
+/* Parse a string, at its opening quote. A string without escapes is used
+ * straight from the source; otherwise it is decoded into the scratch buffer.
+ * Sets `*str` and `*len` to the contents. */
+static void
+parse_chars(json_parser *p, const char **str, size_t *len)
+{
+  size_t start = ++p->pos;
+  bool escaped = false;
+
+  p->buf.len = 0;
+  while (true) {
+    size_t span = p->pos;
+    while (p->pos < p->len) {
+      unsigned char c = p->src[p->pos];
+      if (c == '"' || c == '\\' || c < 0x20) break;
+      p->pos++;
+    }
+    if (p->pos >= p->len || (unsigned char)p->src[p->pos] < 0x20)
+      parse_error(p);
+
+    if (p->src[p->pos] == '"') {
+      if (!escaped) {
+        *str = p->src + start;
+        *len = p->pos - start;
+      }
+      else {
+        fh_strbuf_append(&p->buf, p->src + span, p->pos - span);
+        *str = p->buf.buf;
+        *len = p->buf.len;
+      }
+      p->pos++;
+      return;
+    }
+
+    fh_strbuf_append(&p->buf, p->src + span, p->pos - span);
+    p->pos++;
+    parse_escape(p);
+    escaped = true;
+  }
+}
+
+static js_val *
+parse_string(json_parser *p)
+{
+  const char *str;
+  size_t len;
+  parse_chars(p, &str, &len);
+  return JSSTRN(str, len);
+}
+
+/* Property names are interned, as they must be NUL-terminated for fh_set. */
+static char *
+parse_key(json_parser *p)
+{
+  const char *str;
+  size_t len;
+  char tmp[64], *key;
+
+  parse_chars(p, &str, &len);
+  if (str == p->buf.buf)
+    return fh_intern(p->buf.buf);
+  if (len < sizeof(tmp)) {
+    memcpy(tmp, str, len);
+    tmp[len] = '\0';
+    return fh_intern(tmp);
+  }
+  p->buf.len = 0;
+  fh_strbuf_append(&p->buf, str, len);
+  key = fh_intern(p->buf.buf);
+  return key;
+}
+
+/* JSON numbers are stricter than JS ones (no leading zeros, no bare points),
+ * so the syntax is checked here and the digits read by fh_num_parse_prefix. */
+static js_val *
+parse_number(json_parser *p)
+{
+  size_t start = p->pos;
+  const char *s = p->src;
+  double val;
+
+  if (p->pos < p->len && s[p->pos] == '-') p->pos++;
+  if (p->pos >= p->len) return parse_error(p);
+
+  // Integer part: a single 0, or digits that don't start with one.
+  if (s[p->pos] == '0')
+    p->pos++;
+  else if (s[p->pos] >= '1' && s[p->pos] <= '9') {
+    while (p->pos < p->len && s[p->pos] >= '0' && s[p->pos] <= '9') p->pos++;
+  }
+  else return parse_error(p);
+
+  if (p->pos < p->len && s[p->pos] == '.') {
+    p->pos++;
+    if (p->pos >= p->len || s[p->pos] < '0' || s[p->pos] > '9')
+      return parse_error(p);
+    while (p->pos < p->len && s[p->pos] >= '0' && s[p->pos] <= '9') p->pos++;
+  }
+  if (p->pos < p->len && (s[p->pos] == 'e' || s[p->pos] == 'E')) {
+    p->pos++;
+    if (p->pos < p->len && (s[p->pos] == '+' || s[p->pos] == '-')) p->pos++;
+    if (p->pos >= p->len || s[p->pos] < '0' || s[p->pos] > '9')
+      return parse_error(p);
+    while (p->pos < p->len && s[p->pos] >= '0' && s[p->pos] <= '9') p->pos++;
+  }
+
+  fh_num_parse_prefix(s + start, p->pos - start, &val);
+  return JSNUM(val);
+}
+
+static js_val *
+parse_literal(json_parser *p, const char *word, js_val *val)
+{
+  size_t len = strlen(word), i;
+  for (i = 0; i < len; i++, p->pos++) {
+    if (p->pos >= p->len || p->src[p->pos] != word[i])
+      return parse_error(p);
+  }
+  return val;
+}
+
+static void
+enter(json_parser *p)
+{
+  if (++p->depth > JSON_MAX_DEPTH) {
+    free(p->buf.buf);
+    fh_throw(p->state, fh_new_error(E_RANGE, "JSON is nested too deeply"));
+  }
+  p->pos++;
+  skip_space(p);
+}
+
+static js_val *
+parse_array(json_parser *p)
+{
+  js_val *arr = JSARR();
+  unsigned long i = 0;
+
+  enter(p);
+  if (p->pos < p->len && p->src[p->pos] == ']')
+    p->pos++;
+  else {
+    while (true) {
+      fh_set_elem(arr, i++, parse_value(p));
+      skip_space(p);
+      if (p->pos >= p->len) return parse_error(p);
+      if (p->src[p->pos] == ']') { p->pos++; break; }
+      if (p->src[p->pos] != ',') return parse_error(p);
+      p->pos++;
+    }
+  }
+  p->depth--;
+  fh_set_len(arr, i);
+  return arr;
+}
+
+static js_val *
+parse_object(json_parser *p)
+{
+  js_val *obj = JSOBJ();
+
+  enter(p);
+  if (p->pos < p->len && p->src[p->pos] == '}')
+    p->pos++;
+  else {
+    while (true) {
+      skip_space(p);
+      if (p->pos >= p->len || p->src[p->pos] != '"') return parse_error(p);
+      char *key = parse_key(p);
+      skip_space(p);
+      if (p->pos >= p->len || p->src[p->pos] != ':') return parse_error(p);
+      p->pos++;
+      fh_set(obj, key, parse_value(p));
+      skip_space(p);
+      if (p->pos >= p->len) return parse_error(p);
+      if (p->src[p->pos] == '}') { p->pos++; break; }
+      if (p->src[p->pos] != ',') return parse_error(p);
+      p->pos++;
+    }
+  }
+  p->depth--;
+  return obj;
+}
+
+static js_val *
+parse_value(json_parser *p)
+{
+  skip_space(p);
+  if (p->pos >= p->len) return parse_error(p);
+
+  switch (p->src[p->pos]) {
+    case '{': return parse_object(p);
+    case '[': return parse_array(p);
+    case '"': return parse_string(p);
+    case 't': return parse_literal(p, "true", JSBOOL(true));
+    case 'f': return parse_literal(p, "false", JSBOOL(false));
+    case 'n': return parse_literal(p, "null", JSNULL());
+    default:  return parse_number(p);
+  }
+}
+
+/* Pass each value to the reviver, innermost first, replacing it with the
+ * result (or deleting it for undefined). */
+static js_val *
+revive(js_val *holder, char *key, js_val *reviver, eval_state *state)
+{
+  js_val *val = fh_get(holder, key), *res;
+  js_prop *prop;
+  js_args args;
+
+  if (IS_ARR(val)) {
+    unsigned long i, len = val->object.length;
+    char index[24];
+    for (i = 0; i < len; i++) {
+      snprintf(index, sizeof(index), "%lu", i);
+      res = revive(val, index, reviver, state);
+      if (IS_UNDEF(res)) fh_del_elem(val, i);
+      else fh_set_elem(val, i, res);
+    }
+  }
+  else if (IS_OBJ(val)) {
+    OBJ_ITER(val, prop) {
+      if (!prop->enumerable) continue;
+      res = revive(val, prop->name, reviver, state);
+      if (IS_UNDEF(res)) fh_del_prop(val, prop->name);
+      else fh_set(val, prop->name, res);
+    }
+  }
+
+  args_init(&args);
+  args_append(&args, JSSTR(key));
+  args_append(&args, val);
+  return fh_call(state->ctx, holder, reviver, &args);
+}
+
+// JSON.parse(text[, reviver])
+js_val *
+json_parse(js_val *instance, js_args *args, eval_state *state)
+{
+  js_val *text = TO_STR(ARG(args, 0));
+  js_val *reviver = ARG(args, 1);
+  json_parser p;
+
+  fh_str_flatten(text);
+  p.src = text->string.ptr;
+  p.len = text->string.length;
+  p.pos = 0;
+  p.depth = 0;
+  p.state = state;
+  fh_strbuf_init(&p.buf);
+
+  js_val *result = parse_value(&p);
+  skip_space(&p);
+  if (p.pos < p.len) parse_error(&p);
+  free(p.buf.buf);
+
+  if (!fh_is_callable(reviver))
+    return result;
+
+  js_val *root = JSOBJ();
+  fh_set(root, "", result);
+  return revive(root, "", reviver, state);
+}
+
+
+// ----------------------------------------------------------------------------
+// JSON.stringify
+// ----------------------------------------------------------------------------
+
+typedef struct {
+  fh_strbuf out;
+  js_val *replacer;           // a replacer function, or NULL
+  js_val *keys;               // the names given in a replacer array, or NULL
+  char gap[JSON_MAX_GAP + 1];
+  size_t gap_len;
+  js_val **stack;             // the objects being written, to catch cycles
+  unsigned depth;
+  unsigned cap;
+  eval_state *state;
+} json_writer;
+
+static bool write_value(json_writer *, js_val *, char *, unsigned long, js_val *);
+
+// Bytes that are written escaped: quotes, backslashes and control characters.
+static const char escapes[256] = {
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+  0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\'
+};
+
+/* Whether a value is a Number, String or Boolean object. */
+static bool
+is_wrapper(js_val *val)
+{
+  return IS_OBJ(val) && val->object.primitive && !IS_DATE(val);
+}
+
+static void
+write_bytes(json_writer *w, const char *str, size_t len)
+{
+  fh_strbuf_append(&w->out, str, len);
+}
+
+static void
+write_quoted(json_writer *w, const char *str, size_t len)
+{
+  size_t i = 0, span;
+  char esc[7];
+
+  write_bytes(w, "\"", 1);
+  while (i < len) {
+    for (span = i; i < len && !escapes[(unsigned char)str[i]]; i++);
+    write_bytes(w, str + span, i - span);
+    if (i == len) break;
+
+    char kind = escapes[(unsigned char)str[i]];
+    if (kind == 'u')
+      snprintf(esc, sizeof(esc), "\\u%04x", (unsigned char)str[i]);
+    else {
+      esc[0] = '\\';
+      esc[1] = kind;
+      esc[2] = '\0';
+    }
+    write_bytes(w, esc, strlen(esc));
+    i++;
+  }
+  write_bytes(w, "\"", 1);
+}
+
+static void
+write_number(json_writer *w, js_val *num)
+{
+  if (num->number.is_nan || num->number.is_inf) {
+    write_bytes(w, "null", 4);
+    return;
+  }
+  char buf[FH_NUM_BUF];
+  write_bytes(w, buf, fh_num_format(num->number.val, buf));
+}
+
+static void
+write_newline(json_writer *w)
+{
+  unsigned i;
+  if (!w->gap_len) return;
+  write_bytes(w, "\n", 1);
+  for (i = 0; i < w->depth; i++)
+    write_bytes(w, w->gap, w->gap_len);
+}
+
+static void
+writer_release(json_writer *w)
+{
+  free(w->out.buf);
+  free(w->stack);
+}
+
+static void
+push_object(json_writer *w, js_val *obj)
+{
+  unsigned i;
+  for (i = 0; i < w->depth; i++) {
+    if (w->stack[i] == obj) {
+      writer_release(w);
+      fh_throw(w->state, fh_new_error(E_TYPE, "Converting circular structure to JSON"));
+    }
+  }
+  if (w->depth == w->cap) {
+    w->cap = w->cap ? w->cap * 2 : 16;
+    w->stack = realloc(w->stack, w->cap * sizeof(js_val *));
+  }
+  w->stack[w->depth++] = obj;
+}
+
+/* The name of a property as a string, for toJSON and the replacer. */
+static js_val *
+key_string(char *key, unsigned long index)
+{
+  char buf[24];
+  if (key) return JSSTR(key);
+  snprintf(buf, sizeof(buf), "%lu", index);
+  return JSSTR(buf);
+}
+
+static void
+write_array(json_writer *w, js_val *arr)
+{
+  unsigned long i, len = arr->object.length;
+
+  push_object(w, arr);
+  write_bytes(w, "[", 1);
+  for (i = 0; i < len; i++) {
+    if (i > 0) write_bytes(w, ",", 1);
+    write_newline(w);
+    js_val *elem = fh_get_elem(arr, i);
+    if (!write_value(w, arr, NULL, i, elem ? elem : JSUNDEF()))
+      write_bytes(w, "null", 4);
+  }
+  w->depth--;
+  if (len > 0) write_newline(w);
+  write_bytes(w, "]", 1);
+}
+
+/* Write a member, unless its value is skipped (undefined or a function), in
+ * which case what was written for the member is taken back. */
+static bool
+write_member(json_writer *w, js_val *obj, char *key, js_val *val, bool first)
+{
+  size_t mark = w->out.len;
+
+  if (!first) write_bytes(w, ",", 1);
+  write_newline(w);
+  write_quoted(w, key, strlen(key));
+  write_bytes(w, w->gap_len ? ": " : ":", w->gap_len ? 2 : 1);
+  if (write_value(w, obj, key, 0, val))
+    return true;
+
+  w->out.len = mark;
+  w->out.buf[mark] = '\0';
+  return false;
+}
+
+static void
+write_object(json_writer *w, js_val *obj)
+{
+  bool first = true;
+  js_prop *prop;
+
+  push_object(w, obj);
+  write_bytes(w, "{", 1);
+  if (w->keys) {
+    unsigned long i, len = w->keys->object.length;
+    for (i = 0; i < len; i++) {
+      char *key = fh_get_elem(w->keys, i)->string.ptr;
+      if (write_member(w, obj, key, fh_get_proto(obj, key), first))
+        first = false;
+    }
+  }
+  else {
+    OBJ_ITER(obj, prop) {
+      if (!prop->enumerable || !prop->ptr) continue;
+      if (write_member(w, obj, prop->name, prop->ptr, first))
+        first = false;
+    }
+  }
+  w->depth--;
+  if (!first) write_newline(w);
+  write_bytes(w, "}", 1);
+}
+
+/* Write a value, after toJSON and the replacer have had their say. Returns
+ * false, having written nothing, for values that aren't represented. */
+static bool
+write_value(json_writer *w, js_val *holder, char *key, unsigned long index, js_val *val)
+{
+  js_args args;
+
+  if (IS_OBJ(val)) {
+    js_val *to_json = fh_get_proto(val, "toJSON");
+    if (fh_is_callable(to_json)) {
+      args_init(&args);
+      args_append(&args, key_string(key, index));
+      val = fh_call(w->state->ctx, val, to_json, &args);
+    }
+  }
+  if (w->replacer) {
+    args_init(&args);
+    args_append(&args, key_string(key, index));
+    args_append(&args, val);
+    val = fh_call(w->state->ctx, holder, w->replacer, &args);
+  }
+
+  // Number, String and Boolean objects are written as their values.
+  if (is_wrapper(val)) {
+    js_type type = val->object.primitive->type;
+    val = type == T_NUMBER ? TO_NUM(val) : 
+          type == T_STRING ? TO_STR(val) : val->object.primitive;
+  }
+
+  switch (val->type) {
+    case T_NULL:
+      write_bytes(w, "null", 4);
+      return true;
+    case T_BOOLEAN:
+      if (val->boolean.val) write_bytes(w, "true", 4);
+      else write_bytes(w, "false", 5);
+      return true;
+    case T_NUMBER:
+      write_number(w, val);
+      return true;
+    case T_STRING:
+      fh_str_flatten(val);
+      write_quoted(w, val->string.ptr, val->string.length);
+      return true;
+    case T_OBJECT:
+      if (fh_is_callable(val)) return false;
+      if (IS_ARR(val)) write_array(w, val);
+      else write_object(w, val);
+      return true;
+    default:
+      return false;
+  }
+}
+
+/* The names of an array replacer, as strings and without repeats. */
+static js_val *
+replacer_keys(js_val *list)
+{
+  js_val *keys = JSARR(), *item;
+  unsigned long i, j, n = 0, len = list->object.length;
+
+  for (i = 0; i < len; i++) {
+    item = fh_get_index(list, i);
+    if (IS_NUM(item) || (is_wrapper(item) && !IS_BOOL(item->object.primitive)))
+      item = TO_STR(item);
+    else if (!IS_STR(item))
+      continue;
+
+    fh_str_flatten(item);
+    for (j = 0; j < n; j++)
+      if (STREQ(fh_get_elem(keys, j)->string.ptr, item->string.ptr)) break;
+    if (j == n) fh_set_elem(keys, n++, item);
+  }
+  fh_set_len(keys, n);
+  return keys;
+}
+
+/* The indentation per level, from a count of spaces or a string. */
+static void
+set_gap(json_writer *w, js_val *space)
+{
+  if (is_wrapper(space) && IS_NUM(space->object.primitive))
+    space = TO_NUM(space);
+  else if (is_wrapper(space) && IS_STR(space->object.primitive))
+    space = TO_STR(space);
+
+  w->gap_len = 0;
+  if (IS_NUM(space)) {
+    double n = TO_INT(space)->number.val;
+    w->gap_len = n < 1 ? 0 : n > JSON_MAX_GAP ? JSON_MAX_GAP : n;
+    memset(w->gap, ' ', w->gap_len);
+  }
+  else if (IS_STR(space)) {
+    fh_str_flatten(space);
+    w->gap_len = MIN(space->string.length, JSON_MAX_GAP);
+    memcpy(w->gap, space->string.ptr, w->gap_len);
+  }
+  w->gap[w->gap_len] = '\0';
+}
+
+// JSON.stringify(value[, replacer[, space]])
+js_val *
+json_stringify(js_val *instance, js_args *args, eval_state *state)
+{
+  js_val *value = ARG(args, 0);
+  js_val *replacer = ARG(args, 1);
+  json_writer w;
+
+  w.replacer = fh_is_callable(replacer) ? replacer : NULL;
+  w.keys = !w.replacer && IS_ARR(replacer) ? replacer_keys(replacer) : NULL;
+  set_gap(&w, ARG(args, 2));
+  w.stack = NULL;
+  w.depth = 0;
+  w.cap = 0;
+  w.state = state;
+  fh_strbuf_init(&w.out);
+
+  // The value is written as the "" property of a wrapper object.
+  js_val *holder = JSOBJ();
+  fh_set(holder, "", value);
+
+  js_val *result = JSUNDEF();
+  if (write_value(&w, holder, "", 0, value))
+    result = JSSTRN(w.out.buf, w.out.len);
+  writer_release(&w);
+  return result;
+}
+
+js_val *
+bootstrap_json()
+{
+  js_val *json = JSOBJ();
+
+  fh_set_class(json, "JSON");
+
+  DEF(json, "parse", JSNFUNC(json_parse, 2));
+  DEF(json, "stringify", JSNFUNC(json_stringify, 3));
+
+  return json;
+}
@@ -0,0 +1,14 @@
+// JSON.h
+// ------
+
+#ifndef JS_JSON_H
+#define JS_JSON_H
+
+#include "../runtime.h"
+
+js_val * json_parse(js_val *, js_args *, eval_state *);
+js_val * json_stringify(js_val *, js_args *, eval_state *);
+
+js_val * bootstrap_json(void);
+
+#endif
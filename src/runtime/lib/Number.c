@@ -13,9 +13,12 @@ js_val *
 number_new(js_val *instance, js_args *args, eval_state *state)
 {
   js_val *value = ARG(args, 0);
-  if (state->construct)
-    state->this->object.primitive = TO_NUM(value);
-  return TO_NUM(value);
+  js_val *num = TO_NUM(value);
+  if (state->construct) {
+    GC_BARRIER(state->this, num);
+    state->this->object.primitive = num;
+  }
+  return num;
 }
 
 // Number.prototype.toExponential([fractionalDigits])
@@ -140,6 +143,7 @@ bootstrap_number()
   DEF(prototype, "valueOf", JSNFUNC(number_proto_value_of, 0));
 
   fh_attach_prototype(prototype, fh->function_proto);
+  fh->number_proto = prototype;
 
   return number;
 }
@@ -90,7 +90,7 @@ js_val *
 obj_get_own_property_descriptor(js_val *instance, js_args *args, eval_state *state)
 {
   js_val *obj = obj_or_throw(ARG(args, 0), state, "getOwnPropertyDescriptor");
-  js_val *prop_name = ARG(args, 1);
+  js_val *prop_name = TO_STR(ARG(args, 1));
   js_prop *prop = fh_get_prop(obj, prop_name->string.ptr);
   js_val *descriptor = JSOBJ();
 
@@ -108,15 +108,7 @@ obj_keys(js_val *instance, js_args *args, eval_state *state)
 {
   js_val *obj = obj_or_throw(ARG(args, 0), state, "keys");
   js_val *keys = JSARR();
-
-  js_prop *p;
-  int i = 0;
-  OBJ_ITER(obj, p) {
-    if (p->enumerable)
-      fh_set(keys, JSNUMKEY(i++)->string.ptr, JSSTR(p->name));
-  }
-
-  fh_set_len(keys, i);
+  fh_append_keys(keys, obj, false);
   return keys;
 }
 
@@ -126,14 +118,7 @@ obj_get_own_property_names(js_val *instance, js_args *args, eval_state *state)
 {
   js_val *obj = obj_or_throw(ARG(args, 0), state, "getOwnPropertyNames");
   js_val *names = JSARR();
-
-  js_prop *p;
-  int i = 0;
-  OBJ_ITER(obj, p) {
-    fh_set(names, JSNUMKEY(i++)->string.ptr, JSSTR(p->name));
-  }
-
-  fh_set_len(names, i);
+  fh_append_keys(names, obj, true);
   return names;
 }
 
@@ -168,6 +153,8 @@ obj_seal(js_val *instance, js_args *args, eval_state *state)
 {
   js_val *obj = obj_or_throw(ARG(args, 0), state, "seal");
   js_prop *prop;
+  // Elements can't carry their own flags; move them into the map.
+  fh_make_sparse(obj);
   OBJ_ITER(obj, prop) {
     prop->configurable = false;
   }
@@ -193,6 +180,8 @@ obj_freeze(js_val *instance, js_args *args, eval_state *state)
 {
   js_val *obj = obj_or_throw(ARG(args, 0), state, "freeze");
   js_prop *prop;
+  // Elements can't carry their own flags; move them into the map.
+  fh_make_sparse(obj);
   OBJ_ITER(obj, prop) {
     prop->configurable = false;
     prop->writable = false;
@@ -218,7 +207,10 @@ obj_is_frozen(js_val *instance, js_args *args, eval_state *state)
 js_val *
 obj_proto_has_own_property(js_val *instance, js_args *args, eval_state *state)
 {
-  js_val *prop_name = ARG(args, 0);
+  js_val *prop_name = TO_STR(ARG(args, 0));
+  unsigned long i;
+  if (instance->dense && fh_is_index(prop_name->string.ptr, &i))
+    return JSBOOL(fh_get_elem(instance, i) != NULL);
   return JSBOOL(fh_get_prop(instance, prop_name->string.ptr) != NULL);
 }
 
@@ -240,7 +232,10 @@ obj_proto_is_prototype_of(js_val *instance, js_args *args, eval_state *state)
 js_val *
 obj_proto_property_is_enumerable(js_val *instance, js_args *args, eval_state *state)
 {
-  js_val *prop_name = ARG(args, 0);
+  js_val *prop_name = TO_STR(ARG(args, 0));
+  unsigned long i;
+  if (instance->dense && fh_is_index(prop_name->string.ptr, &i))
+    return JSBOOL(fh_get_elem(instance, i) != NULL);
   js_prop *prop = fh_get_prop(instance, prop_name->string.ptr);
   return JSBOOL(prop != NULL && prop->enumerable);
 }
@@ -257,7 +252,12 @@ js_val *
 obj_proto_to_string(js_val *instance, js_args *args, eval_state *state)
 {
   char *class = TO_OBJ(state->this)->object.class;
-  return JSSTR(fh_str_concat(fh_str_concat("[object ", class), "]"));
+  char *prefix = fh_str_concat("[object ", class);
+  char *str = fh_str_concat(prefix, "]");
+  js_val *res = JSSTR(str);
+  free(prefix);
+  free(str);
+  return res;
 }
 
 // Object.prototype.valueOf()
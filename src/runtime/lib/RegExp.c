@@ -35,7 +35,7 @@ regexp_new(js_val *instance, js_args *args, eval_state *state)
     }
   }
 
-  regexp->proto = fh_try_get_proto("RegExp");
+  regexp->proto = fh->regexp_proto;
   return regexp;
 }
 
@@ -55,27 +55,21 @@ regexp_proto_exec(js_val *instance, js_args *args, eval_state *state)
   bool global   = fh_get_proto(instance, "global")->boolean.val;
   bool caseless = fh_get_proto(instance, "ignoreCase")->boolean.val;
 
-  bool matched = false;
   int *matches = NULL;
 
-  int count;
+  int count = 0;
   int length = strlen(str->string.ptr);
   int i = fh_to_int32(last_ind)->number.val;
 
   if (!global) 
     i = 0;
 
-  while (!matched) {
-    if (i < 0 || i > length) {
-      fh_set(instance, "lastIndex", JSNUM(0));
-      free(matches);
-      return JSNULL();
-    }
+  // A match is searched for from the offset on, so one search will do.
+  if (i >= 0 && i <= length)
     matches = fh_regexp(str->string.ptr, pattern->string.ptr, &count, i, caseless);
-    if (count == 0) 
-      i++;
-    else
-      matched = true;
+  if (count == 0) {
+    fh_set(instance, "lastIndex", JSNUM(0));
+    return JSNULL();
   }
 
   char *substr = fh_str_slice(str->string.ptr, matches[0], matches[1]);
@@ -89,27 +83,38 @@ regexp_proto_exec(js_val *instance, js_args *args, eval_state *state)
   fh_set(res, "input", str);
 
   fh_set(res, "0", JSSTR(substr));
+  free(substr);
 
   for (i = 1; i <= count; i++) {
     substr = fh_str_slice(str->string.ptr, matches[2*i], matches[2*i+1]);
-    fh_set(res, JSNUMKEY(i)->string.ptr, JSSTR(substr ? substr : ""));
+    fh_set_elem(res, i, JSSTR(substr ? substr : ""));
+    free(substr);
   }
 
-  free(matches);
   fh_set_len(res, count);
 
   return res;
 }
 
 // RegExp.prototype.test([str])
+//
+// Like exec, a global RegExp searches from, and advances, its lastIndex.
 js_val *
 regexp_proto_test(js_val *instance, js_args *args, eval_state *state)
 {
   char *str = TO_STR(ARG(args, 0))->string.ptr;
   char *pattern = TO_STR(fh_get(instance, "source"))->string.ptr;
+  bool global   = fh_get_proto(instance, "global")->boolean.val;
   bool caseless = fh_get_proto(instance, "ignoreCase")->boolean.val;
-  int count;
-  fh_regexp(str, pattern, &count, 0, caseless);
+  int count = 0, *matches = NULL, i = 0;
+
+  if (global)
+    i = fh_to_int32(fh_get_proto(instance, "lastIndex"))->number.val;
+
+  if (i >= 0 && i <= (int)strlen(str))
+    matches = fh_regexp(str, pattern, &count, i, caseless);
+  if (global)
+    fh_set(instance, "lastIndex", JSNUM(count > 0 ? matches[1] : 0));
   return JSBOOL(count > 0);
 }
 
@@ -172,6 +177,7 @@ bootstrap_regexp()
   DEF(prototype, "toString", JSNFUNC(regexp_proto_to_string, 0));
 
   fh_attach_prototype(prototype, fh->function_proto);
+  fh->regexp_proto = prototype;
 
   return regexp;
 }
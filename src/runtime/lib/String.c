@@ -2,13 +2,35 @@
 // ----------
 // String properties, methods, and prototype
 
-#include <ctype.h>
 #include <math.h>
 
 #include "RegExp.h"
 #include "String.h"
 
 
+// ---------------------------------------------------------------------------- 
+// String Helpers
+// ---------------------------------------------------------------------------- 
+
+// An integer argument clamped to [0, len].
+static unsigned long
+clamp_arg(js_val *arg, unsigned long len)
+{
+  double d = TO_INT(arg)->number.val;
+  return d <= 0 ? 0 : d >= len ? len : d;
+}
+
+// An integer argument counted from the end when negative, clamped to
+// [0, len].
+static unsigned long
+relative_arg(js_val *arg, unsigned long len)
+{
+  double d = TO_INT(arg)->number.val;
+  if (d < 0) d += len;
+  return d <= 0 ? 0 : d >= len ? len : d;
+}
+
+
 // ---------------------------------------------------------------------------- 
 // String Constructor
 // ---------------------------------------------------------------------------- 
@@ -17,9 +39,12 @@ js_val *
 str_new(js_val *instance, js_args *args, eval_state *state)
 {
   js_val *value = ARGLEN(args) > 0 ? ARG(args, 0) : JSSTR("");
-  if (state->construct)
-    state->this->object.primitive = TO_STR(value);
-  return TO_STR(value);
+  js_val *str = TO_STR(value);
+  if (state->construct) {
+    GC_BARRIER(state->this, str);
+    state->this->object.primitive = str;
+  }
+  return str;
 }
 
 
@@ -44,14 +69,12 @@ str_from_char_code(js_val *instance, js_args *args, eval_state *state)
 js_val *
 str_proto_char_at(js_val *instance, js_args *args, eval_state *state)
 {
-  int index = TO_NUM(ARG(args, 0))->number.val;
+  double index = TO_INT(ARG(args, 0))->number.val;
   int len = instance->string.length;
 
   if (index < 0 || index >= len)
     return JSSTR("");
-  char *str = malloc(2);
-  sprintf(str, "%c", instance->string.ptr[index]);
-  return JSSTR(str);
+  return JSSTRN(instance->string.ptr + (long)index, 1);
 }
 
 // String.prototype.charCodeAt(index)
@@ -66,20 +89,19 @@ str_proto_char_code_at(js_val *instance, js_args *args, eval_state *state)
 js_val *
 str_proto_concat(js_val *instance, js_args *args, eval_state *state)
 {
-  js_val *new = JSSTR(instance->string.ptr);
+  fh_strbuf sb;
+  fh_strbuf_init(&sb);
+  fh_strbuf_append(&sb, instance->string.ptr, instance->string.length);
 
   js_val *arg;
-  char *tmp;
   unsigned i;
   for (i = 0; i < ARGLEN(args); i++) {
     arg = TO_STR(ARG(args, i));
-    tmp = new->string.ptr;
-    new->string.ptr = fh_str_concat(new->string.ptr, arg->string.ptr);
-    // Free the old string (GC can't reach it anymore).
-    free(tmp);
+    fh_strbuf_append(&sb, arg->string.ptr, arg->string.length);
   }
 
-  new->string.length = strlen(new->string.ptr);
+  js_val *new = JSSTRN(sb.buf, sb.len);
+  free(sb.buf);
   return new;
 }
 
@@ -87,74 +109,27 @@ str_proto_concat(js_val *instance, js_args *args, eval_state *state)
 js_val *
 str_proto_index_of(js_val *instance, js_args *args, eval_state *state)
 {
-  js_val *search_str = TO_STR(ARG(args, 0));
-
-  char *haystack = instance->string.ptr;
-  char *needle = search_str->string.ptr;
-  js_val *from = ARG(args, 1);
-
-  long i = TO_INT(from)->number.val;
-  long match = 0;
-
-  long needle_len = strlen(needle);
-  long haystack_len = strlen(haystack);
-
-  // Searching for an empty string returns the fromIndex when less than
-  // the instance string length, and the instance string length otherwise.
-  if (needle_len == 0)
-    return JSNUM(i <= haystack_len ? i : haystack_len);
+  js_val *search = TO_STR(ARG(args, 0));
+  unsigned long len = instance->string.length;
+  unsigned long from = clamp_arg(ARG(args, 1), len);
 
-  if (needle_len > haystack_len || i > haystack_len)
-    return JSNUM(-1);
-
-  for (; i < haystack_len; i++) {
-    if (haystack[i] == needle[match])
-      match++;
-    else
-      match = haystack[i] == needle[0];
-    if (match == needle_len)
-      return JSNUM(i - needle_len + 1);
-  }
-
-  return JSNUM(-1);
+  // Searching for an empty string finds it at the (clamped) fromIndex.
+  return JSNUM(fh_str_find(instance->string.ptr, len, 
+                           search->string.ptr, search->string.length, from));
 }
 
 // String.prototype.lastIndexOf(searchValue[, fromIndex])
 js_val *
 str_proto_last_index_of(js_val *instance, js_args *args, eval_state *state)
 {
-  js_val *search_str = TO_STR(ARG(args, 0));
-  js_val *from = ARG(args, 1);
-
-  char *haystack = instance->string.ptr;
-  char *needle = search_str->string.ptr;
-
-  double max = IS_NUM(from) ? from->number.val : strlen(haystack) - 1;
-  long match = strlen(needle) - 1;
-  long i = strlen(haystack) - 1;
-
-  long needle_len = strlen(needle);
-  long haystack_len = strlen(haystack);
-
-  if (max < 0) max = 0;
-  if (max > haystack_len) max = haystack_len - 1;
-
-  if (needle_len == 0)
-    return JSNUM(max <= haystack_len ? max : haystack_len);
-
-  if (needle_len > haystack_len)
-    return JSNUM(-1);
-
-  for (; i >= 0; i--) {
-    if (haystack[i] == needle[match])
-      match--;
-    else
-      match = needle_len - (haystack[i] == needle[0] ? 2 : 1);
-    if (match < 0 && i <= max)
-      return JSNUM(i);
-  }
-
-  return JSNUM(-1);
+  js_val *search = TO_STR(ARG(args, 0));
+  js_val *from = TO_NUM(ARG(args, 1));
+  unsigned long len = instance->string.length;
+
+  // A missing (or NaN) fromIndex searches the whole string.
+  unsigned long max = from->number.is_nan ? len : clamp_arg(from, len);
+  return JSNUM(fh_str_rfind(instance->string.ptr, len,
+                            search->string.ptr, search->string.length, max));
 }
 
 // String.prototype.localeCompare(compareString)
@@ -173,13 +148,13 @@ str_proto_match(js_val *instance, js_args *args, eval_state *state)
   if (!IS_REGEXP(regexp))
     regexp = fh_new_regexp("");
 
-  js_args *exec_args;
+  js_args exec_args;
 
   bool global = fh_get_proto(regexp, "global")->boolean.val;
   if (!global) {
-    exec_args = args_new();
-    args_append(exec_args, instance);
-    return regexp_proto_exec(regexp, exec_args, state);
+    args_init(&exec_args);
+    args_append(&exec_args, instance);
+    return regexp_proto_exec(regexp, &exec_args, state);
   }
 
   fh_set(regexp, "lastIndex", JSNUM(0));
@@ -190,9 +165,9 @@ str_proto_match(js_val *instance, js_args *args, eval_state *state)
   js_val *result, *match_str;
 
   while (last_match) {
-    exec_args = args_new();
-    args_append(exec_args, instance);
-    result = regexp_proto_exec(regexp, exec_args, state);
+    args_init(&exec_args);
+    args_append(&exec_args, instance);
+    result = regexp_proto_exec(regexp, &exec_args, state);
     if (IS_NULL(result)) {
       last_match = false;
       break;
@@ -206,7 +181,7 @@ str_proto_match(js_val *instance, js_args *args, eval_state *state)
       prev_last_ind = this_ind;
     }
     match_str = fh_get(result, "0");
-    fh_set(arr, JSNUMKEY(n)->string.ptr, match_str);
+    fh_set_elem(arr, n, match_str);
     n++;
   }
 
@@ -218,59 +193,116 @@ str_proto_match(js_val *instance, js_args *args, eval_state *state)
 
 /* Cut out the string between start and end, replacing it with the new string */
 static char *
-splice(char *str, char *rep, int start, int end)
+splice(char *str, unsigned long len, char *rep, int start, int end)
 {
-  char *front, *back, *tmp, *new;
-  front = fh_str_slice(str, 0, start);
-  back = fh_str_slice(str, end, strlen(str));
-  tmp = fh_str_concat(front, rep);
-  new = fh_str_concat(tmp, back);
-  free(front);
-  free(back);
-  free(tmp);
-  return new;
+  fh_strbuf sb;
+  fh_strbuf_init(&sb);
+  fh_strbuf_append(&sb, str, start);
+  fh_strbuf_append(&sb, rep, strlen(rep));
+  fh_strbuf_append(&sb, str + end, len - end);
+  return sb.buf;
+}
+
+/* Call a replacement function with the match at `matches` in `str`, its
+ * groups, its offset in `self` and `self`. The arguments are all made before
+ * the call, which may run regular expressions of its own and so reuse the
+ * match vector. */
+static js_val *
+call_replacer(js_val *func, js_val *self, char *str, int *matches, int count,
+    long offset, eval_state *state)
+{
+  js_args cbargs;
+  int g;
+
+  args_init(&cbargs);
+  args_append(&cbargs, JSSTRN(str + matches[0], matches[1] - matches[0]));
+  for (g = 1; g < count; g++) {
+    int start = matches[2*g], end = matches[2*g+1];
+    args_append(&cbargs,
+        start < 0 ? JSUNDEF() : JSSTRN(str + start, end - start));
+  }
+  args_append(&cbargs, JSNUM(offset));
+  args_append(&cbargs, self);
+
+  js_val *result = fh_call(state->ctx, JSUNDEF(), func, &cbargs);
+  args_release(&cbargs);
+  return fh_str_flatten(TO_STR(result));
 }
 
 // String.prototype.replace(regexp|substr, newSubStr|function)
 js_val *
 str_proto_replace(js_val *instance, js_args *args, eval_state *state)
 {
-  // TODO: replace function, replacement substitutions
-  char *str = TO_STR(instance)->string.ptr;
+  // TODO: replacement substitutions
+  js_val *self = TO_STR(instance);
+  char *str = self->string.ptr, *orig = str;
+  unsigned long len = self->string.length;
   js_val *search_val = ARG(args, 0);
   js_val *replace_val = ARG(args, 1);
 
   // Not a RegExp
   if (!IS_REGEXP(search_val)) {
-    char *search = TO_STR(search_val)->string.ptr;
-    char *replace = TO_STR(replace_val)->string.ptr;
-    return JSSTR(fh_str_replace(str, search, replace, 1));
+    js_val *search = TO_STR(search_val);
+    long at = fh_str_find(str, len, search->string.ptr, search->string.length, 0);
+    if (at < 0) return self;
+
+    js_val *replace;
+    if (IS_FUNC(replace_val)) {
+      int span[2] = { at, at + search->string.length };
+      replace = call_replacer(replace_val, self, str, span, 1, at, state);
+    }
+    else replace = TO_STR(replace_val);
+
+    fh_strbuf sb;
+    unsigned long rest = at + search->string.length;
+    fh_strbuf_init(&sb);
+    fh_strbuf_append(&sb, str, at);
+    fh_strbuf_append(&sb, replace->string.ptr, replace->string.length);
+    fh_strbuf_append(&sb, str + rest, len - rest);
+
+    js_val *res = JSSTRN(sb.buf, sb.len);
+    free(sb.buf);
+    return res;
   }
 
   bool global = TO_BOOL(fh_get_proto(search_val, "global"))->boolean.val,
        caseless = TO_BOOL(fh_get_proto(search_val, "ignoreCase"))->boolean.val;
 
   char *pattern = fh_get(search_val, "source")->string.ptr;
-  char *repl = TO_STR(replace_val)->string.ptr;
-  int count, *matches;
+  bool replacer = IS_FUNC(replace_val);
+  char *repl = replacer ? NULL : TO_STR(replace_val)->string.ptr, *next;
+  unsigned long repl_len = replacer ? 0 : strlen(repl);
+  int count, *matches, start, end;
 
   fh_set(search_val, "lastIndex", JSNUM(0));
 
   unsigned i = 0;
-  while (i < strlen(str)) {
+  while (i < len) {
     matches = fh_regexp(str, pattern, &count, i, caseless);
     if (count == 0) break;
-    fh_set(search_val, "lastIndex", JSNUM(matches[1]));
-    str = splice(str, repl, matches[0], matches[1]);
-    i = matches[1] + strlen(repl) - (matches[1] - matches[0]);
+    start = matches[0], end = matches[1];
+    fh_set(search_val, "lastIndex", JSNUM(end));
+    if (replacer) {
+      // `str` has had its earlier matches replaced; offsets are into `self`.
+      long offset = start - (long)(len - self->string.length);
+      repl = call_replacer(replace_val, self, str, matches, count, offset,
+          state)->string.ptr;
+      repl_len = strlen(repl);
+    }
+    next = splice(str, len, repl, start, end);
+    if (str != orig) free(str);
+    str = next;
+    len += repl_len - (end - start);
+    i = end + repl_len - (end - start);
     count = 0;
-    free(matches);
     if (!global) break;
   }
 
-  if (instance->string.ptr != str) {
-    free(instance->string.ptr);
-    instance->string.ptr = str;
+  // Strings are immutable; return a new one rather than editing the instance.
+  if (str != orig) {
+    js_val *result = JSSTRN(str, len);
+    free(str);
+    return result;
   }
   return instance;
 }
@@ -295,9 +327,7 @@ str_proto_search(js_val *instance, js_args *args, eval_state *state)
   if (!matches) 
     return JSNUM(-1);
 
-  js_val *result = JSNUM(matches[0]);
-  free(matches);
-  return result;
+  return JSNUM(matches[0]);
 }
 
 // String.prototype.slice(beginSlice[, endSlice])
@@ -305,48 +335,41 @@ js_val *
 str_proto_slice(js_val *instance, js_args *args, eval_state *state)
 {
   js_val *end_arg = ARG(args, 1);
-  int len = strlen(instance->string.ptr);
-  int end = IS_UNDEF(end_arg) ? len : TO_NUM(end_arg)->number.val;
-  int start = TO_NUM(ARG(args, 0))->number.val;
+  unsigned long len = instance->string.length;
+  unsigned long start = relative_arg(ARG(args, 0), len);
+  unsigned long end = IS_UNDEF(end_arg) ? len : relative_arg(end_arg, len);
 
-  if (start < 0) start = len + start > 0 ? len + start : 0;
-  if (end < 0) end = len + end > 0 ? len + end : 0;
-  if (end > len) end = len;
-  if (end - start == 0) return JSSTR("");
-
-  return JSSTR(fh_str_slice(instance->string.ptr, start, end));
+  if (end <= start) return JSSTR("");
+  return JSSTRN(instance->string.ptr + start, end - start);
 }
 
 static js_val *
-regexp_splitter(char *str, js_val *regexp, int limit)
+regexp_splitter(js_val *instance, js_val *regexp, int limit)
 {
   // TODO: splice matches of captured groups
   char *source = TO_STR(fh_get_proto(regexp, "source"))->string.ptr;
   bool caseless = TO_BOOL(fh_get_proto(regexp, "ignoreCase"))->boolean.val;
   // int ncaps = fh_regexp_ncaptures(source);
+  char *str = instance->string.ptr;
+  unsigned long len = instance->string.length;
   js_val *arr = JSARR();
   int count, *matches;
-  char *tmp;
   unsigned i, j;
   bool matched_last = false;
 
-  for (i = 0, j = 0; i < strlen(str); j++) {
+  for (i = 0, j = 0; i < len; j++) {
     matched_last = false;
     matches = fh_regexp(str, source, &count, i, caseless);
     if (count == 0) break;
-    tmp = fh_str_slice(str, i, matches[0]);
-    fh_set(arr, JSNUMKEY(j)->string.ptr, JSSTR(tmp));
+    fh_set_elem(arr, j, JSSTRN(str + i, matches[0] - i));
     i = matches[1];
-    free(matches);
     matched_last = true;
   }
 
-  if (i < strlen(str)) {
-    tmp = fh_str_slice(str, i, strlen(str));
-    fh_set(arr, JSNUMKEY(j++)->string.ptr, JSSTR(tmp));
-  }
+  if (i < len)
+    fh_set_elem(arr, j++, JSSTRN(str + i, len - i));
   else if (matched_last)
-    fh_set(arr, JSNUMKEY(j++)->string.ptr, JSSTR(""));
+    fh_set_elem(arr, j++, JSSTR(""));
 
   fh_set_len(arr, j);
   return arr;
@@ -374,50 +397,34 @@ str_proto_split(js_val *instance, js_args *args, eval_state *state)
     return arr;
   }
   else if (IS_REGEXP(sep_arg))
-    return regexp_splitter(instance->string.ptr, sep_arg, limit);
+    return regexp_splitter(instance, sep_arg, limit);
   else
     sep_arg = TO_STR(sep_arg);
 
-  char *split;                       // store the split substring
-  char *str = instance->string.ptr;  // instance string
-  char *sep = sep_arg->string.ptr;   // separator string
-  int len = instance->string.length; // instance string length
-  int match = 0;                     // number of chars of sep matched
-  int start = 0;                     // start index to split from
-  int index = 0;                     // result array index
-  int n = strlen(str);               // len of str
-  int i;                             // instance string index
-  bool matched_last = false;         // 
-
-  for (i = 0; i < n; i++) {
-    matched_last = false;
-    if (str[i] == sep[match])
-      match++;
-    else
-      match = str[i] == sep[0];
-   
-    if (match == (int)strlen(sep)) {
-      split = fh_str_slice(str, start, i - strlen(sep) + 1);
-      fh_set(arr, JSNUMKEY(index++)->string.ptr, JSSTR(split));
-      free(split);
-      start = i + 1;
-      match = 0;
-      matched_last = true;
-      if (--limit == 0) break;
-    }
+  char *str = instance->string.ptr;
+  char *sep = sep_arg->string.ptr;
+  unsigned long len = instance->string.length;
+  unsigned long sep_len = sep_arg->string.length;
+  unsigned long start = 0, index = 0;
+  long at;
+
+  // An empty separator splits the string into its characters.
+  if (sep_len == 0) {
+    for (; index < len && index < limit; index++)
+      fh_set_elem(arr, index, JSSTRN(str + index, 1));
+    fh_set_len(arr, index);
+    return arr;
   }
 
-  // Move the remaining string (possibly all of it) into the array.
-  if (limit > 0) {
-    if (start != len) {
-      split = fh_str_slice(str, start, len);
-      fh_set(arr, JSNUMKEY(index++)->string.ptr, JSSTR(split));
-      free(split);
-    }
-    else if (matched_last && strlen(sep))
-      fh_set(arr, JSNUMKEY(index++)->string.ptr, JSSTR(""));
+  while (index < limit && (at = fh_str_find(str, len, sep, sep_len, start)) >= 0) {
+    fh_set_elem(arr, index++, JSSTRN(str + start, at - start));
+    start = at + sep_len;
   }
 
+  // The rest of the string (possibly all of it) is the last piece.
+  if (index < limit)
+    fh_set_elem(arr, index++, JSSTRN(str + start, len - start));
+
   fh_set_len(arr, index);
   return arr;
 }
@@ -437,7 +444,7 @@ str_proto_substr(js_val *instance, js_args *args, eval_state *state)
     return JSSTR("");
 
   int end = MIN(slen, start + length);
-  return JSSTR(fh_str_slice(instance->string.ptr, start, end));
+  return JSSTRN(instance->string.ptr + start, end - start);
 }
 
 // String.prototype.substring(start[, end])
@@ -454,7 +461,7 @@ str_proto_substring(js_val *instance, js_args *args, eval_state *state)
   int from = MIN(start, end);
   int to = MAX(start, end);
 
-  return JSSTR(fh_str_slice(instance->string.ptr, from, to));
+  return JSSTRN(instance->string.ptr + from, to - from);
 }
 
 // String.prototype.toLocaleLowerCase()
@@ -475,13 +482,8 @@ str_proto_to_locale_upper_case(js_val *instance, js_args *args, eval_state *stat
 js_val *
 str_proto_to_lower_case(js_val *instance, js_args *args, eval_state *state)
 {
-  js_val *new = JSSTR(instance->string.ptr);
-  char *str = new->string.ptr;
-  int i = 0;
-  while (str[i]) {
-    str[i] = tolower(str[i]);
-    i++;
-  }
+  js_val *new = JSSTRN(instance->string.ptr, instance->string.length);
+  fh_str_lower(new->string.ptr, new->string.ptr, new->string.length);
   return new;
 }
 
@@ -496,50 +498,42 @@ str_proto_to_string(js_val *instance, js_args *args, eval_state *state)
 js_val *
 str_proto_to_upper_case(js_val *instance, js_args *args, eval_state *state)
 {
-  js_val *new = JSSTR(instance->string.ptr);
-  char *str = new->string.ptr;
-  int i = 0;
-  while (str[i]) {
-    str[i] = toupper(str[i]);
-    i++;
-  }
+  js_val *new = JSSTRN(instance->string.ptr, instance->string.length);
+  fh_str_upper(new->string.ptr, new->string.ptr, new->string.length);
   return new;
 }
 
+static js_val *
+trim(js_val *str, bool left, bool right)
+{
+  unsigned long start = 0, end = str->string.length;
+  if (right) end = fh_str_space_suffix(str->string.ptr, end);
+  if (left) start = fh_str_space_prefix(str->string.ptr, end);
+
+  // Strings are immutable, so one without whitespace can be returned as is.
+  if (start == 0 && end == str->string.length) return str;
+  return JSSTRN(str->string.ptr + start, end - start);
+}
+
 // String.prototype.trim()
 js_val *
 str_proto_trim(js_val *instance, js_args *args, eval_state *state)
 {
-  js_val *rtrimmed = str_proto_trim_right(instance, args, state);
-  return str_proto_trim_left(rtrimmed, args, state);
+  return trim(instance, true, true);
 }
 
 // String.prototype.trimLeft()
 js_val *
 str_proto_trim_left(js_val *instance, js_args *args, eval_state *state)
 {
-  js_val *new = JSSTR(instance->string.ptr);
-  char *str = new->string.ptr;
-  int n = 0;
-  while (str[n] != '\0' && isspace((unsigned char)str[n]))
-    n++;
-  memmove(str, str + n, strlen(str) - n + 1);
-  new->string.length = strlen(str);
-  return new;
+  return trim(instance, true, false);
 }
 
 // String.prototype.trimRight()
 js_val *
 str_proto_trim_right(js_val *instance, js_args *args, eval_state *state)
 {
-  js_val *new = JSSTR(instance->string.ptr);
-  char *str = new->string.ptr;
-  int n = strlen(str);
-  while (n > 0 && isspace((unsigned char)str[n - 1]))
-    n--;
-  str[n] = '\0';
-  new->string.length = n;
-  return new;
+  return trim(instance, false, true);
 }
 
 // String.prototype.valueOf()
@@ -595,6 +589,7 @@ bootstrap_string()
   DEF(prototype, "valueOf", JSNFUNC(str_proto_value_of, 0));
 
   fh_attach_prototype(prototype, fh->function_proto);
+  fh->string_proto = prototype;
 
   return string;
 }
@@ -0,0 +1,432 @@
+// TypedArray.c
+// ------------
+// ArrayBuffer and the typed array views of it. A view's elements are packed
+// in its buffer's bytes, and are read and written through the element
+// functions in props.c, so indexing a view takes the same fast paths as a
+// dense array.
+
+#include <math.h>
+#include <string.h>
+
+#include "TypedArray.h"
+
+static const struct {
+  char *name;
+  unsigned size;
+} kinds[] = {
+  {"ArrayBuffer", 1},
+  {"Int8Array", 1},
+  {"Uint8Array", 1},
+  {"Uint8ClampedArray", 1},
+  {"Int16Array", 2},
+  {"Uint16Array", 2},
+  {"Int32Array", 4},
+  {"Uint32Array", 4},
+  {"Float32Array", 4},
+  {"Float64Array", 8}
+};
+
+
+// ----------------------------------------------------------------------------
+// Helpers
+// ----------------------------------------------------------------------------
+
+static bool
+is_buffer(js_val *val)
+{
+  return IS_OBJ(val) && val->typed && val->typed->kind == TA_BUFFER;
+}
+
+static bool
+is_view(js_val *val)
+{
+  return IS_OBJ(val) && val->typed && val->dense;
+}
+
+static js_typed *
+view_this(js_val *instance, eval_state *state)
+{
+  if (!is_view(instance))
+    fh_throw(state, fh_new_error(E_TYPE, "this is not a typed array"));
+  return instance->typed;
+}
+
+// A length or byte offset: a nonnegative integer.
+static unsigned long
+to_index(js_val *val, eval_state *state)
+{
+  if (IS_UNDEF(val)) return 0;
+
+  double d = fh_typed_num(val);
+  if (isnan(d)) return 0;
+  if (d < 0 || d >= ULONG_MAX)
+    fh_throw(state, fh_new_error(E_RANGE, "Invalid typed array length"));
+  return d;
+}
+
+// An index relative to the end when negative, clamped to [0, len].
+static unsigned long
+relative_index(js_val *val, unsigned long len, unsigned long missing)
+{
+  if (IS_UNDEF(val)) return missing;
+
+  double d = fh_typed_num(val);
+  if (isnan(d)) return 0;
+  d = trunc(d);
+  if (d < 0) d = MAX(len + d, 0);
+  return MIN(d, len);
+}
+
+static js_val *
+buffer_init(js_val *obj, unsigned long bytes, eval_state *state)
+{
+  unsigned char *data = calloc(bytes ? bytes : 1, 1);
+  if (!data)
+    fh_throw(state, fh_new_error(E_RANGE, "Array buffer allocation failed"));
+
+  js_typed *typed = calloc(1, sizeof(js_typed));
+  typed->kind = TA_BUFFER;
+  typed->data = data;
+  typed->length = bytes;
+  obj->typed = typed;
+  fh_gc_external(bytes);
+
+  fh_set_class(obj, "ArrayBuffer");
+  DEF2(obj, "byteLength", JSNUM(bytes), P_NONE);
+  return obj;
+}
+
+// A zeroed buffer for `len` elements of a kind.
+static js_val *
+new_buffer(unsigned long len, js_typed_kind kind, eval_state *state)
+{
+  if (len > ULONG_MAX / kinds[kind].size)
+    fh_throw(state, fh_new_error(E_RANGE, "Invalid typed array length"));
+
+  js_val *buffer = JSOBJ();
+  buffer->proto = fh->buffer_proto;
+  return buffer_init(buffer, len * kinds[kind].size, state);
+}
+
+static js_val *
+view_init(js_val *obj, js_typed_kind kind, js_val *buffer,
+          unsigned long offset, unsigned long len)
+{
+  js_typed *typed = calloc(1, sizeof(js_typed));
+  typed->kind = kind;
+  typed->data = buffer->typed->data + offset;
+  typed->length = len;
+  typed->offset = offset;
+  GC_BARRIER(obj, buffer);
+  typed->buffer = buffer;
+
+  obj->typed = typed;
+  obj->dense = true;
+  obj->object.length = len;
+
+  fh_set_class(obj, kinds[kind].name);
+  DEF2(obj, "length", JSNUM(len), P_NONE);
+  DEF2(obj, "byteLength", JSNUM(len * kinds[kind].size), P_NONE);
+  DEF2(obj, "byteOffset", JSNUM(offset), P_NONE);
+  DEF2(obj, "buffer", buffer, P_NONE);
+  return obj;
+}
+
+// Copy `len` elements of an array (or typed array) into a view at `at`.
+static void
+copy_elems(js_typed *to, unsigned long at, js_val *src, unsigned long len)
+{
+  unsigned long i;
+  if (len == 0) return;
+
+  if (!is_view(src)) {
+    for (i = 0; i < len; i++)
+      fh_typed_store(to, at + i, fh_typed_num(fh_get_index(src, i)));
+    return;
+  }
+
+  js_typed from = *src->typed;
+  unsigned size = kinds[from.kind].size;
+  if (from.kind == to->kind) {
+    memmove(to->data + at * size, from.data, len * size);
+    return;
+  }
+
+  // Views of one buffer may overlap, so convert from a copy.
+  if (from.buffer == to->buffer) {
+    from.data = malloc(len * size);
+    memcpy(from.data, src->typed->data, len * size);
+  }
+  for (i = 0; i < len; i++)
+    fh_typed_store(to, at + i, fh_typed_load(&from, i));
+  if (from.data != src->typed->data)
+    free(from.data);
+}
+
+static js_val *
+view_new(js_typed_kind kind, js_args *args, eval_state *state)
+{
+  js_val *arg = ARG(args, 0), *obj = state->this;
+  unsigned size = kinds[kind].size;
+  unsigned long offset, bytes, len;
+
+  if (!state->construct)
+    fh_throw(state, fh_new_error(E_TYPE, "Constructor %s requires 'new'",
+                                 kinds[kind].name));
+
+  // new T(buffer[, byteOffset[, length]])
+  if (is_buffer(arg)) {
+    bytes = arg->typed->length;
+    offset = to_index(ARG(args, 1), state);
+    if (offset % size || offset > bytes)
+      fh_throw(state, fh_new_error(E_RANGE, "Invalid typed array offset"));
+
+    if (IS_UNDEF(ARG(args, 2))) {
+      if ((bytes - offset) % size)
+        fh_throw(state, fh_new_error(E_RANGE, "Invalid typed array length"));
+      len = (bytes - offset) / size;
+    }
+    else {
+      len = to_index(ARG(args, 2), state);
+      if (len > (bytes - offset) / size)
+        fh_throw(state, fh_new_error(E_RANGE, "Invalid typed array length"));
+    }
+    return view_init(obj, kind, arg, offset, len);
+  }
+
+  // new T(array), new T(typedArray)
+  if (IS_OBJ(arg)) {
+    len = is_view(arg) ?
+      arg->typed->length :
+      to_index(fh_get_proto(arg, "length"), state);
+    view_init(obj, kind, new_buffer(len, kind, state), 0, len);
+    copy_elems(obj->typed, 0, arg, len);
+    return obj;
+  }
+
+  // new T(length)
+  len = to_index(arg, state);
+  return view_init(obj, kind, new_buffer(len, kind, state), 0, len);
+}
+
+
+// ----------------------------------------------------------------------------
+// ArrayBuffer
+// ----------------------------------------------------------------------------
+
+// ArrayBuffer(length)
+js_val *
+buffer_new(js_val *instance, js_args *args, eval_state *state)
+{
+  if (!state->construct)
+    fh_throw(state, fh_new_error(E_TYPE, "Constructor ArrayBuffer requires 'new'"));
+  return buffer_init(state->this, to_index(ARG(args, 0), state), state);
+}
+
+// ArrayBuffer.isView(arg)
+js_val *
+buffer_is_view(js_val *instance, js_args *args, eval_state *state)
+{
+  return JSBOOL(is_view(ARG(args, 0)));
+}
+
+// ArrayBuffer.prototype.slice(begin[, end])
+js_val *
+buffer_proto_slice(js_val *instance, js_args *args, eval_state *state)
+{
+  if (!is_buffer(instance))
+    fh_throw(state, fh_new_error(E_TYPE, "this is not an ArrayBuffer"));
+
+  unsigned long len = instance->typed->length;
+  unsigned long begin = relative_index(ARG(args, 0), len, 0);
+  unsigned long end = relative_index(ARG(args, 1), len, len);
+  unsigned long bytes = end > begin ? end - begin : 0;
+
+  js_val *copy = new_buffer(bytes, TA_BUFFER, state);
+  memcpy(copy->typed->data, instance->typed->data + begin, bytes);
+  return copy;
+}
+
+
+// ----------------------------------------------------------------------------
+// Typed Array Constructors
+// ----------------------------------------------------------------------------
+
+js_val *
+int8_array_new(js_val *instance, js_args *args, eval_state *state)
+{
+  return view_new(TA_INT8, args, state);
+}
+
+js_val *
+uint8_array_new(js_val *instance, js_args *args, eval_state *state)
+{
+  return view_new(TA_UINT8, args, state);
+}
+
+js_val *
+uint8_clamped_array_new(js_val *instance, js_args *args, eval_state *state)
+{
+  return view_new(TA_UINT8_CLAMPED, args, state);
+}
+
+js_val *
+int16_array_new(js_val *instance, js_args *args, eval_state *state)
+{
+  return view_new(TA_INT16, args, state);
+}
+
+js_val *
+uint16_array_new(js_val *instance, js_args *args, eval_state *state)
+{
+  return view_new(TA_UINT16, args, state);
+}
+
+js_val *
+int32_array_new(js_val *instance, js_args *args, eval_state *state)
+{
+  return view_new(TA_INT32, args, state);
+}
+
+js_val *
+uint32_array_new(js_val *instance, js_args *args, eval_state *state)
+{
+  return view_new(TA_UINT32, args, state);
+}
+
+js_val *
+float32_array_new(js_val *instance, js_args *args, eval_state *state)
+{
+  return view_new(TA_FLOAT32, args, state);
+}
+
+js_val *
+float64_array_new(js_val *instance, js_args *args, eval_state *state)
+{
+  return view_new(TA_FLOAT64, args, state);
+}
+
+
+// ----------------------------------------------------------------------------
+// Typed Array Prototype
+// ----------------------------------------------------------------------------
+
+// TypedArray.prototype.set(array[, offset])
+js_val *
+typed_proto_set(js_val *instance, js_args *args, eval_state *state)
+{
+  js_typed *typed = view_this(instance, state);
+  js_val *src = ARG(args, 0);
+  unsigned long offset = to_index(ARG(args, 1), state), len = 0;
+
+  if (is_view(src))
+    len = src->typed->length;
+  else if (IS_OBJ(src))
+    len = to_index(fh_get_proto(src, "length"), state);
+
+  if (offset > typed->length || len > typed->length - offset)
+    fh_throw(state, fh_new_error(E_RANGE, "Source is too large"));
+
+  copy_elems(typed, offset, src, len);
+  return JSUNDEF();
+}
+
+// TypedArray.prototype.subarray([begin[, end]])
+js_val *
+typed_proto_subarray(js_val *instance, js_args *args, eval_state *state)
+{
+  js_typed *typed = view_this(instance, state);
+  unsigned long begin = relative_index(ARG(args, 0), typed->length, 0);
+  unsigned long end = relative_index(ARG(args, 1), typed->length, typed->length);
+
+  js_val *view = JSOBJ();
+  view->proto = instance->proto;
+  return view_init(view, typed->kind, typed->buffer,
+                   typed->offset + begin * kinds[typed->kind].size,
+                   end > begin ? end - begin : 0);
+}
+
+// TypedArray.prototype.fill(value[, begin[, end]])
+js_val *
+typed_proto_fill(js_val *instance, js_args *args, eval_state *state)
+{
+  js_typed *typed = view_this(instance, state);
+  double val = fh_typed_num(ARG(args, 0));
+  unsigned long begin = relative_index(ARG(args, 1), typed->length, 0);
+  unsigned long end = relative_index(ARG(args, 2), typed->length, typed->length);
+  if (begin >= end) return instance;
+
+  // Store the value once, then keep doubling the filled span.
+  unsigned size = kinds[typed->kind].size;
+  unsigned char *start = typed->data + begin * size;
+  unsigned long len = end - begin, done = 1, n;
+
+  fh_typed_store(typed, begin, val);
+  for (; done < len; done += n) {
+    n = MIN(done, len - done);
+    memcpy(start + done * size, start, n * size);
+  }
+  return instance;
+}
+
+
+// ----------------------------------------------------------------------------
+// Bootstrap
+// ----------------------------------------------------------------------------
+
+static void
+bootstrap_view(js_val *global, js_typed_kind kind, js_native_function *ctr_fn)
+{
+  js_val *ctr = JSNFUNC(ctr_fn, 3);
+  js_val *proto = JSOBJ();
+
+  // Views are array-like, so the Array methods work on them too.
+  proto->proto = fh->array_proto;
+
+  DEF(ctr, "prototype", proto);
+  DEF(ctr, "BYTES_PER_ELEMENT", JSNUM(kinds[kind].size));
+
+  DEF(proto, "constructor", ctr);
+  DEF(proto, "BYTES_PER_ELEMENT", JSNUM(kinds[kind].size));
+
+  DEF(proto, "set", JSNFUNC(typed_proto_set, 2));
+  DEF(proto, "subarray", JSNFUNC(typed_proto_subarray, 2));
+  DEF(proto, "fill", JSNFUNC(typed_proto_fill, 1));
+
+  fh_attach_prototype(proto, fh->function_proto);
+  DEF(global, kinds[kind].name, ctr);
+}
+
+void
+bootstrap_typed_arrays(js_val *global)
+{
+  js_val *buffer = JSNFUNC(buffer_new, 1);
+  js_val *proto = JSOBJ();
+  proto->proto = fh->object_proto;
+
+  // ArrayBuffer
+  // -----------
+
+  DEF(buffer, "prototype", proto);
+  DEF(buffer, "isView", JSNFUNC(buffer_is_view, 1));
+
+  DEF(proto, "constructor", buffer);
+  DEF(proto, "slice", JSNFUNC(buffer_proto_slice, 2));
+
+  fh_attach_prototype(proto, fh->function_proto);
+  fh->buffer_proto = proto;
+  DEF(global, "ArrayBuffer", buffer);
+
+  // Views
+  // -----
+
+  bootstrap_view(global, TA_INT8, int8_array_new);
+  bootstrap_view(global, TA_UINT8, uint8_array_new);
+  bootstrap_view(global, TA_UINT8_CLAMPED, uint8_clamped_array_new);
+  bootstrap_view(global, TA_INT16, int16_array_new);
+  bootstrap_view(global, TA_UINT16, uint16_array_new);
+  bootstrap_view(global, TA_INT32, int32_array_new);
+  bootstrap_view(global, TA_UINT32, uint32_array_new);
+  bootstrap_view(global, TA_FLOAT32, float32_array_new);
+  bootstrap_view(global, TA_FLOAT64, float64_array_new);
+}
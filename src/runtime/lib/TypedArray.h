@@ -0,0 +1,29 @@
+// TypedArray.h
+// ------------
+
+#ifndef JS_TYPED_ARRAY_H
+#define JS_TYPED_ARRAY_H
+
+#include "../runtime.h"
+
+js_val * buffer_new(js_val *, js_args *, eval_state *);
+js_val * buffer_is_view(js_val *, js_args *, eval_state *);
+js_val * buffer_proto_slice(js_val *, js_args *, eval_state *);
+
+js_val * int8_array_new(js_val *, js_args *, eval_state *);
+js_val * uint8_array_new(js_val *, js_args *, eval_state *);
+js_val * uint8_clamped_array_new(js_val *, js_args *, eval_state *);
+js_val * int16_array_new(js_val *, js_args *, eval_state *);
+js_val * uint16_array_new(js_val *, js_args *, eval_state *);
+js_val * int32_array_new(js_val *, js_args *, eval_state *);
+js_val * uint32_array_new(js_val *, js_args *, eval_state *);
+js_val * float32_array_new(js_val *, js_args *, eval_state *);
+js_val * float64_array_new(js_val *, js_args *, eval_state *);
+
+js_val * typed_proto_set(js_val *, js_args *, eval_state *);
+js_val * typed_proto_subarray(js_val *, js_args *, eval_state *);
+js_val * typed_proto_fill(js_val *, js_args *, eval_state *);
+
+void bootstrap_typed_arrays(js_val *);
+
+#endif
@@ -2,10 +2,7 @@
 // ---------
 // Native implementations for the `console` property of the global object.
 
-#include <time.h>
-
 #include "console.h"
-#include "Date.h"
 
 // console.log(obj1[, obj2, ..., objN])
 js_val *
@@ -48,38 +45,63 @@ console_assert(js_val *instance, js_args *args, eval_state *state)
   UNREACHABLE();
 }
 
-// console.time(name)
+// Timers and counters are kept natively (see timers.c), by label, which
+// defaults to "default".
+static const char *
+label(js_args *args)
+{
+  js_val *name = ARG(args, 0);
+  return IS_UNDEF(name) ? "default" : TO_STR(name)->string.ptr;
+}
+
+// console.time([label])
 js_val *
 console_time(js_val *instance, js_args *args, eval_state *state)
 {
-  js_val *name = TO_STR(ARG(args, 0));
-  js_val *timers = fh_get(instance, "__timers__");
-  if (IS_UNDEF(timers)) {
-    timers = JSOBJ();
-    fh_set(instance, "__timers__", timers);
-  }
-  fh_set(timers, name->string.ptr, JSNUM(utc_now()));
+  fh_timer *timer = fh_get_timer(label(args));
+  timer->running = true;
+  timer->started = fh_clock_ms();
   return JSUNDEF();
 }
 
-// console.timeEnd(name)
+// console.timeEnd([label])
+//
+// Prints the time since console.time, and adds it to the label's samples.
 js_val *
 console_time_end(js_val *instance, js_args *args, eval_state *state)
 {
-  js_val *name = TO_STR(ARG(args, 0));
-  js_val *timers = fh_get(instance, "__timers__");
-  if (IS_OBJ(timers)) {
-    js_val *timer = fh_get(timers, name->string.ptr);
-    if (IS_NUM(timer)) {
-      long old = timer->number.val;
-      long cur = utc_now();
-      fprintf(stdout, "%s: %ldms\n", name->string.ptr, cur - old);
-    }
-    fh_del_prop(timers, name->string.ptr);
+  double now = fh_clock_ms();
+  fh_timer *timer = fh_get_timer(label(args));
+  if (timer->running) {
+    double ms = now - timer->started;
+    timer->running = false;
+    fh_timer_sample(timer, ms);
+    fprintf(stdout, "%s: %.3fms\n", timer->name, ms);
   }
   return JSUNDEF();
 }
 
+// console.count([label])
+js_val *
+console_count(js_val *instance, js_args *args, eval_state *state)
+{
+  fh_timer *timer = fh_get_timer(label(args));
+  timer->count++;
+  fprintf(stdout, "%s: %lu\n", timer->name, timer->count);
+  return JSUNDEF();
+}
+
+// console.timeReport()   Non-standard
+//
+// Prints the count, total, mean, min, median, 99th percentile and max of the
+// samples of each timer, then the counters.
+js_val *
+console_time_report(js_val *instance, js_args *args, eval_state *state)
+{
+  fh_timer_report(stdout);
+  return JSUNDEF();
+}
+
 js_val *
 bootstrap_console()
 {
@@ -91,6 +113,8 @@ bootstrap_console()
   DEF(console, "assert", JSNFUNC(console_assert, 1));
   DEF(console, "time", JSNFUNC(console_time, 1));
   DEF(console, "timeEnd", JSNFUNC(console_time_end, 1));
+  DEF(console, "count", JSNFUNC(console_count, 1));
+  DEF(console, "timeReport", JSNFUNC(console_time_report, 0));
 
   fh_attach_prototype(console, fh->function_proto);
 
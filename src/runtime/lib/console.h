@@ -12,6 +12,8 @@ js_val * console_info(js_val *, js_args *, eval_state *);
 js_val * console_assert(js_val *, js_args *, eval_state *);
 js_val * console_time(js_val *, js_args *, eval_state *);
 js_val * console_time_end(js_val *, js_args *, eval_state *);
+js_val * console_count(js_val *, js_args *, eval_state *);
+js_val * console_time_report(js_val *, js_args *, eval_state *);
 
 js_val * bootstrap_console(void);
 
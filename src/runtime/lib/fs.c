@@ -0,0 +1,291 @@
+// fs.c
+// ----
+// The `fs` property of the global object (non-standard): reading and writing
+// whole files, and reading large ones a line at a time.
+//
+// A reader keeps its state and buffer in a block it owns as an ArrayBuffer
+// owns its bytes, so the GC frees them along with it, counted with the
+// buffers, and closes the file if it's still open. Lines are cut from the
+// buffer in place, and it only grows for a line longer than itself, so a
+// file of any size is read in constant memory. The file is closed at its
+// end, by close(), or once the reader is collected.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fs.h"
+
+#define FS_READ_BUFFER (1 << 20)    // bytes a reader reads at a time
+#define FS_CHUNK 65536              // bytes read at a time from a pipe
+
+typedef struct {
+  int fd;                           // -1 once closed
+  size_t cap;                       // bytes of buffer after the header
+  size_t start;                     // the unread bytes, [start, end)
+  size_t end;
+} fs_reader;
+
+#define READER_BUF(r) ((char *)((r) + 1))
+
+static void
+fs_error(eval_state *state, const char *path)
+{
+  fh_throw(state, fh_new_error(E_ERROR, "%s: %s", path, strerror(errno)));
+}
+
+/* The contents of a file that can't be mapped (e.g. a pipe). */
+static js_val *
+read_stream(int fd, const char *path, eval_state *state)
+{
+  fh_strbuf buf;
+  char chunk[FS_CHUNK];
+  ssize_t n;
+
+  fh_strbuf_init(&buf);
+  while ((n = read(fd, chunk, sizeof(chunk))) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      int err = errno;
+      free(buf.buf);
+      close(fd);
+      errno = err;
+      fs_error(state, path);
+    }
+    fh_strbuf_append(&buf, chunk, n);
+  }
+  close(fd);
+  js_val *str = JSSTRN(buf.buf ? buf.buf : "", buf.len);
+  free(buf.buf);
+  return str;
+}
+
+// fs.readFile(path)
+//
+// The contents of the file as a string. A regular file is mapped and copied
+// straight into the string.
+js_val *
+fs_read_file(js_val *instance, js_args *args, eval_state *state)
+{
+  char *path = TO_STR(ARG(args, 0))->string.ptr;
+  struct stat st;
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    int err = errno;
+    if (fd >= 0) close(fd);
+    errno = err;
+    fs_error(state, path);
+  }
+  if (!S_ISREG(st.st_mode) || st.st_size == 0)
+    return read_stream(fd, path, state);
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    fs_error(state, path);
+
+  js_val *str = JSSTRN(map, st.st_size);
+  munmap(map, st.st_size);
+  return str;
+}
+
+static js_val *
+write_file(js_args *args, eval_state *state, int flags)
+{
+  char *path = TO_STR(ARG(args, 0))->string.ptr;
+  js_val *data = TO_STR(ARG(args, 1));
+  const char *p = data->string.ptr;
+  size_t left = data->string.length;
+  int fd = open(path, O_WRONLY | O_CREAT | flags, 0666);
+
+  if (fd < 0) fs_error(state, path);
+  while (left) {
+    ssize_t n = write(fd, p, left);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      int err = errno;
+      close(fd);
+      errno = err;
+      fs_error(state, path);
+    }
+    p += n;
+    left -= n;
+  }
+  if (close(fd) < 0) fs_error(state, path);
+  return JSUNDEF();
+}
+
+// fs.writeFile(path, data)
+//
+// Replaces the file's contents with the string, creating it if need be.
+js_val *
+fs_write_file(js_val *instance, js_args *args, eval_state *state)
+{
+  return write_file(args, state, O_TRUNC);
+}
+
+// fs.appendFile(path, data)
+js_val *
+fs_append_file(js_val *instance, js_args *args, eval_state *state)
+{
+  return write_file(args, state, O_APPEND);
+}
+
+static fs_reader *
+get_reader(js_val *reader, eval_state *state)
+{
+  if (!reader || !IS_OBJ(reader) || !STREQ(reader->object.class, "FileReader") ||
+      !reader->typed || reader->typed->kind != TA_READER)
+    fh_throw(state, fh_new_error(E_TYPE, "not a file reader"));
+  return (fs_reader *)reader->typed->data;
+}
+
+static void
+close_reader(fs_reader *r)
+{
+  if (r->fd >= 0) close(r->fd);
+  r->fd = -1;
+}
+
+/* Free a reader's block as the GC frees the reader. */
+void
+fs_reader_free(unsigned char *data)
+{
+  close_reader((fs_reader *)data);
+  free(data);
+}
+
+// fs.open(path)
+//
+// A reader of the file's lines, with readLine() and close().
+js_val *
+fs_open(js_val *instance, js_args *args, eval_state *state)
+{
+  char *path = TO_STR(ARG(args, 0))->string.ptr;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) fs_error(state, path);
+
+  fs_reader *r = malloc(sizeof(fs_reader) + FS_READ_BUFFER);
+  js_typed *typed = calloc(1, sizeof(js_typed));
+  if (!r || !typed) {
+    free(r);
+    free(typed);
+    close(fd);
+    fh_throw(state, fh_new_error(E_RANGE, "File reader allocation failed"));
+  }
+  r->fd = fd;
+  r->cap = FS_READ_BUFFER;
+  r->start = r->end = 0;
+
+  js_val *reader = JSOBJ();
+  typed->kind = TA_READER;
+  typed->data = (unsigned char *)r;
+  typed->length = sizeof(fs_reader) + r->cap;
+  reader->typed = typed;
+  fh_gc_external(typed->length);
+  fh_set_class(reader, "FileReader");
+
+  DEF(reader, "readLine", JSNFUNC(fs_reader_read_line, 0));
+  DEF(reader, "close", JSNFUNC(fs_reader_close, 0));
+  return reader;
+}
+
+/* Read more of the file into the buffer, first moving what's unread to the
+ * front, or growing it if it's full. Returns false at the end of the file. */
+static bool
+fill(js_val *reader, fs_reader **rp, eval_state *state)
+{
+  fs_reader *r = *rp;
+  ssize_t n;
+
+  if (r->fd < 0) return false;
+  if (r->start > 0) {
+    memmove(READER_BUF(r), READER_BUF(r) + r->start, r->end - r->start);
+    r->end -= r->start;
+    r->start = 0;
+  }
+  if (r->end == r->cap) {
+    fs_reader *grown = realloc(r, sizeof(fs_reader) + r->cap * 2);
+    if (!grown)
+      fh_throw(state, fh_new_error(E_RANGE, "File reader allocation failed"));
+    r = *rp = grown;
+    fh_gc_external(r->cap);
+    r->cap *= 2;
+    reader->typed->data = (unsigned char *)r;
+    reader->typed->length = sizeof(fs_reader) + r->cap;
+  }
+
+  while ((n = read(r->fd, READER_BUF(r) + r->end, r->cap - r->end)) < 0) {
+    if (errno != EINTR) {
+      close_reader(r);
+      fs_error(state, "readLine");
+    }
+  }
+  if (n == 0) {
+    close_reader(r);
+    return false;
+  }
+  r->end += n;
+  return true;
+}
+
+// reader.readLine()
+//
+// The next line, without its line ending ("\n" or "\r\n"), or null once the
+// file has been read.
+js_val *
+fs_reader_read_line(js_val *instance, js_args *args, eval_state *state)
+{
+  fs_reader *r = get_reader(instance, state);
+  size_t scanned = 0;
+  char *nl;
+
+  while (!(nl = memchr(READER_BUF(r) + r->start + scanned, '\n',
+                       r->end - r->start - scanned))) {
+    scanned = r->end - r->start;
+    if (!fill(instance, &r, state)) {
+      // The last line may have no newline.
+      if (r->start == r->end) return JSNULL();
+      js_val *line = JSSTRN(READER_BUF(r) + r->start, r->end - r->start);
+      r->start = r->end;
+      return line;
+    }
+  }
+
+  char *line = READER_BUF(r) + r->start;
+  size_t len = nl - line;
+  r->start += len + 1;
+  if (len && line[len - 1] == '\r') len--;
+  return JSSTRN(line, len);
+}
+
+// reader.close()
+//
+// Closes the file, and drops what's been read of it but not returned.
+js_val *
+fs_reader_close(js_val *instance, js_args *args, eval_state *state)
+{
+  fs_reader *r = get_reader(instance, state);
+  close_reader(r);
+  r->start = r->end = 0;
+  return JSUNDEF();
+}
+
+js_val *
+bootstrap_fs()
+{
+  js_val *fs = JSOBJ();
+
+  DEF(fs, "readFile", JSNFUNC(fs_read_file, 1));
+  DEF(fs, "writeFile", JSNFUNC(fs_write_file, 2));
+  DEF(fs, "appendFile", JSNFUNC(fs_append_file, 2));
+  DEF(fs, "open", JSNFUNC(fs_open, 1));
+
+  fh_attach_prototype(fs, fh->function_proto);
+
+  return fs;
+}
@@ -0,0 +1,19 @@
+// fs.h
+// ----
+
+#ifndef JS_FS_H
+#define JS_FS_H
+
+#include "../runtime.h"
+
+js_val * fs_read_file(js_val *, js_args *, eval_state *);
+js_val * fs_write_file(js_val *, js_args *, eval_state *);
+js_val * fs_append_file(js_val *, js_args *, eval_state *);
+js_val * fs_open(js_val *, js_args *, eval_state *);
+js_val * fs_reader_read_line(js_val *, js_args *, eval_state *);
+js_val * fs_reader_close(js_val *, js_args *, eval_state *);
+void fs_reader_free(unsigned char *);
+
+js_val * bootstrap_fs(void);
+
+#endif
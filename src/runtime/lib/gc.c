@@ -24,19 +24,112 @@ gc_run(js_val *instance, js_args *args, eval_state *state)
 
 // gc.info()
 //
-// Returns information about the last garbage collection.
+// Returns information about the heap and the garbage collections so far. Times
+// are in microseconds, except `time` (the total, in milliseconds) and
+// `lastStart` (milliseconds since startup). `last` describes the last
+// collection, and `pauses` counts the pauses up to each bound, in order.
+// `caches` has the hits and misses of the caches of parsed scripts (`load`),
+// eval'd strings (`eval`) and modules (`require`).
+static js_val *
+collection_info(gc_collection *c)
+{
+  js_val *info = JSOBJ();
+  fh_set_prop(info, "type", JSSTR((char *)c->type), P_DEFAULT);
+  fh_set_prop(info, "pause", JSNUM(c->pause), P_DEFAULT);
+  fh_set_prop(info, "maxPause", JSNUM(c->max_pause), P_DEFAULT);
+  fh_set_prop(info, "pauses", JSNUM(c->pauses), P_DEFAULT);
+  fh_set_prop(info, "marked", JSNUM(c->marked), P_DEFAULT);
+  fh_set_prop(info, "swept", JSNUM(c->swept), P_DEFAULT);
+  fh_set_prop(info, "moved", JSNUM(c->moved), P_DEFAULT);
+  fh_set_prop(info, "heapBefore", JSNUM(c->heap_before), P_DEFAULT);
+  fh_set_prop(info, "heapAfter", JSNUM(c->heap_after), P_DEFAULT);
+  return info;
+}
+
+static js_val *
+cache_info(fh_cache_stats *c)
+{
+  js_val *info = JSOBJ();
+  fh_set_prop(info, "hits", JSNUM(c->hits), P_DEFAULT);
+  fh_set_prop(info, "misses", JSNUM(c->misses), P_DEFAULT);
+  return info;
+}
+
 js_val *
 gc_info(js_val *instance, js_args *args, eval_state *state)
 {
+  gc_stats *stats = &fh->gc_stats;
   js_val *info = JSOBJ();
   fh_set_prop(info, "arenas", JSNUM(fh->gc_num_arenas), P_DEFAULT);
   fh_set_prop(info, "arenaSize", JSNUM(SLOTS_PER_ARENA), P_DEFAULT);
-  fh_set_prop(info, "runs", JSNUM(fh->gc_runs), P_DEFAULT);
-  fh_set_prop(info, "lastStart", JSNUM(fh->gc_last_start), P_DEFAULT);
-  fh_set_prop(info, "time", JSNUM(fh->gc_time), P_DEFAULT);
+  fh_set_prop(info, "heapSize", JSNUM(fh_heap_size()), P_DEFAULT);
+  fh_set_prop(info, "usedSlots", JSNUM(fh_heap_used()), P_DEFAULT);
+  fh_set_prop(info, "externalBytes", JSNUM(fh->gc_external), P_DEFAULT);
+  fh_set_prop(info, "maxHeapSize", JSNUM(fh->opt_max_heap), P_DEFAULT);
+  fh_set_prop(info, "runs", JSNUM(stats->major_runs), P_DEFAULT);
+  fh_set_prop(info, "minorRuns", JSNUM(stats->minor_runs), P_DEFAULT);
+  fh_set_prop(info, "compactions", JSNUM(stats->compactions), P_DEFAULT);
+  fh_set_prop(info, "lastStart",
+      JSNUM(stats->last.type ? (stats->last.start - stats->epoch) / 1000 : 0),
+      P_DEFAULT);
+  fh_set_prop(info, "time", JSNUM(stats->total_pause / 1000.0), P_DEFAULT);
+  fh_set_prop(info, "maxPause", JSNUM(stats->max_pause), P_DEFAULT);
+  if (stats->last.type)
+    fh_set_prop(info, "last", collection_info(&stats->last), P_DEFAULT);
+
+  js_val *pauses = JSARR();
+  int i;
+  for (i = 0; i < GC_PAUSE_BUCKETS; i++) {
+    js_val *bucket = JSOBJ();
+    js_val *bound = i < GC_PAUSE_BUCKETS - 1 ? JSNUM(fh_gc_pause_bounds[i]) : JSINF();
+    fh_set_prop(bucket, "upTo", bound, P_DEFAULT);
+    fh_set_prop(bucket, "count", JSNUM(stats->histogram[i]), P_DEFAULT);
+    fh_set_elem(pauses, i, bucket);
+  }
+  fh_set_len(pauses, i);
+  fh_set_prop(info, "pauses", pauses, P_DEFAULT);
+
+  js_val *caches = JSOBJ();
+  fh_set_prop(caches, "load", cache_info(&fh->script_cache), P_DEFAULT);
+  fh_set_prop(caches, "eval", cache_info(&fh->eval_cache), P_DEFAULT);
+  fh_set_prop(caches, "require", cache_info(&fh->module_cache), P_DEFAULT);
+  fh_set_prop(info, "caches", caches, P_DEFAULT);
+#ifdef FH_HOTSPOTS
+  // Hotspot counts point at nodes, so no parse tree is ever freed.
+  fh_set_prop(info, "keepsTrees", JSBOOL(true), P_DEFAULT);
+#endif
   return info;
 }
 
+// gc.compact()
+//
+// Runs garbage collection, then moves the surviving values into as few
+// arenas as they fit in and frees the rest. The values move at the end of
+// the current top-level statement, where nothing but the interpreter holds
+// them. Returns undefined.
+js_val *
+gc_compact(js_val *instance, js_args *args, eval_state *state)
+{
+  fh_gc();
+  fh_gc_compact();
+  return JSUNDEF();
+}
+
+// gc.profile([sites])
+//
+// Runs garbage collection and returns the survivors counted by type and by
+// [[Class]], with their bytes, along with the allocations counted by source
+// line and column. Pass true to start counting allocations (they're counted
+// from the start with --heap-profile) or false to stop.
+js_val *
+gc_profile(js_val *instance, js_args *args, eval_state *state)
+{
+  if (ARGLEN(args) >= 1)
+    fh->heap_profiling = TO_BOOL(ARG(args, 0))->boolean.val;
+  fh_gc();
+  return fh_heap_profile();
+}
+
 // gc.spy(value)
 //
 // Flags a value for verbose GC logging. Because there's so much noise from
@@ -59,6 +152,8 @@ bootstrap_gc()
 
   DEF(gc, "run", JSNFUNC(gc_run, 0));
   DEF(gc, "info", JSNFUNC(gc_info, 0));
+  DEF(gc, "compact", JSNFUNC(gc_compact, 0));
+  DEF(gc, "profile", JSNFUNC(gc_profile, 1));
   DEF(gc, "spy", JSNFUNC(gc_spy, 1));
 
   fh_attach_prototype(gc, fh->function_proto);
@@ -8,6 +8,8 @@
 
 js_val * gc_run(js_val *, js_args *, eval_state *);
 js_val * gc_info(js_val *, js_args *, eval_state *);
+js_val * gc_compact(js_val *, js_args *, eval_state *);
+js_val * gc_profile(js_val *, js_args *, eval_state *);
 js_val * gc_spy(js_val *, js_args *, eval_state *);
 
 js_val * bootstrap_gc(void);
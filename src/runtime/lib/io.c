@@ -0,0 +1,298 @@
+// io.c
+// ----
+// The `io` property of the global object (non-standard): file descriptors
+// for the event loop. A callback given to io.watch runs, after the script,
+// whenever its descriptor is ready; io.read and io.write then make a single
+// system call each, so they don't block on a ready descriptor. Sockets are
+// made non-blocking, and errors are thrown as Errors with the system's
+// message. A write to a pipe or socket whose reader has gone throws
+// 'write: Broken pipe' rather than letting SIGPIPE end the process.
+
+// getaddrinfo is POSIX.1-2001, beyond what -D_XOPEN_SOURCE asks for.
+#define _POSIX_C_SOURCE 200112L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "io.h"
+#include "../../loop.h"
+#include "../../output.h"
+
+#define IO_READ_SIZE 65536      // bytes io.read asks for by default
+#define IO_BACKLOG 64           // connections io.listen queues
+
+static int
+fd_arg(js_args *args, int n, eval_state *state)
+{
+  js_val *fd = TO_NUM(ARG(args, n));
+  if (fd->number.is_nan || fd->number.val < 0 || fd->number.val > INT_MAX)
+    fh_throw(state, fh_new_error(E_TYPE, "invalid file descriptor"));
+  return (int)fd->number.val;
+}
+
+static void
+io_error(eval_state *state, const char *call)
+{
+  fh_throw(state, fh_new_error(E_ERROR, "%s: %s", call, strerror(errno)));
+}
+
+static bool
+would_block()
+{
+  return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+static int
+non_blocking(int fd)
+{
+  int flags = fcntl(fd, F_GETFL);
+  return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* write(), but failing with EPIPE instead of raising SIGPIPE. */
+static ssize_t
+write_nosignal(int fd, const char *buf, size_t len)
+{
+  struct sigaction ignore, old;
+  ssize_t n;
+
+#ifdef MSG_NOSIGNAL
+  n = send(fd, buf, len, MSG_NOSIGNAL);
+  if (n >= 0 || errno != ENOTSOCK) return n;
+#endif
+  // Not a socket: ignore the signal for this one call. A SIGPIPE raised
+  // while it's ignored is discarded.
+  memset(&ignore, 0, sizeof(ignore));
+  ignore.sa_handler = SIG_IGN;
+  sigemptyset(&ignore.sa_mask);
+  sigaction(SIGPIPE, &ignore, &old);
+  n = write(fd, buf, len);
+  int err = errno;
+  sigaction(SIGPIPE, &old, NULL);
+  errno = err;
+  return n;
+}
+
+// io.watch(fd, mode, callback)
+//
+// Calls callback(fd) whenever fd is ready to read, or to write, as mode is
+// 'read' or 'write'. Returns an id for io.unwatch.
+js_val *
+io_watch(js_val *instance, js_args *args, eval_state *state)
+{
+  int fd = fd_arg(args, 0, state);
+  js_val *mode = TO_STR(ARG(args, 1));
+  js_val *callback = ARG(args, 2);
+  short events = POLLIN;
+
+  if (STREQ(mode->string.ptr, "write"))
+    events = POLLOUT;
+  else if (!STREQ(mode->string.ptr, "read"))
+    fh_throw(state, fh_new_error(E_TYPE, "mode must be 'read' or 'write'"));
+  if (!IS_FUNC(callback))
+    fh_throw(state, fh_new_error(E_TYPE, "callback must be a function"));
+
+  return JSNUM(fh_loop_watch(state->ctx, fd, events, callback));
+}
+
+// io.unwatch(id)
+js_val *
+io_unwatch(js_val *instance, js_args *args, eval_state *state)
+{
+  js_val *id = TO_NUM(ARG(args, 0));
+  if (id->number.is_nan || id->number.val < 1) return JSBOOL(0);
+  return JSBOOL(fh_loop_cancel((unsigned long)id->number.val));
+}
+
+// io.read(fd[, size])
+//
+// Up to size bytes (65536 by default), '' at the end of the input, or
+// undefined if there's nothing to read yet.
+js_val *
+io_read(js_val *instance, js_args *args, eval_state *state)
+{
+  int fd = fd_arg(args, 0, state);
+  js_val *size = TO_NUM(ARG(args, 1));
+  size_t len = IO_READ_SIZE;
+  if (!size->number.is_nan && size->number.val >= 1)
+    len = size->number.val;
+
+  char *buf = malloc(len);
+  ssize_t n = read(fd, buf, len);
+  if (n < 0) {
+    int err = errno;
+    free(buf);
+    errno = err;
+    if (would_block()) return JSUNDEF();
+    io_error(state, "read");
+  }
+  js_val *str = JSSTRN(buf, n);
+  free(buf);
+  return str;
+}
+
+// io.write(fd, string)
+//
+// The number of bytes written, which may be fewer than the string has, or
+// undefined if there's no room for any yet.
+js_val *
+io_write(js_val *instance, js_args *args, eval_state *state)
+{
+  int fd = fd_arg(args, 0, state);
+  js_val *str = TO_STR(ARG(args, 1));
+
+  // Keep the order of what console.log has buffered.
+  if (fd == STDOUT_FILENO || fd == STDERR_FILENO)
+    fh_output_flush();
+
+  ssize_t n = write_nosignal(fd, str->string.ptr, str->string.length);
+  if (n < 0) {
+    if (would_block()) return JSUNDEF();
+    io_error(state, "write");
+  }
+  return JSNUM(n);
+}
+
+// io.close(fd)
+js_val *
+io_close(js_val *instance, js_args *args, eval_state *state)
+{
+  if (close(fd_arg(args, 0, state)) < 0)
+    io_error(state, "close");
+  return JSUNDEF();
+}
+
+// io.pipe()
+//
+// A new pipe, as [readFd, writeFd]. Both ends are non-blocking.
+js_val *
+io_pipe(js_val *instance, js_args *args, eval_state *state)
+{
+  int fds[2];
+  if (pipe(fds) < 0) io_error(state, "pipe");
+  non_blocking(fds[0]);
+  non_blocking(fds[1]);
+
+  js_val *pair = JSARR();
+  fh_set_elem(pair, 0, JSNUM(fds[0]));
+  fh_set_elem(pair, 1, JSNUM(fds[1]));
+  fh_set_len(pair, 2);
+  return pair;
+}
+
+/* The addresses of host (any, if NULL) and port, for a TCP socket. */
+static struct addrinfo *
+resolve(const char *host, js_val *port, bool passive, eval_state *state)
+{
+  struct addrinfo hints, *res;
+  char service[16];
+  int err;
+
+  if (port->number.is_nan || port->number.val < 0 || port->number.val > 65535)
+    fh_throw(state, fh_new_error(E_RANGE, "invalid port"));
+  snprintf(service, sizeof(service), "%d", (int)port->number.val);
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = passive ? AI_PASSIVE : 0;
+  if ((err = getaddrinfo(host, service, &hints, &res)) != 0)
+    fh_throw(state, fh_new_error(E_ERROR, "%s: %s", host ? host : "*",
+          gai_strerror(err)));
+  return res;
+}
+
+// io.listen(port[, host])
+//
+// A socket accepting TCP connections on port, of any address or of host's.
+js_val *
+io_listen(js_val *instance, js_args *args, eval_state *state)
+{
+  js_val *host = ARG(args, 1);
+  struct addrinfo *res = resolve(IS_UNDEF(host) ? NULL : TO_STR(host)->string.ptr,
+      TO_NUM(ARG(args, 0)), true, state);
+  int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol), on = 1;
+
+  if (fd >= 0) {
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(fd, res->ai_addr, res->ai_addrlen) < 0 ||
+        listen(fd, IO_BACKLOG) < 0 || non_blocking(fd) < 0) {
+      int err = errno;
+      close(fd);
+      errno = err;
+      fd = -1;
+    }
+  }
+  freeaddrinfo(res);
+  if (fd < 0) io_error(state, "listen");
+  return JSNUM(fd);
+}
+
+// io.accept(fd)
+//
+// The socket of the next connection to a listening socket, or undefined if
+// none is waiting.
+js_val *
+io_accept(js_val *instance, js_args *args, eval_state *state)
+{
+  int fd = accept(fd_arg(args, 0, state), NULL, NULL);
+  if (fd < 0) {
+    if (would_block() || errno == ECONNABORTED) return JSUNDEF();
+    io_error(state, "accept");
+  }
+  non_blocking(fd);
+  return JSNUM(fd);
+}
+
+// io.connect(host, port)
+//
+// A socket connecting to host on port. The connection is made in the
+// background: watch the socket for 'write' to know when it's done.
+js_val *
+io_connect(js_val *instance, js_args *args, eval_state *state)
+{
+  struct addrinfo *res = resolve(TO_STR(ARG(args, 0))->string.ptr,
+      TO_NUM(ARG(args, 1)), false, state);
+  int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+
+  if (fd >= 0 && (non_blocking(fd) < 0 ||
+      (connect(fd, res->ai_addr, res->ai_addrlen) < 0 && errno != EINPROGRESS))) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  if (fd < 0) io_error(state, "connect");
+  return JSNUM(fd);
+}
+
+js_val *
+bootstrap_io()
+{
+  js_val *io = JSOBJ();
+
+  DEF(io, "stdin", JSNUM(STDIN_FILENO));
+  DEF(io, "stdout", JSNUM(STDOUT_FILENO));
+  DEF(io, "stderr", JSNUM(STDERR_FILENO));
+
+  DEF(io, "watch", JSNFUNC(io_watch, 3));
+  DEF(io, "unwatch", JSNFUNC(io_unwatch, 1));
+  DEF(io, "read", JSNFUNC(io_read, 2));
+  DEF(io, "write", JSNFUNC(io_write, 2));
+  DEF(io, "close", JSNFUNC(io_close, 1));
+  DEF(io, "pipe", JSNFUNC(io_pipe, 0));
+  DEF(io, "listen", JSNFUNC(io_listen, 2));
+  DEF(io, "accept", JSNFUNC(io_accept, 1));
+  DEF(io, "connect", JSNFUNC(io_connect, 2));
+
+  fh_attach_prototype(io, fh->function_proto);
+
+  return io;
+}
@@ -0,0 +1,21 @@
+// io.h
+// ----
+
+#ifndef JS_IO_H
+#define JS_IO_H
+
+#include "../runtime.h"
+
+js_val * io_watch(js_val *, js_args *, eval_state *);
+js_val * io_unwatch(js_val *, js_args *, eval_state *);
+js_val * io_read(js_val *, js_args *, eval_state *);
+js_val * io_write(js_val *, js_args *, eval_state *);
+js_val * io_close(js_val *, js_args *, eval_state *);
+js_val * io_pipe(js_val *, js_args *, eval_state *);
+js_val * io_listen(js_val *, js_args *, eval_state *);
+js_val * io_accept(js_val *, js_args *, eval_state *);
+js_val * io_connect(js_val *, js_args *, eval_state *);
+
+js_val * bootstrap_io(void);
+
+#endif
@@ -0,0 +1,357 @@
+// parallel.c
+// ----------
+// The `parallel` property of the global object (non-standard): mapping over
+// an array on several cores at once.
+//
+// The workers are forked copies of the process, each an isolate with its own
+// heap, made at the call. As copies, they already have the array and the
+// callback, closure and all, so only indices are sent to them, and only the
+// results, as structured clones (see clone.c), come back. Interpreter state
+// such as atoms and the parser is shared by the threads of a process, which
+// is why the workers don't run on threads of this one.
+//
+// The array is cut into several chunks per worker, handed out one at a time
+// to whichever worker is free, so a slow chunk doesn't hold the others up.
+// What a callback changes other than its result stays in its worker.
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "parallel.h"
+#include "../../clone.h"
+#include "../../output.h"
+
+#define PARALLEL_MAX_WORKERS 64
+#define PARALLEL_CHUNKS 8           // chunks per worker
+
+typedef struct {
+  pid_t pid;
+  int to;                           // chunks to the worker
+  int from;                         // results from it
+  bool busy;
+} worker;
+
+// What a worker sends back for each chunk, ahead of the clones.
+typedef struct {
+  bool ok;                          // else the payload is an error message
+  unsigned long start;
+  unsigned long count;
+  size_t len;
+} chunk_header;
+
+static bool
+read_full(int fd, void *buf, size_t len)
+{
+  char *p = buf;
+  while (len) {
+    ssize_t n = read(fd, p, len);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool
+write_full(int fd, const void *buf, size_t len)
+{
+  const char *p = buf;
+  while (len) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static void
+send_result(int fd, bool ok, unsigned long start, unsigned long count,
+    fh_strbuf *buf)
+{
+  chunk_header head = {ok, start, count, buf->len};
+  if (!write_full(fd, &head, sizeof(head)) || !write_full(fd, buf->buf, buf->len))
+    _exit(1);
+}
+
+/* A worker's life: map each range of the array it's sent, until the pipe is
+ * closed. An error ends it, after it's been sent back. Its catch frame is the
+ * outermost, as the parent's try statements (and the REPL) can't be unwound
+ * to from here, and it leaves only with _exit. */
+static void
+worker_main(int in, int out, js_val *array, js_val *callback, js_val *ctx)
+{
+  unsigned long range[2], i;
+  fh_strbuf buf;
+  js_args args;
+
+  fh->forked_worker = true;
+  fh->catches = NULL;
+
+  while (read_full(in, range, sizeof(range))) {
+    fh_strbuf_init(&buf);
+
+    eval_state *state = fh_new_state(0, 0);
+    fh_catch c;
+    state->ctx = ctx;
+    fh_push_state(state);
+    fh_catch_push(&c);
+    if (setjmp(c.jmp)) {
+      js_val *err = c.error;
+      js_val *msg = TO_STR(fh_to_primitive(err, T_STRING));
+      fh_strbuf text;
+      fh_output_flush();
+      fh_strbuf_init(&text);
+      fh_strbuf_append(&text, msg->string.ptr, msg->string.length);
+      send_result(out, false, range[0], 0, &text);
+      _exit(1);
+    }
+
+    for (i = range[0]; i < range[1]; i++) {
+      args_init(&args);
+      args_append(&args, fh_get_index(array, i));
+      args_append(&args, JSNUM(i));
+      args_append(&args, array);
+      fh_clone_write(&buf, fh_call(ctx, JSUNDEF(), callback, &args), state);
+    }
+    fh_catch_pop(&c);
+    fh_pop_state();
+
+    fh_output_flush();
+    send_result(out, true, range[0], range[1] - range[0], &buf);
+    free(buf.buf);
+  }
+  _exit(0);
+}
+
+static int
+default_workers()
+{
+#ifdef _SC_NPROCESSORS_ONLN
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  if (n > 0) return n;
+#endif
+  return 1;
+}
+
+/* Stop the workers still running, and wait for all of them. */
+static void
+end_workers(worker *workers, int n, bool kill_them)
+{
+  int i;
+  for (i = 0; i < n; i++) {
+    if (workers[i].to >= 0) close(workers[i].to);
+    if (workers[i].from >= 0) close(workers[i].from);
+    if (kill_them) kill(workers[i].pid, SIGKILL);
+  }
+  for (i = 0; i < n; i++)
+    waitpid(workers[i].pid, NULL, 0);
+}
+
+/* Fork `n` workers, or as many as can be made. Returns how many. */
+static int
+start_workers(worker *workers, int n, js_val *array, js_val *callback,
+    js_val *ctx)
+{
+  int i, j, to[2], from[2];
+
+  // A child would print what's buffered again.
+  fh_output_flush();
+  fflush(stdout);
+  fflush(stderr);
+
+  for (i = 0; i < n; i++) {
+    if (pipe(to) < 0) break;
+    if (pipe(from) < 0) {
+      close(to[0]);
+      close(to[1]);
+      break;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+      close(to[0]); close(to[1]); close(from[0]); close(from[1]);
+      break;
+    }
+    if (pid == 0) {
+      for (j = 0; j < i; j++) {
+        close(workers[j].to);
+        close(workers[j].from);
+      }
+      close(to[1]);
+      close(from[0]);
+      worker_main(to[0], from[1], array, callback, ctx);
+    }
+    close(to[0]);
+    close(from[1]);
+    workers[i].pid = pid;
+    workers[i].to = to[1];
+    workers[i].from = from[0];
+    workers[i].busy = false;
+  }
+  return i;
+}
+
+static bool
+send_chunk(worker *w, unsigned long *next, unsigned long len,
+    unsigned long chunk)
+{
+  unsigned long range[2];
+  if (*next >= len) {
+    close(w->to);
+    w->to = -1;
+    return true;
+  }
+  range[0] = *next;
+  range[1] = *next + chunk < len ? *next + chunk : len;
+  *next = range[1];
+  w->busy = true;
+  return write_full(w->to, range, sizeof(range));
+}
+
+/* Read a worker's result into `map`. Returns NULL, or the error to throw. */
+static js_val *
+receive_chunk(worker *w, js_val *map)
+{
+  chunk_header head;
+  const char *p, *end;
+  unsigned long i;
+  js_val *val, *err = NULL;
+
+  w->busy = false;
+  if (!read_full(w->from, &head, sizeof(head)))
+    return fh_new_error(E_ERROR, "parallel.map: a worker exited");
+
+  char *payload = malloc(head.len + 1);
+  if (!read_full(w->from, payload, head.len)) {
+    free(payload);
+    return fh_new_error(E_ERROR, "parallel.map: a worker exited");
+  }
+  payload[head.len] = '\0';
+
+  if (!head.ok)
+    err = fh_new_error(E_ERROR, "parallel.map: %s", payload);
+  for (p = payload, end = payload + head.len, i = 0; !err && i < head.count; i++) {
+    if (!(val = fh_clone_read(&p, end)))
+      err = fh_new_error(E_ERROR, "parallel.map: a result was cut short");
+    else
+      fh_set_elem(map, head.start + i, val);
+  }
+  free(payload);
+  return err;
+}
+
+// parallel.map(array, callback[, options])
+//
+// Like Array.prototype.map, with the callback run in worker processes. The
+// options can set `workers`, which is the number of cores by default. The
+// results, and the callback's errors, are copied back as plain data.
+js_val *
+parallel_map(js_val *instance, js_args *args, eval_state *state)
+{
+  js_val *array = ARG(args, 0), *callback = ARG(args, 1), *options = ARG(args, 2);
+  int n = default_workers(), num_workers, i;
+
+  if (!IS_ARR(array))
+    fh_throw(state, fh_new_error(E_TYPE, "parallel.map needs an array"));
+  if (!IS_FUNC(callback))
+    fh_throw(state, fh_new_error(E_TYPE, "callback must be a function"));
+  if (IS_OBJ(options)) {
+    js_val *opt = fh_get(options, "workers");
+    if (!IS_UNDEF(opt)) {
+      double d = TO_NUM(opt)->number.val;
+      if (!(d >= 1))
+        fh_throw(state, fh_new_error(E_RANGE, "workers must be at least 1"));
+      n = d < PARALLEL_MAX_WORKERS ? d : PARALLEL_MAX_WORKERS;
+    }
+  }
+
+  unsigned long len = array->object.length, next = 0;
+  unsigned long chunk = len / ((unsigned long)n * PARALLEL_CHUNKS);
+  if (chunk == 0) chunk = 1;
+  if ((unsigned long)n > (len + chunk - 1) / chunk)
+    n = (len + chunk - 1) / chunk;
+
+  // A single worker would only add the copying.
+  js_val *map = JSARR();
+  if (n <= 1) {
+    js_args cbargs;
+    unsigned long k;
+    for (k = 0; k < len; k++) {
+      args_init(&cbargs);
+      args_append(&cbargs, fh_get_index(array, k));
+      args_append(&cbargs, JSNUM(k));
+      args_append(&cbargs, array);
+      fh_set_elem(map, k, fh_call(state->ctx, JSUNDEF(), callback, &cbargs));
+    }
+    fh_set_len(map, len);
+    return map;
+  }
+
+  worker *workers = malloc(n * sizeof(worker));
+  struct pollfd *fds = malloc(n * sizeof(struct pollfd));
+  struct sigaction ignore, prev;
+  js_val *err = NULL;
+
+  num_workers = start_workers(workers, n, array, callback, state->ctx);
+  if (num_workers == 0)
+    err = fh_new_error(E_ERROR, "parallel.map: %s", strerror(errno));
+
+  // A worker that dies is an error to throw, not a signal to die of.
+  memset(&ignore, 0, sizeof(ignore));
+  ignore.sa_handler = SIG_IGN;
+  sigemptyset(&ignore.sa_mask);
+  sigaction(SIGPIPE, &ignore, &prev);
+
+  for (i = 0; i < num_workers && !err; i++)
+    if (!send_chunk(&workers[i], &next, len, chunk))
+      err = fh_new_error(E_ERROR, "parallel.map: a worker exited");
+
+  while (!err) {
+    int busy = 0;
+    for (i = 0; i < num_workers; i++) {
+      fds[i].fd = workers[i].busy ? workers[i].from : -1;
+      fds[i].events = POLLIN;
+      fds[i].revents = 0;
+      busy += workers[i].busy;
+    }
+    if (!busy) break;
+    if (poll(fds, num_workers, -1) < 0) {
+      if (errno == EINTR) continue;
+      err = fh_new_error(E_ERROR, "parallel.map: %s", strerror(errno));
+      break;
+    }
+    for (i = 0; i < num_workers && !err; i++) {
+      if (!fds[i].revents) continue;
+      if (!(err = receive_chunk(&workers[i], map)) &&
+          !send_chunk(&workers[i], &next, len, chunk))
+        err = fh_new_error(E_ERROR, "parallel.map: a worker exited");
+    }
+  }
+
+  end_workers(workers, num_workers, err != NULL);
+  sigaction(SIGPIPE, &prev, NULL);
+  free(workers);
+  free(fds);
+  if (err) fh_throw(state, err);
+
+  fh_set_len(map, len);
+  return map;
+}
+
+js_val *
+bootstrap_parallel()
+{
+  js_val *parallel = JSOBJ();
+
+  DEF(parallel, "map", JSNFUNC(parallel_map, 2));
+
+  fh_attach_prototype(parallel, fh->function_proto);
+
+  return parallel;
+}
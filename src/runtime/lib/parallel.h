@@ -0,0 +1,13 @@
+// parallel.h
+// ----------
+
+#ifndef JS_PARALLEL_H
+#define JS_PARALLEL_H
+
+#include "../runtime.h"
+
+js_val * parallel_map(js_val *, js_args *, eval_state *);
+
+js_val * bootstrap_parallel(void);
+
+#endif
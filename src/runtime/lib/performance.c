@@ -0,0 +1,44 @@
+// performance.c
+// -------------
+// The `performance` property of the global object: a high resolution clock
+// for timing scripts from within, and a way to tally samples under a name
+// without printing each (see also console.time and console.timeReport).
+
+#include "performance.h"
+
+// performance.now()
+//
+// Milliseconds since the runtime started, on a monotonic clock, with
+// fractions down to the clock's resolution.
+js_val *
+performance_now(js_val *instance, js_args *args, eval_state *state)
+{
+  return JSNUM(fh_clock_ms() - fh->clock_origin);
+}
+
+// performance.sample(name, ms)   Non-standard
+//
+// Adds a sample to the named timer, as console.timeEnd does, but quietly.
+js_val *
+performance_sample(js_val *instance, js_args *args, eval_state *state)
+{
+  js_val *name = TO_STR(ARG(args, 0));
+  js_val *ms = TO_NUM(ARG(args, 1));
+  if (ms->number.is_nan)
+    fh_throw(state, fh_new_error(E_TYPE, "sample must be a number"));
+  fh_timer_sample(fh_get_timer(name->string.ptr), ms->number.val);
+  return JSUNDEF();
+}
+
+js_val *
+bootstrap_performance()
+{
+  js_val *performance = JSOBJ();
+
+  DEF(performance, "now", JSNFUNC(performance_now, 0));
+  DEF(performance, "sample", JSNFUNC(performance_sample, 2));
+
+  fh_attach_prototype(performance, fh->function_proto);
+
+  return performance;
+}
@@ -0,0 +1,14 @@
+// performance.h
+// -------------
+
+#ifndef JS_PERFORMANCE_H
+#define JS_PERFORMANCE_H
+
+#include "../runtime.h"
+
+js_val * performance_now(js_val *, js_args *, eval_state *);
+js_val * performance_sample(js_val *, js_args *, eval_state *);
+
+js_val * bootstrap_performance(void);
+
+#endif
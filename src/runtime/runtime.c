@@ -18,15 +18,22 @@
 
 #include <math.h>
 #include <unistd.h>
-#include <ctype.h>
+#include <string.h>
+#include <sys/stat.h>
 
 #include "runtime.h"
 #include "lib/console.h"
 #include "lib/gc.h"
 #include "lib/Math.h"
+#include "lib/JSON.h"
+#include "lib/performance.h"
+#include "lib/io.h"
+#include "lib/fs.h"
+#include "lib/parallel.h"
 #include "lib/Object.h"
 #include "lib/Function.h"
 #include "lib/Array.h"
+#include "lib/TypedArray.h"
 #include "lib/String.h"
 #include "lib/Number.h"
 #include "lib/Boolean.h"
@@ -62,69 +69,40 @@ radix_val(char x)
   return 36;
 }
 
-static char *
-slice_with_free(char *input, unsigned start, unsigned end)
-{
-  char *tmp = input;
-  input = fh_str_slice(input, start, end);
-  free(tmp);
-  return input;
-}
-
 // parseInt(string[, radix])
 js_val *
 global_parse_int(js_val *instance, js_args *args, eval_state *state)
 {
-  char *input = TO_STR(ARG(args, 0))->string.ptr;
-  js_val *radix = TO_INT32(ARG(args, 1));
-
-  int sign = 1;
-  unsigned len = strlen(input);
-  unsigned offset = 0;
-
-  while (isspace(input[offset]) && offset < len)
-    offset++;
-  char *s = fh_str_slice(input, offset, len);
-  len = strlen(s);
-  if (len > 0 && s[0] == '-')
-    sign = -1;
-  if (len > 0 && (s[0] == '-' || s[0] == '+')) {
-    s = slice_with_free(s, 1, len);
-    len = strlen(s);
-  }
-
+  js_val *input = TO_STR(ARG(args, 0));
+  long radix = TO_INT32(ARG(args, 1))->number.val;
+  char *s = input->string.ptr;
+  size_t len = input->string.length, i = fh_str_space_prefix(s, len), start;
   bool strip_prefix = true;
-  unsigned r = 10;
-  if (radix->number.val != 0) {
-    if (radix->number.val < 2 || radix->number.val > 32)
+  double sign = 1, sum = 0;
+
+  if (i < len && (s[i] == '-' || s[i] == '+'))
+    sign = s[i++] == '-' ? -1 : 1;
+
+  if (radix != 0) {
+    if (radix < 2 || radix > 36)
       return JSNAN();
-    if (radix->number.val != 16)
-      strip_prefix = false;
-    r = radix->number.val;
+    strip_prefix = radix == 16;
   }
+  else radix = 10;
 
-  if (strip_prefix) {
-    if (len >= 2 && s[0] == '0' && (s[1] == 'X' || s[1] == 'x')) {
-      s = slice_with_free(s, 2, len);
-      len = strlen(s);
-      r = 16;
-    }
+  if (strip_prefix && len - i >= 2 && s[i] == '0' && (s[i + 1] == 'X' || s[i + 1] == 'x')) {
+    i += 2;
+    radix = 16;
   }
 
-  for (offset = 0; offset < len; offset++)
-    if (radix_val(s[offset]) > r) break;
-
-  if (offset == 0)
+  for (start = i; i < len && radix_val(s[i]) < radix; i++)
+    sum = sum * radix + radix_val(s[i]);
+  if (i == start)
     return JSNAN();
-  else {
-    s = slice_with_free(s, 0, offset);
-    len = strlen(s);
-  }
 
-  double sum = 0;
-  unsigned i;
-  for (i = 0; i < len; i++)
-    sum += radix_val(s[i]) * pow(r, len - i - 1);
+  // Long decimals would be rounded at every digit; strtod rounds once.
+  if (radix == 10 && i - start > 15)
+    fh_num_parse_prefix(s + start, i - start, &sum);
 
   return JSNUM(sign * sum);
 }
@@ -133,7 +111,13 @@ global_parse_int(js_val *instance, js_args *args, eval_state *state)
 js_val *
 global_parse_float(js_val *instance, js_args *args, eval_state *state)
 {
-  return TO_NUM(ARG(args, 0));
+  js_val *input = TO_STR(ARG(args, 0));
+  size_t start = fh_str_space_prefix(input->string.ptr, input->string.length);
+  double val;
+
+  if (!fh_num_parse_prefix(input->string.ptr + start, input->string.length - start, &val))
+    return JSNAN();
+  return JSNUM(val);
 }
 
 // eval(string)
@@ -154,35 +138,44 @@ global_print(js_val *instance, js_args *args, eval_state *state)
   return JSUNDEF();
 }
 
-static int
-load_file(char *name)
+static js_val *
+set_timer(js_args *args, eval_state *state, bool repeat)
 {
-  if (access(name, R_OK) == -1)
-    return -1;
-
-  FILE *file = fopen(name, "r");
-
-  fseek(file, 0, SEEK_END); 
-  unsigned size = ftell(file);
-  fseek(file, 0, SEEK_SET);
+  js_val *callback = ARG(args, 0);
+  js_args rest;
+
+  if (!IS_FUNC(callback))
+    fh_throw(state, fh_new_error(E_TYPE, "callback must be a function"));
+  args_slice(&rest, args, 2);
+  return JSNUM(fh_loop_timer(state->ctx, callback,
+        TO_NUM(ARG(args, 1))->number.val, repeat, &rest));
+}
 
-  char *fcontent = malloc(size + 1);
-  size_t result = fread(fcontent, 1, size, file); 
-  fclose(file);
+// setTimeout(callback, delay[, arg1[, arg2[, ...]]])
+//
+// Calls the callback with the arguments after the script, once `delay` ms
+// have passed. Returns an id for clearTimeout.
+js_val *
+global_set_timeout(js_val *instance, js_args *args, eval_state *state)
+{
+  return set_timer(args, state, false);
+}
 
-  if (result != size) {
-    if (fcontent != NULL)
-      free(fcontent);
-    return -1;
-  }
+// setInterval(callback, delay[, arg1[, arg2[, ...]]])
+js_val *
+global_set_interval(js_val *instance, js_args *args, eval_state *state)
+{
+  return set_timer(args, state, true);
+}
 
-  char *prev_script = fh->script_name;
-  fh->script_name = name;
-  fcontent[size] = '\0';
-  fh_eval_string(fcontent, fh->global);
-  free(fcontent);
-  fh->script_name = prev_script;
-  return 0;
+// clearTimeout(id), clearInterval(id)
+js_val *
+global_clear_timeout(js_val *instance, js_args *args, eval_state *state)
+{
+  js_val *id = TO_NUM(ARG(args, 0));
+  if (!id->number.is_nan && id->number.val >= 1)
+    fh_loop_cancel((unsigned long)id->number.val);
+  return JSUNDEF();
 }
 
 // load(filename)
@@ -194,12 +187,149 @@ global_load(js_val *instance, js_args *args, eval_state *state)
 {
   unsigned i;
   for (i = 0; i < ARGLEN(args); i++) {
-    if (load_file(TO_STR(ARG(args, i))->string.ptr) == -1)
+    if (!fh_eval_path(TO_STR(ARG(args, i))->string.ptr, fh->global))
       fh_throw(state, fh_new_error(E_ERROR, "File could not be read"));
   }
   return JSUNDEF();
 }
 
+/* Make `name` absolute, relative to the directory of the running script, and
+ * drop its "." and ".." segments. */
+static char *
+module_path(char *name)
+{
+  char *base = NULL, *slash = strrchr(fh->script_name, '/');
+  size_t cap = 256;
+
+  if (name[0] == '/')
+    base = calloc(1, 1);
+  else if (slash && fh->script_name[0] == '/') {
+    base = malloc(slash - fh->script_name + 1);
+    memcpy(base, fh->script_name, slash - fh->script_name);
+    base[slash - fh->script_name] = '\0';
+  }
+  else {
+    base = malloc(cap);
+    while (!getcwd(base, cap))
+      base = realloc(base, cap *= 2);
+    if (slash) {
+      size_t len = strlen(base), dir = slash - fh->script_name;
+      base = realloc(base, len + dir + 2);
+      base[len] = '/';
+      memcpy(base + len + 1, fh->script_name, dir);
+      base[len + dir + 1] = '\0';
+    }
+  }
+
+  size_t len = strlen(base) + strlen(name) + 2;
+  char *joined = malloc(len), *path = malloc(len + 1);
+  snprintf(joined, len, "%s/%s", base, name);
+  free(base);
+
+  // Copy over the segments, backing up for each "..".
+  size_t out = 0;
+  char *seg = strtok(joined, "/");
+  for (; seg; seg = strtok(NULL, "/")) {
+    if (STREQ(seg, ".")) continue;
+    if (STREQ(seg, "..")) {
+      while (out > 0 && path[--out] != '/');
+      continue;
+    }
+    path[out++] = '/';
+    strcpy(path + out, seg);
+    out += strlen(seg);
+  }
+  if (out == 0) path[out++] = '/';
+  path[out] = '\0';
+  free(joined);
+  return path;
+}
+
+/* The file a module name refers to, as an atom, or NULL if there's none. */
+static char *
+resolve_module(char *name)
+{
+  struct stat st;
+  char *path = module_path(name), *res = NULL;
+  size_t len = strlen(path);
+
+  if (stat(path, &st) == 0 && S_ISREG(st.st_mode))
+    res = fh_intern(path);
+  else {
+    path = realloc(path, len + 4);
+    strcpy(path + len, ".js");
+    if (stat(path, &st) == 0 && S_ISREG(st.st_mode))
+      res = fh_intern(path);
+  }
+  free(path);
+  return res;
+}
+
+/* Functions a module exports keep its scope, as a function returned from a
+ * call keeps the scope of that call. */
+static void
+capture_module_scope(js_val *val, js_val *scope)
+{
+  if (IS_FUNC(val) && !val->object.native && !val->object.scope) {
+    GC_BARRIER(val, scope);
+    val->object.scope = scope;
+  }
+}
+
+// require(name)
+//
+// Load a CommonJS module and return its exports. The name is a path, relative
+// to the script calling require, with or without the ".js". Each module runs
+// once, in a scope of its own with `module`, `exports` and `__filename`, and
+// is kept in require.cache under its resolved path.
+js_val *
+global_require(js_val *instance, js_args *args, eval_state *state)
+{
+  js_val *name = TO_STR(ARG(args, 0));
+  char *path = resolve_module(name->string.ptr);
+  if (!path)
+    fh_throw(state, fh_new_error(E_ERROR, "Cannot find module '%s'", name->string.ptr));
+
+  js_val *module = fh_get(fh->modules, path);
+  if (IS_OBJ(module)) {
+    fh->module_cache.hits++;
+    return fh_get(module, "exports");
+  }
+  fh->module_cache.misses++;
+
+  // Cached before it runs, so modules that require each other get the
+  // exports so far rather than looping.
+  js_val *exports = JSOBJ();
+  module = JSOBJ();
+  fh_set(module, "id", JSSTR(path));
+  fh_set(module, "exports", exports);
+  fh_set(module, "loaded", JSBOOL(false));
+  fh_set(fh->modules, path, module);
+
+  js_val *scope = JSOBJ();
+  GC_BARRIER(scope, fh->global);
+  scope->object.parent = fh->global;
+  fh_set(scope, "this", exports);
+  fh_set(scope, "module", module);
+  fh_set(scope, "exports", exports);
+  fh_set(scope, "__filename", JSSTR(path));
+
+  if (!fh_eval_path(path, scope)) {
+    fh_del_prop(fh->modules, path);
+    fh_throw(state, fh_new_error(E_ERROR, "File could not be read"));
+  }
+  fh_set(module, "loaded", JSBOOL(true));
+
+  js_prop *prop;
+  exports = fh_get(module, "exports");
+  capture_module_scope(exports, scope);
+  if (IS_OBJ(exports)) {
+    OBJ_ITER(exports, prop)
+      if (prop->ptr) capture_module_scope(prop->ptr, scope);
+  }
+  return exports;
+}
+
 // Helper function that attaches a given prototype to all properties of the
 // given object that are native functions.
 void
@@ -228,7 +358,12 @@ fh_bootstrap()
   DEF(global, "RegExp",   bootstrap_regexp());
   DEF(global, "Error",    bootstrap_error(global));
   DEF(global, "Math",     bootstrap_math());
+  DEF(global, "JSON",     bootstrap_json());
   DEF(global, "console",  bootstrap_console());
+  DEF(global, "performance", bootstrap_performance());
+  DEF(global, "io",       bootstrap_io());
+  DEF(global, "fs",       bootstrap_fs());
+  DEF(global, "parallel", bootstrap_parallel());
 #ifdef FH_GC_EXPOSE
   DEF(global, "gc",       bootstrap_gc());
 #endif
@@ -247,15 +382,8 @@ fh_bootstrap()
   DEF(global, "undefined", JSUNDEF());
   DEF(global, "this",      global);
 
-  // These aren't currently optimized, just here for compatibility's sake.
-  DEF(global, "Float32Array", JSNFUNC(arr_new, 1));
-  DEF(global, "Float64Array", JSNFUNC(arr_new, 1));
-  DEF(global, "Uint8Array",   JSNFUNC(arr_new, 1));
-  DEF(global, "Uint16Array",  JSNFUNC(arr_new, 1));
-  DEF(global, "Uint32Array",  JSNFUNC(arr_new, 1));
-  DEF(global, "Int8Array",    JSNFUNC(arr_new, 1));
-  DEF(global, "Int16Array",   JSNFUNC(arr_new, 1));
-  DEF(global, "Int32Array",   JSNFUNC(arr_new, 1));
+  // ArrayBuffer and the typed array views.
+  bootstrap_typed_arrays(global);
 
   DEF(global, "isNaN",      JSNFUNC(global_is_nan, 1));
   DEF(global, "isFinite",   JSNFUNC(global_is_finite, 1));
@@ -268,5 +396,15 @@ fh_bootstrap()
   DEF(global, "load",       JSNFUNC(global_load, 1));
   DEF(global, "print",      JSNFUNC(global_print, 1));
 
+  DEF(global, "setTimeout",    JSNFUNC(global_set_timeout, 2));
+  DEF(global, "setInterval",   JSNFUNC(global_set_interval, 2));
+  DEF(global, "clearTimeout",  JSNFUNC(global_clear_timeout, 1));
+  DEF(global, "clearInterval", JSNFUNC(global_clear_timeout, 1));
+
+  js_val *require = JSNFUNC(global_require, 1);
+  fh->modules = JSOBJ();
+  DEF(require, "cache", fh->modules);
+  DEF(global, "require",    require);
+
   return global;
 }
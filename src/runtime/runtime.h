@@ -22,11 +22,15 @@
 #include "../flathead.h"
 #include "../props.h"
 #include "../str.h"
+#include "../numconv.h"
 #include "../regexp.h"
 #include "../debug.h"
 #include "../eval.h"
 #include "../gc.h"
 #include "../args.h"
+#include "../heapprof.h"
+#include "../timers.h"
+#include "../loop.h"
 
 js_val * global_is_nan(js_val *, js_args *, eval_state *);
 js_val * global_is_finite(js_val *, js_args *, eval_state *);
@@ -36,6 +40,10 @@ js_val * global_eval(js_val *, js_args *, eval_state *);
 js_val * global_gc(js_val *, js_args *, eval_state *);
 js_val * global_load(js_val *, js_args *, eval_state *);
 js_val * global_print(js_val *, js_args *, eval_state *);
+js_val * global_require(js_val *, js_args *, eval_state *);
+js_val * global_set_timeout(js_val *, js_args *, eval_state *);
+js_val * global_set_interval(js_val *, js_args *, eval_state *);
+js_val * global_clear_timeout(js_val *, js_args *, eval_state *);
 
 void fh_attach_prototype(js_val *, js_val *);
 js_val * fh_bootstrap(void);
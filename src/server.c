@@ -0,0 +1,333 @@
+/*
+ * server.c -- A fork server that runs scripts for its clients
+ *
+ * Copyright (c) 2012-2013 Nick Reynolds
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* `flat --server=SOCKET [lib.js ...]` bootstraps the runtime and loads the
+ * libraries once, then forks a child for each request, which runs the
+ * client's script with the client's stdio in a copy-on-write copy of the
+ * heap. Nothing is exec'd, linked, bootstrapped or loaded per script.
+ *
+ * The heap is collected before the first fork, so children don't start
+ * with a collection of the libraries' garbage. The server only accepts and
+ * waits: each connection's child reads the request itself, so a client slow
+ * to send one holds up no one else. The server keeps the connection of each
+ * running child, and a SIGCHLD (through a pipe, so poll() sees it) has it
+ * reap them and send their statuses. The server's own options (engine, heap
+ * sizes, quotas) apply to every script, and quotas are counted from each
+ * child's start.
+ *
+ * Scripts run as the server's user, so the socket is made readable and
+ * writable by that user alone, and a connection from any other is answered
+ * with status 1. */
+
+// struct ucred and SO_PEERCRED are GNU extensions.
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "flathead.h"
+#include "server.h"
+#include "gc.h"
+#include "loop.h"
+#include "output.h"
+#include "quota.h"
+
+typedef struct {
+  pid_t pid;
+  int conn;                     // where its exit status goes
+} server_child;
+
+static int sigchld_pipe[2];
+static server_child *children;
+static int num_children, children_cap;
+
+static void
+on_sigchld(int sig)
+{
+  int saved = errno;
+  if (write(sigchld_pipe[1], "", 1) < 0) {}   // full already: a wakeup's due
+  errno = saved;
+}
+
+/* Read a request from `conn`: its strings into `buf`, and its descriptors.
+ * Returns false for a malformed one, with no descriptors left open. */
+static bool
+recv_request(int conn, char *buf, char **dir, char **path, int *fds)
+{
+  char control[CMSG_SPACE(SERVER_NUM_FDS * sizeof(int))];
+  struct iovec iov = { buf, SERVER_MAX_REQUEST };
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  ssize_t n;
+  int i;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  while ((n = recvmsg(conn, &msg, 0)) < 0 && errno == EINTR);
+  if (n <= 0) return false;
+
+  bool got_fds = false;
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+      continue;
+    int num = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    int *passed = (int *)CMSG_DATA(cmsg);
+    for (i = 0; i < num; i++) {
+      if (!got_fds && num == SERVER_NUM_FDS) fds[i] = passed[i];
+      else close(passed[i]);
+    }
+    got_fds = got_fds || num == SERVER_NUM_FDS;
+  }
+
+  // Two strings, both ending in the message.
+  size_t dir_len = strnlen(buf, n);
+  bool ok = got_fds && !(msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) &&
+    dir_len + 1 < (size_t)n && buf[n - 1] == '\0';
+  if (!ok) {
+    if (got_fds)
+      for (i = 0; i < SERVER_NUM_FDS; i++) close(fds[i]);
+    return false;
+  }
+  *dir = buf;
+  *path = buf + dir_len + 1;
+  return true;
+}
+
+/* The child's side of a connection: read the request, take over the
+ * client's stdio, and run the script as `flat` would. A malformed request,
+ * or none in time, exits with status 1. */
+static void
+run_request(int listener, int conn)
+{
+  char buf[SERVER_MAX_REQUEST], *dir, *path;
+  struct timeval timeout = { SERVER_REQUEST_TIMEOUT, 0 };
+  int fds[SERVER_NUM_FDS], i;
+
+  // None of the server's descriptors, the other clients' included, are kept.
+  close(listener);
+  for (i = 0; i < num_children; i++)
+    close(children[i].conn);
+  close(sigchld_pipe[0]);
+  close(sigchld_pipe[1]);
+  signal(SIGCHLD, SIG_DFL);
+
+  setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  if (!recv_request(conn, buf, &dir, &path, fds))
+    exit(1);
+  close(conn);
+
+  // A passed descriptor may itself be 0, 1 or 2, if the server was started
+  // without them: move them all out of the way before any is replaced.
+  for (i = 0; i < SERVER_NUM_FDS; i++)
+    if (fds[i] < SERVER_NUM_FDS)
+      fds[i] = fcntl(fds[i], F_DUPFD, SERVER_NUM_FDS);
+  for (i = 0; i < SERVER_NUM_FDS; i++) {
+    if (fds[i] < 0) exit(1);
+    dup2(fds[i], i);
+    close(fds[i]);
+  }
+  fh_output_init();
+
+  if (chdir(dir) < 0) {
+    fprintf(stderr, "Can't change to the directory %s: %s\n", dir,
+        strerror(errno));
+    exit(1);
+  }
+
+  fh_quota_start();
+  if (!fh_eval_path(path, fh->global))
+    fh_throw(NULL, fh_new_error(E_ERROR, "invalid input file"));
+  fh_loop_run();
+  fh_output_flush();
+  exit(0);
+}
+
+/* Reply to a client with its script's exit status, and hang up. */
+static void
+reply(int conn, int32_t status)
+{
+  send(conn, &status, sizeof(status), MSG_NOSIGNAL);
+  close(conn);
+}
+
+static void
+serve_request(int listener, int conn)
+{
+  // Nothing buffered may be written twice.
+  fh_output_flush();
+  pid_t pid = fork();
+  if (pid == 0) run_request(listener, conn);
+
+  if (pid < 0) {
+    fprintf(stderr, "fork: %s\n", strerror(errno));
+    reply(conn, 1);
+    return;
+  }
+
+  if (num_children == children_cap) {
+    children_cap = children_cap ? children_cap * 2 : 16;
+    children = realloc(children, children_cap * sizeof(server_child));
+  }
+  children[num_children].pid = pid;
+  children[num_children].conn = conn;
+  num_children++;
+}
+
+/* Reap the children that have ended, and send their statuses. */
+static void
+reap_children()
+{
+  int status, i;
+  pid_t pid;
+
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+    for (i = 0; i < num_children && children[i].pid != pid; i++);
+    if (i == num_children) continue;
+    reply(children[i].conn, WIFEXITED(status) ?
+        WEXITSTATUS(status) : 128 + WTERMSIG(status));
+    children[i] = children[--num_children];
+  }
+}
+
+/* Is the process at the other end of `conn` run by our own user? */
+static bool
+peer_is_owner(int conn)
+{
+#ifdef SO_PEERCRED
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  return getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 &&
+    cred.uid == geteuid();
+#else
+  uid_t uid;
+  gid_t gid;
+  return getpeereid(conn, &uid, &gid) == 0 && uid == geteuid();
+#endif
+}
+
+/* Listen on a socket at `path`, replacing one left there (by a server that
+ * was killed, say), but nothing else. Only its owner may connect to it. */
+static int
+listen_on(const char *path)
+{
+  struct sockaddr_un addr;
+  struct stat st;
+  mode_t mask;
+  int fd, err;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "The socket path is too long: %s\n", path);
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  if (lstat(path, &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      fprintf(stderr, "Not replacing %s, which isn't a socket\n", path);
+      return -1;
+    }
+    unlink(path);
+  }
+
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+    perror("socket");
+    return -1;
+  }
+  mask = umask(0177);
+  err = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+  umask(mask);
+  if (err < 0 || listen(fd, SERVER_BACKLOG) < 0) {
+    fprintf(stderr, "Can't listen on %s: %s\n", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* Load the libraries, then serve requests on the socket at `path` until
+ * killed. Returns only if it can't start. */
+int
+fh_serve(const char *path, int num_libs, char **libs)
+{
+  struct sigaction sa;
+  int listener, i;
+
+  for (i = 0; i < num_libs; i++) {
+    if (!fh_eval_path(libs[i], fh->global)) {
+      fprintf(stderr, "Can't load %s\n", libs[i]);
+      return 1;
+    }
+  }
+  fh_loop_run();
+  fh_gc();
+
+  if ((listener = listen_on(path)) < 0) return 1;
+  if (pipe(sigchld_pipe) < 0) {
+    perror("pipe");
+    return 1;
+  }
+  for (i = 0; i < 2; i++) {
+    fcntl(sigchld_pipe[i], F_SETFL, O_NONBLOCK);
+    fcntl(sigchld_pipe[i], F_SETFD, FD_CLOEXEC);
+  }
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_sigchld;
+  sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  sigaction(SIGCHLD, &sa, NULL);
+
+  struct pollfd fds[2] = {
+    { listener, POLLIN, 0 },
+    { sigchld_pipe[0], POLLIN, 0 }
+  };
+  char drain[64];
+  while (true) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      perror("poll");
+      return 1;
+    }
+    if (fds[1].revents) {
+      while (read(sigchld_pipe[0], drain, sizeof(drain)) > 0);
+      reap_children();
+    }
+    if (fds[0].revents & POLLIN) {
+      int conn = accept(listener, NULL, NULL);
+      if (conn < 0) continue;
+      // Scripts run as the server's user, so no one else may send them.
+      if (peer_is_owner(conn))
+        serve_request(listener, conn);
+      else
+        reply(conn, 1);
+    }
+  }
+}
@@ -0,0 +1,36 @@
+/*
+ * server.h -- A fork server that runs scripts for its clients
+ *
+ * Copyright (c) 2012-2013 Nick Reynolds
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+/* A request is one message on the server's unix socket: the client's
+ * working directory and the script's path, each ending in a NUL, with the
+ * client's stdin, stdout and stderr passed alongside (SCM_RIGHTS). The reply
+ * is the script's exit status as an int32_t, or 128 plus the number of the
+ * signal that killed it. This header is shared with the client, which is
+ * built without the runtime. */
+
+#define SERVER_MAX_REQUEST 8192   // bytes of a request's strings
+#define SERVER_BACKLOG 64         // connections waiting to be accepted
+#define SERVER_NUM_FDS 3          // stdin, stdout and stderr
+#define SERVER_REQUEST_TIMEOUT 10 // seconds a request may take to arrive
+
+int fh_serve(const char *, int, char **);
+
+#endif
@@ -21,19 +21,93 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "str.h"
 
+// The search and scan kernels look at 16 bytes at a time where the target
+// has vector registers for it, and fall back to scalar loops elsewhere and
+// for the tails. A vector comparison is reduced to a bit mask with
+// LANE_BITS bits per byte.
+
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+#define STR_SIMD
+#define LANE_BITS 1
+#define LANES_ALL 0xFFFFULL
+
+typedef __m128i vec;
+
+static inline vec vload(const char *p) { return _mm_loadu_si128((const __m128i *)p); }
+static inline void vstore(char *p, vec v) { _mm_storeu_si128((__m128i *)p, v); }
+static inline vec vsplat(char c) { return _mm_set1_epi8(c); }
+static inline vec veq(vec a, vec b) { return _mm_cmpeq_epi8(a, b); }
+static inline vec vand(vec a, vec b) { return _mm_and_si128(a, b); }
+static inline vec vor(vec a, vec b) { return _mm_or_si128(a, b); }
+static inline vec vxor(vec a, vec b) { return _mm_xor_si128(a, b); }
+static inline uint64_t vmask(vec v) { return (unsigned)_mm_movemask_epi8(v); }
+
+// The bytes in [lo, lo + n], compared unsigned.
+static inline vec
+vrange(vec x, char lo, char n)
+{
+  vec t = _mm_sub_epi8(x, vsplat(lo));
+  return veq(_mm_min_epu8(t, vsplat(n)), t);
+}
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+
+#include <arm_neon.h>
+#define STR_SIMD
+#define LANE_BITS 4
+#define LANES_ALL (~0ULL)
+
+typedef uint8x16_t vec;
+
+static inline vec vload(const char *p) { return vld1q_u8((const uint8_t *)p); }
+static inline void vstore(char *p, vec v) { vst1q_u8((uint8_t *)p, v); }
+static inline vec vsplat(char c) { return vdupq_n_u8((uint8_t)c); }
+static inline vec veq(vec a, vec b) { return vceqq_u8(a, b); }
+static inline vec vand(vec a, vec b) { return vandq_u8(a, b); }
+static inline vec vor(vec a, vec b) { return vorrq_u8(a, b); }
+static inline vec vxor(vec a, vec b) { return veorq_u8(a, b); }
+
+// NEON has no movemask; narrowing each 16-bit pair by 4 leaves a nibble
+// per byte.
+static inline uint64_t
+vmask(vec v)
+{
+  uint8x8_t narrow = vshrn_n_u16(vreinterpretq_u16_u8(v), 4);
+  return vget_lane_u64(vreinterpret_u64_u8(narrow), 0);
+}
+
+static inline vec
+vrange(vec x, char lo, char n)
+{
+  return vcleq_u8(vsubq_u8(x, vsplat(lo)), vsplat(n));
+}
+
+#endif
+
+#ifdef STR_SIMD
+#define LANE_ONE ((1ULL << LANE_BITS) - 1)
+#define LOWEST_LANE(mask) (__builtin_ctzll(mask) / LANE_BITS)
+#define HIGHEST_LANE(mask) ((63 - __builtin_clzll(mask)) / LANE_BITS)
+#define CLEAR_LANE(mask, lane) ((mask) & ~(LANE_ONE << ((lane) * LANE_BITS)))
+#endif
+
+
 
 /* Returns a newly allocated string that is the concatenation of the two
  * argument strings */
 char *
 fh_str_concat(char *a, char *b)
 {
-  size_t size = strlen(a) + strlen(b) + 1;
-  char *new = malloc(size);
-  new[size - 1] = '\0';
-  snprintf(new, size, "%s%s", a, b);
+  size_t a_len = strlen(a), b_len = strlen(b);
+  char *new = malloc(a_len + b_len + 1);
+  memcpy(new, a, a_len);
+  memcpy(new + a_len, b, b_len + 1);
   return new;
 }
 
@@ -43,10 +117,10 @@ fh_str_slice(char *str, unsigned start, unsigned end)
 {
   if (str == NULL || start > end || end > strlen(str))
     return NULL;
-  size_t size = end - start + 1;
-  char *new = malloc(size);
-  new[size - 1] = '\0';
-  snprintf(new, size, "%.*s", end - start, str + start);
+  size_t len = end - start;
+  char *new = malloc(len + 1);
+  memcpy(new, str + start, len);
+  new[len] = '\0';
   return new;
 }
 
@@ -58,28 +132,202 @@ fh_str_slice(char *str, unsigned start, unsigned end)
 char *
 fh_str_replace(char *orig, char *repl, char *new, int limit)
 {
-  char *result, *ins, *tmp;
-  int count, dist;
-  bool has_limit = limit > 0;
-
-  if (!(orig && repl && strlen(repl) && new)) return orig;
-  if (!(ins = strstr(orig, repl))) return orig;
-
-  int len_new = strlen(new), len_repl = strlen(repl);
-  for (count = 0; (tmp = strstr(ins, repl)) && (!has_limit || limit); count++, limit--)
-    ins = tmp + len_repl;
-
-  tmp = result = malloc(strlen(orig) + (len_new - len_repl) * count + 1);
-  if (!result) return orig;
-  
-  while (count--) {
-    ins = strstr(orig, repl);
-    dist = ins - orig;
-    tmp = strncpy(tmp, orig, dist) + dist;
-    tmp = strcpy(tmp, new) + len_new;
-    orig += dist + len_repl;
+  if (!(orig && repl && *repl && new)) return orig;
+
+  size_t len = strlen(orig), len_repl = strlen(repl), len_new = strlen(new);
+  long at = fh_str_find(orig, len, repl, len_repl, 0);
+  if (at < 0) return orig;
+
+  fh_strbuf sb;
+  size_t from = 0;
+  fh_strbuf_init(&sb);
+  do {
+    fh_strbuf_append(&sb, orig + from, at - from);
+    fh_strbuf_append(&sb, new, len_new);
+    from = at + len_repl;
+  } while (--limit != 0 && (at = fh_str_find(orig, len, repl, len_repl, from)) >= 0);
+
+  fh_strbuf_append(&sb, orig + from, len - from);
+  return sb.buf;
+}
+
+void
+fh_strbuf_init(fh_strbuf *sb)
+{
+  sb->cap = 64;
+  sb->len = 0;
+  sb->buf = malloc(sb->cap);
+  sb->buf[0] = '\0';
+}
+
+/* Append `len` bytes of `str`, doubling the buffer as needed. The contents are
+ * always NUL-terminated. */
+void
+fh_strbuf_append(fh_strbuf *sb, const char *str, size_t len)
+{
+  if (sb->len + len + 1 > sb->cap) {
+    while (sb->len + len + 1 > sb->cap) sb->cap *= 2;
+    sb->buf = realloc(sb->buf, sb->cap);
   }
+  memcpy(sb->buf + sb->len, str, len);
+  sb->len += len;
+  sb->buf[sb->len] = '\0';
+}
+
+
+// ----------------------------------------------------------------------------
+// Search and scan kernels
+// ----------------------------------------------------------------------------
+
+// These all take explicit lengths, so the strings may contain NULs.
+
+/* Return the index of the first `needle` in `hay` at or after `from`, or -1. 
+ * An empty needle is found at `from`. */
+long
+fh_str_find(const char *hay, size_t hay_len, 
+            const char *needle, size_t needle_len, size_t from)
+{
+  if (from > hay_len || needle_len > hay_len - from) return -1;
+  if (needle_len == 0) return from;
+
+  size_t i = from, last = hay_len - needle_len;
+  size_t rest = needle_len > 2 ? needle_len - 2 : 0;
 
-  strcpy(tmp, orig);
-  return result;
+#ifdef STR_SIMD
+  // Test 16 starting points at once by the needle's first and last bytes,
+  // and compare the rest only where both match.
+  if (needle_len > 1) {
+    vec first = vsplat(needle[0]), end = vsplat(needle[needle_len - 1]);
+    for (; i + 15 <= last; i += 16) {
+      uint64_t mask = vmask(vand(veq(vload(hay + i), first),
+                                 veq(vload(hay + i + needle_len - 1), end)));
+      while (mask) {
+        size_t lane = LOWEST_LANE(mask);
+        if (!memcmp(hay + i + lane + 1, needle + 1, rest)) return i + lane;
+        mask = CLEAR_LANE(mask, lane);
+      }
+    }
+  }
+#endif
+
+  // memchr is vectorized by most C libraries.
+  while (i <= last) {
+    const char *p = memchr(hay + i, needle[0], last - i + 1);
+    if (!p) return -1;
+    i = p - hay;
+    if (!memcmp(hay + i + 1, needle + 1, needle_len - 1)) return i;
+    i++;
+  }
+  return -1;
+}
+
+/* Return the index of the last `needle` in `hay` starting at or before
+ * `from`, or -1. */
+long
+fh_str_rfind(const char *hay, size_t hay_len,
+             const char *needle, size_t needle_len, size_t from)
+{
+  if (needle_len > hay_len) return -1;
+
+  long i = from < hay_len - needle_len ? from : hay_len - needle_len;
+  if (needle_len == 0) return i;
+
+  size_t rest = needle_len > 2 ? needle_len - 2 : 0;
+  char first = needle[0], last = needle[needle_len - 1];
+
+#ifdef STR_SIMD
+  vec vfirst = vsplat(first), vlast = vsplat(last);
+  for (; i >= 15; i -= 16) {
+    const char *base = hay + i - 15;
+    uint64_t mask = vmask(vand(veq(vload(base), vfirst),
+                               veq(vload(base + needle_len - 1), vlast)));
+    while (mask) {
+      size_t lane = HIGHEST_LANE(mask);
+      if (!memcmp(base + lane + 1, needle + 1, rest)) return i - 15 + lane;
+      mask = CLEAR_LANE(mask, lane);
+    }
+  }
+#endif
+
+  for (; i >= 0; i--) {
+    if (hay[i] == first && hay[i + needle_len - 1] == last &&
+        !memcmp(hay + i + 1, needle + 1, rest))
+      return i;
+  }
+  return -1;
+}
+
+// The ASCII whitespace: tab, newline, vertical tab, form feed, carriage
+// return (9-13) and space.
+static bool
+is_space(char c)
+{
+  return c == ' ' || (unsigned char)(c - '\t') <= 4;
+}
+
+#ifdef STR_SIMD
+static inline vec
+vspace(vec x)
+{
+  return vor(veq(x, vsplat(' ')), vrange(x, '\t', 4));
+}
+#endif
+
+/* The number of whitespace bytes at the start of a string. */
+size_t
+fh_str_space_prefix(const char *str, size_t len)
+{
+  size_t i = 0;
+#ifdef STR_SIMD
+  for (; i + 16 <= len; i += 16) {
+    uint64_t mask = vmask(vspace(vload(str + i)));
+    if (mask != LANES_ALL) return i + LOWEST_LANE(~mask);
+  }
+#endif
+  while (i < len && is_space(str[i])) i++;
+  return i;
+}
+
+/* The length of a string without any whitespace at its end. */
+size_t
+fh_str_space_suffix(const char *str, size_t len)
+{
+#ifdef STR_SIMD
+  for (; len >= 16; len -= 16) {
+    uint64_t mask = vmask(vspace(vload(str + len - 16)));
+    if (mask != LANES_ALL) return len - 16 + HIGHEST_LANE(~mask & LANES_ALL) + 1;
+  }
+#endif
+  while (len > 0 && is_space(str[len - 1])) len--;
+  return len;
+}
+
+// Flip the case bit of the ASCII letters in [lo, lo + 25].
+static void
+flip_case(char *dst, const char *src, size_t len, char lo)
+{
+  size_t i = 0;
+#ifdef STR_SIMD
+  vec bit = vsplat(0x20);
+  for (; i + 16 <= len; i += 16) {
+    vec x = vload(src + i);
+    vstore(dst + i, vxor(x, vand(vrange(x, lo, 25), bit)));
+  }
+#endif
+  for (; i < len; i++)
+    dst[i] = (unsigned char)(src[i] - lo) <= 25 ? src[i] ^ 0x20 : src[i];
+}
+
+/* Copy `len` bytes, mapping ASCII letters to lower case. */
+void
+fh_str_lower(char *dst, const char *src, size_t len)
+{
+  flip_case(dst, src, len, 'A');
+}
+
+/* Copy `len` bytes, mapping ASCII letters to upper case. */
+void
+fh_str_upper(char *dst, const char *src, size_t len)
+{
+  flip_case(dst, src, len, 'a');
 }
@@ -19,8 +19,27 @@
 #ifndef STR_H
 #define STR_H 
 
+#include <stddef.h>
+
+/* A growable buffer for building a string in a single pass. */
+typedef struct {
+  char *buf;
+  size_t len;
+  size_t cap;
+} fh_strbuf;
+
 char * fh_str_concat(char *, char *);
 char * fh_str_slice(char *, unsigned, unsigned);
 char * fh_str_replace(char *, char *, char *, int);
 
+void fh_strbuf_init(fh_strbuf *);
+void fh_strbuf_append(fh_strbuf *, const char *, size_t);
+
+long fh_str_find(const char *, size_t, const char *, size_t, size_t);
+long fh_str_rfind(const char *, size_t, const char *, size_t, size_t);
+size_t fh_str_space_prefix(const char *, size_t);
+size_t fh_str_space_suffix(const char *, size_t);
+void fh_str_lower(char *, const char *, size_t);
+void fh_str_upper(char *, const char *, size_t);
+
 #endif
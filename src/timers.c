@@ -0,0 +1,155 @@
+/*
+ * timers.c -- A monotonic clock, and named timers and counters
+ *
+ * Copyright (c) 2012-2013 Nick Reynolds
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Timers belong to the isolate they're made in, so names only clash within
+ * a script. The clock is shared: fh_clock_ms counts from an arbitrary point,
+ * and performance.now() counts from when the isolate was made. */
+
+// clock_gettime is POSIX.1b, beyond what -D_XOPEN_SOURCE asks for.
+#define _POSIX_C_SOURCE 200112L
+
+#include <math.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "timers.h"
+
+/* Milliseconds on a clock that never goes back, to the nanosecond where the
+ * system has one. */
+double
+fh_clock_ms(void)
+{
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+#endif
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1e3 + tv.tv_usec / 1e3;
+}
+
+/* The timer (or counter) of a name, made if it's new. */
+fh_timer *
+fh_get_timer(const char *label)
+{
+  char *name = fh_intern((char *)label);
+  fh_timer *timer;
+
+  HASH_FIND(hh, fh->timers, &name, sizeof(char *), timer);
+  if (timer) return timer;
+
+  timer = calloc(1, sizeof(fh_timer));
+  timer->name = name;
+  HASH_ADD(hh, fh->timers, name, sizeof(char *), timer);
+  return timer;
+}
+
+static int
+bucket_of(double ms)
+{
+  int exp;
+  double frac = frexp(ms, &exp);    // ms = frac * 2^exp, frac in [0.5, 1)
+
+  if (!(ms > 0) || exp - 1 < TIMER_MIN_EXP) return 0;
+  if (exp - 1 >= TIMER_MAX_EXP) return TIMER_BUCKETS - 1;
+  return (exp - 1 - TIMER_MIN_EXP) * TIMER_SUB_BUCKETS +
+    (int)((frac * 2 - 1) * TIMER_SUB_BUCKETS);
+}
+
+static double
+bucket_mid(int i)
+{
+  int exp = i / TIMER_SUB_BUCKETS + TIMER_MIN_EXP;
+  double sub = i % TIMER_SUB_BUCKETS + 0.5;
+  return ldexp(1 + sub / TIMER_SUB_BUCKETS, exp);
+}
+
+void
+fh_timer_sample(fh_timer *timer, double ms)
+{
+  if (!timer->buckets)
+    timer->buckets = calloc(TIMER_BUCKETS, sizeof(unsigned long));
+
+  if (timer->count == 0 || ms < timer->min) timer->min = ms;
+  if (timer->count == 0 || ms > timer->max) timer->max = ms;
+  timer->count++;
+  timer->total += ms;
+  timer->buckets[bucket_of(ms)]++;
+}
+
+/* The sample that `p` percent of a timer's samples are at or below. */
+double
+fh_timer_percentile(fh_timer *timer, double p)
+{
+  if (!timer->buckets || timer->count == 0) return NAN;
+
+  double rank = ceil(p / 100 * timer->count);
+  unsigned long seen = 0;
+  int i;
+
+  if (rank < 1) rank = 1;
+  for (i = 0; i < TIMER_BUCKETS; i++) {
+    seen += timer->buckets[i];
+    if (seen >= rank) break;
+  }
+  if (i == TIMER_BUCKETS) i--;
+
+  double mid = bucket_mid(i);
+  return mid < timer->min ? timer->min : mid > timer->max ? timer->max : mid;
+}
+
+/* Write a table of the timers, then the counters, in the order they were
+ * made. */
+void
+fh_timer_report(FILE *stream)
+{
+  fh_timer *timer;
+  bool header = false;
+
+  for (timer = fh->timers; timer; timer = timer->hh.next) {
+    if (!timer->buckets) continue;
+    if (!header) {
+      fprintf(stream, "%-20s %8s %12s %10s %10s %10s %10s %10s\n", "timer",
+          "count", "total(ms)", "mean", "min", "p50", "p99", "max");
+      header = true;
+    }
+    fprintf(stream, "%-20s %8lu %12.3f %10.4f %10.4f %10.4f %10.4f %10.4f\n",
+        timer->name, timer->count, timer->total, timer->total / timer->count,
+        timer->min, fh_timer_percentile(timer, 50),
+        fh_timer_percentile(timer, 99), timer->max);
+  }
+
+  for (timer = fh->timers; timer; timer = timer->hh.next) {
+    if (!timer->buckets && timer->count)
+      fprintf(stream, "%s: %lu\n", timer->name, timer->count);
+  }
+}
+
+void
+fh_free_timers(fh_state *state)
+{
+  fh_timer *timer, *tmp;
+
+  HASH_ITER(hh, state->timers, timer, tmp) {
+    HASH_DEL(state->timers, timer);
+    free(timer->buckets);
+    free(timer);
+  }
+}
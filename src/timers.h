@@ -0,0 +1,52 @@
+/*
+ * timers.h -- A monotonic clock, and named timers and counters
+ *
+ * Copyright (c) 2012-2013 Nick Reynolds
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef TIMERS_H
+#define TIMERS_H
+
+#include "flathead.h"
+
+#define TIMER_SUB_BUCKETS 16    // histogram buckets per doubling
+#define TIMER_MIN_EXP -20       // samples below 2^-20 ms (~1ns) share a bucket
+#define TIMER_MAX_EXP 30        // and above 2^30 ms (~12 days)
+#define TIMER_BUCKETS ((TIMER_MAX_EXP - TIMER_MIN_EXP) * TIMER_SUB_BUCKETS)
+
+/* Samples of a named timer (in ms), or a counter's calls. Samples are only
+ * tallied, in a log-linear histogram, so percentiles are within half a
+ * bucket (about 3%) and no memory is kept per sample. A counter has no
+ * histogram. */
+typedef struct fh_timer {
+  char *name;                   // an atom
+  bool running;
+  double started;               // fh_clock_ms() when it was started
+  unsigned long count;
+  double total;
+  double min;
+  double max;
+  unsigned long *buckets;       // TIMER_BUCKETS, once there's a sample
+  UT_hash_handle hh;
+} fh_timer;
+
+double fh_clock_ms(void);
+fh_timer * fh_get_timer(const char *);
+void fh_timer_sample(fh_timer *, double);
+double fh_timer_percentile(fh_timer *, double);
+void fh_timer_report(FILE *);
+void fh_free_timers(fh_state *);
+
+#endif
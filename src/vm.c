@@ -0,0 +1,1525 @@
+/*
+ * vm.c -- Bytecode compiler and virtual machine
+ *
+ * Copyright (c) 2012-2013 Nick Reynolds
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "vm.h"
+#include "eval.h"
+#include "props.h"
+#include "args.h"
+#include "gc.h"
+#include "heapprof.h"
+#include "jit.h"
+#include "quota.h"
+
+/* VM Overview
+ *
+ * An alternative to the AST walker in eval.c, selected with `--engine=vm`.
+ *
+ * Each program and function body is lowered once into a flat array of
+ * instructions (a chunk), which is cached on its AST node. The chunk is then
+ * run by a single dispatch loop over an operand stack, so loops and
+ * statement lists no longer recurse through `fh_eval`. Values, properties and
+ * the runtime library are shared with the AST walker.
+ *
+ * Inside a function body, identifiers naming a parameter, a local variable or
+ * function, `this` or `arguments` are resolved when compiling to slot
+ * indices. The activation object is still a property map (closures and eval
+ * share it by reference), but the props backing the slots are looked up once
+ * per call, after hoisting, and every access after that is an indexed load
+ * or store. Other identifiers take the dynamic path up the scope chain, as do
+ * all identifiers in functions that `delete` a plain identifier.
+ *
+ * Named property reads (`obj.x`, including the callee of `obj.m()`) carry an
+ * inline cache keyed on the receiver's shape, holding up to VM_IC_ENTRIES
+ * receiver shapes with the slot offset of the prop, either on the receiver
+ * itself or on a prototype (see js_shape in flathead.h).
+ *
+ * Control flow is compiled to jumps. Statements always start and end with an
+ * empty operand stack, so a `break` or `continue` is a plain jump, and
+ * longer-lived temporaries (switch discriminants and for-in key lists) live
+ * in registers and iterators allocated by nesting depth.
+ *
+ * try/catch/finally regions are run by a nested call to the dispatch loop
+ * with a catch frame in place. A nested run ends with a completion: normal,
+ * a jump out of the region (break/continue), a return, or a throw. A `throw`
+ * in a function with a region around it is just a completion; only errors
+ * from calls and natives come back through the catch frame's longjmp.
+ *
+ * Expressions without a dedicated instruction (`new`, `delete` and
+ * increments of members) fall back to `fh_eval` on their node.
+ *
+ * With the JIT on, `while` and `for` bodies start with VM_JIT, which counts
+ * the iterations and runs the rest of a hot loop in machine code (jit.c).
+ * It turns into a VM_NOP for loops the JIT can't compile.
+ */
+
+typedef enum {
+  VM_NORMAL,
+  VM_JUMPED,
+  VM_RETURNED,
+  VM_THROWN
+} vm_completion;
+
+typedef struct vm_target {
+  bool loop;
+  int *breaks;
+  int num_breaks;
+  int *conts;
+  int num_conts;
+  struct vm_target *parent;
+} vm_target;
+
+typedef struct {
+  vm_chunk *chunk;
+  vm_target *targets;
+  int depth;
+  int regs;
+  int iters;
+} vm_compiler;
+
+static void compile_stmt(vm_compiler *, ast_node *);
+static void compile_exp(vm_compiler *, ast_node *);
+static vm_completion vm_run(vm_frame *, int, int);
+
+
+// ----------------------------------------------------------------------------
+// Emitting
+// ----------------------------------------------------------------------------
+
+static int
+emit(vm_compiler *c, vm_opcode op, int effect, ast_node *node)
+{
+  vm_chunk *chunk = c->chunk;
+  if (chunk->len == chunk->cap) {
+    chunk->cap = chunk->cap ? chunk->cap * 2 : 32;
+    chunk->code = realloc(chunk->code, chunk->cap * sizeof(vm_insn));
+  }
+
+  vm_insn *in = &chunk->code[chunk->len];
+  memset(in, 0, sizeof(vm_insn));
+  in->op = op;
+  in->node = node;
+
+  c->depth += effect;
+  if (c->depth > chunk->max_stack)
+    chunk->max_stack = c->depth;
+
+  return chunk->len++;
+}
+
+static int
+emit_str(vm_compiler *c, vm_opcode op, int effect, char *s)
+{
+  int pc = emit(c, op, effect, NULL);
+  c->chunk->code[pc].s = s;
+  return pc;
+}
+
+static int
+emit_get_prop(vm_compiler *c, char *name, ast_node *node)
+{
+  int pc = emit(c, VM_GET_PROP, 0, node);
+  c->chunk->code[pc].s = name;
+  c->chunk->code[pc].ic = calloc(1, sizeof(vm_ic));
+  return pc;
+}
+
+static int
+emit_op(vm_compiler *c, vm_opcode op, int effect, enum ast_op a)
+{
+  int pc = emit(c, op, effect, NULL);
+  c->chunk->code[pc].a = a;
+  return pc;
+}
+
+static int
+here(vm_compiler *c)
+{
+  return c->chunk->len;
+}
+
+static void
+patch(vm_compiler *c, int pc, int target)
+{
+  c->chunk->code[pc].a = target;
+}
+
+static void
+compile_error(ast_node *node, const char *msg)
+{
+  eval_state *state = fh_new_state(node->line, node->column);
+  fh_push_state(state);
+  fh_throw(state, fh_new_error(E_SYNTAX, msg));
+}
+
+
+// ----------------------------------------------------------------------------
+// Break & Continue Targets
+// ----------------------------------------------------------------------------
+
+static void
+push_target(vm_compiler *c, vm_target *target, bool loop)
+{
+  memset(target, 0, sizeof(vm_target));
+  target->loop = loop;
+  target->parent = c->targets;
+  c->targets = target;
+}
+
+static void
+pop_target(vm_compiler *c, int break_pc, int cont_pc)
+{
+  vm_target *target = c->targets;
+  int i;
+  for (i = 0; i < target->num_breaks; i++)
+    patch(c, target->breaks[i], break_pc);
+  for (i = 0; i < target->num_conts; i++)
+    patch(c, target->conts[i], cont_pc);
+  free(target->breaks);
+  free(target->conts);
+  c->targets = target->parent;
+}
+
+static void
+add_jump(int **list, int *len, int pc)
+{
+  *list = realloc(*list, (*len + 1) * sizeof(int));
+  (*list)[(*len)++] = pc;
+}
+
+
+// ----------------------------------------------------------------------------
+// Lists & Hoisting
+// ----------------------------------------------------------------------------
+
+/* Lists are linked through e2 in reverse, so visit the tail first. */
+static void
+compile_list(vm_compiler *c, ast_node *list, void (*fn)(vm_compiler *, ast_node *))
+{
+  if (!list) return;
+  if (list->e2) compile_list(c, list->e2, fn);
+  if (list->e1) fn(c, list->e1);
+}
+
+static void
+collect_list(ast_node *list, ast_node **items, int *len)
+{
+  if (!list) return;
+  if (list->e2) collect_list(list->e2, items, len);
+  if (list->e1) items[(*len)++] = list->e1;
+}
+
+static void
+hoist_funcs(vm_chunk *chunk, ast_node *list)
+{
+  if (!list) return;
+  if (list->e2) hoist_funcs(chunk, list->e2);
+  if (list->e1 && list->e1->type == NODE_FUNC && list->e1->e3) {
+    chunk->funcs = realloc(chunk->funcs, (chunk->num_funcs + 1) * sizeof(ast_node *));
+    chunk->funcs[chunk->num_funcs++] = list->e1;
+  }
+}
+
+static bool
+deletes_ident(ast_node *node)
+{
+  if (!node || node->type == NODE_FUNC) return false;
+  if (node->type == NODE_EXP && node->op == OP_DELETE && 
+      node->e1->type == NODE_IDENT) 
+    return true;
+  return deletes_ident(node->e1) || deletes_ident(node->e2) || 
+    deletes_ident(node->e3);
+}
+
+static int
+slot_of(vm_chunk *chunk, char *name)
+{
+  int i;
+  for (i = 0; i < chunk->num_slots; i++)
+    if (STREQ(chunk->slots[i], name)) return i;
+  return -1;
+}
+
+static void
+add_slot(vm_chunk *chunk, char *name)
+{
+  if (slot_of(chunk, name) >= 0) return;
+  chunk->slots = realloc(chunk->slots, (chunk->num_slots + 1) * sizeof(char *));
+  chunk->slots[chunk->num_slots++] = name;
+}
+
+/* Assign slots to the names bound in the activation object of `func`. */
+static void
+resolve_slots(vm_chunk *chunk, ast_node *func)
+{
+  int i, num_params = 0;
+  ast_node *params[node_count(func->e1) + 1];
+
+  if (deletes_ident(fh_func_body(func))) return;
+
+  add_slot(chunk, "this");
+  add_slot(chunk, "arguments");
+  if (func->e3) add_slot(chunk, func->e3->sval);
+
+  collect_list(func->e1, params, &num_params);
+  for (i = 0; i < num_params; i++)
+    add_slot(chunk, params[i]->sval);
+  for (i = 0; i < chunk->num_funcs; i++)
+    add_slot(chunk, chunk->funcs[i]->e3->sval);
+  for (i = 0; i < chunk->num_vars; i++)
+    add_slot(chunk, chunk->vars[i]);
+}
+
+static void
+hoist_vars(vm_chunk *chunk, ast_node *node)
+{
+  // Don't touch functions (stay within our current scope)
+  if (!node || node->type == NODE_FUNC) return;
+
+  if (node->type == NODE_VAR_DEC) {
+    chunk->vars = realloc(chunk->vars, (chunk->num_vars + 1) * sizeof(char *));
+    chunk->vars[chunk->num_vars++] = node->e1->sval;
+  }
+
+  hoist_vars(chunk, node->e1);
+  hoist_vars(chunk, node->e2);
+  hoist_vars(chunk, node->e3);
+}
+
+
+// ----------------------------------------------------------------------------
+// Expressions
+// ----------------------------------------------------------------------------
+
+/* Push the value of an identifier. */
+static void
+emit_load(vm_compiler *c, ast_node *ident)
+{
+  int slot = slot_of(c->chunk, ident->sval);
+  if (slot < 0)
+    emit(c, VM_LOAD, 1, ident);
+  else
+    patch(c, emit(c, VM_LOAD_SLOT, 1, ident), slot);
+}
+
+/* Assign the value on top of the stack to an identifier, leaving it there. */
+static void
+emit_store(vm_compiler *c, ast_node *ident)
+{
+  int slot = slot_of(c->chunk, ident->sval);
+  if (slot < 0)
+    emit(c, VM_STORE, 0, ident);
+  else
+    patch(c, emit(c, VM_STORE_SLOT, 0, ident), slot);
+}
+
+/* Push the object and key of a member expression. */
+static void
+compile_member_ref(vm_compiler *c, ast_node *member)
+{
+  compile_exp(c, member->e2);
+  if (member->val)
+    compile_exp(c, member->e1);
+  else
+    emit(c, VM_STR, 1, member->e1);
+}
+
+static void
+compile_update(vm_compiler *c, ast_node *node, bool postfix)
+{
+  // Only identifiers are handled here, see compile_exp.
+  enum ast_op op = node->op == OP_INC ? OP_ADD : OP_SUB;
+  emit_load(c, node->e1);
+  emit(c, VM_TO_NUM, 0, NULL);
+  if (postfix) emit(c, VM_DUP, 1, NULL);
+  emit_op(c, VM_INC, 0, op);
+  emit_store(c, node->e1);
+  if (postfix) emit(c, VM_POP, -1, NULL);
+}
+
+static void
+compile_prefix(vm_compiler *c, ast_node *node)
+{
+  switch (node->op) {
+    case OP_TYPEOF:
+      if (node->e1->type == NODE_IDENT && slot_of(c->chunk, node->e1->sval) < 0)
+        emit(c, VM_LOAD_TYPEOF, 1, node->e1);
+      else {
+        compile_exp(c, node->e1);
+        emit(c, VM_TYPEOF, 0, NULL);
+      }
+      break;
+    case OP_VOID:
+      compile_exp(c, node->e1);
+      emit(c, VM_POP, -1, NULL);
+      emit(c, VM_UNDEF, 1, NULL);
+      break;
+    case OP_INC:
+    case OP_DEC:
+      if (node->e1->type == NODE_IDENT)
+        compile_update(c, node, false);
+      else
+        emit(c, VM_EVAL, 1, node);
+      break;
+    case OP_DELETE:
+      emit(c, VM_EVAL, 1, node);
+      break;
+    default:
+      compile_exp(c, node->e1);
+      emit_op(c, VM_UNARY, 0, node->op);
+  }
+}
+
+static void
+compile_binary(vm_compiler *c, ast_node *node)
+{
+  // Logical (must short-circuit)
+  if (node->op == OP_AND || node->op == OP_OR) {
+    compile_exp(c, node->e1);
+    int jump = emit(c, node->op == OP_AND ? VM_AND : VM_OR, -1, NULL);
+    compile_exp(c, node->e2);
+    patch(c, jump, here(c));
+    return;
+  }
+
+  compile_exp(c, node->e1);
+  compile_exp(c, node->e2);
+  emit_op(c, VM_BINARY, -1, node->op);
+}
+
+static void
+compile_assign(vm_compiler *c, ast_node *node)
+{
+  ast_node *lhs = node->e1;
+  enum ast_op op = node->op;
+
+  // The comma operator is also represented as an assignment node.
+  if (op == OP_NONE) {
+    compile_exp(c, lhs);
+    emit(c, VM_POP, -1, NULL);
+    compile_exp(c, node->e2);
+    return;
+  }
+
+  if (lhs->type == NODE_IDENT) {
+    if (op == OP_ASGN)
+      compile_exp(c, node->e2);
+    else {
+      emit_load(c, lhs);
+      compile_exp(c, node->e2);
+      emit_op(c, VM_BINARY, -1, op);
+    }
+    emit_store(c, lhs);
+  }
+  else if (lhs->type == NODE_MEMBER) {
+    compile_member_ref(c, lhs);
+    if (op == OP_ASGN)
+      compile_exp(c, node->e2);
+    else {
+      emit(c, VM_DUP2, 2, NULL);
+      emit(c, VM_GET_ELEM, -1, NULL);
+      compile_exp(c, node->e2);
+      emit_op(c, VM_BINARY, -1, op);
+    }
+    emit(c, VM_PUT_ELEM, -2, NULL);
+  }
+  else
+    emit(c, VM_EVAL, 1, node);
+}
+
+static bool
+has_prop_names(ast_node *list)
+{
+  for (; list; list = list->e2)
+    if (list->e1 && !list->e1->e1->sval) return false;
+  return true;
+}
+
+static void
+compile_prop(vm_compiler *c, ast_node *prop)
+{
+  compile_exp(c, prop->e2);
+  emit_str(c, VM_INIT_PROP, -1, prop->e1->sval);
+}
+
+/* Replace the object on top of the stack with its member `member`. */
+static void
+compile_member_get(vm_compiler *c, ast_node *member)
+{
+  if (member->val) {
+    compile_exp(c, member->e1);
+    emit(c, VM_GET_ELEM, -1, member);
+  }
+  else
+    emit_get_prop(c, member->e1->sval, member);
+}
+
+/* The same, for the member `key` read off a call's result, as in `f().x`. */
+static void
+compile_call_member_get(vm_compiler *c, ast_node *key)
+{
+  if (key->type == NODE_IDENT)
+    emit_get_prop(c, key->sval, key);
+  else {
+    compile_exp(c, key);
+    emit(c, VM_GET_ELEM, -1, NULL);
+  }
+}
+
+static void
+compile_call(vm_compiler *c, ast_node *node)
+{
+  ast_node *exp = node->e1;
+  bool method = false;
+
+  // Special treatment for:
+  //   CallExpression [ Expression ]
+  //   CallExpression . Identifier
+  if (node->e2->type != NODE_ARG_LST) {
+    compile_exp(c, exp);
+    compile_call_member_get(c, node->e2);
+    return;
+  }
+
+  // Methods keep their object on the stack, under the function, to be
+  // passed as the receiver.
+  if (exp->type == NODE_MEMBER) {
+    compile_exp(c, exp->e2);
+    emit(c, VM_DUP, 1, NULL);
+    compile_member_get(c, exp);
+    method = true;
+  }
+  else if (exp->type == NODE_CALL && exp->e2->type != NODE_ARG_LST) {
+    compile_exp(c, exp->e1);
+    emit(c, VM_DUP, 1, NULL);
+    compile_call_member_get(c, exp->e2);
+    method = true;
+  }
+  else
+    compile_exp(c, exp);
+
+  int argc = node_count(node->e2);
+  compile_list(c, node->e2, compile_exp);
+  int pc = method ?
+    emit(c, VM_CALL_METHOD, -argc - 1, node) :
+    emit(c, VM_CALL, -argc, node);
+  c->chunk->code[pc].a = argc;
+}
+
+static void
+compile_exp(vm_compiler *c, ast_node *node)
+{
+  if (!node) {
+    emit(c, VM_UNDEF, 1, NULL);
+    return;
+  }
+
+  switch (node->type) {
+    case NODE_BOOL:   emit(c, VM_BOOL, 1, node); break;
+    case NODE_STR:    emit(c, VM_STR, 1, node); break;
+    case NODE_REGEXP: emit(c, VM_REGEXP, 1, node); break;
+    case NODE_NUM:    emit(c, VM_NUM, 1, node); break;
+    case NODE_NULL:   emit(c, VM_NULL, 1, node); break;
+    case NODE_FUNC:   emit(c, VM_FUNC, 1, node); break;
+    case NODE_IDENT:  emit_load(c, node); break;
+    case NODE_ASGN:   compile_assign(c, node); break;
+    case NODE_CALL:   compile_call(c, node); break;
+
+    case NODE_ARR:
+    {
+      int count = node_count(node->e1);
+      compile_list(c, node->e1, compile_exp);
+      int pc = emit(c, VM_ARRAY, 1 - count, node);
+      c->chunk->code[pc].a = count;
+      break;
+    }
+
+    case NODE_OBJ:
+      if (!has_prop_names(node->e1)) {
+        emit(c, VM_EVAL, 1, node);
+        break;
+      }
+      emit(c, VM_OBJECT, 1, node);
+      compile_list(c, node->e1, compile_prop);
+      break;
+
+    case NODE_MEMBER:
+      compile_exp(c, node->e2);
+      compile_member_get(c, node);
+      break;
+
+    case NODE_EXP:
+      if (node->sub_type == NODE_UNARY_POST) {
+        if (node->e1->type == NODE_IDENT)
+          compile_update(c, node, true);
+        else
+          emit(c, VM_EVAL, 1, node);
+      }
+      else if (node->sub_type == NODE_UNARY_PRE)
+        compile_prefix(c, node);
+      else
+        compile_binary(c, node);
+      break;
+
+    case NODE_TERN:
+    {
+      compile_exp(c, node->e1);
+      int jelse = emit(c, VM_JUMP_IF_FALSE, -1, NULL);
+      compile_exp(c, node->e2);
+      int jend = emit(c, VM_JUMP, 0, NULL);
+      c->depth--;
+      patch(c, jelse, here(c));
+      compile_exp(c, node->e3);
+      patch(c, jend, here(c));
+      break;
+    }
+
+    default:
+      emit(c, VM_EVAL, 1, node);
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Statements
+// ----------------------------------------------------------------------------
+
+static void
+compile_var_dec(vm_compiler *c, ast_node *node)
+{
+  // The declaration itself is hoisted, leaving only the initializer.
+  if (node->e2) {
+    compile_exp(c, node->e2);
+    if (slot_of(c->chunk, node->e1->sval) < 0)
+      emit(c, VM_DECLARE, -1, node->e1);
+    else {
+      emit_store(c, node->e1);
+      emit(c, VM_POP, -1, NULL);
+    }
+  }
+}
+
+/* Start a loop's body with a VM_JIT (to be patched with the end of the loop),
+ * if the JIT is on. */
+static int
+emit_jit(vm_compiler *c, ast_node *loop)
+{
+  return fh->opt_jit ? emit(c, VM_JIT, 0, loop) : -1;
+}
+
+static void
+compile_while(vm_compiler *c, ast_node *node)
+{
+  vm_target target;
+  int top = here(c);
+
+  compile_exp(c, node->e1);
+  int jend = emit(c, VM_JUMP_IF_FALSE, -1, NULL);
+  int jit = emit_jit(c, node);
+
+  push_target(c, &target, true);
+  compile_stmt(c, node->e2);
+  patch(c, emit(c, VM_JUMP, 0, NULL), top);
+  patch(c, jend, here(c));
+  if (jit >= 0) patch(c, jit, here(c));
+  pop_target(c, here(c), top);
+}
+
+static void
+compile_dowhile(vm_compiler *c, ast_node *node)
+{
+  vm_target target;
+  int top = here(c);
+
+  push_target(c, &target, true);
+  compile_stmt(c, node->e1);
+  int cont = here(c);
+  compile_exp(c, node->e2);
+  patch(c, emit(c, VM_JUMP_IF_TRUE, -1, NULL), top);
+  pop_target(c, here(c), cont);
+}
+
+static void
+compile_for(vm_compiler *c, ast_node *node)
+{
+  vm_target target;
+  ast_node *exp_grp = node->e1;
+  int jend = -1;
+
+  if (exp_grp->e1 && exp_grp->e1->type == NODE_VAR_DEC_LST)
+    compile_stmt(c, exp_grp->e1);
+  else if (exp_grp->e1) {
+    compile_exp(c, exp_grp->e1);
+    emit(c, VM_POP, -1, NULL);
+  }
+
+  int top = here(c);
+  if (exp_grp->e2) {
+    compile_exp(c, exp_grp->e2);
+    jend = emit(c, VM_JUMP_IF_FALSE, -1, NULL);
+  }
+  int jit = emit_jit(c, node);
+
+  push_target(c, &target, true);
+  compile_stmt(c, node->e2);
+  int cont = here(c);
+  if (exp_grp->e3) {
+    compile_exp(c, exp_grp->e3);
+    emit(c, VM_POP, -1, NULL);
+  }
+  patch(c, emit(c, VM_JUMP, 0, NULL), top);
+  if (jend >= 0) patch(c, jend, here(c));
+  if (jit >= 0) patch(c, jit, here(c));
+  pop_target(c, here(c), cont);
+}
+
+static void
+compile_forin(vm_compiler *c, ast_node *node)
+{
+  vm_target target;
+  ast_node *lhs = node->e1;
+  int iter = c->iters++;
+  if (c->iters > c->chunk->num_iters)
+    c->chunk->num_iters = c->iters;
+
+  compile_exp(c, node->e2);
+  patch(c, emit(c, VM_ITER_INIT, -1, NULL), iter);
+
+  int top = here(c);
+  int next = emit(c, VM_ITER_NEXT, 1, NULL);
+  patch(c, next, iter);
+
+  // Assign the key to the loop variable, possibly undeclared assignment.
+  if (lhs->type == NODE_VAR_DEC) lhs = lhs->e1;
+  if (lhs->type == NODE_IDENT) {
+    emit_store(c, lhs);
+    emit(c, VM_POP, -1, NULL);
+  }
+  else if (lhs->type == NODE_MEMBER) {
+    int reg = c->regs++;
+    if (c->regs > c->chunk->num_regs)
+      c->chunk->num_regs = c->regs;
+    patch(c, emit(c, VM_STORE_REG, -1, NULL), reg);
+    compile_member_ref(c, lhs);
+    patch(c, emit(c, VM_LOAD_REG, 1, NULL), reg);
+    emit(c, VM_PUT_ELEM, -2, NULL);
+    emit(c, VM_POP, -1, NULL);
+    c->regs--;
+  }
+  else
+    compile_error(lhs, "Invalid left-hand side in for-in");
+
+  push_target(c, &target, true);
+  compile_stmt(c, node->e3);
+  patch(c, emit(c, VM_JUMP, 0, NULL), top);
+  c->chunk->code[next].b = here(c);
+  pop_target(c, here(c), top);
+  c->iters--;
+}
+
+static void
+compile_switch(vm_compiler *c, ast_node *node)
+{
+  vm_target target;
+  ast_node *caseblock = node->e2,
+           *defaultclause = caseblock->e2;
+
+  // Case clauses before and after the default case, in source order.
+  int num_a = 0, num_b = 0;
+  ast_node *clauses_a[node_count(caseblock->e1) + 1];
+  ast_node *clauses_b[node_count(caseblock->e3) + 1];
+  collect_list(caseblock->e1, clauses_a, &num_a);
+  collect_list(caseblock->e3, clauses_b, &num_b);
+
+  int i, jumps_a[num_a + 1], jumps_b[num_b + 1], jdefault;
+
+  if (fh_switch_table(node)) {
+    // VM_SWITCH skips ahead to the jump for its clause (see
+    // fh_switch_lookup), the last being the jump past them all.
+    compile_exp(c, node->e1);
+    emit(c, VM_SWITCH, -1, node);
+    for (i = 0; i < num_a; i++)
+      jumps_a[i] = emit(c, VM_JUMP, 0, NULL);
+    if (defaultclause)
+      jdefault = emit(c, VM_JUMP, 0, NULL);
+    for (i = 0; i < num_b; i++)
+      jumps_b[i] = emit(c, VM_JUMP, 0, NULL);
+    if (!defaultclause)
+      jdefault = emit(c, VM_JUMP, 0, NULL);
+  }
+  else {
+    int reg = c->regs++;
+    if (c->regs > c->chunk->num_regs)
+      c->chunk->num_regs = c->regs;
+
+    compile_exp(c, node->e1);
+    patch(c, emit(c, VM_STORE_REG, -1, NULL), reg);
+
+    // Compare against each case, then take the default case (if any).
+    for (i = 0; i < num_a + num_b; i++) {
+      ast_node *clause = i < num_a ? clauses_a[i] : clauses_b[i - num_a];
+      patch(c, emit(c, VM_LOAD_REG, 1, NULL), reg);
+      compile_exp(c, clause->e1);
+      emit_op(c, VM_BINARY, -1, OP_STRICT_EQ);
+      int jump = emit(c, VM_JUMP_IF_TRUE, -1, NULL);
+      if (i < num_a) jumps_a[i] = jump;
+      else jumps_b[i - num_a] = jump;
+    }
+    jdefault = emit(c, VM_JUMP, 0, NULL);
+    c->regs--;
+  }
+
+  // Cases fall-through to the next when breaks are omitted.
+  push_target(c, &target, false);
+  for (i = 0; i < num_a; i++) {
+    patch(c, jumps_a[i], here(c));
+    compile_stmt(c, clauses_a[i]->e2);
+  }
+  if (defaultclause) {
+    patch(c, jdefault, here(c));
+    compile_stmt(c, defaultclause->e2);
+  }
+  for (i = 0; i < num_b; i++) {
+    patch(c, jumps_b[i], here(c));
+    compile_stmt(c, clauses_b[i]->e2);
+  }
+  if (!defaultclause)
+    patch(c, jdefault, here(c));
+  pop_target(c, here(c), 0);
+}
+
+static void
+compile_try(vm_compiler *c, ast_node *node)
+{
+  int try = emit(c, VM_TRY, 0, node);
+  vm_insn *code;
+
+  compile_stmt(c, node->e1);
+  emit(c, VM_END, 0, NULL);
+
+  int catch = -1, finally = -1;
+  if (node->e2) {
+    catch = here(c);
+    compile_stmt(c, node->e2->e2);
+    emit(c, VM_END, 0, NULL);
+  }
+  if (node->e3) {
+    finally = here(c);
+    compile_stmt(c, node->e3->e1);
+    emit(c, VM_END, 0, NULL);
+  }
+
+  // Re-fetch, emitting may have moved the code.
+  code = c->chunk->code;
+  code[try].a = catch;
+  code[try].b = finally;
+  code[try].c = here(c);
+}
+
+static void
+compile_jump(vm_compiler *c, ast_node *node, bool is_break)
+{
+  vm_target *target = c->targets;
+  while (target && !is_break && !target->loop)
+    target = target->parent;
+
+  if (!target)
+    compile_error(node, is_break ? "Illegal break statement" :
+                                   "Illegal continue statement");
+
+  int pc = emit(c, VM_LEAVE, 0, node);
+  if (is_break)
+    add_jump(&target->breaks, &target->num_breaks, pc);
+  else
+    add_jump(&target->conts, &target->num_conts, pc);
+}
+
+static void
+compile_stmt(vm_compiler *c, ast_node *node)
+{
+  if (!node) return;
+
+  switch (node->type) {
+    case NODE_SRC_LST:
+    case NODE_STMT_LST:
+    case NODE_VAR_DEC_LST:
+      compile_list(c, node, compile_stmt);
+      break;
+
+    case NODE_BLOCK:
+    case NODE_VAR_STMT:
+      compile_stmt(c, node->e1);
+      break;
+
+    case NODE_VAR_DEC:     compile_var_dec(c, node); break;
+    case NODE_WHILE:       compile_while(c, node); break;
+    case NODE_DOWHILE:     compile_dowhile(c, node); break;
+    case NODE_FOR:         compile_for(c, node); break;
+    case NODE_FORIN:       compile_forin(c, node); break;
+    case NODE_SWITCH_STMT: compile_switch(c, node); break;
+    case NODE_TRY_STMT:    compile_try(c, node); break;
+    case NODE_BREAK:       compile_jump(c, node, true); break;
+    case NODE_CONT:        compile_jump(c, node, false); break;
+
+    // Function declarations are hoisted.
+    case NODE_FUNC:
+    case NODE_EMPT_STMT:
+      break;
+
+    case NODE_EXP_STMT:
+      compile_exp(c, node->e1);
+      emit(c, VM_RESULT, -1, NULL);
+      break;
+
+    case NODE_IF:
+    {
+      compile_exp(c, node->e1);
+      int jelse = emit(c, VM_JUMP_IF_FALSE, -1, NULL);
+      compile_stmt(c, node->e2);
+      if (node->e3) {
+        int jend = emit(c, VM_JUMP, 0, NULL);
+        patch(c, jelse, here(c));
+        compile_stmt(c, node->e3);
+        patch(c, jend, here(c));
+      }
+      else
+        patch(c, jelse, here(c));
+      break;
+    }
+
+    case NODE_RETURN:
+      compile_exp(c, node->e1);
+      emit(c, VM_RETURN, -1, NULL);
+      break;
+
+    case NODE_THROW:
+      compile_exp(c, node->e1);
+      emit(c, VM_THROW, -1, node->e1);
+      break;
+
+    default:
+      emit(c, VM_EVAL, 1, node);
+      emit(c, VM_RESULT, -1, NULL);
+  }
+}
+
+/* Compile a program or function body. Pass the function node when compiling
+ * a function body, so that its locals can be resolved to slots. */
+vm_chunk *
+fh_vm_compile(ast_node *node, ast_node *func)
+{
+  vm_compiler c;
+  memset(&c, 0, sizeof(vm_compiler));
+  c.chunk = calloc(1, sizeof(vm_chunk));
+
+  if (node->type == NODE_SRC_LST) {
+    hoist_funcs(c.chunk, node);
+    hoist_vars(c.chunk, node);
+    if (func) resolve_slots(c.chunk, func);
+    emit(&c, VM_HOIST, 0, node);
+  }
+
+  compile_stmt(&c, node);
+  emit(&c, VM_END, 0, NULL);
+
+  c.chunk->next = fh->vm_chunks;
+  fh->vm_chunks = c.chunk;
+  return c.chunk;
+}
+
+
+// ----------------------------------------------------------------------------
+// Try/Catch
+// ----------------------------------------------------------------------------
+
+/* Run a region with a catch frame in place. A throw from this frame's own
+ * code comes back as a completion; one from further in (a call, a native)
+ * lands on the frame. Either way the error is left in `f->error`. */
+static vm_completion
+vm_protect(vm_frame *f, int start, int end)
+{
+  fh_catch c;
+  fh_catch_push(&c);
+
+  // `fh_throw` pops the frame and restores `fh->vm_frames` before jumping.
+  if (setjmp(c.jmp)) {
+    f->protect--;
+    if (fh->quota_exceeded) fh_throw(fh->callstack, c.error);
+    f->error = c.error;
+    return VM_THROWN;
+  }
+
+  f->protect++;
+  vm_completion res = vm_run(f, start, end);
+  f->protect--;
+  fh_catch_pop(&c);
+  return res;
+}
+
+/* Throw from a frame: a completion if a region of the frame will catch it,
+ * otherwise up through fh_throw. */
+static vm_completion
+vm_throw(vm_frame *f, ast_node *node, js_val *error)
+{
+  if (f->protect) {
+    f->error = error;
+    return VM_THROWN;
+  }
+  eval_state *state = fh_new_state(node->line, node->column);
+  fh_push_state(state);
+  fh_throw(state, error);
+  return VM_THROWN;
+}
+
+static vm_completion
+vm_try(vm_frame *f, vm_insn *in, int pc)
+{
+  ast_node *node = in->node;
+  int catch = in->a, finally = in->b, end = in->c;
+  int try_end = catch >= 0 ? catch : (finally >= 0 ? finally : end);
+  int catch_end = finally >= 0 ? finally : end;
+  js_val *error = NULL;
+
+  vm_completion res = vm_protect(f, pc + 1, try_end);
+
+  // Catch
+  if (res == VM_THROWN && catch >= 0) {
+    fh_set(f->ctx, node->e2->e1->sval, f->error);
+    res = finally >= 0 ?
+      vm_protect(f, catch, catch_end) :
+      vm_run(f, catch, catch_end);
+  }
+  if (res == VM_THROWN) error = f->error;
+
+  // Finally (an abrupt completion here takes precedence)
+  if (finally >= 0) {
+    vm_completion final_res = vm_run(f, finally, end);
+    if (final_res != VM_NORMAL) return final_res;
+  }
+
+  if (res == VM_THROWN)
+    return vm_throw(f, node, error);
+  return res;
+}
+
+
+// ----------------------------------------------------------------------------
+// Dispatch Loop
+// ----------------------------------------------------------------------------
+
+static void
+iter_init(vm_iter *iter, js_val *obj)
+{
+  // Snapshot the enumerable keys along the prototype chain.
+  iter->obj = obj;
+  iter->keys = fh_enum_keys(obj);
+  iter->pos = 0;
+}
+
+/* The next key taken that the object still has, or NULL when done. */
+static js_val *
+iter_next(vm_iter *iter)
+{
+  while (iter->pos < iter->keys->object.length) {
+    js_val *key = fh_get_elem(iter->keys, iter->pos++);
+    if (fh_has_key(iter->obj, key->string.ptr)) return key;
+  }
+  return NULL;
+}
+
+#ifdef FH_DEBUG
+#define IC_COUNT(ic,counter) ((ic)->counter++)
+#else
+#define IC_COUNT(ic,counter)
+#endif
+
+/* Look up a property along the prototype chain using the inline cache,
+ * updating the cache on a miss. */
+static js_prop *
+ic_lookup(vm_ic *ic, js_val *obj, char *name)
+{
+  js_val *holder;
+  int i, k;
+
+  if (obj->shape) {
+    for (i = 0; i < ic->num_entries; i++) {
+      vm_ic_entry *e = &ic->entries[i];
+      if (e->shape != obj->shape) continue;
+      holder = obj;
+      for (k = 0; k < e->depth; k++) {
+        holder = holder->proto;
+        if (holder != e->protos[k] || holder->shape != e->proto_shapes[k])
+          break;
+      }
+      if (k == e->depth) {
+        IC_COUNT(ic, hits);
+        return holder->slots[e->offset];
+      }
+    }
+  }
+  IC_COUNT(ic, misses);
+
+  vm_ic_entry entry;
+  bool cacheable = obj->shape != NULL;
+  entry.shape = obj->shape;
+  entry.depth = 0;
+
+  holder = obj;
+  js_prop *prop = fh_get_prop(holder, name);
+  while (!prop && holder->proto) {
+    holder = holder->proto;
+    if (entry.depth == VM_IC_DEPTH || !holder->shape)
+      cacheable = false;
+    else {
+      entry.protos[entry.depth] = holder;
+      entry.proto_shapes[entry.depth++] = holder->shape;
+    }
+    prop = fh_get_prop(holder, name);
+  }
+
+  if (!prop || !cacheable) return prop;
+
+  for (i = 0; holder->slots[i] != prop; i++);
+  entry.offset = i;
+
+  if (ic->num_entries < VM_IC_ENTRIES)
+    ic->entries[ic->num_entries++] = entry;
+  else {
+    ic->entries[ic->next] = entry;
+    ic->next = (ic->next + 1) % VM_IC_ENTRIES;
+  }
+  return prop;
+}
+
+static js_val *
+vm_load(js_val *ctx, ast_node *ident)
+{
+  js_prop *prop = fh_get_prop_rec(ctx, ident->sval);
+  if (!prop) {
+    eval_state *state = fh_new_state(ident->line, ident->column);
+    fh_push_state(state);
+    fh_throw(state, fh_new_error(E_REFERENCE, "%s is not defined", ident->sval));
+  }
+  return prop->ptr;
+}
+
+static vm_completion
+vm_run(vm_frame *f, int start, int end)
+{
+  vm_insn *code = f->chunk->code, *in;
+  js_val **stack = f->stack, *ctx = f->ctx, *val, *elem;
+  js_prop *prop;
+  int pc = start, sp = 0, i;
+  unsigned long idx;
+
+#define PUSH(x)  (stack[sp++] = (x))
+#define POP()    (stack[--sp])
+#define TOP      (stack[sp - 1])
+#define TRUTHY(x) fh_truthy(x)
+
+  while (true) {
+    in = &code[pc++];
+    HEAP_PROFILE_AT(in->node);
+
+    switch (in->op) {
+      case VM_END:        return VM_NORMAL;
+      case VM_NOP:        break;
+      case VM_POP:        sp--; break;
+      case VM_DUP:        stack[sp] = stack[sp - 1]; sp++; break;
+      case VM_DUP2:       stack[sp] = stack[sp - 2];
+                          stack[sp + 1] = stack[sp - 1];
+                          sp += 2;
+                          break;
+
+      case VM_UNDEF:      PUSH(JSUNDEF()); break;
+      case VM_NULL:       PUSH(JSNULL()); break;
+      case VM_BOOL:
+      case VM_NUM:
+      case VM_STR:        PUSH(fh_literal(in->node)); break;
+      case VM_REGEXP:     PUSH(JSRE(in->node->sval)); break;
+      case VM_FUNC:       PUSH(JSFUNC(in->node)); break;
+
+      case VM_ARRAY:
+        val = JSARR();
+        for (i = 0; i < in->a; i++)
+          fh_set_elem(val, i, stack[sp - in->a + i]);
+        fh_set_len(val, in->a);
+        sp -= in->a;
+        PUSH(val);
+        break;
+
+      case VM_OBJECT:
+        val = JSOBJ();
+        val->object.parent = ctx;
+        PUSH(val);
+        break;
+
+      case VM_INIT_PROP:
+        val = POP();
+        fh_set(TOP, in->s, val);
+        break;
+
+      case VM_HOIST:
+        for (i = 0; i < f->chunk->num_funcs; i++) {
+          ast_node *func = f->chunk->funcs[i];
+          fh_set_prop(ctx, func->e3->sval, JSFUNC(func), P_WRITE | P_ENUM);
+        }
+        for (i = 0; i < f->chunk->num_vars; i++) {
+          if (!fh_get_prop(ctx, f->chunk->vars[i]))
+            fh_set_prop(ctx, f->chunk->vars[i], JSUNDEF(), P_WRITE | P_ENUM);
+        }
+        for (i = 0; i < f->chunk->num_slots; i++)
+          f->slots[i] = fh_get_prop(ctx, f->chunk->slots[i]);
+        break;
+
+      case VM_LOAD:
+        PUSH(vm_load(ctx, in->node));
+        break;
+
+      case VM_LOAD_SLOT:
+        prop = f->slots[in->a];
+        PUSH(prop ? prop->ptr : vm_load(ctx, in->node));
+        break;
+
+      case VM_STORE_SLOT:
+        prop = f->slots[in->a];
+        if (prop) {
+          GC_BARRIER(ctx, TOP);
+          prop->ptr = TOP;
+          prop->circular = TOP == ctx;
+        }
+        else
+          fh_set_rec(ctx, in->node->sval, TOP);
+        break;
+
+      case VM_LOAD_TYPEOF:
+        PUSH(JSSTR(fh_typeof(fh_get_rec(ctx, in->node->sval))));
+        break;
+
+      case VM_STORE:      fh_set_rec(ctx, in->node->sval, TOP); break;
+      case VM_DECLARE:    fh_set(ctx, in->node->sval, POP()); break;
+      case VM_LOAD_REG:   PUSH(f->regs[in->a]); break;
+      case VM_STORE_REG:  f->regs[in->a] = POP(); break;
+
+      case VM_GET_PROP:
+        prop = ic_lookup(in->ic, TOP, in->s);
+        TOP = prop ? prop->ptr : JSUNDEF();
+        break;
+
+      case VM_GET_ELEM:
+        val = stack[sp - 2];
+        // Index dense arrays by number, without building a string key.
+        if (val->dense && fh_num_index(TOP, &idx) && (elem = fh_get_elem(val, idx))) {
+          stack[sp - 2] = elem;
+          sp--;
+          break;
+        }
+        TOP = TO_STR(TOP);
+        // Handle array-like string character access.
+        if (in->node && IS_STR(val) && in->node->e1->type == NODE_NUM) {
+          int idx = in->node->e1->val, len = val->string.length;
+          char str[2] = {0, 0};
+          if (idx < len && idx >= 0) str[0] = fh_str_flatten(val)->string.ptr[idx];
+          stack[sp - 2] = str[0] ? JSSTR(str) : JSUNDEF();
+        }
+        else
+          stack[sp - 2] = fh_get_proto(val, TOP->string.ptr);
+        sp--;
+        break;
+
+      case VM_PUT_ELEM:
+        if (stack[sp - 3]->dense && fh_num_index(stack[sp - 2], &idx))
+          fh_assign_elem(stack[sp - 3], idx, TOP, OP_ASGN);
+        else {
+          stack[sp - 2] = TO_STR(stack[sp - 2]);
+          fh_assign_member(stack[sp - 3], stack[sp - 2]->string.ptr, TOP, OP_ASGN);
+        }
+        stack[sp - 3] = TOP;
+        sp -= 2;
+        break;
+
+      case VM_BINARY:
+        val = POP();
+        TOP = fh_bin_op(in->a, TOP, val);
+        break;
+
+      case VM_INC:        TOP = fh_bin_op(in->a, TOP, JSNUM(1)); break;
+      case VM_UNARY:      TOP = fh_unary_op(in->a, TOP); break;
+      case VM_TO_NUM:     TOP = TO_NUM(TOP); break;
+      case VM_TYPEOF:     TOP = JSSTR(fh_typeof(TOP)); break;
+
+      case VM_JUMP:
+        if (in->a < pc) QUOTA_STEP();     // a loop going round
+        pc = in->a;
+        break;
+      case VM_JUMP_IF_FALSE:
+        val = POP();
+        if (!TRUTHY(val)) pc = in->a;
+        break;
+      case VM_SWITCH:
+        pc += fh_switch_lookup(in->node, POP());
+        break;
+
+      case VM_JUMP_IF_TRUE:
+        val = POP();
+        if (TRUTHY(val)) {
+          if (in->a < pc) QUOTA_STEP();
+          pc = in->a;
+        }
+        break;
+      case VM_AND:
+        if (!TRUTHY(TOP)) pc = in->a;
+        else sp--;
+        break;
+      case VM_OR:
+        if (TRUTHY(TOP)) pc = in->a;
+        else sp--;
+        break;
+
+      case VM_LEAVE:
+        if (in->a >= start && in->a < end) {
+          pc = in->a;
+          break;
+        }
+        f->target = in->a;
+        return VM_JUMPED;
+
+      case VM_RESULT:
+        f->result = POP();
+        GC_SAFEPOINT();
+        break;
+
+      case VM_RETURN:
+        val = POP();
+        if (IS_FUNC(val)) {
+          GC_BARRIER(val, ctx);
+          val->object.scope = ctx;
+        }
+        f->ret = val;
+        return VM_RETURNED;
+
+      case VM_THROW:
+        return vm_throw(f, in->node, POP());
+
+      case VM_TRY:
+        switch (vm_try(f, in, pc - 1)) {
+          case VM_RETURNED:
+            return VM_RETURNED;
+          case VM_THROWN:
+            return VM_THROWN;
+          case VM_JUMPED:
+            if (f->target < start || f->target >= end) return VM_JUMPED;
+            pc = f->target;
+            break;
+          default:
+            pc = in->c;
+        }
+        break;
+
+      case VM_ITER_INIT:
+        iter_init(&f->iters[in->a], POP());
+        break;
+
+      case VM_ITER_NEXT:
+      {
+        js_val *key = iter_next(&f->iters[in->a]);
+        if (!key)
+          pc = in->b;
+        else
+          PUSH(key);
+        break;
+      }
+
+      case VM_CALL:
+      {
+        // The arguments are passed in place. They stay on the operand
+        // stack, which is a GC root, for the duration of the call.
+        js_args args;
+        args_view(&args, &stack[sp - in->a], in->a);
+        sp -= in->a;
+        TOP = fh_invoke(ctx, NULL, TOP, &args, in->node);
+        if (TOP->signal != S_NONE) TOP->signal = S_NONE;
+        break;
+      }
+
+      case VM_CALL_METHOD:
+      {
+        // As above, with the receiver under the function.
+        js_args args;
+        args_view(&args, &stack[sp - in->a], in->a);
+        sp -= in->a;
+        val = fh_invoke(ctx, stack[sp - 2], TOP, &args, in->node);
+        if (val->signal != S_NONE) val->signal = S_NONE;
+        stack[--sp - 1] = val;
+        break;
+      }
+
+      case VM_EVAL:
+        PUSH(fh_eval(ctx, in->node));
+        break;
+
+      case VM_JIT:
+        switch (fh_jit_loop(ctx, in->node, &f->result)) {
+          case JIT_DONE: pc = in->a; break;
+          case JIT_NEVER: in->op = VM_NOP; break;
+          default: break;
+        }
+        break;
+    }
+  }
+
+#undef PUSH
+#undef POP
+#undef TOP
+#undef TRUTHY
+}
+
+
+// ----------------------------------------------------------------------------
+// Entry Points
+// ----------------------------------------------------------------------------
+
+static js_val *
+vm_exec(js_val *ctx, ast_node *node, ast_node *func)
+{
+  if (!node) return JSUNDEF();
+
+  // Each isolate compiles the program or function for itself.
+  fh_node_data *data = fh_get_node_data(func ? func : node);
+  if (!data->chunk) data->chunk = fh_vm_compile(node, func);
+
+  vm_chunk *chunk = data->chunk;
+  js_val *stack[chunk->max_stack + 1], *regs[chunk->num_regs + 1];
+  js_prop *slots[chunk->num_slots + 1];
+  vm_iter iters[chunk->num_iters + 1];
+
+  memset(stack, 0, sizeof(stack));
+  memset(regs, 0, sizeof(regs));
+  memset(slots, 0, sizeof(slots));
+  memset(iters, 0, sizeof(iters));
+
+  vm_frame frame;
+  frame.chunk = chunk;
+  frame.ctx = ctx;
+  frame.stack = stack;
+  frame.regs = regs;
+  frame.slots = slots;
+  frame.iters = iters;
+  frame.result = NULL;
+  frame.ret = NULL;
+  frame.target = 0;
+  frame.protect = 0;
+  frame.error = NULL;
+  frame.parent = fh->vm_frames;
+  fh->vm_frames = &frame;
+
+  vm_completion res = vm_run(&frame, 0, chunk->len);
+  fh->vm_frames = frame.parent;
+
+  if (res == VM_RETURNED) return frame.ret;
+  if (func || !frame.result) return JSUNDEF();
+  return frame.result;
+}
+
+/* Evaluate a program, returning the value of the last expression statement. */
+js_val *
+fh_vm_eval(js_val *ctx, ast_node *node)
+{
+  return vm_exec(ctx, node, NULL);
+}
+
+/* Run the body of a function within its prepared scope. */
+js_val *
+fh_vm_call(js_val *scope, ast_node *func)
+{
+  return vm_exec(scope, fh_func_body(func), func);
+}
+
+/* Empty every inline cache, e.g. once the values they hold have moved. */
+void
+fh_vm_flush_caches()
+{
+  vm_chunk *chunk;
+  int i;
+
+  for (chunk = fh->vm_chunks; chunk; chunk = chunk->next) {
+    for (i = 0; i < chunk->len; i++) {
+      vm_ic *ic = chunk->code[i].ic;
+      if (!ic) continue;
+      ic->num_entries = 0;
+      ic->next = 0;
+    }
+  }
+}
+
+static void
+free_chunk(vm_chunk *chunk)
+{
+  int i;
+  for (i = 0; i < chunk->len; i++)
+    free(chunk->code[i].ic);
+  free(chunk->code);
+  free(chunk->vars);
+  free(chunk->funcs);
+  free(chunk->slots);
+  free(chunk);
+}
+
+/* Free one chunk of the current isolate's, whose tree is going away. */
+void
+fh_vm_free_chunk(vm_chunk *chunk)
+{
+  vm_chunk **link = &fh->vm_chunks;
+  while (*link && *link != chunk) link = &(*link)->next;
+  if (*link) *link = chunk->next;
+  free_chunk(chunk);
+}
+
+/* Free the bytecode compiled by the current isolate. */
+void
+fh_vm_free_chunks()
+{
+  vm_chunk *chunk, *next;
+
+  for (chunk = fh->vm_chunks; chunk; chunk = next) {
+    next = chunk->next;
+    free_chunk(chunk);
+  }
+  fh->vm_chunks = NULL;
+}
+
+#ifdef FH_DEBUG
+/* Print the hit and miss counts of each property lookup site. */
+void
+fh_vm_print_ic_stats(FILE *stream)
+{
+  vm_chunk *chunk;
+  int i;
+
+  for (chunk = fh->vm_chunks; chunk; chunk = chunk->next) {
+    for (i = 0; i < chunk->len; i++) {
+      vm_insn *in = &chunk->code[i];
+      if (!in->ic || in->ic->hits + in->ic->misses == 0) continue;
+      fprintf(stream, "ic %d:%d .%s hits=%lu misses=%lu shapes=%d\n",
+              in->node->line, in->node->column, in->s,
+              in->ic->hits, in->ic->misses, in->ic->num_entries);
+    }
+  }
+}
+#endif
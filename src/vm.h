@@ -0,0 +1,170 @@
+/*
+ * vm.h -- Bytecode compiler and virtual machine
+ *
+ * Copyright (c) 2012-2013 Nick Reynolds
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef VM_H
+#define VM_H
+
+#include "flathead.h"
+#include "nodes.h"
+
+typedef enum {
+  VM_END,             // end of a code region
+  VM_NOP,
+  VM_POP,
+  VM_DUP,
+  VM_DUP2,
+
+  // Literals
+  VM_UNDEF,
+  VM_NULL,
+  VM_BOOL,
+  VM_NUM,
+  VM_STR,
+  VM_REGEXP,
+  VM_FUNC,
+  VM_ARRAY,           // a: element count
+  VM_OBJECT,
+  VM_INIT_PROP,       // s: property name
+
+  // Variables
+  VM_HOIST,
+  VM_LOAD,
+  VM_LOAD_TYPEOF,
+  VM_STORE,
+  VM_DECLARE,
+  VM_LOAD_REG,        // a: register
+  VM_STORE_REG,       // a: register
+  VM_LOAD_SLOT,       // a: slot
+  VM_STORE_SLOT,      // a: slot
+
+  // Members
+  VM_GET_PROP,        // s: property name
+  VM_GET_ELEM,
+  VM_PUT_ELEM,
+
+  // Operators
+  VM_BINARY,          // a: operator
+  VM_UNARY,           // a: operator
+  VM_INC,             // a: OP_ADD or OP_SUB of 1
+  VM_TO_NUM,
+  VM_TYPEOF,
+
+  // Control
+  VM_JUMP,            // a: target
+  VM_JUMP_IF_FALSE,   // a: target
+  VM_JUMP_IF_TRUE,    // a: target
+  VM_SWITCH,          // followed by a VM_JUMP per clause, then one past them
+  VM_AND,             // a: target
+  VM_OR,              // a: target
+  VM_LEAVE,           // a: target of a break or continue
+  VM_RESULT,
+  VM_RETURN,
+  VM_THROW,
+  VM_TRY,             // a: catch, b: finally, c: end
+  VM_ITER_INIT,       // a: iterator
+  VM_ITER_NEXT,       // a: iterator, b: target when done
+
+  // Calls & fallback
+  VM_CALL,            // a: argument count
+  VM_CALL_METHOD,     // a: argument count, after the receiver and function
+  VM_EVAL,            // evaluate the node with the AST walker
+  VM_JIT              // a: end of the loop, left to once it ran in machine code
+} vm_opcode;
+
+#define VM_IC_ENTRIES  4
+#define VM_IC_DEPTH    4
+
+/* An inline cache entry: objects with `shape` find the property on the
+ * holder `depth` prototypes up, at the slot `offset`. The prototypes along
+ * the way must still be the same objects with the same shapes. */
+typedef struct {
+  js_shape *shape;
+  int depth;
+  js_val *protos[VM_IC_DEPTH];
+  js_shape *proto_shapes[VM_IC_DEPTH];
+  unsigned long offset;
+} vm_ic_entry;
+
+typedef struct {
+  vm_ic_entry entries[VM_IC_ENTRIES];
+  int num_entries;
+  int next;               // entry to replace when full
+#ifdef FH_DEBUG
+  unsigned long hits;
+  unsigned long misses;
+#endif
+} vm_ic;
+
+typedef struct {
+  vm_opcode op;
+  int a;
+  int b;
+  int c;
+  char *s;
+  ast_node *node;
+  vm_ic *ic;              // property lookup cache (VM_GET_PROP)
+} vm_insn;
+
+typedef struct vm_chunk {
+  vm_insn *code;
+  int len;
+  int cap;
+  int max_stack;
+  int num_regs;
+  int num_iters;
+  char **vars;            // hoisted variable names
+  int num_vars;
+  ast_node **funcs;       // hoisted function declarations
+  int num_funcs;
+  char **slots;           // names resolved to slots
+  int num_slots;
+  struct vm_chunk *next;  // all compiled chunks
+} vm_chunk;
+
+typedef struct {
+  js_val *obj;            // the object iterated
+  js_val *keys;           // array of the keys to visit
+  unsigned long pos;
+} vm_iter;
+
+typedef struct vm_frame {
+  vm_chunk *chunk;
+  js_val *ctx;
+  js_val **stack;
+  js_val **regs;
+  js_prop **slots;        // props of slot-resolved names (or NULL)
+  vm_iter *iters;
+  js_val *result;         // completion value of the last statement
+  js_val *ret;            // return value
+  int target;             // pending break/continue target
+  int protect;            // try regions running in the frame
+  js_val *error;          // the error of a VM_THROWN completion
+  struct vm_frame *parent;
+} vm_frame;
+
+vm_chunk * fh_vm_compile(ast_node *, ast_node *);
+js_val * fh_vm_eval(js_val *, ast_node *);
+js_val * fh_vm_call(js_val *, ast_node *);
+void fh_vm_flush_caches(void);
+void fh_vm_free_chunk(vm_chunk *);
+void fh_vm_free_chunks(void);
+#ifdef FH_DEBUG
+void fh_vm_print_ic_stats(FILE *);
+#endif
+
+#endif
@@ -0,0 +1,26 @@
+// globals.js
+// ----------
+
+// Run twice in one process by `make test-isolates`: the second run must see
+// none of what the first left behind, though its tree is shared.
+
+var assert = console.assert;
+
+assert(typeof leaked === 'undefined');
+assert(typeof implicit === 'undefined');
+assert(({}).polluted === undefined);
+assert([].extra === undefined);
+assert(Math.tau === undefined);
+assert(JSON.stringify({a: 1, b: [2]}) === '{"a":1,"b":[2]}');
+
+var keys = '';
+for (var k in {a: 1, b: 2}) keys += k;
+assert(keys === 'ab');
+
+// Leave all of it behind for the next isolate.
+var leaked = 1;
+implicit = 2;
+Object.prototype.polluted = true;
+Array.prototype.extra = function() {};
+Math.tau = 2 * Math.PI;
+JSON.stringify = function() { return 'replaced'; };
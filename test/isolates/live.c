@@ -0,0 +1,57 @@
+// live.c
+// ------
+
+// Built and run by `make test-isolates`: two isolates live side by side, and
+// the one churning through eval'd strings must not free the trees of the
+// other's functions, or hand their nodes' slots to data of its own.
+
+#include <stdio.h>
+
+#include "../../src/flathead.h"
+#include "../../src/gc.h"
+
+// Eval a string making a function, a new string for each n.
+static void
+eval_func(fh_state *isolate, int n)
+{
+  char buf[128];
+  fh_enter_isolate(isolate);
+  snprintf(buf, sizeof(buf),
+      "var f = function () { return %d + 'x'.length - 1; };", n);
+  fh_eval_string(buf, isolate->global);
+}
+
+int
+main(int argc, char **argv)
+{
+  fh_state *a, *b;
+  js_val *res;
+  int i;
+
+  a = fh_new_isolate(NULL);
+  b = fh_new_isolate(NULL);
+
+  // A keeps its first function, whose tree the next strings evict.
+  fh_enter_isolate(a);
+  fh_eval_string("var keep = eval('(function () { return 41 + 1; });');",
+      a->global);
+  for (i = 0; i < 100; i++) eval_func(a, i);
+
+  // B lets each of its go, collecting as it goes.
+  for (i = 0; i < 400; i++) {
+    eval_func(b, i);
+    if (i % 10 == 0) fh_gc();
+  }
+
+  fh_enter_isolate(a);
+  fh_gc();
+  res = fh_eval_string("keep() + f();", a->global);
+  if (!IS_NUM(res) || res->number.val != 141) {
+    fprintf(stderr, "live.c: the kept function broke\n");
+    return 1;
+  }
+
+  fh_free_isolate(b);
+  fh_free_isolate(a);
+  return 0;
+}
@@ -0,0 +1,10 @@
+// unparsed.js
+// -----------
+
+// Run by `make test-parse-cache`, first as usual and then with --eager-parse:
+// the body below is never called, so only an eager parse finds its error,
+// and an entry from the lazy run must not stand in for one.
+
+var broken = function() { return 1 +; };
+
+console.log('a lazy parse skips the broken body');
@@ -0,0 +1,16 @@
+// heap.js
+// -------
+
+// Run with a heap quota by `make test-quotas`: the script must end once its
+// heap is full, however it's caught.
+
+var keep = [];
+var grow = function() {
+  try {
+    while (true) keep.push({n: keep.length, s: 'value ' + keep.length});
+  } catch (e) {
+    console.log('caught ' + e);
+  }
+};
+
+try { grow(); } catch (e) { console.log('caught ' + e); }
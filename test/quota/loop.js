@@ -0,0 +1,16 @@
+// loop.js
+// -------
+
+// Run with a step or time quota by `make test-quotas`: no try stops the
+// script being terminated, in the tree-walker or in the VM.
+
+var spins = 0;
+var spin = function() {
+  try {
+    while (true) spins++;
+  } catch (e) {
+    console.log('caught ' + e);
+  }
+};
+
+try { spin(); } catch (e) { console.log('caught ' + e); }
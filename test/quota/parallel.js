@@ -0,0 +1,16 @@
+// parallel.js
+// -----------
+
+// Run with a step quota by `make test-quotas`: a worker over the quota ends
+// on its own, and its error reaches parallel.map in the parent, which (not
+// over the quota itself) may catch it. The worker never unwinds into the
+// parent's try statements.
+
+var caught = 0;
+try {
+  parallel.map([1, 2, 3, 4], function(x) { while (true) {} }, {workers: 2});
+} catch (e) {
+  caught++;
+  console.assert(e.message.indexOf('terminated') >= 0);
+}
+console.assert(caught === 1);
@@ -0,0 +1,5 @@
+// fail.js
+// -------
+
+console.log('before');
+throw new Error('failed on purpose');
@@ -0,0 +1,4 @@
+// hello.js
+// --------
+
+console.log(greet('server'));
@@ -0,0 +1,6 @@
+// lib.js
+// ------
+
+// Loaded once by the server; every script it runs sees these.
+
+var greet = function(who) { return 'hello ' + who; };
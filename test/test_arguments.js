@@ -49,3 +49,14 @@ var assert = console.assert;
 (function(arguments) {
   assert(typeof arguments == 'number');
 })(42);
+
+
+// Nested functions see their own arguments object.
+(function(a, b) {
+  function inner() { return arguments.length; }
+  function shadow() { return typeof arguments; }
+  assert(inner() === 0);
+  assert(inner(a, b, 3) === 3);
+  assert(shadow() === 'object');
+  assert(arguments.length === 2);
+})(1, 2);
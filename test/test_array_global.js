@@ -35,6 +35,27 @@ test('Constructor', function() {
 
 });
 
+test('Elements', function() {
+  var a = [];
+  for (var i = 0; i < 200; i++) a[i] = i * 2;
+  assertEquals(200, a.length);
+  assertEquals(398, a[199]);
+
+  var b = [1, 2, 3];
+  delete b[1];
+  assertEquals(undefined, b[1]);
+  assertEquals(false, b.hasOwnProperty(1));
+  assertEquals(true, b.hasOwnProperty('2'));
+
+  var c = [0];
+  c[100000] = 1;
+  assertEquals(100001, c.length);
+  assertEquals(1, c[100000]);
+  assertEquals(undefined, c[50000]);
+  c.pop();
+  assertEquals(100000, c.length);
+});
+
 test('Array.isArray(value)', function() {
   assert(Array.isArray([]));
   assert(Array.isArray([1]));
@@ -217,6 +238,32 @@ test('Array#sort()', function() {
   a.sort();
   assertArrayEquals([1, 2, 3, 4], a);
   assertArrayEquals([200, 45, 7], [7, 45, 200].sort());
+  assertArrayEquals([7, 45, 200], [200, 7, 45].sort(function(a, b) { return a - b; }));
+  assertArrayEquals([200, 45, 7], [7, 200, 45].sort(function(x, y) { return y - x; }));
+  assertArrayEquals([1, 'a', 'b', undefined], ['b', undefined, 1, 'a'].sort());
+
+  var byKey = function(a, b) { return a.k - b.k; };
+  var recs = [{k: 2, v: 'a'}, {k: 1, v: 'b'}, {k: 2, v: 'c'}, {k: 1, v: 'd'}];
+  var order = recs.sort(byKey).map(function(r) { return r.v; });
+  assertArrayEquals(['b', 'd', 'a', 'c'], order);
+
+  var nested = [3, 1, 2].sort(function(a, b) {
+    [2, 1].sort();
+    return a - b + [9, 8].sort()[0] - 8;
+  });
+  assertArrayEquals([1, 2, 3], nested);
+
+  var long = [], i;
+  for (i = 0; i < 100; i++) long.push(99 - i);
+  long.sort(function(a, b) { return a - b; });
+  for (i = 0; i < 100; i++) assertEquals(i, long[i]);
+
+  var s = Array(300).join('x');
+  var ropes = [s + 'b', 7, s + 'a'].sort();
+  assertEquals(3, ropes.length);
+  assertEquals(7, ropes[0]);
+  assertEquals(s + 'a', ropes[1]);
+  assertEquals(s + 'b', ropes[2]);
 });
 
 test('Array#forEach(callback[, ctx])', function() {
@@ -4,7 +4,9 @@
 var assert = console.assert;
 
 var assertEquals = function(a, b) {
-  return a === b;
+  if (a !== b)
+    console.log(a + ' !== ' + b);
+  assert(a === b);
 };
 
 var test = function(name, f) {
@@ -28,6 +30,44 @@ test('Variable assignment', function() {
   assertEquals(7, x);
 });
 
+test('Compound assignment with the other operators', function() {
+  var x = 17;
+
+  x %= 5;
+  assertEquals(2, x);
+
+  x <<= 3;
+  assertEquals(16, x);
+
+  x >>= 2;
+  assertEquals(4, x);
+
+  x = -8;
+  x >>= 1;
+  assertEquals(-4, x);
+
+  x >>>= 28;
+  assertEquals(15, x);
+
+  x &= 6;
+  assertEquals(6, x);
+
+  x ^= 3;
+  assertEquals(5, x);
+
+  x |= 8;
+  assertEquals(13, x);
+
+  var o = {n: 12, m: [7]};
+  o.n %= 5;
+  o.n <<= 2;
+  o.n |= 1;
+  assertEquals(9, o.n);
+  o.m[0] ^= 2;
+  o.m[0] >>>= 1;
+  assertEquals(2, o.m[0]);
+});
+
 test('Assignment with member expressions', function() {
   var y = {};
 
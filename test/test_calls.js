@@ -10,3 +10,56 @@ var myObject = {
 console.assert(myObject.myMethod() === 42);
 console.assert(myObject["myMethod"]() === 42);
 console.assert(myObject["my" + "Method"]() === 42);
+
+// A call as a statement doesn't end the caller, and literals are rebuilt on
+// every evaluation.
+var calls = 0;
+function count() { calls++; return calls; }
+count();
+count();
+console.assert(calls === 2);
+
+var lengths = [];
+for (var i = 0; i < 3; i++) {
+  var pair = [i, count()];
+  lengths.push(pair.length);
+}
+console.assert(lengths.join() === '2,2,2');
+
+// Function bodies are parsed when first called, and parsed only once.
+function neverCalled() {
+  var x = 1 + ;
+}
+var threw = false;
+try { neverCalled(); } catch (e) { threw = e.name === 'SyntaxError'; }
+console.assert(threw);
+
+function nested(n) {
+  function twice(x) { return 2 * x + arguments.length; }
+  return twice(n);
+}
+console.assert(nested(1) === 3);
+console.assert(nested(2) === 5);
+
+// Without a return statement, a call evaluates to undefined.
+function noReturn() { calls++; }
+console.assert(noReturn() === undefined);
+
+// Methods are called with their object as this, however they're reached.
+var counter = {
+  n: 0,
+  bump: function() { this.n++; return this; }
+};
+counter.bump().bump();
+counter["bump"]();
+console.assert(counter.n === 3);
+
+function Point(x) { this.x = x; }
+Point.prototype.getX = function() { return this.x; };
+function makePoint(x) { return new Point(x); }
+console.assert(makePoint(4).getX() === 4);
+
+// Builtin methods see the value they're called on.
+console.assert("abc".charAt(1) === 'b');
+console.assert((2.5).toFixed(2) === '2.50');
+console.assert([1, 2].concat([3]).length === 3);
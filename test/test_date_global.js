@@ -273,6 +273,18 @@ test('Date#getUTCDate()', function() {
   assertEquals(7,  d2u.getUTCDate());
   assertEquals(28, d3u.getUTCDate());
   assertEquals(25, d4u.getUTCDate());
+
+  // Month and year boundaries, around leap days
+  var leap = new Date(Date.UTC(2012, 1, 29, 23, 59));
+  assertEquals(29, leap.getUTCDate());
+  assertEquals(1,  leap.getUTCMonth());
+  assertEquals(1,  new Date(leap.getTime() + 60000).getUTCDate());
+  assertEquals(2,  new Date(leap.getTime() + 60000).getUTCMonth());
+  assertEquals(1,  new Date(Date.UTC(2100, 2, 1)).getUTCDate());
+  assertEquals(2,  new Date(Date.UTC(2100, 2, 1)).getUTCMonth());
+  assertEquals(31, new Date(Date.UTC(1999, 11, 31, 23)).getUTCDate());
+  assertEquals(1999, new Date(Date.UTC(1999, 11, 31, 23)).getUTCFullYear());
+  assertEquals(31, new Date(Date.UTC(1969, 11, 31)).getUTCDate());
 });
 
 test('Date#getDay()', function() {
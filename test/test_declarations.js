@@ -9,3 +9,10 @@ var b = 42, c = 'foobar', d;
 assert(b === 42);
 assert(c === 'foobar');
 assert(d === undefined);
+
+// Hoisting keeps parameters of the same name, and initializers run once.
+var inits = 0;
+function redeclare(x) { var x; var y = ++inits; return x; }
+assert(redeclare(7) === 7);
+assert(redeclare(8) === 8);
+assert(inits === 2);
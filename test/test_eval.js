@@ -18,3 +18,43 @@ test('eval with references', function() {
   assertEquals(f, eval('f;'));
   function f() { return 'The f function'; };
 });
+
+test('eval of the same string again', function() {
+  var total = 0;
+  for (var i = 0; i < 5; i++) total += eval('i * 2;');
+  assertEquals(20, total);
+  assertEquals(3, eval('var y = 3; y;'));
+  assertEquals(4, eval('var y = 4; y;'));
+});
+
+test('eval of more strings than are kept parsed', function() {
+  var add = eval('(function(a) { return a + 1; });');
+  var total = 0;
+  for (var i = 0; i < 200; i++) total += eval(i + ' + 1;');
+  assertEquals(20100, total);
+  assertEquals(3, add(2));
+  assertEquals('s', eval("'s';"));
+});
+
+test('eval and Function churn keeps memory flat', function() {
+  if (typeof gc === 'undefined' || gc.info().keepsTrees) return;
+
+  var kept = new Function('a', 'return a + "kept";');
+  var churn = function(from, to) {
+    for (var i = from; i < to; i++) {
+      eval("'s" + i + "' + " + i + ';');
+      (new Function('a', 'return a + "t' + i + '";'))(i);
+      eval('(function(a) { return a + ' + i + '; });')(i);
+    }
+  };
+  var used = function() {
+    gc.run();
+    return gc.info().usedSlots;
+  };
+
+  churn(0, 500);
+  var before = used();
+  churn(500, 5500);
+  assert(used() - before < 1000);
+  assertEquals('1kept', kept(1));
+});
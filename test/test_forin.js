@@ -63,3 +63,57 @@ test('for-in with crazy lhs member expression on object', function() {
   }
   assertEquals('c', x.y.z.key);
 });
+
+test('for-in visits own keys, then inherited ones', function() {
+  var Point = function() { this.x = 1; this.y = 2; };
+  Point.prototype.z = 3;
+  var keys = '';
+
+  for (var k in new Point()) keys += k;
+  assertEquals('xyz', keys);
+
+  // Objects of the same shape give the same keys, with their own flags.
+  var p = new Point(), q = new Point();
+  Object.defineProperty(q, 'x', { enumerable: false });
+  keys = '';
+  for (k in p) keys += k;
+  for (k in q) keys += k;
+  assertEquals('xyzyz', keys);
+});
+
+test('for-in skips keys added during the loop', function() {
+  var obj = { a: 1, b: 2 }, keys = '';
+
+  for (var k in obj) {
+    keys += k;
+    obj[k + k] = 0;
+  }
+  assertEquals('ab', keys);
+});
+
+test('for-in skips keys deleted during the loop', function() {
+  var obj = { a: 1, b: 2, c: 3, d: undefined }, keys = '';
+
+  for (var k in obj) {
+    keys += k;
+    if (k == 'a') delete obj.c;
+  }
+  assertEquals('abd', keys);
+
+  var arr = [1, 2, 3];
+  keys = '';
+  for (k in arr) {
+    keys += k;
+    delete arr[2];
+  }
+  assertEquals('01', keys);
+
+  var Point = function() { this.x = 1; };
+  Point.prototype.z = 3;
+  keys = '';
+  for (k in new Point()) {
+    keys += k;
+    delete Point.prototype.z;
+  }
+  assertEquals('x', keys);
+});
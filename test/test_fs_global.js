@@ -0,0 +1,68 @@
+// test_fs_global.js
+// -----------------
+
+(this.load || require)((this.load ? 'test' : '.') + '/tools/assertions.js');
+
+var path = '/tmp/flathead_test_fs.txt';
+
+
+// ----------------------------------------------------------------------------
+// fs
+// ----------------------------------------------------------------------------
+
+testIfFlathead(function() {
+
+  // String literals keep their escapes, but JSON strings don't.
+  var NL = JSON.parse('"\n"'), CR = JSON.parse('"\r"');
+
+  assertEquals('object', typeof fs);
+  assertEquals(1, NL.length);
+
+  test('fs.writeFile(), fs.appendFile() and fs.readFile()', function() {
+    fs.writeFile(path, 'one' + NL + 'two' + CR + NL);
+    fs.appendFile(path, NL + 'four');
+    assertEquals('one' + NL + 'two' + CR + NL + NL + 'four', fs.readFile(path));
+    fs.writeFile(path, '');
+    assertEquals('', fs.readFile(path));
+    var threw = false;
+    try { fs.readFile('/tmp/flathead/no/such/file'); } catch (e) { threw = true; }
+    assert(threw);
+  });
+
+  test('fs.open() and reader.readLine()', function() {
+    fs.writeFile(path, 'one' + NL + 'two' + CR + NL + NL + 'four');
+    var reader = fs.open(path), lines = [], line;
+    while ((line = reader.readLine()) !== null) lines.push(line);
+    assertEquals('one,two,,four', lines.join(','));
+    assertEquals(null, reader.readLine());
+
+    reader = fs.open(path);
+    assertEquals('one', reader.readLine());
+    reader.close();
+    assertEquals(null, reader.readLine());
+  });
+
+  test('lines longer than the buffer', function() {
+    var chunk = 'abcdefghijklmnop', long = chunk;
+    while (long.length < 3000000) long += long;
+    fs.writeFile(path, 'x' + NL + long + NL + 'y');
+    var reader = fs.open(path);
+    assertEquals('x', reader.readLine());
+    assertEquals(long.length, reader.readLine().length);
+    assertEquals('y', reader.readLine());
+    assertEquals(null, reader.readLine());
+  });
+
+  test('readers dropped while open', function() {
+    if (typeof gc === 'undefined') return;
+    fs.writeFile(path, 'one' + NL + 'two');
+    var before = gc.info().externalBytes, i;
+    for (i = 0; i < 30; i++) assertEquals('one', fs.open(path).readLine());
+    assert(gc.info().externalBytes > before);
+    gc.run();
+    // One may still be seen on the C stack.
+    assert(gc.info().externalBytes <= before + 2 * 1048576);
+  });
+
+  fs.writeFile(path, '');
+});
@@ -50,6 +50,13 @@ test('Constructor', function() {
 assert(Function.prototype);
 assertEquals('function', typeof Function.prototype);
 
+// Built-in functions other than constructors have no prototype object.
+assertEquals(undefined, Array.prototype.push.prototype);
+assertEquals(undefined, Math.max.prototype);
+assert(typeof Array.prototype.push.name === 'string');
+assertEquals(null, Math.max.caller);
+assert(!((new Array) instanceof Math.max));
+
 
 x = 42;
 var y = 99;
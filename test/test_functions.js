@@ -95,3 +95,17 @@ var recursive2 = function(x) {
 };
 
 assertEquals(10, recursive2(1));
+
+
+// Repeated calls start with fresh locals
+
+var counter = function(init) {
+  var n;
+  if (init) n = init;
+  return n;
+};
+
+assertEquals(5, counter(5));
+assertEquals(undefined, counter());
+assertEquals(7, counter(7));
+assertEquals(undefined, counter());
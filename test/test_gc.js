@@ -39,3 +39,93 @@ assertEquals('Still here', f());
 assertEquals(12, x.a);
 assertEquals(99, y);
 assertEquals('99 Luftballons', z);
+
+
+// Keep more values alive than fit in a single arena.
+
+var live = [];
+for (var j = 0; j < 15000; j++) live[j] = {n: j};
+if (typeof gc !== 'undefined') gc.run();
+var sum = 0;
+for (var j = 0; j < live.length; j++) sum += live[j].n;
+assertEquals(112492500, sum);
+
+
+// Move values between long-lived objects while collections are under way.
+
+var from = [], to = {};
+for (var j = 0; j < 1000; j++) from[j] = {n: j};
+for (var r = 0; r < 30; r++) {
+  for (var j = 0; j < 1000; j++) {
+    var k = (j * 7 + r) % 1000;
+    var moved = from[j];
+    from[j] = to[k] || {n: 0};
+    to[k] = moved;
+  }
+}
+var total = 0;
+for (var j = 0; j < 1000; j++) total += from[j].n + (to[j] ? to[j].n : 0);
+assertEquals(499500, total);
+
+
+// Profile the live heap and the allocation sites.
+
+if (typeof gc !== 'undefined') {
+  gc.profile(true);
+  var points = [];
+  for (var j = 0; j < 200; j++) points[j] = {x: j};
+  var profile = gc.profile(false);
+  assert(profile.classes.Object.count >= 200);
+  assert(profile.live.bytes > profile.live.count);
+  assert(profile.sites[0].count >= points.length);
+}
+
+
+// Collections are timed and counted.
+
+if (typeof gc !== 'undefined') {
+  gc.run();
+  var info = gc.info();
+  assert(info.runs > 0);
+  assert(info.last.type === 'major' || info.last.type === 'compact');
+  assert(info.last.marked > 0);
+  assert(info.last.pause >= info.last.maxPause);
+  var pauses = 0;
+  for (var j = 0; j < info.pauses.length; j++) pauses += info.pauses[j].count;
+  assert(pauses >= info.runs + info.minorRuns);
+  assertEquals(Infinity, info.pauses[info.pauses.length - 1].upTo);
+}
+
+
+// Compact a fragmented heap without losing anything.
+
+if (typeof gc !== 'undefined') {
+  var kept = [], dropped = [];
+  for (var j = 0; j < 30000; j++) {
+    var item = {n: j, inner: {s: 'item ' + j}};
+    if (j % 10 == 0) kept.push(item);
+    else dropped.push(item);
+  }
+  dropped = null;
+  gc.compact();
+  assert(gc.info().compactions > 0);
+  var ok = 0;
+  for (var j = 0; j < kept.length; j++)
+    if (kept[j].n === j * 10 && kept[j].inner.s === 'item ' + j * 10) ok++;
+  assertEquals(kept.length, ok);
+}
+
+
+// Values unshifted and spliced into an old array survive minor collections.
+
+if (typeof gc !== 'undefined') {
+  var old = [{n: 0}, {n: 1}];
+  gc.run();
+  old.unshift({n: -1});
+  old.splice(1, 0, {n: 10}, {n: 11});
+  for (var j = 0; j < 30000; j++) ({n: j, s: 'churn ' + j});
+  assert(gc.info().minorRuns > 0);
+  var ns = [];
+  for (var j = 0; j < old.length; j++) ns.push(old[j].n);
+  assertEquals('-1,10,11,0,1', ns.join());
+}
@@ -34,6 +34,9 @@ test('global functions', function() {
     assertEquals(15, parseInt(021, 8));
     assertNaN(parseInt("Not a number"));
     assertNaN(parseInt(Infinity));
+    assertEquals(35, parseInt('z', 36));
+    assertEquals(-255, parseInt('  -0xff'));
+    assertNaN(parseInt('10', 37));
   });
 
   test('parseFloat(string)', function() {
@@ -41,6 +44,8 @@ test('global functions', function() {
 
     assert(parseFloat("3.14") === 3.14);
     assert(parseFloat("42") === 42);
+    assert(parseFloat("  3.5px") === 3.5);
+    assert(parseFloat("-Infinityx") === -Infinity);
     assertNaN(parseFloat("Not a number"));
   });
 
@@ -222,7 +227,10 @@ test('global constructors', function() {
   });
 
   test('JSON', function() {
-    // TODO
+    assertIsObject(JSON);
+
+    assertIsFunction(JSON.parse, 2);
+    assertIsFunction(JSON.stringify, 3);
   });
 
   test('Math', function() {
@@ -0,0 +1,85 @@
+// test_io_global.js
+// -----------------
+
+(this.load || require)((this.load ? 'test' : '.') + '/tools/assertions.js');
+
+
+// ----------------------------------------------------------------------------
+// io
+// ----------------------------------------------------------------------------
+
+testIfFlathead(function() {
+
+  var seen = [];
+
+  assertEquals('object', typeof io);
+
+  test('io.pipe(), io.write() and io.read()', function() {
+    var ends = io.pipe();
+    assertEquals(2, ends.length);
+    assertEquals(undefined, io.read(ends[0]));
+    assertEquals(4, io.write(ends[1], 'ping'));
+    assertEquals('pi', io.read(ends[0], 2));
+    assertEquals('ng', io.read(ends[0]));
+    io.close(ends[1]);
+    assertEquals('', io.read(ends[0]));
+    io.close(ends[0]);
+  });
+
+  test('writing to a closed pipe throws', function() {
+    var ends = io.pipe(), message;
+    io.close(ends[0]);
+    try { io.write(ends[1], 'lost'); } catch (e) { message = e.message; }
+    assertEquals('write: Broken pipe', message);
+    io.close(ends[1]);
+  });
+
+  test('io.watch() calls back once a pipe is readable', function() {
+    var ends = io.pipe();
+    var id = io.watch(ends[0], 'read', function(fd) {
+      assertEquals(ends[0], fd);
+      seen.push(io.read(fd));
+      assert(io.unwatch(id));
+      io.close(ends[0]);
+    });
+    assert(!io.unwatch(id + 1000));
+    io.write(ends[1], 'watched');
+    io.close(ends[1]);
+  });
+
+  test('io.listen(), io.connect() and io.accept()', function() {
+    var server, port;
+    for (port = 47315; port < 47335 && server === undefined; port++) {
+      try { server = io.listen(port, '127.0.0.1'); } catch (e) {}
+    }
+    assert(server !== undefined);
+
+    var client = io.connect('127.0.0.1', port - 1);
+    var sent = io.watch(client, 'write', function() {
+      io.unwatch(sent);
+      io.write(client, 'hello');
+    });
+    var accepted = io.watch(server, 'read', function() {
+      var peer = io.accept(server);
+      if (peer === undefined) return;
+      io.unwatch(accepted);
+      io.close(server);
+      var got = io.watch(peer, 'read', function() {
+        io.unwatch(got);
+        seen.push(io.read(peer));
+        // The peer has gone: no SIGPIPE, just an Error.
+        io.close(peer);
+        var threw = false;
+        try {
+          while (true) io.write(client, 'more');
+        } catch (e) { threw = true; }
+        assert(threw);
+        io.close(client);
+      });
+    });
+  });
+
+  setTimeout(function() {
+    assertEquals('watched,hello', seen.join(','));
+  }, 200);
+});
@@ -0,0 +1,85 @@
+// test_jit.js
+// -----------
+
+var assert = console.assert;
+
+// Numeric loops that run long enough to be compiled, and ones that leave
+// the compiled code part of the way through, should give the same results
+// as the interpreter.
+
+
+// Arithmetic
+
+var sum = 0, i;
+for (i = 0; i < 100000; i++) {
+  sum += i * 2;
+}
+assert(sum === 9999900000);
+assert(i === 100000);
+
+var x = 0, j = 0;
+while (j < 5000) {
+  if (j % 3 == 0) x += Math.floor(Math.sqrt(j));
+  else x -= 1;
+  j++;
+}
+assert(x === 74394);
+
+var total = 0, a, b;
+for (a = 0; a < 100; a++) {
+  for (b = 0; b < 100; b++) {
+    total += a * b - (a | b);
+  }
+}
+assert(total === 23708928);
+
+var y = 0, p = 0;
+while (p < 2000) {
+  p++;
+  y = p > 1000 ? Math.floor(p / 7) : -p;
+  y += p % 5;
+}
+assert(y === 285);
+
+var u = 0, k;
+for (k = 0; k < 2000; k++) {
+  u = !(k < 1000) && k != 1500 || u > 3 ? u + 0.5 : u - 0.25;
+}
+assert(u === 249.25);
+
+
+// Bitwise operators and break
+
+var bits = 0, n;
+for (n = 0; n < 3000; n++) {
+  bits = (bits ^ (n << 3)) >>> 1;
+  if (n == 2500) break;
+}
+assert(bits === 14878);
+assert(n === 2500);
+
+
+// Leaving the compiled code
+
+var big = 0;
+for (n = 0; n < 3000; n++) {
+  big += n == 2500 ? 1e20 | 0 : n & 7;
+}
+assert(big === -2147473152);
+
+var quot = 0;
+for (n = 0; n < 3000; n++) {
+  quot += 10 / (n - 2000);
+}
+assert(quot === Infinity);
+
+var count = function(start) {
+  var t = start, m;
+  for (m = 0; m < 1500; m++) {
+    t = t + 1;
+  }
+  return t;
+};
+assert(count(0) === 1500);
+assert(count(0) === 1500);
+assert(count("s") === "s" + Array(1501).join("1"));
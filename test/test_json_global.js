@@ -0,0 +1,84 @@
+// test_json_global.js
+// -------------------
+
+(this.load || require)((this.load ? 'test' : '.') + '/tools/assertions.js');
+
+
+// ----------------------------------------------------------------------------
+// JSON
+// ----------------------------------------------------------------------------
+
+assertEquals('object', typeof JSON);
+
+var parseError = function(text) {
+  var name;
+  try {
+    JSON.parse(text);
+  } catch (e) {
+    name = e.name;
+  }
+  return name;
+};
+
+test('JSON.parse(text[, reviver])', function() {
+  var v = JSON.parse(' {"a": [1, -2, 3.5e2, true, false, null], "b": {"c": "d"}} ');
+  assertArrayEquals([1, -2, 350, true, false, null], v.a);
+  assertEquals('d', v.b.c);
+  assertEquals(42, JSON.parse('42'));
+  assertEquals('plain', JSON.parse('"plain"'));
+  assertEquals(0, JSON.parse('[]').length);
+
+  var revived = JSON.parse('[1, [2, {"x": 3}]]', function(k, v) {
+    return typeof v === 'number' ? v * 2 : v;
+  });
+  assertEquals(2, revived[0]);
+  assertEquals(6, revived[1][1].x);
+  assertEquals(undefined, JSON.parse('{"a": 1, "b": 2}', function(k, v) {
+    return k === 'a' ? undefined : v;
+  }).a);
+
+  assertEquals('SyntaxError', parseError('{'));
+  assertEquals('SyntaxError', parseError('[1,]'));
+  assertEquals('SyntaxError', parseError('{"a" 1}'));
+  assertEquals('SyntaxError', parseError('01'));
+  assertEquals('SyntaxError', parseError('1.'));
+  assertEquals('SyntaxError', parseError('"abc'));
+  assertEquals('SyntaxError', parseError('[1] x'));
+  assertEquals('SyntaxError', parseError(''));
+});
+
+test('JSON.stringify(value[, replacer[, space]])', function() {
+  assertEquals('{"a":1,"b":[true,null,"x"],"c":{}}',
+               JSON.stringify({a: 1, b: [true, null, 'x'], c: {d: undefined, e: function() {}}}));
+  assertEquals('[null,null,null,-5]', JSON.stringify([undefined, function() {}, Infinity, -5]));
+  assertEquals(undefined, JSON.stringify(undefined));
+  assertEquals('3"s"false', JSON.stringify(new Number(3)) + JSON.stringify(new String('s')) +
+                            JSON.stringify(new Boolean(false)));
+  assertEquals('{"d":"1970-01-01T00:00:00.000Z"}', JSON.stringify({d: new Date(0)}));
+  assertEquals('{"x":"key:x"}', JSON.stringify({x: {toJSON: function(k) { return 'key:' + k; }}}));
+
+  assertEquals('{"c":3,"a":1}', JSON.stringify({a: 1, b: 2, c: 3}, ['c', 'a']));
+  assertEquals('{"a":10,"b":"x"}', JSON.stringify({a: 1, b: 'x'}, function(k, v) {
+    return typeof v === 'number' ? v * 10 : v;
+  }));
+
+  // The source has no escapes here, so lines are compared split up.
+  var lines = function(s) { return s.split(s.charAt(1)); };
+  assertArrayEquals(['{', '  "a": [', '    1', '  ],', '  "b": {}', '}'],
+                    lines(JSON.stringify({a: [1], b: {}}, null, 2)));
+  assertArrayEquals(['[', '--[]', ']'], lines(JSON.stringify([[]], null, '--')));
+
+  var cycle = {};
+  cycle.self = cycle;
+  try {
+    JSON.stringify(cycle);
+    assert(false);
+  } catch (e) {
+    assertEquals('TypeError', e.name);
+  }
+});
+
+test('Round trip', function() {
+  var v = {list: [1, 'two', {three: [3]}], flag: false, none: null};
+  assertEquals(JSON.stringify(v), JSON.stringify(JSON.parse(JSON.stringify(v))));
+});
@@ -31,6 +31,12 @@ test('Constructor', function() {
   assertEquals('number', typeof Number(1));
   assertEquals('number', typeof Number(42));
   assertEquals(42, Number('42'));
+  assertEquals(12, Number(' 12 '));
+  assertEquals(0, Number(''));
+  assertEquals(31, Number('0x1F'));
+  assertEquals(-0.005, Number('-.5e-2'));
+  assert(isNaN(Number('12px')));
+  assert(isNaN(Number('inf')));
   assert(42 == new Number(42));
 });
 
@@ -66,6 +72,17 @@ test('Number#toExponential([fracDigits])', function() {
   // assert(num.toExponential() === '4.14723723471e-4');
 });
 
+test('Number#toString()', function() {
+  assertEquals('0.30000000000000004', (0.1 + 0.2).toString());
+  assertEquals('123456789012', (123456789012).toString());
+  assertEquals('1e+21', (1e21).toString());
+  assertEquals('0.000001', (0.000001).toString());
+  assertEquals('1.5e-7', (1.5e-7).toString());
+  assertEquals('-Infinity', (-Infinity).toString());
+  assertEquals('5e-324', (5e-324).toString());
+  assertEquals('0', (-0).toString());
+});
+
 test('Number#toFixed([digits])', function() {
   var num = 12345.6789;
   assertEquals('12346', num.toFixed());
@@ -188,6 +188,11 @@ test('binary', function() {
 
   test('division', function() {
     assert((9 / 3) === 3);
+    var zero = 0, one = 1;
+    assert(isNaN(zero / zero));
+    assertEquals(Infinity, one / zero);
+    assertEquals(-Infinity, -one / zero);
+    assertEquals(-Infinity, one / -zero);
   });
 
   test('modulus', function() {
@@ -253,6 +258,20 @@ test('binary', function() {
     assert({} instanceof Object);
   });
 
+  test('in conditions', function() {
+    var seen = '';
+    var note = function(x) { seen += x; return x; };
+    var nan = NaN;
+
+    if (note(1) < note(2) && !(note(3) >= note(4)) || note(5)) seen += '!';
+    assertEquals('1234!', seen);
+    if (nan < 1 || nan >= 1 || nan == nan) assert(false);
+    if (!(nan != nan)) assert(false);
+    if (!("10" > 9 && "a" < "b" && null == undefined)) assert(false);
+    if (!({} && "0" && -1) || "" || 0 || nan || null) assert(false);
+    assertEquals('yes', 1 / 0 > 1e308 ? 'yes' : 'no');
+  });
+
 });
 
 
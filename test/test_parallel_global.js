@@ -0,0 +1,47 @@
+// test_parallel_global.js
+// -----------------------
+
+(this.load || require)((this.load ? 'test' : '.') + '/tools/assertions.js');
+
+var list = [];
+for (var i = 0; i < 100; i++) list.push(i);
+
+var scale = 3;
+var work = function(x, i) {
+  return { index: i, value: x * scale, tags: ['n' + x, [x % 2 == 0, null]] };
+};
+
+
+// ----------------------------------------------------------------------------
+// parallel
+// ----------------------------------------------------------------------------
+
+testIfFlathead(function() {
+
+  assertEquals('object', typeof parallel);
+
+  test('parallel.map()', function() {
+    var expected = JSON.stringify(list.map(work));
+    assertEquals(expected, JSON.stringify(parallel.map(list, work, {workers: 4})));
+    assertEquals(expected, JSON.stringify(parallel.map(list, work, {workers: 1})));
+    assertEquals(expected, JSON.stringify(parallel.map(list, work)));
+    assertEquals(0, parallel.map([], work).length);
+  });
+
+  test('parallel.map() errors', function() {
+    var message = null;
+    try {
+      parallel.map(list, function(x) {
+        if (x == 50) throw new Error('bad ' + x);
+        return x;
+      }, {workers: 2});
+    } catch (e) { message = e.message; }
+    assert(message.indexOf('bad 50') >= 0);
+
+    message = null;
+    try {
+      parallel.map(list, function(x) { return function() {}; }, {workers: 2});
+    } catch (e) { message = e.message; }
+    assert(message.indexOf("can't be cloned") >= 0);
+  });
+});
@@ -0,0 +1,37 @@
+// test_performance_global.js
+// --------------------------
+
+(this.load || require)((this.load ? 'test' : '.') + '/tools/assertions.js');
+
+
+// ----------------------------------------------------------------------------
+// performance
+// ----------------------------------------------------------------------------
+
+assertEquals('object', typeof performance);
+
+test('performance.now()', function() {
+  var start = performance.now(), last = start, fractional = false;
+  assert(start >= 0);
+  for (var i = 0; i < 1000; i++) {
+    var now = performance.now();
+    assert(now >= last);
+    if (now !== Math.floor(now)) fractional = true;
+    last = now;
+  }
+  assert(fractional);
+});
+
+test('performance.sample(name, ms)', function() {
+  if (typeof FH_VERSION === 'undefined') return;
+  for (var i = 0; i < 100; i++)
+    performance.sample('test', i / 10);
+
+  var name;
+  try {
+    performance.sample('test', 'slow');
+  } catch (e) {
+    name = e.name;
+  }
+  assertEquals('TypeError', name);
+});
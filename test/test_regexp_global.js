@@ -119,6 +119,50 @@ test('RegExp#test(str)', function() {
   assertFalse(re.test(""));
 });
 
+test('global RegExp#exec and RegExp#test advance lastIndex', function() {
+  var re = /o+/g, str = 'foo boo zoooo';
+
+  assertEquals('oo', re.exec(str)[0]);
+  assertEquals(3, re.lastIndex);
+  var second = re.exec(str);
+  assertEquals('oo', second[0]);
+  assertEquals(5, second.index);
+  assertEquals(7, re.lastIndex);
+  assertEquals('oooo', re.exec(str)[0]);
+  assertEquals(13, re.lastIndex);
+  assertEquals(null, re.exec(str));
+  assertEquals(0, re.lastIndex);
+
+  assertTrue(re.test(str));
+  assertEquals(3, re.lastIndex);
+  assertTrue(re.test(str));
+  assertEquals(7, re.lastIndex);
+  assertTrue(re.test(str));
+  assertFalse(re.test(str));
+  assertEquals(0, re.lastIndex);
+
+  re.lastIndex = 8;
+  assertTrue(re.test(str));
+  assertEquals(13, re.lastIndex);
+
+  // Without the flag, both start over every time.
+  var once = /o+/;
+  once.lastIndex = 8;
+  assertEquals(1, once.exec(str).index);
+  assertTrue(once.test(str));
+});
+
+test('a replace callback can use the same RegExp', function() {
+  var re = /(\w)(\d)/g;
+  var out = 'a1 b2 c3'.replace(re, function(match, letter, digit, offset, s) {
+    assertEquals('a1 b2 c3', s);
+    var inner = 'x9'.replace(re, function(m, l, d) { return d + l; });
+    assertEquals('9x', inner);
+    return letter.toUpperCase() + digit + '@' + offset;
+  });
+  assertEquals('A1@0 B2@3 C3@6', out);
+});
+
 test('RegExp#toString(str)', function() {
   assertEquals('/abc/gim', (new RegExp('abc', 'img')).toString());
   assertEquals('/abc/gi', (new RegExp('abc', 'ig')).toString());
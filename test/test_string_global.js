@@ -83,6 +83,8 @@ test('String#indexOf(searchValue[, fromIndex])', function() {
   assertEquals(10, s.indexOf('', 10));
   assertEquals(10, s.indexOf('', 11));
   assertEquals(-1, s.indexOf('blue', 11));
+  assertEquals(1,  'aaab'.indexOf('aab'));
+  assertEquals(39, Array(41).join('ab').indexOf('ba', 38));
 });
 
 test('String#lastIndexOf(searchValue[, fromIndex])', function() {
@@ -189,6 +191,7 @@ test('String#slice(beginSlice[, endSlice])', function() {
   assertEquals('',         s.slice(0, -500));
   assertEquals('',         s.slice(-500, -500));
   assertEquals('sl',       s.slice(-500, 2));
+  assertEquals('',         s.slice(4, 2));
 });
 
 test('String#split([separator][, limit])', function() {
@@ -22,3 +22,18 @@ assert(s1[1000] === undefined);
 
 assert('abc'[1] === 'b');
 assert('abc'.toString() === 'abc');
+
+// Long concatenations
+
+var piece = 'abcdefghij', s3 = '', s4 = '';
+for (var i = 0; i < 200; i++) {
+  s3 += piece;
+  s4 = piece + s4;
+}
+assert(s3.length === 2000);
+assert(s3 === s4);
+assert(s3[1995] === 'f');
+assert(s3.charAt(2) === 'c');
+assert(s3.slice(1998) === 'ij');
+assert(s3 + '!' > s4);
+assert([s3, 1, null, 'x'].join('-').length === 2005);
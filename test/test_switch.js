@@ -82,3 +82,32 @@ test('cases that follow default are checked first', function() {
 
   assert(counter === 5);
 });
+
+
+test('literal cases are looked up by value', function() {
+  var f = function(x) {
+    var out = '';
+    switch (x) {
+      case 1: out += 'one';
+      case 2: out += 'two'; break;
+      case 'a': out += 'a'; break;
+      default: out += 'default';
+      case 1000: out += 'thousand'; break;
+      case 2.5: out += 'half'; break;
+      case 1: out += 'again'; break;
+      case 0: out += 'zero'; break;
+    }
+    return out;
+  };
+
+  assert(f(1) === 'onetwo');
+  assert(f(2) === 'two');
+  assert(f('a') === 'a');
+  assert(f('b' + '') === 'defaultthousand');
+  assert(f(1000) === 'thousand');
+  assert(f(5 / 2) === 'half');
+  assert(f(-0) === 'zero');
+  assert(f('1') === 'defaultthousand');
+  assert(f(NaN) === 'defaultthousand');
+  assert(f(null) === 'defaultthousand');
+});
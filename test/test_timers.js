@@ -0,0 +1,59 @@
+// test_timers.js
+// --------------
+
+(this.load || require)((this.load ? 'test' : '.') + '/tools/assertions.js');
+
+
+// ----------------------------------------------------------------------------
+// setTimeout, setInterval
+// ----------------------------------------------------------------------------
+
+var order = [];
+
+// Each group is scheduled from the last callback of the one before, so the
+// order below doesn't depend on how long any of them takes to run.
+var intervals, scope, done;
+
+assertEquals('function', typeof setTimeout);
+assertEquals('function', typeof clearInterval);
+
+test('timers run after the script, soonest first', function() {
+  setTimeout(function(a, b) {
+    order.push(a + b);
+    intervals();
+  }, 20, 'late', '!');
+  setTimeout(function() { order.push('first'); }, 0);
+  setTimeout(function() { order.push('second'); }, 0);
+  order.push('sync');
+});
+
+test('cleared timers never run', function() {
+  var id = setTimeout(function() { order.push('cleared'); }, 1);
+  clearTimeout(id);
+  clearTimeout(id);
+});
+
+intervals = function() {
+  test('intervals repeat until cleared', function() {
+    var runs = 0;
+    var id = setInterval(function() {
+      order.push('tick' + ++runs);
+      if (runs === 3) {
+        clearInterval(id);
+        scope();
+      }
+    }, 2);
+  });
+};
+
+scope = function() {
+  test('callbacks keep their scope', function() {
+    var local = 'scope';
+    setTimeout(function() { order.push(local); done(); }, 10);
+  });
+};
+
+done = function() {
+  var expected = 'sync,first,second,late!,tick1,tick2,tick3,scope';
+  assertEquals(expected, order.join(','));
+};
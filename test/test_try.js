@@ -126,4 +126,22 @@ test('try statement', function() {
 
     console.assert(final_ran);
   });
+
+  test('errors after a completed try go to the enclosing catch', function() {
+    var thrower = function() {
+      try {
+      } catch(e) {
+        console.assert(false);
+      }
+      throw 'outer';
+    };
+
+    var caught;
+    try {
+      thrower();
+    } catch(e) {
+      caught = e;
+    }
+    console.assert(caught === 'outer');
+  });
 });
@@ -0,0 +1,81 @@
+// test_typed_array_global.js
+// --------------------------
+
+(this.load || require)((this.load ? 'test' : '.') + '/tools/assertions.js');
+
+
+// ----------------------------------------------------------------------------
+// ArrayBuffer and Typed Arrays
+// ----------------------------------------------------------------------------
+
+assert(typeof ArrayBuffer === 'function');
+assert(typeof Float64Array === 'function');
+
+
+test('Constructor', function() {
+  var a = new Float64Array(3);
+  assertArrayEquals([0, 0, 0], a);
+  assertEquals(24, a.byteLength);
+  assertEquals(8, Float64Array.BYTES_PER_ELEMENT);
+  assertEquals('[object Float64Array]', Object.prototype.toString.call(a));
+
+  assertArrayEquals([1, 0, 255, 3], new Uint8Array([1, 256, -1, 3.7]));
+  assertArrayEquals([255, 0, 2, 2], new Uint8ClampedArray([300, -5, 1.5, 2.5]));
+  assertArrayEquals([-1, 2], new Int16Array(new Float32Array([65535, 2])));
+
+  var buf = new ArrayBuffer(8);
+  var words = new Int32Array(buf), bytes = new Uint8Array(buf, 4);
+  words[1] = 258;
+  assertArrayEquals([2, 1, 0, 0], bytes);
+  assertEquals(4, bytes.byteOffset);
+  assert(bytes.buffer === buf);
+  assert(ArrayBuffer.isView(bytes));
+  assert(!ArrayBuffer.isView(buf));
+});
+
+test('Elements', function() {
+  var a = new Int32Array(2);
+  a[0] = 7;
+  a[1] += 3.9;
+  a[5] = 1;
+  assertArrayEquals([7, 3], a);
+  assertEquals(undefined, a[5]);
+  assertEquals(2, a.length);
+  assertEquals('7,3', a.join(','));
+
+  var keys = [];
+  for (var k in a) keys.push(k);
+  assertArrayEquals(['0', '1'], keys);
+});
+
+test('TypedArray#set(array[, offset])', function() {
+  var a = new Int16Array(4);
+  a.set([1, 2], 2);
+  assertArrayEquals([0, 0, 1, 2], a);
+  a.set(a.subarray(2));
+  assertArrayEquals([1, 2, 1, 2], a);
+  a.set(new Float64Array([5.5]), 3);
+  assertArrayEquals([1, 2, 1, 5], a);
+});
+
+test('TypedArray#subarray([begin[, end]])', function() {
+  var a = new Uint8Array([1, 2, 3, 4]);
+  var sub = a.subarray(1, -1);
+  assertArrayEquals([2, 3], sub);
+  sub[0] = 9;
+  assertEquals(9, a[1]);
+  assertEquals(0, a.subarray(3, 1).length);
+});
+
+test('TypedArray#fill(value[, begin[, end]])', function() {
+  assertArrayEquals([0, 3, 3, 3, 0], new Float32Array(5).fill(3, 1, -1));
+  assertArrayEquals([7, 7, 7], new Uint32Array(3).fill(7));
+});
+
+test('ArrayBuffer#slice(begin[, end])', function() {
+  var a = new Uint8Array([1, 2, 3, 4]);
+  var copy = new Uint8Array(a.buffer.slice(1, 3));
+  assertArrayEquals([2, 3], copy);
+  copy[0] = 0;
+  assertEquals(2, a[1]);
+});
@@ -0,0 +1,155 @@
+// test_vm.js
+// ----------
+
+var assert = console.assert;
+var assertEquals = function(a, b) {
+  if (a !== b) console.log(a + ' !== ' + b);
+  assert(a === b);
+};
+
+// Run with `make test-vm` (or `flat --engine=vm`), these cover the
+// instructions the VM compiles to; under the tree-walker they must hold too.
+
+
+// Literals, arrays and objects (VM_ARRAY, VM_OBJECT, VM_INIT_PROP)
+
+var lit = {a: 1, b: 'two', c: [3, null, undefined, true]};
+assertEquals(1, lit.a);
+assertEquals('two', lit.b);
+assertEquals(4, lit.c.length);
+assertEquals(null, lit.c[1]);
+assertEquals(undefined, lit.c[2]);
+assertEquals(true, lit.c[3]);
+
+
+// Locals and parameters in registers and slots, declarations and hoisting
+
+var locals = function(p, q) {
+  var r = p * 2;
+  r += q;
+  assertEquals(7, hoisted());
+  function hoisted() { return 7; }
+  return r;
+};
+assertEquals(11, locals(4, 3));
+assertEquals('undefined', typeof notDeclaredAnywhere);
+assertEquals('number', typeof lit.a);
+
+
+// Element access, compound assignment and increments of members
+
+var elems = [1, 2, 3];
+var key = 1;
+elems[key] += 10;
+elems[0]++;
+--elems[2];
+lit.a *= 5;
+lit.a++;
+assertEquals('2,12,2', elems.join());
+assertEquals(6, lit.a);
+
+
+// Conditions, && and ||
+
+var picks = [];
+for (var i = 0; i < 6; i++) {
+  if (i % 2 == 0 && i != 4) picks.push('e' + i);
+  else if (i == 1 || i == 4) picks.push('x' + i);
+  else picks.push(i > 3 ? 'big' : 'small');
+}
+assertEquals('e0,x1,e2,small,x4,big', picks.join());
+assertEquals(0, 0 && 1);
+assertEquals('b', '' || 'b');
+
+
+// Loops, break and continue
+
+var n = 0, seen = '';
+while (true) {
+  n++;
+  if (n > 5) break;
+  if (n != 3) seen += n;
+}
+assertEquals('1245', seen);
+
+var skipped = 0;
+for (i = 0; i < 3; i++) {
+  skipped++;
+  continue;
+  skipped += 100;
+}
+assertEquals(3, skipped);
+
+
+// switch (VM_SWITCH)
+
+var name = function(x) {
+  var res;
+  switch (x) {
+    case 1: res = 'one'; break;
+    case 'two': res = 'two'; break;
+    case 3:
+    case 4: res = 'three or four'; break;
+    default: res = 'other';
+  }
+  return res;
+};
+assertEquals('one', name(1));
+assertEquals('two', name('two'));
+assertEquals('three or four', name(4));
+assertEquals('other', name(5));
+
+
+// for-in (VM_ITER_INIT, VM_ITER_NEXT)
+
+var keys = [];
+for (var p in {x: 1, y: 2, z: 3}) keys.push(p);
+assertEquals('x,y,z', keys.join());
+
+
+// Calls and method calls, with their receivers
+
+var counter = {
+  count: 0,
+  add: function(by) { this.count += by; return this; }
+};
+counter.add(2).add(3);
+assertEquals(5, counter.count);
+assertEquals('a-b', ['a', 'b'].join('-'));
+
+
+// try, catch and finally, and throws from calls
+
+var log = [];
+var thrower = function() { throw new Error('oops'); };
+try {
+  log.push('try');
+  thrower();
+  log.push('not here');
+} catch (e) {
+  log.push(e.message);
+} finally {
+  log.push('finally');
+}
+assertEquals('try,oops,finally', log.join());
+
+var rethrow = function() {
+  try { thrower(); } catch (e) { throw e.message + '!'; }
+};
+try { rethrow(); } catch (e) { log.push(e); }
+assertEquals('oops!', log[3]);
+
+
+// Expressions left to the tree-walker (VM_EVAL): new, delete
+
+var Point = function(x) { this.x = x; };
+var pt = new Point(4);
+assertEquals(4, pt.x);
+delete pt.x;
+assertEquals(undefined, pt.x);
+
+
+// The completion value of a program (VM_RESULT)
+
+assertEquals(3, eval('var e1 = 1; e1 + 2;'));
+assertEquals('done', eval('if (e1) { "done"; } else { "not"; }'));
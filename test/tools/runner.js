@@ -1,10 +1,17 @@
 // runner.js
 // =========
 // Runs the JavaScript test suite on flathead and other implementations.
+//
+// With --save or --baseline, the tests run one at a time and each is
+// measured: wall time, peak RSS and, for flathead, the GC runs and pause time
+// (from its --gc-stats totals). Tests that got worse than a baseline saved
+// earlier by more than the threshold fail the run.
 
 var commander = require('commander'),
     path      = require('path'),
-    exec      = require('child_process').exec,
+    os        = require('os'),
+    child     = require('child_process'),
+    exec      = child.exec,
     fs        = require('fs'),
     _         = require('underscore');
 
@@ -33,6 +40,57 @@ var colors = {
 };
 
 
+// Measurements
+// ------------
+
+// The metrics compared with a baseline, and the least increase of each that
+// counts, so the noise in short tests doesn't fail the run.
+var metrics = {
+  time:   {unit: 'ms', floor: 20},
+  rss:    {unit: 'KB', floor: 2048},
+  gcTime: {unit: 'ms', floor: 5}
+};
+
+// Whether GNU time is there to report the peak RSS of other implementations.
+var hasGnuTime = function() {
+  if (hasGnuTime.result === undefined) {
+    var res = child.spawnSync &&
+      child.spawnSync('/usr/bin/time', ['-f', '%M', '-o', '/dev/null', 'true']);
+    hasGnuTime.result = !!res && res.status === 0;
+  }
+  return hasGnuTime.result;
+};
+
+// Read the totals line flathead's --gc-stats ends with, if it got that far.
+var readGcTotals = function(file) {
+  var totals = null;
+  try {
+    fs.readFileSync(file, 'utf8').split('\n').forEach(function(line) {
+      if (/"type": "total"/.test(line)) totals = JSON.parse(line);
+    });
+    fs.unlinkSync(file);
+  }
+  catch (e) {}
+  return totals;
+};
+
+// Compare a test's results with its baseline. Returns a line for each metric
+// that regressed.
+var compareResult = function(name, result, base, threshold) {
+  var lines = [];
+  _.each(metrics, function(metric, key) {
+    var now = result[key], was = base[key];
+    if (typeof now !== 'number' || typeof was !== 'number') return;
+    if (now > was * (1 + threshold) && now - was >= metric.floor) {
+      var pct = was ? Math.round((now / was - 1) * 100) : Infinity;
+      lines.push(format('%s %s: %s%s -> %s%s (+%s%)', name, key,
+        was, metric.unit, now, metric.unit, pct));
+    }
+  });
+  return lines;
+};
+
+
 // TestRunner
 // ----------
 
@@ -53,6 +111,10 @@ TestRunner.run = function() {
     .option('-t, --timeout [ms]',      'kill test execution after', Number)
     .option('-q, --quiet',             'only display failed tests', Boolean)
     .option('--allow-stderr',          'only fail by exit code, allow stderr', Boolean)
+    .option('--exit-status <n>',       'pass tests that exit with n, whatever they print', Number)
+    .option('-s, --save <file>',       'measure each test, and save the results to file', String)
+    .option('-b, --baseline <file>',   'measure each test, and compare with file', String)
+    .option('--threshold <ratio>',     'increase that counts as a regression (0.25)', Number)
     .parse(process.argv)
     .name = 'test';
 
@@ -73,9 +135,15 @@ _.extend(TestRunner.prototype, {
     timeout: 2000,
     allowStderr: false,
     quiet: false,
+    save: null,
+    baseline: null,
+    threshold: 0.25,
     files: []
   },
 
+  // Measurements by test file name, when measuring.
+  results: {},
+
   stats: {
     passed: 0,
     failed: 0,
@@ -119,10 +187,42 @@ _.extend(TestRunner.prototype, {
     var msg = color(format('\n%s passed, %s failed', this.stats.passed, this.stats.failed));
     msg += format(' (%s) %sms\n', this.options.exec, duration);
     this.print(msg, true);
-    if (this.stats.failed > 0)
+    var regressed = this.measuring() ? this.report() : [];
+    if (this.stats.failed > 0 || regressed.length > 0)
       process.exit(1);
   },
 
+  // Whether each test is measured.
+  measuring: function() {
+    return !!(this.options.save || this.options.baseline);
+  },
+
+  // Compare the measurements with the baseline, if any, and save them, if
+  // asked to. Returns what regressed.
+  report: function() {
+    var threshold = this.options.threshold, results = this.results;
+    var report = {exec: this.options.exec, results: results}, regressed = [];
+
+    if (this.options.baseline) {
+      var baseline = JSON.parse(fs.readFileSync(this.options.baseline, 'utf8'));
+      _.each(results, function(result, name) {
+        var base = baseline.results && baseline.results[name];
+        if (base && base.passed && result.passed)
+          regressed = regressed.concat(compareResult(name, result, base, threshold));
+      });
+      report.regressed = regressed;
+      regressed.forEach(function(line) {
+        this.error(colors.failure(format('✖ regressed: %s', line)));
+      }, this);
+      if (!regressed.length)
+        this.print(colors.success(format('No regressions from %s', this.options.baseline)));
+    }
+
+    if (this.options.save)
+      fs.writeFileSync(this.options.save, JSON.stringify(report, null, 2) + '\n');
+    return regressed;
+  },
+
   // Start collecting stats.
   start: function() {
     this.stats.startedAt = Date.now();
@@ -130,43 +230,97 @@ _.extend(TestRunner.prototype, {
 
   // Execute the given (or default) command providing the file as an argument.
   // Provide success/failure callbacks. A test is considered failed if the
-  // exit code is non-zero, or the output streams are non-empty.
+  // exit code is non-zero, or the output streams are non-empty. With
+  // --exit-status, it fails unless it exits with that code.
   runScript: function(fileName, onSuccess, onFailure) {
     var args = this.options.argsTpl.replace('[test]', fileName);
     var cmd = [this.options.exec, args].join(' ');
     var this_ = this;
-    exec(cmd, {timeout: this.options.timeout}, function(err, stdout, stderr) {
+    var measure = this.measuring() && this.measureCommand(cmd);
+    var startedAt = Date.now();
+    exec(measure ? measure.cmd : cmd, {timeout: this.options.timeout}, function(err, stdout, stderr) {
       var allowStderr = this_.options.allowStderr;
+      var status = this_.options.exitStatus;
+      var passed = status ?
+        !!err && err.code === status :
+        !(err || (stderr && !allowStderr));
       fileName = fileName.split('/')[fileName.split('/').length - 1];
-      return (err || (stderr && !allowStderr)) ?
+      if (measure)
+        this_.results[fileName] = measure.finish(Date.now() - startedAt, passed);
+      return !passed ?
         onFailure(fileName, err, stderr) :
         onSuccess(fileName);
     });
   },
 
+  // Wrap a test's command to measure it. Flathead reports its GC totals and
+  // peak RSS through --gc-stats, others their RSS through GNU time, if it's
+  // installed.
+  measureCommand: function(cmd) {
+    var exec = this.options.exec;
+    var tmp = path.join(os.tmpdir(), format('flathead-test-%s-%s', process.pid,
+      Object.keys(this.results).length));
+    var flathead = path.basename(exec) === 'flat';
+    if (flathead)
+      cmd = cmd.replace(exec, exec + ' --gc-stats=' + tmp + '.gc');
+    else if (hasGnuTime())
+      cmd = format('/usr/bin/time -f %M -o %s.rss %s', tmp, cmd);
+
+    return {
+      cmd: cmd,
+      finish: function(time, passed) {
+        var result = {passed: passed, time: time};
+        if (flathead) {
+          var totals = readGcTotals(tmp + '.gc');
+          if (totals) {
+            result.rss = totals.max_rss;
+            result.gcRuns = totals.runs;
+            result.gcMinorRuns = totals.minor_runs;
+            result.gcTime = Math.round(totals.pause_us / 100) / 10;
+          }
+        }
+        else if (fs.existsSync(tmp + '.rss')) {
+          result.rss = parseInt(fs.readFileSync(tmp + '.rss', 'utf8'), 10) || undefined;
+          fs.unlinkSync(tmp + '.rss');
+        }
+        return result;
+      }
+    };
+  },
+
   // Look for test files in this file's directory and run them.
   runAll: function() {
     var this_ = this;
     fs.readdir(this.options.dir, function(err, files) {
-      files.forEach(function(f) {
-        if (f.match(/^test_/)) {
-          this_.runScript(
-            path.join(this_.options.dir, f),
-            _.bind(this_.onTestPass, this_),
-            _.bind(this_.onTestFail, this_)
-          );
-          this_.stats.found++;
-        }
-      });
-      this_.print(format('Found %s test files.\n', this_.stats.found));
+      files = files.filter(function(f) { return f.match(/^test_/); }).sort();
+      this_.print(format('Found %s test files.\n', files.length));
+      this_.runEach(files.map(function(f) {
+        return path.join(this_.options.dir, f);
+      }));
     });
   },
 
-  // Run each file in an array of filename strings.
+  // Run each file in an array of filename strings: all at once, or one after
+  // the other when they're measured.
   runEach: function(files) {
+    var this_ = this;
     this.stats.found = files.length;
-    files.forEach(function(f) {
-      this.runScript(f, _.bind(this.onTestPass, this), _.bind(this.onTestFail, this));
-    }, this);
+    if (!this.measuring()) {
+      files.forEach(function(f) {
+        this.runScript(f, _.bind(this.onTestPass, this), _.bind(this.onTestFail, this));
+      }, this);
+      return;
+    }
+    var next = function(i) {
+      if (i === files.length) return;
+      var after = function(onDone) {
+        return function() {
+          onDone.apply(this_, arguments);
+          next(i + 1);
+        };
+      };
+      this_.runScript(files[i], after(this_.onTestPass), after(this_.onTestFail));
+    };
+    next(0);
   },
 });
@@ -0,0 +1,61 @@
+#!/bin/sh
+# server.sh
+# =========
+# A smoke test of the fork server and its client: a script's output and exit
+# status come back through the client, a missing socket is an error, and
+# the server won't replace a file that isn't a socket.
+#
+# Usage: test/tools/server.sh [flat [flat-client]]
+
+FLAT=${1:-bin/flat}
+CLIENT=${2:-bin/flat-client}
+DIR=$(dirname "$0")/../server
+SOCK=${TMPDIR:-/tmp}/flathead-server-test-$$.sock
+failed=0
+
+fail() {
+  echo "✖ $1"
+  failed=1
+}
+
+"$FLAT" --server="$SOCK" "$DIR/lib.js" &
+server=$!
+trap 'kill $server 2>/dev/null; rm -f "$SOCK"' EXIT
+
+# Wait for the server to listen.
+tries=0
+while [ ! -S "$SOCK" ] && [ $tries -lt 50 ]; do
+  sleep 0.1
+  tries=$((tries + 1))
+done
+[ -S "$SOCK" ] || { echo "✖ the server didn't start"; exit 1; }
+
+out=$("$CLIENT" "$SOCK" "$DIR/hello.js")
+status=$?
+[ $status -eq 0 ] || fail "hello.js exited with $status"
+[ "$out" = "hello server" ] || fail "hello.js printed '$out'"
+
+out=$("$CLIENT" "$SOCK" "$DIR/fail.js" 2>/dev/null)
+status=$?
+[ $status -eq 1 ] || fail "fail.js exited with $status"
+[ "$out" = "before" ] || fail "fail.js printed '$out'"
+err=$("$CLIENT" "$SOCK" "$DIR/fail.js" 2>&1 >/dev/null)
+case "$err" in
+  *"failed on purpose"*) ;;
+  *) fail "fail.js's error wasn't forwarded: '$err'" ;;
+esac
+
+"$CLIENT" "$SOCK.missing" "$DIR/hello.js" 2>/dev/null
+status=$?
+[ $status -eq 1 ] || fail "a missing socket exited with $status"
+
+# A file in the socket's place is left alone.
+echo keep > "$SOCK.file"
+"$FLAT" --server="$SOCK.file" 2>/dev/null
+status=$?
+[ $status -eq 1 ] || fail "serving over a file exited with $status"
+[ "$(cat "$SOCK.file")" = keep ] || fail "serving over a file replaced it"
+rm -f "$SOCK.file"
+
+[ $failed -eq 0 ] && echo "✓ server"
+exit $failed